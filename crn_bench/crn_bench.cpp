@@ -0,0 +1,690 @@
+// File: crn_bench.cpp - Benchmark harness for crnlib's compression, transcoding and decoding throughput.
+// Compresses a set of textures (loaded from a directory, or generated deterministically) with every DXT quality level,
+// every DXTc block compressor and a sweep of CRN quality levels, then times crnd_unpack_level() and
+// crn_decompress_dds_to_images() on the results. Each measurement is written as a CSV or JSON record, so runs
+// of different versions can be diffed to catch regressions.
+// This software is in the public domain. Please see license.txt.
+//
+// Important: If compiling with gcc, be sure strict aliasing is disabled: -fno-strict-aliasing
+#include "crn_core.h"
+#include "crn_console.h"
+#include "crn_colorized_console.h"
+#include "crn_command_line_params.h"
+#include "crn_find_files.h"
+#include "crn_file_utils.h"
+#include "crn_image_utils.h"
+#include "crn_atomics.h"
+#include "crn_threading.h"
+#include "crn_timer.h"
+#include "crn_rand.h"
+
+#define CRND_HEADER_FILE_ONLY
+#include "crn_decomp.h"
+
+using namespace crnlib;
+
+const uint32 cDefaultTextureSize = 512;
+const uint32 cDefaultNumTextures = 2;
+const uint32 cDefaultIterations = 10;
+const uint32 cDefaultCRNQualityLevel = 128;
+
+// CRN quality levels swept by the "crn" benchmark.
+static const uint32 g_crn_quality_levels[] = { 0, 64, 128, 192, 255 };
+
+//-----------------------------------------------------------------------------------------------------------------------
+// Peak memory tracking. crnlib (and crn_decomp.h, which crnlib redirects into its own allocator) allocates everything
+// through crn_set_memory_callbacks(), so a small size header on each block is enough to track current and peak usage.
+
+const uint32 cMemHeaderSize = CRNLIB_MIN_ALLOC_ALIGNMENT;
+
+static volatile atomic64_t g_cur_allocated;
+static volatile atomic64_t g_peak_allocated;
+
+static void update_allocated(int64 delta)
+{
+   atomic64_t cur, new_cur;
+   do
+   {
+      cur = g_cur_allocated;
+      new_cur = cur + delta;
+   } while (atomic_compare_exchange64(&g_cur_allocated, new_cur, cur) != cur);
+
+   for ( ; ; )
+   {
+      atomic64_t peak = g_peak_allocated;
+      if ((new_cur <= peak) || (atomic_compare_exchange64(&g_peak_allocated, new_cur, peak) == peak))
+         break;
+   }
+}
+
+static void* bench_realloc(void* p, size_t size, size_t* pActual_size, bool movable, void* pUser_data)
+{
+   pUser_data;
+
+   uint8* pBlock = p ? (static_cast<uint8*>(p) - cMemHeaderSize) : NULL;
+   const size_t cur_size = pBlock ? *reinterpret_cast<size_t*>(pBlock) : 0;
+
+   if (!size)
+   {
+      if (pBlock)
+      {
+         update_allocated(-static_cast<int64>(cur_size));
+         free(pBlock);
+      }
+      if (pActual_size)
+         *pActual_size = 0;
+      return NULL;
+   }
+
+   // Blocks can't be grown in place, so fail non-movable reallocs like crnlib's default allocator does on this platform.
+   if ((pBlock) && (!movable))
+   {
+      if (pActual_size)
+         *pActual_size = cur_size;
+      return NULL;
+   }
+
+   uint8* pNew_block = static_cast<uint8*>(realloc(pBlock, size + cMemHeaderSize));
+   if (!pNew_block)
+   {
+      if (pActual_size)
+         *pActual_size = cur_size;
+      return NULL;
+   }
+
+   *reinterpret_cast<size_t*>(pNew_block) = size;
+   update_allocated(static_cast<int64>(size) - static_cast<int64>(cur_size));
+
+   if (pActual_size)
+      *pActual_size = size;
+   return pNew_block + cMemHeaderSize;
+}
+
+static size_t bench_msize(void* p, void* pUser_data)
+{
+   pUser_data;
+   return p ? *reinterpret_cast<size_t*>(static_cast<uint8*>(p) - cMemHeaderSize) : 0;
+}
+
+// Only called between benchmarks, while no other threads are allocating.
+static void reset_peak_allocated()
+{
+   g_peak_allocated = g_cur_allocated;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+struct bench_texture
+{
+   dynamic_string m_name;
+   image_u8 m_image;
+};
+
+struct bench_result
+{
+   bench_result() :
+      m_compression(false),
+      m_compressor(cCRNDXTCompressorCRN),
+      m_dxt_quality(cCRNDXTQualityNormal),
+      m_crn_quality(-1),
+      m_width(0),
+      m_height(0),
+      m_pixels(0),
+      m_secs(0.0f),
+      m_bits_per_texel(0.0f),
+      m_psnr(0.0f),
+      m_ssim(0.0f),
+      m_peak_mem(0)
+   {
+   }
+
+   const char* m_pBench;
+   dynamic_string m_texture;
+   crn_format m_format;
+   bool m_compression;
+   crn_dxt_compressor_type m_compressor;
+   crn_dxt_quality m_dxt_quality;
+   int m_crn_quality;            // -1 if the benchmark doesn't use it
+   uint32 m_width;
+   uint32 m_height;
+   uint64 m_pixels;              // Pixels processed over all iterations and mip levels (just the top level for compression)
+   double m_secs;
+   double m_bits_per_texel;
+   double m_psnr;
+   double m_ssim;
+   int64 m_peak_mem;             // Peak bytes allocated by crnlib on top of what was allocated before the benchmark started
+};
+
+typedef crnlib::vector<bench_result> bench_result_vec;
+
+static const char* get_compressor_name(crn_dxt_compressor_type compressor)
+{
+   switch (compressor)
+   {
+      case cCRNDXTCompressorCRN:  return "crn";
+      case cCRNDXTCompressorCRNF: return "crnf";
+      case cCRNDXTCompressorRYG:  return "ryg";
+      default: break;
+   }
+   return "?";
+}
+
+class crn_bench
+{
+   CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(crn_bench);
+
+   command_line_params m_params;
+
+   crnlib::vector<bench_texture> m_textures;
+   bench_result_vec m_results;
+
+   crn_format m_format;
+   uint32 m_num_helper_threads;
+   uint32 m_iterations;
+   bool m_mips;
+
+public:
+   crn_bench() :
+      m_format(cCRNFmtDXT1),
+      m_num_helper_threads(0),
+      m_iterations(cDefaultIterations),
+      m_mips(false)
+   {
+   }
+
+   static void print_usage()
+   {
+      console::message("\nCommand line usage:");
+      console::printf("crn_bench [options]");
+      console::printf("-corpus dir - Benchmark every readable image in dir, instead of synthetic textures");
+      console::printf("-size n - Width and height of the synthetic textures (default %u)", cDefaultTextureSize);
+      console::printf("-count n - Number of synthetic textures (default %u)", cDefaultNumTextures);
+      console::printf("-format fmt - Output format, such as DXT1 or DXT5 (default DXT1)");
+      console::printf("-mips - Generate and compress full mipmap chains");
+      console::printf("-helperThreads n - Number of compressor helper threads (default is one per extra processor)");
+      console::printf("-iterations n - Transcoding and decoding repeat count (default %u)", cDefaultIterations);
+      console::printf("-quick - Only benchmark the normal DXT quality and 3 CRN quality levels");
+      console::printf("-json - Write JSON instead of CSV");
+      console::printf("-out filename - Write the results to filename instead of stdout");
+      console::printf("-quiet - Disable progress messages");
+   }
+
+   bool run(const char* pCommand_line)
+   {
+      static const command_line_params::param_desc std_params[] =
+      {
+         { "corpus", 1, false },
+         { "size", 1, false },
+         { "count", 1, false },
+         { "format", 1, false },
+         { "mips", 0, false },
+         { "helperThreads", 1, false },
+         { "iterations", 1, false },
+         { "quick", 0, false },
+         { "json", 0, false },
+         { "out", 1, false },
+         { "quiet", 0, false },
+      };
+
+      if (!m_params.parse(pCommand_line, sizeof(std_params) / sizeof(std_params[0]), std_params, true))
+      {
+         print_usage();
+         return false;
+      }
+
+      if (m_params.has_key("format"))
+      {
+         const dynamic_string& fmt_str = m_params.get_value_as_string_or_empty("format");
+         uint32 i;
+         for (i = 0; i < cCRNFmtTotal; i++)
+            if (fmt_str == dynamic_string(crn_get_format_string(static_cast<crn_format>(i))))
+               break;
+         if (i == cCRNFmtTotal)
+         {
+            console::error("Unrecognized format: %s", fmt_str.get_ptr());
+            return false;
+         }
+         m_format = static_cast<crn_format>(i);
+      }
+
+      m_num_helper_threads = m_params.get_value_as_int("helperThreads", 0, g_number_of_processors - 1, 0, cCRNMaxHelperThreads);
+      m_iterations = m_params.get_value_as_int("iterations", 0, cDefaultIterations, 1, 100000);
+      m_mips = m_params.has_key("mips");
+
+      if (m_params.has_key("corpus"))
+      {
+         if (!load_corpus(m_params.get_value_as_string_or_empty("corpus").get_ptr()))
+            return false;
+      }
+      else
+      {
+         const uint32 size = m_params.get_value_as_int("size", 0, cDefaultTextureSize, 4, cCRNMaxLevelResolution);
+         const uint32 count = m_params.get_value_as_int("count", 0, cDefaultNumTextures, 1, 1024);
+         generate_textures(size, count);
+      }
+
+      const bool quick = m_params.has_key("quick");
+
+      for (uint32 t = 0; t < m_textures.size(); t++)
+      {
+         const bench_texture& tex = m_textures[t];
+         console::info("Texture %u of %u: %s (%ux%u)", t + 1, m_textures.size(), tex.m_name.get_ptr(), tex.m_image.get_width(), tex.m_image.get_height());
+
+         crnlib::vector<uint8> dds_data;
+         for (uint32 q = 0; q < cCRNDXTQualityTotal; q++)
+         {
+            if ((quick) && (q != cCRNDXTQualityNormal))
+               continue;
+
+            for (uint32 c = 0; c < cCRNTotalDXTCompressors; c++)
+            {
+               crnlib::vector<uint8> data;
+               if (!bench_compress(tex, cCRNFileTypeDDS, static_cast<crn_dxt_quality>(q), static_cast<crn_dxt_compressor_type>(c), -1, data))
+                  return false;
+
+               if ((q == cCRNDXTQualityNormal) && (c == cCRNDXTCompressorCRN))
+                  dds_data.swap(data);
+            }
+         }
+
+         crnlib::vector<uint8> crn_data;
+         for (uint32 i = 0; i < CRNLIB_ARRAY_SIZE(g_crn_quality_levels); i++)
+         {
+            const uint32 quality_level = g_crn_quality_levels[i];
+            if ((quick) && (quality_level != 0) && (quality_level != cDefaultCRNQualityLevel) && (quality_level != 255))
+               continue;
+
+            crnlib::vector<uint8> data;
+            if (!bench_compress(tex, cCRNFileTypeCRN, cCRNDXTQualityNormal, cCRNDXTCompressorCRN, quality_level, data))
+               return false;
+
+            if (quality_level == cDefaultCRNQualityLevel)
+               crn_data.swap(data);
+         }
+
+         if (!bench_transcode(tex, crn_data))
+            return false;
+
+         if (!bench_decode(tex, dds_data))
+            return false;
+      }
+
+      return write_results();
+   }
+
+private:
+   bool load_corpus(const char* pDir)
+   {
+      find_files finder;
+      if (!finder.find(pDir, "*", find_files::cFlagAllowFiles))
+      {
+         console::error("Failed finding files in corpus directory: %s", pDir);
+         return false;
+      }
+
+      // Sort by name, so the results always come out in the same order.
+      crnlib::vector<dynamic_string> filenames;
+      for (uint32 i = 0; i < finder.get_files().size(); i++)
+         filenames.push_back(finder.get_files()[i].m_fullname);
+      filenames.sort();
+
+      for (uint32 i = 0; i < filenames.size(); i++)
+      {
+         bench_texture tex;
+         if (!image_utils::read_from_file(tex.m_image, filenames[i].get_ptr()))
+         {
+            console::warning("Skipping unreadable file: %s", filenames[i].get_ptr());
+            continue;
+         }
+
+         file_utils::split_path(filenames[i].get_ptr(), NULL, NULL, &tex.m_name, NULL);
+         m_textures.push_back(tex);
+      }
+
+      if (m_textures.empty())
+      {
+         console::error("No readable images in corpus directory: %s", pDir);
+         return false;
+      }
+
+      return true;
+   }
+
+   // Generates deterministic textures which mix smooth gradients, hard edges, noise and an alpha channel, so every block
+   // encoding path gets some work.
+   void generate_textures(uint32 size, uint32 count)
+   {
+      for (uint32 t = 0; t < count; t++)
+      {
+         crnlib::random rm(0x5EED0000 + t);
+
+         const float fx = rm.frand(1.0f, 8.0f) / size, fy = rm.frand(1.0f, 8.0f) / size;
+         const uint32 cell_size = 4U << rm.irand(0, 4);
+         const uint32 noise_amp = rm.irand(0, 48);
+
+         m_textures.enlarge(1);
+         bench_texture& tex = m_textures.back();
+         tex.m_name.format("synthetic%u", t);
+         tex.m_image.resize(size, size);
+
+         for (uint32 y = 0; y < size; y++)
+         {
+            for (uint32 x = 0; x < size; x++)
+            {
+               const float s = sinf(x * fx * 6.2831853f) * cosf(y * fy * 6.2831853f);
+               const bool cell = (((x / cell_size) ^ (y / cell_size)) & 1) != 0;
+               const int noise = noise_amp ? rm.irand_inclusive(-(int)noise_amp, noise_amp) : 0;
+
+               int r = static_cast<int>(128.0f + 100.0f * s) + noise;
+               int g = static_cast<int>(x * 255U / size) + (cell ? 32 : -32);
+               int b = static_cast<int>(y * 255U / size) + noise;
+               int a = cell ? 255 : static_cast<int>((x + y) * 255U / (2 * size));
+
+               tex.m_image(x, y).set(math::clamp(r, 0, 255), math::clamp(g, 0, 255), math::clamp(b, 0, 255), math::clamp(a, 0, 255));
+            }
+         }
+      }
+   }
+
+   void init_comp_params(const bench_texture& tex, crn_file_type file_type, crn_dxt_quality dxt_quality, crn_dxt_compressor_type compressor, int crn_quality, crn_comp_params& comp_params) const
+   {
+      comp_params.clear();
+      comp_params.m_file_type = file_type;
+      comp_params.m_format = m_format;
+      comp_params.m_width = tex.m_image.get_width();
+      comp_params.m_height = tex.m_image.get_height();
+      comp_params.m_dxt_quality = dxt_quality;
+      comp_params.m_dxt_compressor_type = compressor;
+      comp_params.m_num_helper_threads = m_num_helper_threads;
+      comp_params.m_pImages[0][0] = reinterpret_cast<const crn_uint32*>(tex.m_image.get_ptr());
+      if (crn_quality >= 0)
+         comp_params.m_quality_level = crn_quality;
+   }
+
+   bench_result& add_result(const char* pBench, const bench_texture& tex)
+   {
+      bench_result& result = *m_results.enlarge(1);
+      result.m_pBench = pBench;
+      result.m_texture = tex.m_name;
+      result.m_format = m_format;
+      result.m_width = tex.m_image.get_width();
+      result.m_height = tex.m_image.get_height();
+      return result;
+   }
+
+   // Computes the PSNR and luma SSIM of the file's top mip level against the source image.
+   bool compute_quality(const bench_texture& tex, const crnlib::vector<uint8>& data, crn_file_type file_type, bench_result& result)
+   {
+      const void* pDDS_data = data.get_ptr();
+      crn_uint32 dds_size = data.size();
+      if (file_type == cCRNFileTypeCRN)
+      {
+         pDDS_data = crn_decompress_crn_to_dds(data.get_ptr(), dds_size);
+         if (!pDDS_data)
+            return false;
+      }
+
+      crn_uint32* pImages[cCRNMaxFaces * cCRNMaxLevels];
+      crn_texture_desc tex_desc;
+      const bool success = crn_decompress_dds_to_images(pDDS_data, dds_size, pImages, tex_desc);
+
+      if (file_type == cCRNFileTypeCRN)
+         crn_free_block(const_cast<void*>(pDDS_data));
+
+      if (!success)
+         return false;
+
+      image_u8 unpacked(tex_desc.m_width, tex_desc.m_height);
+      memcpy(static_cast<void*>(unpacked.get_ptr()), pImages[0], tex_desc.m_width * tex_desc.m_height * sizeof(crn_uint32));
+      crn_free_all_images(pImages, tex_desc);
+
+      uint32 first_channel = 0, num_channels = 4;
+      switch (m_format)
+      {
+         case cCRNFmtDXT1:    num_channels = 3; break;
+         case cCRNFmtDXT5A:   first_channel = 3; num_channels = 1; break;
+         case cCRNFmtDXN_XY:
+         case cCRNFmtDXN_YX:  num_channels = 2; break;
+         default: break;
+      }
+
+      image_utils::error_metrics metrics;
+      metrics.compute(tex.m_image, unpacked, first_channel, num_channels);
+      result.m_psnr = metrics.mPeakSNR;
+      result.m_ssim = image_utils::compute_ssim(tex.m_image, unpacked, (num_channels >= 3) ? -1 : static_cast<int>(first_channel));
+      return true;
+   }
+
+   bool bench_compress(const bench_texture& tex, crn_file_type file_type, crn_dxt_quality dxt_quality, crn_dxt_compressor_type compressor, int crn_quality, crnlib::vector<uint8>& data)
+   {
+      crn_comp_params comp_params;
+      init_comp_params(tex, file_type, dxt_quality, compressor, crn_quality, comp_params);
+
+      crn_mipmap_params mip_params;
+      mip_params.m_mode = m_mips ? cCRNMipModeGenerateMips : cCRNMipModeNoMips;
+
+      bench_result& result = add_result((file_type == cCRNFileTypeCRN) ? "crn" : "dxt", tex);
+      result.m_compression = true;
+      result.m_compressor = compressor;
+      result.m_dxt_quality = dxt_quality;
+      result.m_crn_quality = crn_quality;
+      result.m_pixels = result.m_width * result.m_height;
+
+      const int64 base_allocated = g_cur_allocated;
+      reset_peak_allocated();
+
+      timer tm;
+      tm.start();
+
+      crn_uint32 compressed_size = 0;
+      void* pData = crn_compress(comp_params, mip_params, compressed_size);
+
+      result.m_secs = tm.get_elapsed_secs();
+      result.m_peak_mem = g_peak_allocated - base_allocated;
+
+      if (!pData)
+      {
+         console::error("crn_compress() failed on %s", tex.m_name.get_ptr());
+         return false;
+      }
+
+      data.resize(compressed_size);
+      memcpy(data.get_ptr(), pData, compressed_size);
+      crn_free_block(pData);
+
+      result.m_bits_per_texel = (compressed_size * 8.0f) / result.m_pixels;
+
+      if (!compute_quality(tex, data, file_type, result))
+      {
+         console::error("Failed unpacking compressed %s", tex.m_name.get_ptr());
+         return false;
+      }
+
+      console::info("  %s %s %s q%i: %3.3fs, %3.3f bits/texel, PSNR %3.3f, SSIM %1.5f",
+         result.m_pBench, get_compressor_name(compressor), crn_get_dxt_quality_string(dxt_quality), crn_quality,
+         result.m_secs, result.m_bits_per_texel, result.m_psnr, result.m_ssim);
+
+      return true;
+   }
+
+   // Times crnd_unpack_level() over every level of the CRN file.
+   bool bench_transcode(const bench_texture& tex, const crnlib::vector<uint8>& crn_data)
+   {
+      crnd::crn_texture_info tex_info;
+      if (!crnd::crnd_get_texture_info(crn_data.get_ptr(), crn_data.size(), &tex_info))
+         return false;
+
+      const uint32 bytes_per_block = crnd::crnd_get_bytes_per_dxt_block(tex_info.m_format);
+
+      crnlib::vector<uint8> level_data;
+      uint64 level_pixels = 0;
+      for (uint32 l = 0; l < tex_info.m_levels; l++)
+      {
+         const uint32 width = math::maximum(1U, tex_info.m_width >> l), height = math::maximum(1U, tex_info.m_height >> l);
+         level_data.resize(math::maximum(level_data.size(), ((width + 3) / 4) * ((height + 3) / 4) * bytes_per_block * tex_info.m_faces));
+         level_pixels += width * height * tex_info.m_faces;
+      }
+
+      bench_result& result = add_result("transcode", tex);
+      result.m_crn_quality = cDefaultCRNQualityLevel;
+      result.m_pixels = level_pixels * m_iterations;
+      result.m_bits_per_texel = (crn_data.size() * 8.0f) / level_pixels;
+
+      const int64 base_allocated = g_cur_allocated;
+      reset_peak_allocated();
+
+      timer tm;
+      tm.start();
+
+      for (uint32 i = 0; i < m_iterations; i++)
+      {
+         crnd::crnd_unpack_context pContext = crnd::crnd_unpack_begin(crn_data.get_ptr(), crn_data.size());
+         if (!pContext)
+            return false;
+
+         for (uint32 l = 0; l < tex_info.m_levels; l++)
+         {
+            const uint32 width = math::maximum(1U, tex_info.m_width >> l), height = math::maximum(1U, tex_info.m_height >> l);
+            const uint32 row_pitch = ((width + 3) / 4) * bytes_per_block;
+            const uint32 face_size = row_pitch * ((height + 3) / 4);
+
+            void* pFaces[cCRNMaxFaces];
+            for (uint32 f = 0; f < tex_info.m_faces; f++)
+               pFaces[f] = &level_data[f * face_size];
+
+            if (!crnd::crnd_unpack_level(pContext, pFaces, face_size, row_pitch, l))
+            {
+               crnd::crnd_unpack_end(pContext);
+               return false;
+            }
+         }
+
+         crnd::crnd_unpack_end(pContext);
+      }
+
+      result.m_secs = tm.get_elapsed_secs();
+      result.m_peak_mem = g_peak_allocated - base_allocated;
+
+      console::info("  transcode: %3.3f MPix/s", result.m_pixels / (result.m_secs * 1000000.0f));
+      return true;
+   }
+
+   // Times crn_decompress_dds_to_images().
+   bool bench_decode(const bench_texture& tex, const crnlib::vector<uint8>& dds_data)
+   {
+      bench_result& result = add_result("decode", tex);
+      result.m_bits_per_texel = (dds_data.size() * 8.0f) / (result.m_width * result.m_height);
+
+      const int64 base_allocated = g_cur_allocated;
+      reset_peak_allocated();
+
+      timer tm;
+      tm.start();
+
+      for (uint32 i = 0; i < m_iterations; i++)
+      {
+         crn_uint32* pImages[cCRNMaxFaces * cCRNMaxLevels];
+         crn_texture_desc tex_desc;
+         if (!crn_decompress_dds_to_images(dds_data.get_ptr(), dds_data.size(), pImages, tex_desc))
+            return false;
+
+         for (uint32 l = 0; l < tex_desc.m_levels; l++)
+            result.m_pixels += math::maximum(1U, tex_desc.m_width >> l) * math::maximum(1U, tex_desc.m_height >> l) * tex_desc.m_faces;
+
+         crn_free_all_images(pImages, tex_desc);
+      }
+
+      result.m_secs = tm.get_elapsed_secs();
+      result.m_peak_mem = g_peak_allocated - base_allocated;
+
+      console::info("  decode: %3.3f MPix/s", result.m_pixels / (result.m_secs * 1000000.0f));
+      return true;
+   }
+
+   bool write_results()
+   {
+      FILE* pFile = stdout;
+      if (m_params.has_key("out"))
+      {
+         const dynamic_string& filename = m_params.get_value_as_string_or_empty("out");
+         pFile = NULL;
+         crn_fopen(&pFile, filename.get_ptr(), "w");
+         if (!pFile)
+         {
+            console::error("Unable to create file: %s", filename.get_ptr());
+            return false;
+         }
+      }
+
+      const bool json = m_params.has_key("json");
+      if (json)
+         fprintf(pFile, "{\n  \"version\": %u,\n  \"helper_threads\": %u,\n  \"results\": [\n", CRNLIB_VERSION, m_num_helper_threads);
+      else
+         fprintf(pFile, "bench,texture,format,compressor,dxt_quality,crn_quality,width,height,seconds,mpix_per_sec,bits_per_texel,psnr,ssim,peak_mem_bytes\n");
+
+      for (uint32 i = 0; i < m_results.size(); i++)
+      {
+         const bench_result& r = m_results[i];
+         const double mpix_per_sec = (r.m_secs > 0.0f) ? (r.m_pixels / (r.m_secs * 1000000.0f)) : 0.0f;
+         const char* pCompressor = r.m_compression ? get_compressor_name(r.m_compressor) : "";
+         const char* pDXT_quality = r.m_compression ? crn_get_dxt_quality_string(r.m_dxt_quality) : "";
+
+         if (json)
+         {
+            fprintf(pFile, "    { \"bench\": \"%s\", \"texture\": \"%s\", \"format\": \"%s\", \"compressor\": \"%s\", \"dxt_quality\": \"%s\", \"crn_quality\": %i, "
+               "\"width\": %u, \"height\": %u, \"seconds\": %f, \"mpix_per_sec\": %f, \"bits_per_texel\": %f, \"psnr\": %f, \"ssim\": %f, \"peak_mem_bytes\": " CRNLIB_INT64_FORMAT_SPECIFIER " }%s\n",
+               r.m_pBench, r.m_texture.get_ptr(), crn_get_format_string(r.m_format), pCompressor, pDXT_quality, r.m_crn_quality,
+               r.m_width, r.m_height, r.m_secs, mpix_per_sec, r.m_bits_per_texel, r.m_psnr, r.m_ssim, r.m_peak_mem, ((i + 1) < m_results.size()) ? "," : "");
+         }
+         else
+         {
+            fprintf(pFile, "%s,%s,%s,%s,%s,%i,%u,%u,%f,%f,%f,%f,%f," CRNLIB_INT64_FORMAT_SPECIFIER "\n",
+               r.m_pBench, r.m_texture.get_ptr(), crn_get_format_string(r.m_format), pCompressor, pDXT_quality, r.m_crn_quality,
+               r.m_width, r.m_height, r.m_secs, mpix_per_sec, r.m_bits_per_texel, r.m_psnr, r.m_ssim, r.m_peak_mem);
+         }
+      }
+
+      if (json)
+         fprintf(pFile, "  ]\n}\n");
+
+      if (pFile != stdout)
+         fclose(pFile);
+
+      return true;
+   }
+};
+
+//-----------------------------------------------------------------------------------------------------------------------
+
+static bool check_for_option(int argc, char* argv[], const char* pOption)
+{
+   for (int i = 1; i < argc; i++)
+   {
+      if ((argv[i][0] == '/') || (argv[i][0] == '-'))
+      {
+         if (crn_stricmp(&argv[i][1], pOption) == 0)
+            return true;
+      }
+   }
+   return false;
+}
+
+int main(int argc, char* argv[])
+{
+   crn_set_memory_callbacks(bench_realloc, bench_msize, NULL);
+
+   colorized_console::init();
+
+   // Progress messages go to stdout, so they're only printed when the results go to a file.
+   if ((check_for_option(argc, argv, "quiet")) || (!check_for_option(argc, argv, "out")))
+      console::disable_output();
+
+   dynamic_string cmd_line;
+   get_command_line_as_single_string(cmd_line, argc, argv);
+
+   const bool status = crn_bench().run(cmd_line.get_ptr());
+
+   colorized_console::deinit();
+
+   return status ? EXIT_SUCCESS : EXIT_FAILURE;
+}
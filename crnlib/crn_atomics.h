@@ -91,6 +91,24 @@ namespace crnlib
       CRNLIB_ASSERT((reinterpret_cast<ptr_bits_t>(pDest) & 3) == 0);
       return InterlockedExchangeAdd(pDest, val);
    }
+
+   // Returns the current value (volatile reads have acquire semantics in MSVC).
+   inline atomic32_t atomic_load32(atomic32_t volatile *pDest)
+   {
+      CRNLIB_ASSERT((reinterpret_cast<ptr_bits_t>(pDest) & 3) == 0);
+      return *pDest;
+   }
+
+   // Returns the current value.
+   inline atomic64_t atomic_load64(atomic64_t volatile *pDest)
+   {
+      CRNLIB_ASSERT((reinterpret_cast<ptr_bits_t>(pDest) & 7) == 0);
+   #if CRNLIB_PLATFORM_PC_X64
+      return *pDest;
+   #else
+      return _InterlockedCompareExchange64(pDest, 0, 0);
+   #endif
+   }
 #elif CRNLIB_USE_GCC_ATOMIC_BUILTINS
    typedef long atomic32_t;
    typedef long long atomic64_t;
@@ -143,6 +161,20 @@ namespace crnlib
       CRNLIB_ASSERT((reinterpret_cast<ptr_bits_t>(pDest) & 3) == 0);
       return __sync_fetch_and_add(pDest, val);
    }
+
+   // Returns the current value.
+   inline atomic32_t atomic_load32(atomic32_t volatile *pDest)
+   {
+      CRNLIB_ASSERT((reinterpret_cast<ptr_bits_t>(pDest) & 3) == 0);
+      return __atomic_load_n(pDest, __ATOMIC_ACQUIRE);
+   }
+
+   // Returns the current value.
+   inline atomic64_t atomic_load64(atomic64_t volatile *pDest)
+   {
+      CRNLIB_ASSERT((reinterpret_cast<ptr_bits_t>(pDest) & 7) == 0);
+      return __atomic_load_n(pDest, __ATOMIC_ACQUIRE);
+   }
 #else
    #define CRNLIB_NO_ATOMICS 1
 
@@ -201,6 +233,18 @@ namespace crnlib
       *pDest += val;
       return cur;
    }
+
+   inline atomic32_t atomic_load32(atomic32_t volatile *pDest)
+   {
+      CRNLIB_ASSERT((reinterpret_cast<ptr_bits_t>(pDest) & 3) == 0);
+      return *pDest;
+   }
+
+   inline atomic64_t atomic_load64(atomic64_t volatile *pDest)
+   {
+      CRNLIB_ASSERT((reinterpret_cast<ptr_bits_t>(pDest) & 7) == 0);
+      return *pDest;
+   }
 #endif
 
 } // namespace crnlib
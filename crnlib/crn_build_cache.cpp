@@ -0,0 +1,283 @@
+// File: crn_build_cache.cpp
+// This software is in the public domain. Please see license.txt.
+#include "crn_core.h"
+#include "crn_build_cache.h"
+#include "crn_checksum.h"
+#include "crn_hash.h"
+#include "crn_file_utils.h"
+#include "crn_cfile_stream.h"
+#include "crn_atomics.h"
+#include "../inc/crnlib.h"
+
+#ifdef WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace crnlib
+{
+   const uint32 cBuildCacheEntrySig = 0x434E5243; // 'CRNC'
+   const uint32 cBuildCacheEntryHeaderSize = 12;
+
+   static atomic32_t g_temp_file_counter;
+
+   static uint32 get_process_id()
+   {
+#ifdef WIN32
+      return static_cast<uint32>(_getpid());
+#else
+      return static_cast<uint32>(getpid());
+#endif
+   }
+
+   template<typename T>
+   static inline void append_key(crnlib::vector<uint8>& key, const T& val)
+   {
+      const uint ofs = key.size();
+      key.resize(ofs + sizeof(T));
+      memcpy(&key[ofs], &val, sizeof(T));
+   }
+
+   // Two independent 32-bit hashes of a level's pixels, taken row by row so image pitch doesn't matter.
+   static void append_level_hash(crnlib::vector<uint8>& key, const mip_level& level)
+   {
+      uint32 hash = 0;
+      uint32 adler = cInitAdler32;
+
+      if (const image_u8* pImage = level.get_image())
+      {
+         const uint row_size = pImage->get_width() * sizeof(color_quad_u8);
+         for (uint y = 0; y < pImage->get_height(); y++)
+         {
+            const color_quad_u8* pRow = pImage->get_scanline(y);
+            hash = bitmix32c(hash ^ fast_hash(pRow, row_size));
+            adler = adler32(pRow, row_size, adler);
+         }
+      }
+      else if (const dxt_image* pDXT_image = level.get_dxt_image())
+      {
+         const dxt_image::element_vec& elements = pDXT_image->get_element_vec();
+         hash = fast_hash(elements.get_ptr(), elements.size() * sizeof(dxt_image::element));
+         adler = adler32(elements.get_ptr(), elements.size() * sizeof(dxt_image::element), adler);
+      }
+
+      append_key(key, level.get_width());
+      append_key(key, level.get_height());
+      append_key(key, level.get_format());
+      append_key(key, level.get_comp_flags());
+      append_key(key, level.is_packed());
+      append_key(key, hash);
+      append_key(key, adler);
+   }
+
+   build_cache::build_cache()
+   {
+   }
+
+   bool build_cache::init(const char* pDir)
+   {
+      clear();
+
+      dynamic_string dir(pDir);
+      if ((dir.is_empty()) || (!file_utils::full_path(dir)))
+         return false;
+
+      if (!file_utils::does_dir_exist(dir.get_ptr()))
+      {
+         if (!file_utils::create_path(dir))
+            return false;
+      }
+
+      m_dir = dir;
+      return true;
+   }
+
+   void build_cache::clear()
+   {
+      m_dir.clear();
+   }
+
+   void build_cache::compute_key(const texture_conversion::convert_params& params, crnlib::vector<uint8>& key)
+   {
+      key.resize(0);
+
+      append_key(key, static_cast<uint32>(CRNLIB_VERSION));
+
+      append_key(key, params.m_texture_type);
+      append_key(key, params.m_dst_file_type);
+      append_key(key, params.m_dst_format);
+      append_key(key, params.m_y_flip);
+      append_key(key, params.m_unflip);
+      append_key(key, params.m_always_use_source_pixel_format);
+      append_key(key, params.m_write_mipmaps_to_multiple_files);
+      append_key(key, params.m_quick);
+
+      // Callbacks and image pointers don't affect the output. The helper thread count does (the DXT compressors split the work
+      // between the threads), so it's part of the key. In batch mode it's the count the file was given.
+      const crn_comp_params& c = params.m_comp_params;
+      append_key(key, c.m_num_helper_threads);
+      append_key(key, c.m_file_type);
+      append_key(key, c.m_faces);
+      append_key(key, c.m_width);
+      append_key(key, c.m_height);
+      append_key(key, c.m_levels);
+      append_key(key, c.m_format);
+      append_key(key, c.m_flags);
+      append_key(key, c.m_target_bitrate);
+      append_key(key, c.m_quality_level);
+      append_key(key, c.m_dxt1a_alpha_threshold);
+      append_key(key, c.m_dxt_quality);
+      append_key(key, c.m_dxt_compressor_type);
+      append_key(key, c.m_alpha_component);
+      append_key(key, c.m_crn_adaptive_tile_color_psnr_derating);
+      append_key(key, c.m_crn_adaptive_tile_alpha_psnr_derating);
+      append_key(key, c.m_crn_color_endpoint_palette_size);
+      append_key(key, c.m_crn_color_selector_palette_size);
+      append_key(key, c.m_crn_alpha_endpoint_palette_size);
+      append_key(key, c.m_crn_alpha_selector_palette_size);
+      append_key(key, c.m_userdata0);
+      append_key(key, c.m_userdata1);
+
+      const crn_mipmap_params& m = params.m_mipmap_params;
+      append_key(key, m.m_mode);
+      append_key(key, m.m_filter);
+      append_key(key, m.m_gamma_filtering);
+      append_key(key, m.m_gamma);
+      append_key(key, m.m_blurriness);
+      append_key(key, m.m_renormalize);
+      append_key(key, m.m_tiled);
+      append_key(key, m.m_max_levels);
+      append_key(key, m.m_min_mip_size);
+      append_key(key, m.m_scale_mode);
+      append_key(key, m.m_scale_x);
+      append_key(key, m.m_scale_y);
+      append_key(key, m.m_window_left);
+      append_key(key, m.m_window_top);
+      append_key(key, m.m_window_right);
+      append_key(key, m.m_window_bottom);
+      append_key(key, m.m_clamp_scale);
+      append_key(key, m.m_clamp_width);
+      append_key(key, m.m_clamp_height);
+      append_key(key, m.m_cascade);
+
+      const mipmapped_texture& tex = *params.m_pInput_texture;
+      append_key(key, tex.get_width());
+      append_key(key, tex.get_height());
+      append_key(key, tex.get_num_faces());
+      append_key(key, tex.get_num_levels());
+      append_key(key, tex.get_format());
+      append_key(key, tex.get_comp_flags());
+      append_key(key, tex.is_flipped());
+
+      for (uint f = 0; f < tex.get_num_faces(); f++)
+         for (uint l = 0; l < tex.get_num_levels(); l++)
+            append_level_hash(key, *tex.get_level(f, l));
+   }
+
+   void build_cache::get_entry_filename(const crnlib::vector<uint8>& key, dynamic_string& filename) const
+   {
+      // Name collisions only cause misses, because read_entry() compares the full key.
+      dynamic_string name(cVarArg, "%08x%08x.crncache", fast_hash(key.get_ptr(), key.size()), adler32(key.get_ptr(), key.size()));
+      file_utils::combine_path(filename, m_dir.get_ptr(), name.get_ptr());
+   }
+
+   bool build_cache::read_entry(const crnlib::vector<uint8>& key, crnlib::vector<uint8>& data) const
+   {
+      dynamic_string entry_filename;
+      get_entry_filename(key, entry_filename);
+
+      crnlib::vector<uint8> buf;
+      if (!cfile_stream::read_file_into_array(entry_filename.get_ptr(), buf))
+         return false;
+
+      if (buf.size() < cBuildCacheEntryHeaderSize)
+         return false;
+
+      uint32 sig, key_size, data_size;
+      memcpy(&sig, &buf[0], sizeof(uint32));
+      memcpy(&key_size, &buf[4], sizeof(uint32));
+      memcpy(&data_size, &buf[8], sizeof(uint32));
+
+      if ((sig != cBuildCacheEntrySig) || (key_size != key.size()))
+         return false;
+      if (buf.size() != cBuildCacheEntryHeaderSize + key_size + data_size)
+         return false;
+      if (memcmp(&buf[cBuildCacheEntryHeaderSize], key.get_ptr(), key_size) != 0)
+         return false;
+
+      data.resize(data_size);
+      if (data_size)
+         memcpy(data.get_ptr(), &buf[cBuildCacheEntryHeaderSize + key_size], data_size);
+
+      return true;
+   }
+
+   build_cache::lookup_status build_cache::lookup(const crnlib::vector<uint8>& key, const char* pDst_filename) const
+   {
+      if (!is_enabled())
+         return cMiss;
+
+      crnlib::vector<uint8> data;
+      if (!read_entry(key, data))
+         return cMiss;
+
+      // Leave identical outputs alone, so their timestamps aren't touched.
+      uint64 dst_file_size;
+      if ((file_utils::get_file_size(pDst_filename, dst_file_size)) && (dst_file_size == data.size()))
+      {
+         crnlib::vector<uint8> dst_data;
+         if ((cfile_stream::read_file_into_array(pDst_filename, dst_data)) && (dst_data == data))
+            return cUpToDate;
+      }
+
+      if (!cfile_stream::write_array_to_file(pDst_filename, data))
+         return cMiss;
+
+      return cHit;
+   }
+
+   bool build_cache::insert(const crnlib::vector<uint8>& key, const char* pOutput_filename) const
+   {
+      if (!is_enabled())
+         return false;
+
+      crnlib::vector<uint8> data;
+      if (!cfile_stream::read_file_into_array(pOutput_filename, data))
+         return false;
+
+      crnlib::vector<uint8> buf(cBuildCacheEntryHeaderSize + key.size() + data.size());
+
+      const uint32 key_size = key.size(), data_size = data.size();
+      memcpy(&buf[0], &cBuildCacheEntrySig, sizeof(uint32));
+      memcpy(&buf[4], &key_size, sizeof(uint32));
+      memcpy(&buf[8], &data_size, sizeof(uint32));
+      if (key_size)
+         memcpy(&buf[cBuildCacheEntryHeaderSize], key.get_ptr(), key_size);
+      if (data_size)
+         memcpy(&buf[cBuildCacheEntryHeaderSize + key_size], data.get_ptr(), data_size);
+
+      dynamic_string entry_filename;
+      get_entry_filename(key, entry_filename);
+
+      // Write to a temporary file first, so concurrent readers never see a partial entry. The process ID and counter keep
+      // the temporary file unique when several processes or threads store the same entry at once.
+      dynamic_string temp_filename(cVarArg, "%s.%u.%u.tmp", entry_filename.get_ptr(), get_process_id(), static_cast<uint32>(atomic_increment32(&g_temp_file_counter)));
+      if (!cfile_stream::write_array_to_file(temp_filename.get_ptr(), buf))
+         return false;
+
+      // rename() doesn't replace existing files on Windows.
+      if (rename(temp_filename.get_ptr(), entry_filename.get_ptr()) != 0)
+      {
+         remove(entry_filename.get_ptr());
+         if (rename(temp_filename.get_ptr(), entry_filename.get_ptr()) != 0)
+         {
+            remove(temp_filename.get_ptr());
+            return false;
+         }
+      }
+
+      return true;
+   }
+
+} // namespace crnlib
@@ -0,0 +1,47 @@
+// File: crn_build_cache.h
+// This software is in the public domain. Please see license.txt.
+#pragma once
+#include "crn_texture_conversion.h"
+
+namespace crnlib
+{
+   // Content addressed on-disk cache of converted output files.
+   // Entries are keyed on the decoded source pixels, every parameter that affects the output, and the library version.
+   // Unlike timestamp checks, any parameter change is a miss, while touching or copying an unchanged source is still a hit.
+   class build_cache
+   {
+      CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(build_cache);
+
+   public:
+      build_cache();
+
+      bool init(const char* pDir);
+      void clear();
+
+      inline bool is_enabled() const { return !m_dir.is_empty(); }
+      inline const dynamic_string& get_dir() const { return m_dir; }
+
+      // Computes the key for converting params.m_pInput_texture using params. Call after the input texture's
+      // final pixels and all parameters have been set up.
+      static void compute_key(const texture_conversion::convert_params& params, crnlib::vector<uint8>& key);
+
+      enum lookup_status
+      {
+         cMiss,
+         cHit,             // Cached output was written to the destination file
+         cUpToDate         // Destination file already matches the cached output
+      };
+
+      lookup_status lookup(const crnlib::vector<uint8>& key, const char* pDst_filename) const;
+
+      // Stores the contents of pOutput_filename under key. Safe to call concurrently from multiple processes.
+      bool insert(const crnlib::vector<uint8>& key, const char* pOutput_filename) const;
+
+   private:
+      dynamic_string m_dir;
+
+      void get_entry_filename(const crnlib::vector<uint8>& key, dynamic_string& filename) const;
+      bool read_entry(const crnlib::vector<uint8>& key, crnlib::vector<uint8>& data) const;
+   };
+
+} // namespace crnlib
@@ -5,6 +5,7 @@
 #include "crn_comp.h"
 #include "crn_zeng.h"
 #include "crn_checksum.h"
+#include "crn_comp_stats.h"
 
 #define CRNLIB_ENABLE_DEBUG_MESSAGES 0
 
@@ -12,8 +13,13 @@ namespace crnlib
 {
    static const uint cEncodingMapNumChunksPerCode = 3;
 
+   // Height of each independently coded band (in chunk rows) when cCRNCompFlagBandedLevels is set. 16 chunk rows = 128 texels.
+   static const uint cBandChunkRows = 16;
+
    crn_comp::crn_comp() :
-      m_pParams(NULL)
+      m_pParams(NULL),
+      m_total_pixels(0),
+      m_pChunks(NULL)
    {
    }
 
@@ -875,50 +881,6 @@ namespace crnlib
       return true;
    }
 
-   bool crn_comp::pack_chunks_simulation(
-      uint first_chunk, uint num_chunks,
-      uint& total_bits,
-      const crnlib::vector<uint>* pColor_endpoint_remap,
-      const crnlib::vector<uint>* pColor_selector_remap,
-      const crnlib::vector<uint>* pAlpha_endpoint_remap,
-      const crnlib::vector<uint>* pAlpha_selector_remap)
-   {
-      if (!pack_chunks(first_chunk, num_chunks, true, NULL, pColor_endpoint_remap, pColor_selector_remap, pAlpha_endpoint_remap, pAlpha_selector_remap))
-         return false;
-
-      symbol_codec codec;
-      codec.start_encoding(2*1024*1024);
-      codec.encode_enable_simulation(true);
-
-      m_chunk_encoding_dm.init(true, m_chunk_encoding_hist, 16);
-
-      for (uint i = 0; i < 2; i++)
-      {
-         if (m_endpoint_index_hist[i].size())
-         {
-            m_endpoint_index_dm[i].init(true, m_endpoint_index_hist[i], 16);
-
-            codec.encode_transmit_static_huffman_data_model(m_endpoint_index_dm[i], false);
-         }
-
-         if (m_selector_index_hist[i].size())
-         {
-            m_selector_index_dm[i].init(true, m_selector_index_hist[i], 16);
-
-            codec.encode_transmit_static_huffman_data_model(m_selector_index_dm[i], false);
-         }
-      }
-
-      if (!pack_chunks(first_chunk, num_chunks, false, &codec, pColor_endpoint_remap, pColor_selector_remap, pAlpha_endpoint_remap, pAlpha_selector_remap))
-         return false;
-
-      codec.stop_encoding(false);
-
-      total_bits = codec.encode_get_total_bits_written();
-
-      return true;
-   }
-
    void crn_comp::append_vec(crnlib::vector<uint8>& a, const void* p, uint size)
    {
       if (size)
@@ -1075,6 +1037,7 @@ namespace crnlib
       CRNLIB_ASSERT(m_chunks.size() == m_total_chunks);
    }
 
+   // The chunk, index and packed data arrays (and m_hvq's) keep their capacity, so they're reused by the next texture.
    void crn_comp::clear()
    {
       m_pParams = NULL;
@@ -1087,23 +1050,30 @@ namespace crnlib
 
       m_mip_groups.clear();
 
+      m_total_chunks = 0;
+      m_total_pixels = 0;
+
+      m_chunks.resize(0);
+      m_pChunks = NULL;
+
+      clear_pass();
+   }
+
+   void crn_comp::clear_pass()
+   {
       utils::zero_object(m_has_comp);
 
-      m_chunk_details.clear();
+      m_chunk_details.resize(0);
 
       for (uint i = 0; i < cNumComps; i++)
       {
-         m_endpoint_indices[i].clear();
-         m_selector_indices[i].clear();
+         m_endpoint_indices[i].resize(0);
+         m_selector_indices[i].resize(0);
       }
 
-      m_total_chunks = 0;
-
-      m_chunks.clear();
-
       utils::zero_object(m_crn_header);
 
-      m_comp_data.clear();
+      m_comp_data.resize(0);
 
       m_hvq.clear();
 
@@ -1118,14 +1088,31 @@ namespace crnlib
       }
 
       for (uint i = 0; i < cCRNMaxLevels; i++)
-         m_packed_chunks[i].clear();
+         m_packed_chunks[i].resize(0);
 
-      m_packed_data_models.clear();
+      m_packed_data_models.resize(0);
 
-      m_packed_color_endpoints.clear();
-      m_packed_color_selectors.clear();
-      m_packed_alpha_endpoints.clear();
-      m_packed_alpha_selectors.clear();
+      m_packed_color_endpoints.resize(0);
+      m_packed_color_selectors.resize(0);
+      m_packed_alpha_endpoints.resize(0);
+      m_packed_alpha_selectors.resize(0);
+   }
+
+   uint64 crn_comp::get_retained_bytes() const
+   {
+      uint64 total = m_chunks.capacity_in_bytes() + m_chunk_details.capacity_in_bytes() + m_comp_data.capacity_in_bytes();
+
+      for (uint i = 0; i < cNumComps; i++)
+         total += m_endpoint_indices[i].capacity_in_bytes() + m_selector_indices[i].capacity_in_bytes();
+
+      for (uint i = 0; i < cCRNMaxLevels; i++)
+         total += m_packed_chunks[i].capacity_in_bytes();
+
+      total += m_packed_data_models.capacity_in_bytes();
+      total += m_packed_color_endpoints.capacity_in_bytes() + m_packed_color_selectors.capacity_in_bytes();
+      total += m_packed_alpha_endpoints.capacity_in_bytes() + m_packed_alpha_selectors.capacity_in_bytes();
+
+      return total + m_hvq.get_retained_bytes();
    }
 
    bool crn_comp::quantize_chunks()
@@ -1184,6 +1171,7 @@ namespace crnlib
 
       params.m_pProgress_func = m_pParams->m_pProgress_func;
       params.m_pProgress_func_data = m_pParams->m_pProgress_func_data;
+      params.m_pStats = m_pParams->m_pStats;
 
       switch (m_pParams->m_format)
       {
@@ -1271,7 +1259,7 @@ namespace crnlib
          params.m_levels[i].m_num_chunks = m_levels[i].m_num_chunks;
       }
 
-      if (!m_hvq.compress(params, m_total_chunks, &m_chunks[0], m_task_pool))
+      if (!m_hvq.compress(params, m_total_chunks, &(*m_pChunks)[0], m_task_pool))
          return false;
 
       return true;
@@ -1316,9 +1304,109 @@ namespace crnlib
       }
    }
 
+   // A distinct (previous, current) pair of codebook indices in the chunk index streams, and how often it occurs.
+   struct index_transition
+   {
+      uint m_prev_index;
+      uint m_cur_index;
+      uint m_count;
+   };
+   typedef crnlib::vector<index_transition> index_transition_vec;
+
+   const uint cStreamStartIndex = cUINT32_MAX;
+
+   // Each index stream is delta coded against the previous index of the same stream, starting from 0. The (previous, current)
+   // index pairs don't depend on the codebook order, so they're gathered once and each remapping trial only rebuilds the
+   // delta histogram from them instead of running pack_chunks() over every chunk.
+   static void get_index_transitions(index_transition_vec& transitions, const crnlib::vector<uint>* const* ppIndices, uint num_streams)
+   {
+      uint total_indices = 0;
+      for (uint s = 0; s < num_streams; s++)
+         total_indices += ppIndices[s]->size();
+
+      crnlib::vector<uint64> keys;
+      keys.reserve(total_indices);
+
+      for (uint s = 0; s < num_streams; s++)
+      {
+         const crnlib::vector<uint>& indices = *ppIndices[s];
+
+         uint prev_index = cStreamStartIndex;
+         for (uint i = 0; i < indices.size(); i++)
+         {
+            keys.push_back((static_cast<uint64>(prev_index) << 32U) | indices[i]);
+            prev_index = indices[i];
+         }
+      }
+
+      std::sort(keys.begin(), keys.end());
+
+      transitions.resize(0);
+
+      for (uint i = 0; i < keys.size(); )
+      {
+         uint j = i + 1;
+         while ((j < keys.size()) && (keys[j] == keys[i]))
+            j++;
+
+         index_transition t;
+         t.m_prev_index = static_cast<uint>(keys[i] >> 32U);
+         t.m_cur_index = static_cast<uint>(keys[i]);
+         t.m_count = j - i;
+         transitions.push_back(t);
+
+         i = j;
+      }
+   }
+
+   // Returns the bits needed to send the index delta model and code the streams with it. This differs from simulating
+   // pack_chunks() only by the chunk encodings and the other index streams, which are the same for every remapping.
+   static uint estimate_remapped_index_bits(const index_transition_vec& transitions, const crnlib::vector<uint>& remapping)
+   {
+      const uint num_syms = remapping.size();
+
+      symbol_histogram hist(num_syms);
+
+      for (uint i = 0; i < transitions.size(); i++)
+      {
+         const index_transition& t = transitions[i];
+
+         uint prev_index = (t.m_prev_index == cStreamStartIndex) ? 0 : remapping[t.m_prev_index];
+
+         int sym = remapping[t.m_cur_index] - prev_index;
+         if (sym < 0)
+            sym += num_syms;
+
+         hist.inc_freq(sym, t.m_count);
+      }
+
+      static_huffman_data_model dm;
+      dm.init(true, hist, 16);
+
+      symbol_codec codec;
+      codec.start_encoding(1024);
+
+      uint total_bits = codec.encode_transmit_static_huffman_data_model(dm, true);
+
+      for (uint i = 0; i < num_syms; i++)
+         if (hist[i])
+            total_bits += hist[i] * dm.get_cost(i);
+
+      return total_bits;
+   }
+
+   struct codebook_remap_trial
+   {
+      crnlib::vector<uint> m_remap;
+      crnlib::vector<uint8> m_packed_data;
+      uint m_total_bits;
+      bool m_status;
+   };
+
    struct optimize_color_endpoint_codebook_params
    {
-      crnlib::vector<uint>* m_pTrial_color_endpoint_remap;
+      const index_transition_vec* m_pTransitions;
+      codebook_remap_trial* m_pTrial;
       uint m_iter_index;
       uint m_max_iter_index;
    };
@@ -1327,10 +1415,11 @@ namespace crnlib
    {
       data;
       optimize_color_endpoint_codebook_params* pParams = reinterpret_cast<optimize_color_endpoint_codebook_params*>(pData_ptr);
+      codebook_remap_trial& trial = *pParams->m_pTrial;
 
       if (pParams->m_iter_index == pParams->m_max_iter_index)
       {
-         sort_color_endpoint_codebook(*pParams->m_pTrial_color_endpoint_remap, m_hvq.get_color_endpoint_vec());
+         sort_color_endpoint_codebook(trial.m_remap, m_hvq.get_color_endpoint_vec());
       }
       else
       {
@@ -1340,12 +1429,17 @@ namespace crnlib
             m_hvq.get_color_endpoint_codebook_size(),
             m_endpoint_indices[cColor].size(),
             &m_endpoint_indices[cColor][0],
-            *pParams->m_pTrial_color_endpoint_remap,
+            trial.m_remap,
             pParams->m_iter_index ? color_endpoint_similarity_func : NULL,
             &m_hvq,
-            f);
+            f,
+            m_task_pool.get_num_threads());
       }
 
+      trial.m_status = pack_color_endpoints(trial.m_packed_data, trial.m_remap, m_endpoint_indices[cColor], pParams->m_iter_index);
+      if (trial.m_status)
+         trial.m_total_bits = trial.m_packed_data.size() * 8 + estimate_remapped_index_bits(*pParams->m_pTransitions, trial.m_remap);
+
       crnlib_delete(pParams);
    }
 
@@ -1372,14 +1466,19 @@ namespace crnlib
          console::debug("----- Begin optimization of color endpoint codebook");
 #endif
 
-      crnlib::vector<uint> trial_color_endpoint_remaps[cMaxEndpointRemapIters + 1];
+      const crnlib::vector<uint>* pIndices[1] = { &m_endpoint_indices[cColor] };
+      index_transition_vec transitions;
+      get_index_transitions(transitions, pIndices, 1);
+
+      codebook_remap_trial trials[cMaxEndpointRemapIters + 1];
 
       for (uint i = 0; i <= cMaxEndpointRemapIters; i++)
       {
          optimize_color_endpoint_codebook_params* pParams = crnlib_new<optimize_color_endpoint_codebook_params>();
+         pParams->m_pTransitions = &transitions;
+         pParams->m_pTrial = &trials[i];
          pParams->m_iter_index = i;
          pParams->m_max_iter_index = cMaxEndpointRemapIters;
-         pParams->m_pTrial_color_endpoint_remap = &trial_color_endpoint_remaps[i];
 
          m_task_pool.queue_object_task(this, &crn_comp::optimize_color_endpoint_codebook_task, 0, pParams);
       }
@@ -1391,33 +1490,20 @@ namespace crnlib
          if (!update_progress(20, i, cMaxEndpointRemapIters+1))
             return false;
 
-         crnlib::vector<uint>& trial_color_endpoint_remap = trial_color_endpoint_remaps[i];
-
-         crnlib::vector<uint8> packed_data;
-         if (!pack_color_endpoints(packed_data, trial_color_endpoint_remap, m_endpoint_indices[cColor], i))
-            return false;
-
-         uint total_packed_chunk_bits;
-         if (!pack_chunks_simulation(0, m_total_chunks, total_packed_chunk_bits, &trial_color_endpoint_remap, NULL, NULL, NULL))
+         codebook_remap_trial& trial = trials[i];
+         if (!trial.m_status)
             return false;
 
 #if CRNLIB_ENABLE_DEBUG_MESSAGES
          if (m_pParams->m_flags & cCRNCompFlagDebugging)
-            console::debug("Pack chunks simulation: %u bits", total_packed_chunk_bits);
+            console::debug("Total bits: %u", trial.m_total_bits);
 #endif
 
-         uint total_bits = packed_data.size() * 8 + total_packed_chunk_bits;
-
-#if CRNLIB_ENABLE_DEBUG_MESSAGES
-         if (m_pParams->m_flags & cCRNCompFlagDebugging)
-            console::debug("Total bits: %u", total_bits);
-#endif
-
-         if (total_bits < best_bits)
+         if (trial.m_total_bits < best_bits)
          {
-            m_packed_color_endpoints.swap(packed_data);
-            remapping.swap(trial_color_endpoint_remap);
-            best_bits = total_bits;
+            m_packed_color_endpoints.swap(trial.m_packed_data);
+            remapping.swap(trial.m_remap);
+            best_bits = trial.m_total_bits;
          }
       }
 
@@ -1431,7 +1517,8 @@ namespace crnlib
 
    struct optimize_color_selector_codebook_params
    {
-      crnlib::vector<uint>* m_pTrial_color_selector_remap;
+      const index_transition_vec* m_pTransitions;
+      codebook_remap_trial* m_pTrial;
       uint m_iter_index;
       uint m_max_iter_index;
    };
@@ -1440,10 +1527,11 @@ namespace crnlib
    {
       data;
       optimize_color_selector_codebook_params* pParams = reinterpret_cast<optimize_color_selector_codebook_params*>(pData_ptr);
+      codebook_remap_trial& trial = *pParams->m_pTrial;
 
       if (pParams->m_iter_index == pParams->m_max_iter_index)
       {
-         sort_selector_codebook(*pParams->m_pTrial_color_selector_remap, m_hvq.get_color_selectors_vec(), g_dxt1_to_linear);
+         sort_selector_codebook(trial.m_remap, m_hvq.get_color_selectors_vec(), g_dxt1_to_linear);
       }
       else
       {
@@ -1452,12 +1540,23 @@ namespace crnlib
             m_hvq.get_color_selector_codebook_size(),
             m_selector_indices[cColor].size(),
             &m_selector_indices[cColor][0],
-            *pParams->m_pTrial_color_selector_remap,
+            trial.m_remap,
             pParams->m_iter_index ? color_selector_similarity_func : NULL,
             (void*)&m_hvq.get_color_selectors_vec(),
-            f);
+            f,
+            m_task_pool.get_num_threads());
       }
 
+      trial.m_status = pack_selectors(
+         trial.m_packed_data,
+         m_selector_indices[cColor],
+         m_hvq.get_color_selectors_vec(),
+         trial.m_remap,
+         3,
+         g_dxt1_to_linear, pParams->m_iter_index);
+      if (trial.m_status)
+         trial.m_total_bits = trial.m_packed_data.size() * 8 + estimate_remapped_index_bits(*pParams->m_pTransitions, trial.m_remap);
+
       crnlib_delete(pParams);
    }
 
@@ -1492,14 +1591,19 @@ namespace crnlib
          console::debug("----- Begin optimization of color selector codebook");
 #endif
 
-      crnlib::vector<uint> trial_color_selector_remaps[cMaxSelectorRemapIters + 1];
+      const crnlib::vector<uint>* pIndices[1] = { &m_selector_indices[cColor] };
+      index_transition_vec transitions;
+      get_index_transitions(transitions, pIndices, 1);
+
+      codebook_remap_trial trials[cMaxSelectorRemapIters + 1];
 
       for (uint i = 0; i <= cMaxSelectorRemapIters; i++)
       {
          optimize_color_selector_codebook_params* pParams = crnlib_new<optimize_color_selector_codebook_params>();
+         pParams->m_pTransitions = &transitions;
+         pParams->m_pTrial = &trials[i];
          pParams->m_iter_index = i;
          pParams->m_max_iter_index = cMaxSelectorRemapIters;
-         pParams->m_pTrial_color_selector_remap = &trial_color_selector_remaps[i];
 
          m_task_pool.queue_object_task(this, &crn_comp::optimize_color_selector_codebook_task, 0, pParams);
       }
@@ -1511,40 +1615,19 @@ namespace crnlib
          if (!update_progress(21, i, cMaxSelectorRemapIters+1))
             return false;
 
-         crnlib::vector<uint>& trial_color_selector_remap = trial_color_selector_remaps[i];
-
-         crnlib::vector<uint8> packed_data;
-         if (!pack_selectors(
-            packed_data,
-            m_selector_indices[cColor],
-            m_hvq.get_color_selectors_vec(),
-            trial_color_selector_remap,
-            3,
-            g_dxt1_to_linear, i))
-         {
-            return false;
-         }
-
-         uint total_packed_chunk_bits;
-         if (!pack_chunks_simulation(0, m_total_chunks, total_packed_chunk_bits, NULL, &trial_color_selector_remap, NULL, NULL))
+         codebook_remap_trial& trial = trials[i];
+         if (!trial.m_status)
             return false;
 
 #if CRNLIB_ENABLE_DEBUG_MESSAGES
          if (m_pParams->m_flags & cCRNCompFlagDebugging)
-            console::debug("Pack chunks simulation: %u bits", total_packed_chunk_bits);
+            console::debug("Total bits: %u", trial.m_total_bits);
 #endif
-
-         uint total_bits = packed_data.size() * 8 + total_packed_chunk_bits;
-
-#if CRNLIB_ENABLE_DEBUG_MESSAGES
-         if (m_pParams->m_flags & cCRNCompFlagDebugging)
-            console::debug("Total bits: %u", total_bits);
-#endif
-         if (total_bits < best_bits)
+         if (trial.m_total_bits < best_bits)
          {
-            m_packed_color_selectors.swap(packed_data);
-            remapping.swap(trial_color_selector_remap);
-            best_bits = total_bits;
+            m_packed_color_selectors.swap(trial.m_packed_data);
+            remapping.swap(trial.m_remap);
+            best_bits = trial.m_total_bits;
          }
       }
 
@@ -1559,7 +1642,8 @@ namespace crnlib
    struct optimize_alpha_endpoint_codebook_params
    {
       crnlib::vector<uint>* m_pAlpha_indices;
-      crnlib::vector<uint>* m_pTrial_alpha_endpoint_remap;
+      const index_transition_vec* m_pTransitions;
+      codebook_remap_trial* m_pTrial;
       uint m_iter_index;
       uint m_max_iter_index;
    };
@@ -1568,10 +1652,11 @@ namespace crnlib
    {
       data;
       optimize_alpha_endpoint_codebook_params* pParams = reinterpret_cast<optimize_alpha_endpoint_codebook_params*>(pData_ptr);
+      codebook_remap_trial& trial = *pParams->m_pTrial;
 
       if (pParams->m_iter_index == pParams->m_max_iter_index)
       {
-         sort_alpha_endpoint_codebook(*pParams->m_pTrial_alpha_endpoint_remap, m_hvq.get_alpha_endpoint_vec());
+         sort_alpha_endpoint_codebook(trial.m_remap, m_hvq.get_alpha_endpoint_vec());
       }
       else
       {
@@ -1581,12 +1666,17 @@ namespace crnlib
             m_hvq.get_alpha_endpoint_codebook_size(),
             pParams->m_pAlpha_indices->size(),
             &(*pParams->m_pAlpha_indices)[0],
-            *pParams->m_pTrial_alpha_endpoint_remap,
+            trial.m_remap,
             pParams->m_iter_index ? alpha_endpoint_similarity_func : NULL,
             &m_hvq,
-            f);
+            f,
+            m_task_pool.get_num_threads());
       }
 
+      trial.m_status = pack_alpha_endpoints(trial.m_packed_data, trial.m_remap, *pParams->m_pAlpha_indices, pParams->m_iter_index);
+      if (trial.m_status)
+         trial.m_total_bits = trial.m_packed_data.size() * 8 + estimate_remapped_index_bits(*pParams->m_pTransitions, trial.m_remap);
+
       crnlib_delete(pParams);
    }
 
@@ -1619,15 +1709,21 @@ namespace crnlib
          console::debug("----- Begin optimization of alpha endpoint codebook");
 #endif
 
-      crnlib::vector<uint> trial_alpha_endpoint_remaps[cMaxEndpointRemapIters + 1];
+      // Both alpha components share one delta model, but each is delta coded against its own previous index.
+      const crnlib::vector<uint>* pIndices[2] = { &m_endpoint_indices[cAlpha0], &m_endpoint_indices[cAlpha1] };
+      index_transition_vec transitions;
+      get_index_transitions(transitions, pIndices, 2);
+
+      codebook_remap_trial trials[cMaxEndpointRemapIters + 1];
 
       for (uint i = 0; i <= cMaxEndpointRemapIters; i++)
       {
          optimize_alpha_endpoint_codebook_params* pParams = crnlib_new<optimize_alpha_endpoint_codebook_params>();
          pParams->m_pAlpha_indices = &alpha_indices;
+         pParams->m_pTransitions = &transitions;
+         pParams->m_pTrial = &trials[i];
          pParams->m_iter_index = i;
          pParams->m_max_iter_index = cMaxEndpointRemapIters;
-         pParams->m_pTrial_alpha_endpoint_remap = &trial_alpha_endpoint_remaps[i];
 
          m_task_pool.queue_object_task(this, &crn_comp::optimize_alpha_endpoint_codebook_task, 0, pParams);
       }
@@ -1639,33 +1735,20 @@ namespace crnlib
          if (!update_progress(22, i, cMaxEndpointRemapIters+1))
             return false;
 
-         crnlib::vector<uint>& trial_alpha_endpoint_remap = trial_alpha_endpoint_remaps[i];
-
-         crnlib::vector<uint8> packed_data;
-         if (!pack_alpha_endpoints(packed_data, trial_alpha_endpoint_remap, alpha_indices, i))
-            return false;
-
-         uint total_packed_chunk_bits;
-         if (!pack_chunks_simulation(0, m_total_chunks, total_packed_chunk_bits, NULL, NULL, &trial_alpha_endpoint_remap, NULL))
+         codebook_remap_trial& trial = trials[i];
+         if (!trial.m_status)
             return false;
 
 #if CRNLIB_ENABLE_DEBUG_MESSAGES
          if (m_pParams->m_flags & cCRNCompFlagDebugging)
-            console::debug("Pack chunks simulation: %u bits", total_packed_chunk_bits);
+            console::debug("Total bits: %u", trial.m_total_bits);
 #endif
 
-         uint total_bits = packed_data.size() * 8 + total_packed_chunk_bits;
-
-#if CRNLIB_ENABLE_DEBUG_MESSAGES
-         if (m_pParams->m_flags & cCRNCompFlagDebugging)
-            console::debug("Total bits: %u", total_bits);
-#endif
-
-         if (total_bits < best_bits)
+         if (trial.m_total_bits < best_bits)
          {
-            m_packed_alpha_endpoints.swap(packed_data);
-            remapping.swap(trial_alpha_endpoint_remap);
-            best_bits = total_bits;
+            m_packed_alpha_endpoints.swap(trial.m_packed_data);
+            remapping.swap(trial.m_remap);
+            best_bits = trial.m_total_bits;
          }
       }
 
@@ -1680,7 +1763,8 @@ namespace crnlib
    struct optimize_alpha_selector_codebook_params
    {
       crnlib::vector<uint>* m_pAlpha_indices;
-      crnlib::vector<uint>* m_pTrial_alpha_selector_remap;
+      const index_transition_vec* m_pTransitions;
+      codebook_remap_trial* m_pTrial;
       uint m_iter_index;
       uint m_max_iter_index;
    };
@@ -1689,10 +1773,11 @@ namespace crnlib
    {
       data;
       optimize_alpha_selector_codebook_params* pParams = reinterpret_cast<optimize_alpha_selector_codebook_params*>(pData_ptr);
+      codebook_remap_trial& trial = *pParams->m_pTrial;
 
       if (pParams->m_iter_index == pParams->m_max_iter_index)
       {
-         sort_selector_codebook(*pParams->m_pTrial_alpha_selector_remap, m_hvq.get_alpha_selectors_vec(), g_dxt5_to_linear);
+         sort_selector_codebook(trial.m_remap, m_hvq.get_alpha_selectors_vec(), g_dxt5_to_linear);
       }
       else
       {
@@ -1701,11 +1786,24 @@ namespace crnlib
             m_hvq.get_alpha_selector_codebook_size(),
             pParams->m_pAlpha_indices->size(),
             &(*pParams->m_pAlpha_indices)[0],
-            *pParams->m_pTrial_alpha_selector_remap,
+            trial.m_remap,
             pParams->m_iter_index ? alpha_selector_similarity_func : NULL,
             (void*)&m_hvq.get_alpha_selectors_vec(),
-            f);
+            f,
+            m_task_pool.get_num_threads());
       }
+
+      trial.m_status = pack_selectors(
+         trial.m_packed_data,
+         *pParams->m_pAlpha_indices,
+         m_hvq.get_alpha_selectors_vec(),
+         trial.m_remap,
+         7,
+         g_dxt5_to_linear, pParams->m_iter_index);
+      if (trial.m_status)
+         trial.m_total_bits = trial.m_packed_data.size() * 8 + estimate_remapped_index_bits(*pParams->m_pTransitions, trial.m_remap);
+
+      crnlib_delete(pParams);
    }
 
    bool crn_comp::optimize_alpha_selector_codebook(crnlib::vector<uint>& remapping)
@@ -1746,15 +1844,20 @@ namespace crnlib
          console::debug("----- Begin optimization of alpha selector codebook");
 #endif
 
-      crnlib::vector<uint> trial_alpha_selector_remaps[cMaxSelectorRemapIters + 1];
+      const crnlib::vector<uint>* pIndices[2] = { &m_selector_indices[cAlpha0], &m_selector_indices[cAlpha1] };
+      index_transition_vec transitions;
+      get_index_transitions(transitions, pIndices, 2);
+
+      codebook_remap_trial trials[cMaxSelectorRemapIters + 1];
 
       for (uint i = 0; i <= cMaxSelectorRemapIters; i++)
       {
          optimize_alpha_selector_codebook_params* pParams = crnlib_new<optimize_alpha_selector_codebook_params>();
          pParams->m_pAlpha_indices = &alpha_indices;
+         pParams->m_pTransitions = &transitions;
+         pParams->m_pTrial = &trials[i];
          pParams->m_iter_index = i;
          pParams->m_max_iter_index = cMaxSelectorRemapIters;
-         pParams->m_pTrial_alpha_selector_remap = &trial_alpha_selector_remaps[i];
 
          m_task_pool.queue_object_task(this, &crn_comp::optimize_alpha_selector_codebook_task, 0, pParams);
       }
@@ -1766,41 +1869,19 @@ namespace crnlib
          if (!update_progress(23, i, cMaxSelectorRemapIters+1))
             return false;
 
-         crnlib::vector<uint>& trial_alpha_selector_remap = trial_alpha_selector_remaps[i];
-
-         crnlib::vector<uint8> packed_data;
-         if (!pack_selectors(
-            packed_data,
-            alpha_indices,
-            m_hvq.get_alpha_selectors_vec(),
-            trial_alpha_selector_remap,
-            7,
-            g_dxt5_to_linear, i))
-         {
-            return false;
-         }
-
-         uint total_packed_chunk_bits;
-         if (!pack_chunks_simulation(0, m_total_chunks, total_packed_chunk_bits, NULL, NULL, NULL, &trial_alpha_selector_remap))
+         codebook_remap_trial& trial = trials[i];
+         if (!trial.m_status)
             return false;
 
 #if CRNLIB_ENABLE_DEBUG_MESSAGES
          if (m_pParams->m_flags & cCRNCompFlagDebugging)
-            console::debug("Pack chunks simulation: %u bits", total_packed_chunk_bits);
-#endif
-
-         uint total_bits = packed_data.size() * 8 + total_packed_chunk_bits;
-
-#if CRNLIB_ENABLE_DEBUG_MESSAGES
-         if (m_pParams->m_flags & cCRNCompFlagDebugging)
-            console::debug("Total bits: %u", total_bits);
+            console::debug("Total bits: %u", trial.m_total_bits);
 #endif
-         if (total_bits < best_bits)
+         if (trial.m_total_bits < best_bits)
          {
-            m_packed_alpha_selectors.swap(packed_data);
-
-            remapping.swap(trial_alpha_selector_remap);
-            best_bits = total_bits;
+            m_packed_alpha_selectors.swap(trial.m_packed_data);
+            remapping.swap(trial.m_remap);
+            best_bits = trial.m_total_bits;
          }
       }
 
@@ -1853,6 +1934,7 @@ namespace crnlib
       m_crn_header.m_format = static_cast<uint8>(m_pParams->m_format);
       m_crn_header.m_userdata0 = m_pParams->m_userdata0;
       m_crn_header.m_userdata1 = m_pParams->m_userdata1;
+      m_crn_header.m_flags = (m_pParams->m_flags & cCRNCompFlagBandedLevels) ? crnd::cCRNHeaderFlagBanded : 0;
 
       m_comp_data.clear();
       m_comp_data.reserve(2*1024*1024);
@@ -1937,12 +2019,39 @@ namespace crnlib
       return (*m_pParams->m_pProgress_func)(phase_index, cTotalCompressionPhases, subphase_index, subphase_total, m_pParams->m_pProgress_func_data) != 0;
    }
 
-   bool crn_comp::compress_internal()
+   void crn_comp::get_level_bands(uint level_index, crnlib::vector<chunk_band>& bands) const
    {
-      if (!alias_images())
-         return false;
+      bands.resize(0);
 
-      create_chunks();
+      const level_tag& level = m_levels[level_index];
+
+      if (!(m_pParams->m_flags & cCRNCompFlagBandedLevels))
+      {
+         chunk_band band;
+         band.m_first_chunk = m_mip_groups[level.m_group_index].m_first_chunk;
+         band.m_num_chunks = m_mip_groups[level.m_group_index].m_num_chunks;
+         bands.push_back(band);
+         return;
+      }
+
+      // Each face's chunks are stored row by row (see create_chunks()), so every band is a contiguous range of chunks.
+      for (uint face = 0; face < m_pParams->m_faces; face++)
+      {
+         for (uint y = 0; y < level.m_chunk_height; y += cBandChunkRows)
+         {
+            const uint num_rows = math::minimum(cBandChunkRows, level.m_chunk_height - y);
+
+            chunk_band band;
+            band.m_first_chunk = level.m_first_chunk + (face * level.m_chunk_height + y) * level.m_chunk_width;
+            band.m_num_chunks = num_rows * level.m_chunk_width;
+            bands.push_back(band);
+         }
+      }
+   }
+
+   bool crn_comp::compress_internal()
+   {
+      crn_comp_stats* pStats = m_pParams->m_pStats;
 
       if (!quantize_chunks())
          return false;
@@ -1954,20 +2063,30 @@ namespace crnlib
 
       if (m_has_comp[cColor])
       {
-         if (!optimize_color_endpoint_codebook(endpoint_remap[0]))
-            return false;
+         {
+            comp_phase_scope phase(pStats, cCRNCompPhaseColorEndpointReorder);
+            if (!optimize_color_endpoint_codebook(endpoint_remap[0]))
+               return false;
+         }
+         comp_phase_scope phase(pStats, cCRNCompPhaseColorSelectorReorder);
          if (!optimize_color_selector_codebook(selector_remap[0]))
             return false;
       }
 
       if (m_has_comp[cAlpha0])
       {
-         if (!optimize_alpha_endpoint_codebook(endpoint_remap[1]))
-            return false;
+         {
+            comp_phase_scope phase(pStats, cCRNCompPhaseAlphaEndpointReorder);
+            if (!optimize_alpha_endpoint_codebook(endpoint_remap[1]))
+               return false;
+         }
+         comp_phase_scope phase(pStats, cCRNCompPhaseAlphaSelectorReorder);
          if (!optimize_alpha_selector_codebook(selector_remap[1]))
             return false;
       }
 
+      comp_phase_scope pack_chunks_phase(pStats, cCRNCompPhasePackChunks);
+
       m_chunk_encoding_hist.clear();
       for (uint i = 0; i < 2; i++)
       {
@@ -1977,26 +2096,59 @@ namespace crnlib
          m_selector_index_dm[i].clear();
       }
 
+      const bool banded = (m_pParams->m_flags & cCRNCompFlagBandedLevels) != 0;
+
+      crnlib::vector<chunk_band> bands;
+
       for (uint pass = 0; pass < 2; pass++)
       {
          for (uint mip_group = 0; mip_group < m_mip_groups.size(); mip_group++)
          {
-            symbol_codec codec;
-            codec.start_encoding(2*1024*1024);
-
-            if (!pack_chunks(
-               m_mip_groups[mip_group].m_first_chunk, m_mip_groups[mip_group].m_num_chunks,
-               !pass && !mip_group, pass ? &codec : NULL,
-               m_has_comp[cColor] ? &endpoint_remap[0] : NULL, m_has_comp[cColor] ? &selector_remap[0] : NULL,
-               m_has_comp[cAlpha0] ? &endpoint_remap[1] : NULL, m_has_comp[cAlpha0] ? &selector_remap[1] : NULL))
+            get_level_bands(mip_group, bands);
+
+            crnlib::vector<uint8>& level_data = m_packed_chunks[mip_group];
+            if ((pass) && (banded))
             {
-               return false;
+               level_data.resize(crnd::cCRNBandTableMinSize + sizeof(crnd::crn_packed_uint<4>) * (bands.size() - 1));
+               level_data.set_all(0);
             }
 
-            codec.stop_encoding(false);
+            for (uint band_index = 0; band_index < bands.size(); band_index++)
+            {
+               symbol_codec codec;
+               codec.start_encoding(2*1024*1024);
+
+               if (!pack_chunks(
+                  bands[band_index].m_first_chunk, bands[band_index].m_num_chunks,
+                  !pass && !mip_group && !band_index, pass ? &codec : NULL,
+                  m_has_comp[cColor] ? &endpoint_remap[0] : NULL, m_has_comp[cColor] ? &selector_remap[0] : NULL,
+                  m_has_comp[cAlpha0] ? &endpoint_remap[1] : NULL, m_has_comp[cAlpha0] ? &selector_remap[1] : NULL))
+               {
+                  return false;
+               }
+
+               codec.stop_encoding(false);
 
-            if (pass)
-               m_packed_chunks[mip_group].swap(codec.get_encoding_buf());
+               if (!pass)
+                  continue;
+
+               if (!banded)
+                  level_data.swap(codec.get_encoding_buf());
+               else
+               {
+                  crnd::crn_band_table& band_table = *(crnd::crn_band_table*)&level_data[0];
+                  band_table.m_band_ofs[band_index] = level_data.size();
+                  // don't use band_table after this - level_data may be reallocated
+                  append_vec(level_data, codec.get_encoding_buf());
+               }
+            }
+
+            if ((pass) && (banded))
+            {
+               crnd::crn_band_table& band_table = *(crnd::crn_band_table*)&level_data[0];
+               band_table.m_band_chunk_rows = cBandChunkRows;
+               band_table.m_num_bands = bands.size();
+            }
          }
 
          if (!pass)
@@ -2014,11 +2166,16 @@ namespace crnlib
          }
       }
 
-      if (!pack_data_models())
-         return false;
+      pack_chunks_phase.end();
 
-      if (!create_comp_data())
-         return false;
+      {
+         comp_phase_scope phase(pStats, cCRNCompPhasePackModels);
+         if (!pack_data_models())
+            return false;
+
+         if (!create_comp_data())
+            return false;
+      }
 
       if (!update_progress(24, 1, 1))
          return false;
@@ -2031,46 +2188,76 @@ namespace crnlib
       return true;
    }
 
+   // The source images and chunks don't depend on the quality level, so they're only created once for all passes.
    bool crn_comp::compress_init(const crn_comp_params& params)
    {
-      params;
+      clear();
+
+      m_pParams = &params;
+
+      if ((math::minimum(m_pParams->m_width, m_pParams->m_height) < 1) || (math::maximum(m_pParams->m_width, m_pParams->m_height) > cCRNMaxLevelResolution))
+         return false;
+
+      comp_phase_scope phase(m_pParams->m_pStats, cCRNCompPhaseInit);
+
+      if (!alias_images())
+         return false;
+
+      create_chunks();
+      m_pChunks = &m_chunks;
+
+      for (uint f = 0; f < m_pParams->m_faces; f++)
+         for (uint l = 0; l < m_pParams->m_levels; l++)
+            m_total_pixels += m_images[f][l].get_total_pixels();
+
       return true;
    }
 
-   bool crn_comp::compress_pass(const crn_comp_params& params, float *pEffective_bitrate)
+   bool crn_comp::compress_init_shared(const crn_comp& init_comp)
    {
       clear();
 
-      if (pEffective_bitrate) *pEffective_bitrate = 0.0f;
+      if (!init_comp.m_pChunks)
+         return false;
 
-      m_pParams = &params;
+      memcpy(m_levels, init_comp.m_levels, sizeof(m_levels));
+      m_mip_groups = init_comp.m_mip_groups;
+      m_total_chunks = init_comp.m_total_chunks;
+      m_total_pixels = init_comp.m_total_pixels;
+      m_pChunks = init_comp.m_pChunks;
 
-      if ((math::minimum(m_pParams->m_width, m_pParams->m_height) < 1) || (math::maximum(m_pParams->m_width, m_pParams->m_height) > cCRNMaxLevelResolution))
+      return true;
+   }
+
+   bool crn_comp::compress_pass(const crn_comp_params& params, float *pEffective_bitrate)
+   {
+      clear_pass();
+
+      if (pEffective_bitrate) *pEffective_bitrate = 0.0f;
+
+      if (!m_pChunks)
          return false;
 
+      m_pParams = &params;
+
       if (!m_task_pool.init(params.m_num_helper_threads))
          return false;
 
+      mem_arena_scope arena_scope;
+
       bool status = compress_internal();
 
       m_task_pool.deinit();
 
       if ((status) && (pEffective_bitrate))
-      {
-         uint total_pixels = 0;
-
-         for (uint f = 0; f < m_pParams->m_faces; f++)
-            for (uint l = 0; l < m_pParams->m_levels; l++)
-               total_pixels += m_images[f][l].get_total_pixels();
-
-         *pEffective_bitrate = (m_comp_data.size() * 8.0f) / total_pixels;
-      }
+         *pEffective_bitrate = (m_comp_data.size() * 8.0f) / m_total_pixels;
 
       return status;
    }
 
    void crn_comp::compress_deinit()
    {
+      clear();
    }
 
 } // namespace crnlib
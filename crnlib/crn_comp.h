@@ -29,9 +29,15 @@ namespace crnlib
       virtual bool compress_pass(const crn_comp_params& params, float *pEffective_bitrate);
       virtual void compress_deinit();
 
+      // Initializes a separate pass context which shares the source chunks of init_comp (which must stay alive and initialized),
+      // so several quality levels can be compressed concurrently.
+      bool compress_init_shared(const crn_comp& init_comp);
+
       virtual const crnlib::vector<uint8>& get_comp_data() const  { return m_comp_data; }
       virtual       crnlib::vector<uint8>& get_comp_data()        { return m_comp_data; }
 
+      virtual uint64 get_retained_bytes() const;
+
       uint get_comp_data_size() const { return m_comp_data.size(); }
       const uint8* get_comp_data_ptr() const { return m_comp_data.size() ? &m_comp_data[0] : NULL; }
 
@@ -84,7 +90,9 @@ namespace crnlib
       crnlib::vector<uint>          m_selector_indices[cNumComps];
 
       uint                          m_total_chunks;
+      uint                          m_total_pixels;
       dxt_hc::pixel_chunk_vec       m_chunks;
+      const dxt_hc::pixel_chunk_vec* m_pChunks; // m_chunks, or the chunks of the context this one shares its init data with
 
       crnd::crn_header              m_crn_header;
       crnlib::vector<uint8>         m_comp_data;
@@ -108,6 +116,7 @@ namespace crnlib
       crnlib::vector<uint8>         m_packed_alpha_selectors;
 
       void clear();
+      void clear_pass();
 
       void append_chunks(const image_u8& img, uint num_chunks_x, uint num_chunks_y, dxt_hc::pixel_chunk_vec& chunks, float weight);
 
@@ -132,6 +141,14 @@ namespace crnlib
          const uint8* pTo_linear,
          uint trial_index);
 
+      // Range of chunks which is coded as a single stream.
+      struct chunk_band
+      {
+         uint m_first_chunk;
+         uint m_num_chunks;
+      };
+      void get_level_bands(uint level_index, crnlib::vector<chunk_band>& bands) const;
+
       bool alias_images();
       void create_chunks();
       bool quantize_chunks();
@@ -146,14 +163,6 @@ namespace crnlib
          const crnlib::vector<uint>* pAlpha_endpoint_remap,
          const crnlib::vector<uint>* pAlpha_selector_remap);
 
-      bool pack_chunks_simulation(
-         uint first_chunk, uint num_chunks,
-         uint& total_bits,
-         const crnlib::vector<uint>* pColor_endpoint_remap,
-         const crnlib::vector<uint>* pColor_selector_remap,
-         const crnlib::vector<uint>* pAlpha_endpoint_remap,
-         const crnlib::vector<uint>* pAlpha_selector_remap);
-
       void optimize_color_endpoint_codebook_task(uint64 data, void* pData_ptr);
       bool optimize_color_endpoint_codebook(crnlib::vector<uint>& remapping);
 
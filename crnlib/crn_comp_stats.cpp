@@ -0,0 +1,95 @@
+// File: crn_comp_stats.cpp
+// This software is in the public domain. Please see license.txt.
+#include "crn_core.h"
+#include "crn_comp_stats.h"
+#include "crn_threading.h"
+
+namespace crnlib
+{
+   static void get_counters(timer_ticks& ticks, double& cpu_time, uint64& alloc_bytes, uint32& allocs, uint32& tasks)
+   {
+      ticks = timer::get_ticks();
+      cpu_time = timer::get_process_cpu_secs();
+      crnlib_get_alloc_counts(alloc_bytes, allocs);
+      tasks = task_pool::get_total_queued_tasks();
+   }
+
+   static void accumulate(crn_comp_phase_stats& s, timer_ticks start_ticks, double start_cpu_time, uint64 start_alloc_bytes, uint32 start_allocs, uint32 start_tasks)
+   {
+      timer_ticks ticks;
+      double cpu_time;
+      uint64 alloc_bytes;
+      uint32 allocs, tasks;
+      get_counters(ticks, cpu_time, alloc_bytes, allocs, tasks);
+
+      s.m_num_calls++;
+      s.m_wall_time += timer::ticks_to_secs(ticks - start_ticks);
+      s.m_cpu_time += math::maximum(0.0, cpu_time - start_cpu_time);
+      s.m_alloc_bytes += alloc_bytes - start_alloc_bytes;
+      s.m_num_allocs += allocs - start_allocs;
+      s.m_num_tasks += tasks - start_tasks;
+   }
+
+   comp_stats_session::comp_stats_session(crn_comp_stats* pStats, uint num_helper_threads) :
+      m_pStats(pStats)
+   {
+      if (!m_pStats)
+         return;
+
+      m_pStats->clear();
+      m_pStats->m_num_threads = num_helper_threads + 1;
+
+      crnlib_enable_alloc_counting(true);
+
+      get_counters(m_start_ticks, m_start_cpu_time, m_start_alloc_bytes, m_start_allocs, m_start_tasks);
+      m_pStats->m_trace_origin = timer::ticks_to_secs(m_start_ticks);
+   }
+
+   comp_stats_session::~comp_stats_session()
+   {
+      if (!m_pStats)
+         return;
+
+      accumulate(m_pStats->m_total, m_start_ticks, m_start_cpu_time, m_start_alloc_bytes, m_start_allocs, m_start_tasks);
+
+      crnlib_enable_alloc_counting(false);
+   }
+
+   comp_phase_scope::comp_phase_scope(crn_comp_stats* pStats, crn_comp_phase phase) :
+      m_pStats(pStats),
+      m_phase(phase)
+   {
+      CRNLIB_ASSERT(phase < cCRNTotalCompPhases);
+      if (!m_pStats)
+         return;
+
+      get_counters(m_start_ticks, m_start_cpu_time, m_start_alloc_bytes, m_start_allocs, m_start_tasks);
+   }
+
+   // Passes of the parallel quality search may end phases on several threads at once.
+   static mutex g_phase_mutex;
+
+   void comp_phase_scope::end()
+   {
+      if (!m_pStats)
+         return;
+
+      scoped_mutex lock(g_phase_mutex);
+
+      crn_comp_phase_stats& s = m_pStats->m_phases[m_phase];
+      const double prev_wall_time = s.m_wall_time;
+
+      accumulate(s, m_start_ticks, m_start_cpu_time, m_start_alloc_bytes, m_start_allocs, m_start_tasks);
+
+      if (m_pStats->m_num_trace_events < cCRNMaxCompTraceEvents)
+      {
+         crn_comp_trace_event& e = m_pStats->m_trace_events[m_pStats->m_num_trace_events++];
+         e.m_phase = m_phase;
+         e.m_start_time = timer::ticks_to_secs(m_start_ticks) - m_pStats->m_trace_origin;
+         e.m_duration = s.m_wall_time - prev_wall_time;
+      }
+
+      m_pStats = NULL;
+   }
+
+} // namespace crnlib
@@ -0,0 +1,48 @@
+// File: crn_comp_stats.h
+// This software is in the public domain. Please see license.txt.
+#pragma once
+#include "../inc/crnlib.h"
+
+namespace crnlib
+{
+   // Clears and starts filling in a crn_comp_stats struct for the lifetime of the object. Does nothing if pStats is NULL.
+   class comp_stats_session
+   {
+      CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(comp_stats_session);
+
+   public:
+      comp_stats_session(crn_comp_stats* pStats, uint num_helper_threads);
+      ~comp_stats_session();
+
+   private:
+      crn_comp_stats* m_pStats;
+      timer_ticks m_start_ticks;
+      double m_start_cpu_time;
+      uint64 m_start_alloc_bytes;
+      uint32 m_start_allocs;
+      uint32 m_start_tasks;
+   };
+
+   // Accumulates the wall/CPU time, allocations and queued tasks of a single compression phase. Does nothing if pStats is NULL.
+   class comp_phase_scope
+   {
+      CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(comp_phase_scope);
+
+   public:
+      comp_phase_scope(crn_comp_stats* pStats, crn_comp_phase phase);
+      ~comp_phase_scope() { end(); }
+
+      // Ends the phase before the object goes out of scope.
+      void end();
+
+   private:
+      crn_comp_stats* m_pStats;
+      crn_comp_phase m_phase;
+      timer_ticks m_start_ticks;
+      double m_start_cpu_time;
+      uint64 m_start_alloc_bytes;
+      uint32 m_start_allocs;
+      uint32 m_start_tasks;
+   };
+
+} // namespace crnlib
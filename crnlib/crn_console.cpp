@@ -19,6 +19,14 @@ namespace crnlib
 
    const uint cConsoleBufSize = 4096;
 
+#if defined(_MSC_VER)
+   static __declspec(thread) console_buffer* g_pThread_buffer;
+#elif defined(__GNUC__)
+   static __thread console_buffer* g_pThread_buffer;
+#else
+   static console_buffer* g_pThread_buffer;
+#endif
+
    void console::init()
    {
       if (!m_pMutex)
@@ -40,27 +48,61 @@ namespace crnlib
    {
       init();
 
-      m_crlf = false;
+      if (g_pThread_buffer)
+         g_pThread_buffer->m_crlf = false;
+      else
+         m_crlf = false;
    }
 
    void console::enable_crlf()
    {
       init();
 
-      m_crlf = true;
+      if (g_pThread_buffer)
+         g_pThread_buffer->m_crlf = true;
+      else
+         m_crlf = true;
    }
 
-   void console::vprintf(eConsoleMessageType type, const char* p, va_list args)
+   void console::set_thread_buffer(console_buffer* pBuf)
    {
       init();
 
-      scoped_mutex lock(*m_pMutex);
+      g_pThread_buffer = pBuf;
+   }
 
-      m_num_messages[type]++;
+   console_buffer* console::get_thread_buffer()
+   {
+      return g_pThread_buffer;
+   }
+
+   void console::vprintf(eConsoleMessageType type, const char* p, va_list args)
+   {
+      init();
 
       char buf[cConsoleBufSize];
       vsprintf_s(buf, cConsoleBufSize, p, args);
 
+      if (g_pThread_buffer)
+      {
+         console_buffer::message& msg = *g_pThread_buffer->m_messages.enlarge(1);
+         msg.m_type = type;
+         msg.m_crlf = g_pThread_buffer->m_crlf;
+         msg.m_text_ofs = g_pThread_buffer->m_text.size();
+         g_pThread_buffer->m_text.append(buf, static_cast<uint>(strlen(buf)) + 1);
+         return;
+      }
+
+      scoped_mutex lock(*m_pMutex);
+
+      output(type, buf);
+   }
+
+   // Caller must hold m_pMutex.
+   void console::output(eConsoleMessageType type, const char* buf)
+   {
+      m_num_messages[type]++;
+
       bool handled = false;
 
       if (m_output_funcs.size())
@@ -104,6 +146,28 @@ namespace crnlib
       }
    }
 
+   void console_buffer::flush()
+   {
+      console::init();
+
+      if (m_messages.empty())
+         return;
+
+      scoped_mutex lock(*console::m_pMutex);
+
+      const bool crlf = console::m_crlf;
+
+      for (uint i = 0; i < m_messages.size(); i++)
+      {
+         console::m_crlf = m_messages[i].m_crlf;
+         console::output(m_messages[i].m_type, &m_text[m_messages[i].m_text_ofs]);
+      }
+
+      console::m_crlf = crlf;
+
+      clear();
+   }
+
    void console::printf(eConsoleMessageType type, const char* p, ...)
    {
       va_list args;
@@ -28,6 +28,34 @@ namespace crnlib
 
    typedef bool (*console_output_func)(eConsoleMessageType type, const char* pMsg, void* pData);
 
+   // Records console output instead of emitting it. While installed on a thread (see console::set_thread_buffer()),
+   // all messages printed by that thread are queued here, and flush() later emits them as one uninterrupted block.
+   class console_buffer
+   {
+   public:
+      console_buffer() : m_crlf(true) { }
+
+      void clear() { m_messages.clear(); m_text.clear(); m_crlf = true; }
+      bool is_empty() const { return m_messages.empty(); }
+
+      void flush();
+
+   private:
+      friend class console;
+
+      // POD, so it can live in a crnlib::vector. The text is stored zero terminated in m_text, starting at m_text_ofs.
+      struct message
+      {
+         eConsoleMessageType  m_type;
+         bool                 m_crlf;
+         uint                 m_text_ofs;
+      };
+      crnlib::vector<message> m_messages;
+      crnlib::vector<char>    m_text;
+
+      bool m_crlf;
+   };
+
    class console
    {
    public:
@@ -74,7 +102,15 @@ namespace crnlib
 
       static uint get_num_messages(eConsoleMessageType type) { return m_num_messages[type]; }
 
+      // Installs (or removes, if NULL) the calling thread's output buffer.
+      static void set_thread_buffer(console_buffer* pBuf);
+      static console_buffer* get_thread_buffer();
+
    private:
+      friend class console_buffer;
+
+      static void output(eConsoleMessageType type, const char* pBuf);
+
       static eConsoleMessageType m_default_category;
 
       struct console_func
@@ -125,6 +125,13 @@
 
 #define CRNLIB_SLOW_STRING_LEN_CHECKS 1
 
+// SSE2 is part of the x64 baseline, and optional on x86. Define CRNLIB_NO_SSE2 to force the scalar code paths.
+#if !defined(CRNLIB_NO_SSE2) && (defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)))
+   #define CRNLIB_USE_SSE2 1
+#else
+   #define CRNLIB_USE_SSE2 0
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <limits.h>
@@ -281,6 +281,24 @@ namespace crnlib
          return m_pStream->read_array(buf);
       }
 
+      // If the stream is memory resident (mapped files, buffers), points pData at the rest of the stream and skips past it,
+      // so it can be parsed in place instead of being copied by read_entire_file().
+      bool read_entire_file_in_place(const uint8*& pData, uint& size)
+      {
+         const uint8* pBase = static_cast<const uint8*>(m_pStream->get_ptr());
+         if (!pBase)
+            return false;
+
+         const uint64 ofs = m_pStream->get_ofs();
+         const uint64 remaining = m_pStream->get_remaining();
+         if ((remaining > cUINT32_MAX) || (!m_pStream->seek(static_cast<int64>(remaining), true)))
+            return false;
+
+         pData = pBase + ofs;
+         size = static_cast<uint>(remaining);
+         return true;
+      }
+
       bool write_entire_file(const crnlib::vector<uint8>& buf)
       {
          return m_pStream->write_array(buf);
@@ -4,6 +4,7 @@
 #include "crn_dds_comp.h"
 #include "crn_dynamic_stream.h"
 #include "crn_lzma_codec.h"
+#include "crn_comp_stats.h"
 
 namespace crnlib
 {
@@ -180,7 +181,7 @@ namespace crnlib
 
       m_pParams = &params;
 
-      if ((math::minimum(m_pParams->m_width, m_pParams->m_height) < 1) || (math::maximum(m_pParams->m_width, m_pParams->m_height) > cCRNMaxLevelResolution))
+      if ((math::minimum(m_pParams->m_width, m_pParams->m_height) < 1) || (math::maximum(m_pParams->m_width, m_pParams->m_height) > cCRNMaxDDSLevelResolution))
          return false;
 
       if (math::minimum(m_pParams->m_faces, m_pParams->m_levels) < 1)
@@ -220,8 +221,11 @@ namespace crnlib
       if (!m_pParams)
          return false;
 
-      if (!convert_to_dxt(params))
-         return false;
+      {
+         comp_phase_scope phase(params.m_pStats, cCRNCompPhaseDXTBlocks);
+         if (!convert_to_dxt(params))
+            return false;
+      }
 
       dynamic_stream out_stream;
       out_stream.reserve(512*1024);
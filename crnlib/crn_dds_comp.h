@@ -24,6 +24,8 @@ namespace crnlib
       virtual const crnlib::vector<uint8>& get_comp_data() const  { return m_comp_data; }
       virtual       crnlib::vector<uint8>& get_comp_data()        { return m_comp_data; }
 
+      virtual uint64 get_retained_bytes() const { return m_comp_data.capacity_in_bytes(); }
+
    private:
       mipmapped_texture m_src_tex;
       mipmapped_texture m_packed_tex;
@@ -14,6 +14,9 @@
 #include "crn_dxt_fast.h"
 #include "crn_intersect.h"
 #include "crn_vec_interval.h"
+#if CRNLIB_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace crnlib
 {
@@ -39,7 +42,8 @@ namespace crnlib
       m_pSolutions(NULL),
       m_perceptual(false),
       m_has_color_weighting(false),
-      m_all_pixels_grayscale(false)
+      m_all_pixels_grayscale(false),
+      m_num_prev_results(0)
    {
       m_low_coords.reserve(512);
       m_high_coords.reserve(512);
@@ -1520,6 +1524,11 @@ namespace crnlib
             colors[2].set_noclamp_rgba( (colors[0].r * 2 + colors[1].r + alternate_rounding) / 3, (colors[0].g * 2 + colors[1].g + alternate_rounding) / 3, (colors[0].b * 2 + colors[1].b + alternate_rounding) / 3, 0);
             colors[3].set_noclamp_rgba( (colors[1].r * 2 + colors[0].r + alternate_rounding) / 3, (colors[1].g * 2 + colors[0].g + alternate_rounding) / 3, (colors[1].b * 2 + colors[0].b + alternate_rounding) / 3, 0);
 
+#if CRNLIB_USE_SSE2
+            if (m_unique_color_lanes.size())
+               trial_error = evaluate_colors_sse2(colors, 4, solution.m_error);
+            else
+#endif
             if (m_perceptual)
             {
                for (int unique_color_index = (int)m_unique_colors.size() - 1; unique_color_index >= 0; unique_color_index--)
@@ -1575,6 +1584,11 @@ namespace crnlib
          {
             colors[2].set_noclamp_rgba( (colors[0].r + colors[1].r + alternate_rounding) >> 1, (colors[0].g + colors[1].g + alternate_rounding) >> 1, (colors[0].b + colors[1].b + alternate_rounding) >> 1, 255U);
 
+#if CRNLIB_USE_SSE2
+            if (m_unique_color_lanes.size())
+               trial_error = evaluate_colors_sse2(colors, 3, solution.m_error);
+            else
+#endif
             if (m_perceptual)
             {
                for (int unique_color_index = (int)m_unique_colors.size() - 1; unique_color_index >= 0; unique_color_index--)
@@ -1723,6 +1737,14 @@ namespace crnlib
             int halfPoint = stops[3] + stops[2];
             int c3Point = stops[2] + stops[0];
 
+#if CRNLIB_USE_SSE2
+            if (m_unique_color_lanes.size())
+            {
+               const int thresholds[3] = { c3Point, halfPoint, c0Point };
+               trial_error = evaluate_colors_fast_sse2(colors, 4, thresholds, dirr, dirg, dirb, solution.m_error);
+            }
+            else
+#endif
             for (int unique_color_index = (int)m_unique_colors.size() - 1; unique_color_index >= 0; unique_color_index--)
             {
                const color_quad_u8& c = m_unique_colors[unique_color_index].m_color;
@@ -1754,6 +1776,14 @@ namespace crnlib
             int c02Point = stops[0] + stops[2];
             int c21Point = stops[2] + stops[1];
 
+#if CRNLIB_USE_SSE2
+            if (m_unique_color_lanes.size())
+            {
+               const int thresholds[2] = { c02Point, c21Point };
+               trial_error = evaluate_colors_fast_sse2(colors, 3, thresholds, dirr, dirg, dirb, solution.m_error);
+            }
+            else
+#endif
             for (int unique_color_index = (int)m_unique_colors.size() - 1; unique_color_index >= 0; unique_color_index--)
             {
                const color_quad_u8& c = m_unique_colors[unique_color_index].m_color;
@@ -2122,6 +2152,187 @@ namespace crnlib
       m_unique_colors.resize(num_unique_colors);
 
       m_total_unique_color_weight = num_opaque_pixels;
+
+#if CRNLIB_USE_SSE2
+      init_unique_color_lanes();
+#endif
+   }
+
+#if CRNLIB_USE_SSE2
+   void dxt1_endpoint_optimizer::init_unique_color_lanes()
+   {
+      m_unique_color_lanes.resize(0);
+
+      // The kernels only implement the perceptual and plain RGB metrics, see color_distance().
+      if ((!m_perceptual) && ((m_pParams->m_grayscale_sampling) || (m_has_color_weighting)))
+         return;
+
+      const uint num_colors = m_unique_colors.size();
+      m_unique_color_lanes.resize(((num_colors + 3) >> 2) * 16);
+
+      int16* pDst = m_unique_color_lanes.get_ptr();
+      for (uint i = 0; i < m_unique_color_lanes.size(); i += 16)
+      {
+         for (uint j = 0; j < 4; j++)
+         {
+            const uint color_index = (i >> 2) + j;
+            const color_quad_u8 c(color_index < num_colors ? m_unique_colors[color_index].m_color : color_quad_u8(0, 0, 0, 0));
+
+            pDst[i + j * 2] = c.r;
+            pDst[i + j * 2 + 1] = c.g;
+            pDst[i + 8 + j * 2] = c.b;
+            pDst[i + 8 + j * 2 + 1] = 0;
+         }
+      }
+   }
+
+   static inline __m128i sse2_select(__m128i mask, __m128i a, __m128i b)
+   {
+      return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+   }
+
+   // Weighted squared RGB distance between 4 unique colors and 4 palette colors, one per 32-bit lane.
+   static inline __m128i sse2_color_distance(__m128i rg, __m128i b, __m128i c_rg, __m128i c_b, __m128i w_rg, __m128i w_b)
+   {
+      const __m128i d_rg = _mm_sub_epi16(rg, c_rg);
+      const __m128i d_b = _mm_sub_epi16(b, c_b);
+      return _mm_add_epi32(_mm_madd_epi16(d_rg, _mm_mullo_epi16(d_rg, w_rg)), _mm_madd_epi16(d_b, _mm_mullo_epi16(d_b, w_b)));
+   }
+
+   // Sums the weighted errors of the selected palette colors and writes m_trial_selectors. Results match the scalar loops:
+   // the early out is only checked every 4 colors, but a partial sum can only grow so the solution is rejected either way.
+   static inline uint64 sse2_accumulate(__m128i err, __m128i sel, const unique_color* pColors, uint8* pSelectors, uint n, uint64 trial_error)
+   {
+      uint32 e[4], s[4];
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(e), err);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(s), sel);
+
+      for (uint j = 0; j < n; j++)
+      {
+         trial_error += e[j] * static_cast<uint64>(pColors[j].m_weight);
+         pSelectors[j] = static_cast<uint8>(s[j]);
+      }
+
+      return trial_error;
+   }
+
+   uint64 dxt1_endpoint_optimizer::evaluate_colors_sse2(const color_quad_u8* pColors, uint num_colors, uint64 max_error)
+   {
+      const __m128i w_rg = m_perceptual ? _mm_set_epi16(color::cGWeight, color::cRWeight, color::cGWeight, color::cRWeight, color::cGWeight, color::cRWeight, color::cGWeight, color::cRWeight) : _mm_set1_epi16(1);
+      const __m128i w_b = m_perceptual ? _mm_set_epi16(0, color::cBWeight, 0, color::cBWeight, 0, color::cBWeight, 0, color::cBWeight) : _mm_set_epi16(0, 1, 0, 1, 0, 1, 0, 1);
+
+      __m128i c_rg[4], c_b[4];
+      for (uint k = 0; k < num_colors; k++)
+      {
+         c_rg[k] = _mm_set_epi16(pColors[k].g, pColors[k].r, pColors[k].g, pColors[k].r, pColors[k].g, pColors[k].r, pColors[k].g, pColors[k].r);
+         c_b[k] = _mm_set_epi16(0, pColors[k].b, 0, pColors[k].b, 0, pColors[k].b, 0, pColors[k].b);
+      }
+
+      const __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2), three = _mm_set1_epi32(3);
+
+      const uint n = m_unique_colors.size();
+      const int16* pLanes = m_unique_color_lanes.get_ptr();
+      uint64 trial_error = 0;
+
+      for (uint i = 0; i < n; i += 4, pLanes += 16)
+      {
+         const __m128i rg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pLanes));
+         const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pLanes + 8));
+
+         // Ties go to the lower palette index, like the scalar compares.
+         __m128i best_err = sse2_color_distance(rg, b, c_rg[0], c_b[0], w_rg, w_b);
+         __m128i best_sel = _mm_setzero_si128();
+
+         __m128i err = sse2_color_distance(rg, b, c_rg[1], c_b[1], w_rg, w_b);
+         __m128i mask = _mm_cmplt_epi32(err, best_err);
+         best_err = sse2_select(mask, err, best_err);
+         best_sel = sse2_select(mask, one, best_sel);
+
+         err = sse2_color_distance(rg, b, c_rg[2], c_b[2], w_rg, w_b);
+         mask = _mm_cmplt_epi32(err, best_err);
+         best_err = sse2_select(mask, err, best_err);
+         best_sel = sse2_select(mask, two, best_sel);
+
+         if (num_colors == 4)
+         {
+            err = sse2_color_distance(rg, b, c_rg[3], c_b[3], w_rg, w_b);
+            mask = _mm_cmplt_epi32(err, best_err);
+            best_err = sse2_select(mask, err, best_err);
+            best_sel = sse2_select(mask, three, best_sel);
+         }
+
+         trial_error = sse2_accumulate(best_err, best_sel, &m_unique_colors[i], &m_trial_selectors[i], math::minimum(4U, n - i), trial_error);
+         if (trial_error >= max_error)
+            break;
+      }
+
+      return trial_error;
+   }
+
+   // Vectorized selector search of evaluate_solution_fast(). pThresholds holds c3Point, halfPoint and c0Point (4 colors),
+   // or c02Point and c21Point (3 colors).
+   uint64 dxt1_endpoint_optimizer::evaluate_colors_fast_sse2(const color_quad_u8* pColors, uint num_colors, const int* pThresholds, int dirr, int dirg, int dirb, uint64 max_error)
+   {
+      const __m128i w_rg = m_perceptual ? _mm_set_epi16(color::cGWeight, color::cRWeight, color::cGWeight, color::cRWeight, color::cGWeight, color::cRWeight, color::cGWeight, color::cRWeight) : _mm_set1_epi16(1);
+      const __m128i w_b = m_perceptual ? _mm_set_epi16(0, color::cBWeight, 0, color::cBWeight, 0, color::cBWeight, 0, color::cBWeight) : _mm_set_epi16(0, 1, 0, 1, 0, 1, 0, 1);
+
+      const __m128i dir_rg = _mm_set_epi16((int16)dirg, (int16)dirr, (int16)dirg, (int16)dirr, (int16)dirg, (int16)dirr, (int16)dirg, (int16)dirr);
+      const __m128i dir_b = _mm_set_epi16(0, (int16)dirb, 0, (int16)dirb, 0, (int16)dirb, 0, (int16)dirb);
+
+      __m128i c_rg[4], c_b[4], c_sel[4];
+      for (uint k = 0; k < num_colors; k++)
+      {
+         c_rg[k] = _mm_set_epi16(pColors[k].g, pColors[k].r, pColors[k].g, pColors[k].r, pColors[k].g, pColors[k].r, pColors[k].g, pColors[k].r);
+         c_b[k] = _mm_set_epi16(0, pColors[k].b, 0, pColors[k].b, 0, pColors[k].b, 0, pColors[k].b);
+         c_sel[k] = _mm_set1_epi32(k);
+      }
+
+      const __m128i t0 = _mm_set1_epi32(pThresholds[0]);
+      const __m128i t1 = _mm_set1_epi32(pThresholds[1]);
+      const __m128i t2 = _mm_set1_epi32((num_colors == 4) ? pThresholds[2] : 0);
+
+      const uint n = m_unique_colors.size();
+      const int16* pLanes = m_unique_color_lanes.get_ptr();
+      uint64 trial_error = 0;
+
+      for (uint i = 0; i < n; i += 4, pLanes += 16)
+      {
+         const __m128i rg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pLanes));
+         const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pLanes + 8));
+
+         const __m128i dot = _mm_add_epi32(_mm_madd_epi16(rg, dir_rg), _mm_madd_epi16(b, dir_b));
+
+         // Each unique color occupies one 32-bit lane in rg and b, so the per-color masks select palette colors directly.
+         __m128i sel_rg, sel_b, sel;
+         if (num_colors == 4)
+         {
+            const __m128i lt_c3 = _mm_cmplt_epi32(dot, t0);
+            const __m128i lt_half = _mm_cmplt_epi32(dot, t1);
+            const __m128i lt_c0 = _mm_cmplt_epi32(dot, t2);
+
+            sel_rg = sse2_select(lt_half, sse2_select(lt_c3, c_rg[0], c_rg[2]), sse2_select(lt_c0, c_rg[3], c_rg[1]));
+            sel_b = sse2_select(lt_half, sse2_select(lt_c3, c_b[0], c_b[2]), sse2_select(lt_c0, c_b[3], c_b[1]));
+            sel = sse2_select(lt_half, sse2_select(lt_c3, c_sel[0], c_sel[2]), sse2_select(lt_c0, c_sel[3], c_sel[1]));
+         }
+         else
+         {
+            const __m128i lt_c02 = _mm_cmplt_epi32(dot, t0);
+            const __m128i lt_c21 = _mm_cmplt_epi32(dot, t1);
+
+            sel_rg = sse2_select(lt_c02, c_rg[0], sse2_select(lt_c21, c_rg[2], c_rg[1]));
+            sel_b = sse2_select(lt_c02, c_b[0], sse2_select(lt_c21, c_b[2], c_b[1]));
+            sel = sse2_select(lt_c02, c_sel[0], sse2_select(lt_c21, c_sel[2], c_sel[1]));
+         }
+
+         const __m128i err = sse2_color_distance(rg, b, sel_rg, sel_b, w_rg, w_b);
+
+         trial_error = sse2_accumulate(err, sel, &m_unique_colors[i], &m_trial_selectors[i], math::minimum(4U, n - i), trial_error);
+         if (trial_error >= max_error)
+            break;
+      }
+
+      return trial_error;
    }
+#endif // CRNLIB_USE_SSE2
 
 } // namespace crnlib
@@ -317,6 +317,15 @@ namespace crnlib
          potential_solution* pBest_solution,
          bool alternate_rounding = false);
 
+#if CRNLIB_USE_SSE2
+      // Unique colors in groups of 4 for the SSE2 kernels. Each group is 8 int16's of (r,g) pairs followed by 8 int16's of (b,0) pairs.
+      crnlib::vector<int16> m_unique_color_lanes;
+
+      void init_unique_color_lanes();
+      uint64 evaluate_colors_sse2(const color_quad_u8* pColors, uint num_colors, uint64 max_error);
+      uint64 evaluate_colors_fast_sse2(const color_quad_u8* pColors, uint num_colors, const int* pThresholds, int dirr, int dirg, int dirb, uint64 max_error);
+#endif
+
       void clear();
       void find_unique_colors();
       bool handle_all_transparent_block();
@@ -5,6 +5,7 @@
 #include "crn_image_utils.h"
 #include "crn_console.h"
 #include "crn_dxt_fast.h"
+#include "crn_comp_stats.h"
 
 #define CRNLIB_USE_FAST_DXT 1
 #define CRNLIB_ENABLE_DEBUG_MESSAGES 0
@@ -46,38 +47,36 @@ namespace crnlib
    {
    }
 
+   // The large per chunk/tile arrays keep their capacity, so a dxt_hc which is reused for several textures doesn't reallocate them.
    void dxt_hc::clear()
    {
       m_num_chunks = 0;
       m_pChunks = NULL;
 
-      m_chunk_encoding.clear();
+      m_chunk_encoding.resize(0);
 
       m_num_alpha_blocks = 0;
       m_has_color_blocks = false;
       m_has_alpha0_blocks = false;
       m_has_alpha1_blocks = false;
 
-      m_color_selectors.clear();
-
-      m_alpha_selectors.clear();
       for (uint i = 0; i < cNumCompressedChunkVecs; i++)
-         m_compressed_chunks[i].clear();
+         m_compressed_chunks[i].resize(0);
 
       utils::zero_object(m_encoding_hist);
 
       m_total_tiles = 0;
 
-      m_color_clusters.clear();
-      m_alpha_clusters.clear();
-      m_color_selectors.clear();
-      m_alpha_selectors.clear();
+      m_color_clusters.resize(0);
+      m_alpha_clusters.resize(0);
+      m_color_selectors.resize(0);
+      m_alpha_selectors.resize(0);
 
-      m_chunk_blocks_using_color_selectors.clear();
-      m_chunk_blocks_using_alpha_selectors.clear();
+      m_chunk_blocks_using_color_selectors.reset();
+      m_chunk_blocks_using_alpha_selectors.reset();
 
-      m_color_endpoints.clear();
-      m_alpha_endpoints.clear();
+      m_color_endpoints.resize(0);
+      m_alpha_endpoints.resize(0);
 
       m_dbg_chunk_pixels.clear();
       m_dbg_chunk_pixels_tile_vis.clear();
@@ -101,11 +100,27 @@ namespace crnlib
       m_prev_percentage_complete = -1;
    }
 
+   uint64 dxt_hc::get_retained_bytes() const
+   {
+      uint64 total = m_chunk_encoding.capacity_in_bytes();
+      for (uint i = 0; i < cNumCompressedChunkVecs; i++)
+         total += m_compressed_chunks[i].capacity_in_bytes();
+
+      total += m_color_clusters.capacity_in_bytes() + m_alpha_clusters.capacity_in_bytes();
+      total += m_color_selectors.capacity_in_bytes() + m_alpha_selectors.capacity_in_bytes();
+      total += m_chunk_blocks_using_color_selectors.capacity_in_bytes() + m_chunk_blocks_using_alpha_selectors.capacity_in_bytes();
+      total += m_color_endpoints.capacity_in_bytes() + m_alpha_endpoints.capacity_in_bytes();
+      return total;
+   }
+
    bool dxt_hc::compress(const params& p, uint num_chunks, const pixel_chunk* pChunks, task_pool& task_pool)
    {
       m_pTask_pool = &task_pool;
       m_main_thread_id = crn_get_current_thread_id();
 
+      // The clusterization temporaries are mostly small, short lived vectors.
+      mem_arena_scope arena_scope;
+
       bool result = compress_internal(p, num_chunks, pChunks);
 
       m_pTask_pool = NULL;
@@ -161,20 +176,33 @@ namespace crnlib
          }
       }
 
-      determine_compressed_chunks();
+      crn_comp_stats* pStats = m_params.m_pStats;
+
+      {
+         comp_phase_scope phase(pStats, cCRNCompPhaseChunkCompression);
+         determine_compressed_chunks();
+      }
 
       if (m_has_color_blocks)
       {
-         if (!determine_color_endpoint_clusters())
-            return false;
+         {
+            comp_phase_scope phase(pStats, cCRNCompPhaseColorEndpointClusters);
+            if (!determine_color_endpoint_clusters())
+               return false;
+         }
+         comp_phase_scope phase(pStats, cCRNCompPhaseColorEndpointCodebook);
          if (!determine_color_endpoint_codebook())
             return false;
       }
 
       if (m_num_alpha_blocks)
       {
-         if (!determine_alpha_endpoint_clusters())
-            return false;
+         {
+            comp_phase_scope phase(pStats, cCRNCompPhaseAlphaEndpointClusters);
+            if (!determine_alpha_endpoint_clusters())
+               return false;
+         }
+         comp_phase_scope phase(pStats, cCRNCompPhaseAlphaEndpointCodebook);
          if (!determine_alpha_endpoint_codebook())
             return false;
       }
@@ -183,36 +211,45 @@ namespace crnlib
 
       if (m_has_color_blocks)
       {
+         comp_phase_scope phase(pStats, cCRNCompPhaseColorSelectorCodebook);
          if (!create_selector_codebook(false))
             return false;
       }
 
       if (m_num_alpha_blocks)
       {
+         comp_phase_scope phase(pStats, cCRNCompPhaseAlphaSelectorCodebook);
          if (!create_selector_codebook(true))
             return false;
       }
 
       if (m_has_color_blocks)
       {
-         if (!refine_quantized_color_selectors())
-            return false;
-
+         {
+            comp_phase_scope phase(pStats, cCRNCompPhaseRefineColorSelectors);
+            if (!refine_quantized_color_selectors())
+               return false;
+         }
+         comp_phase_scope phase(pStats, cCRNCompPhaseRefineColorEndpoints);
          if (!refine_quantized_color_endpoints())
             return false;
       }
 
       if (m_num_alpha_blocks)
       {
-         if (!refine_quantized_alpha_endpoints())
-            return false;
-
+         {
+            comp_phase_scope phase(pStats, cCRNCompPhaseRefineAlphaEndpoints);
+            if (!refine_quantized_alpha_endpoints())
+               return false;
+         }
+         comp_phase_scope phase(pStats, cCRNCompPhaseRefineAlphaSelectors);
          if (!refine_quantized_alpha_selectors())
             return false;
       }
 
       create_final_debug_image();
 
+      comp_phase_scope phase(pStats, cCRNCompPhaseChunkEncodings);
       if (!create_chunk_encodings())
          return false;
 
@@ -290,8 +327,8 @@ namespace crnlib
 
    void dxt_hc::determine_compressed_chunks_task(uint64 data, void* pData_ptr)
    {
-      pData_ptr;
-      const uint thread_index = static_cast<uint>(data);
+      data;
+      parallel_range& range = *static_cast<parallel_range*>(pData_ptr);
 
       image_u8 orig_chunk;
       image_u8 decomp_chunk[cNumChunkEncodings];
@@ -320,23 +357,17 @@ namespace crnlib
          first_encoding = cNumChunkEncodings - 1;
       }
 
-      for (uint chunk_index = 0; chunk_index < m_num_chunks; chunk_index++)
+      for (uint chunk_index = 0, end_chunk_index = 0; range.next(chunk_index, end_chunk_index); chunk_index++)
       {
          if (m_canceled)
             return;
 
-         if ((crn_get_current_thread_id() == m_main_thread_id) && ((chunk_index & 511) == 0))
+         if (crn_get_current_thread_id() == m_main_thread_id)
          {
             if (!update_progress(0, chunk_index, m_num_chunks))
                return;
          }
 
-         if (m_pTask_pool->get_num_threads())
-         {
-            if ((chunk_index % (m_pTask_pool->get_num_threads() + 1)) != thread_index)
-               continue;
-         }
-
          uint level_index = 0;
          for (uint i = 0; i < m_params.m_num_levels; i++)
          {
@@ -632,8 +663,10 @@ namespace crnlib
 
       m_total_tiles = 0;
 
+      parallel_range range(0, m_num_chunks, m_pTask_pool->get_num_threads() + 1);
+
       for (uint i = 0; i <= m_pTask_pool->get_num_threads(); i++)
-         m_pTask_pool->queue_object_task(this, &dxt_hc::determine_compressed_chunks_task, i);
+         m_pTask_pool->queue_object_task(this, &dxt_hc::determine_compressed_chunks_task, i, &range);
 
       m_pTask_pool->join();
       if (m_canceled)
@@ -659,26 +692,20 @@ namespace crnlib
 
    void dxt_hc::assign_color_endpoint_clusters_task(uint64 data, void* pData_ptr)
    {
-      const uint thread_index = (uint)data;
+      data;
       assign_color_endpoint_clusters_state& state = *static_cast<assign_color_endpoint_clusters_state*>(pData_ptr);
 
-      for (uint chunk_index = 0; chunk_index < m_num_chunks; chunk_index++)
+      for (uint chunk_index = 0, end_chunk_index = 0; state.m_range.next(chunk_index, end_chunk_index); chunk_index++)
       {
          if (m_canceled)
             return;
 
-         if ((crn_get_current_thread_id() == m_main_thread_id) && ((chunk_index & 63) == 0))
+         if (crn_get_current_thread_id() == m_main_thread_id)
          {
             if (!update_progress(2, chunk_index, m_num_chunks))
                return;
          }
 
-         if (m_pTask_pool->get_num_threads())
-         {
-            if ((chunk_index % (m_pTask_pool->get_num_threads() + 1)) != thread_index)
-               continue;
-         }
-
          compressed_chunk& chunk = m_compressed_chunks[cColorChunks][chunk_index];
 
          for (uint tile_index = 0; tile_index < chunk.m_num_tiles; tile_index++)
@@ -709,6 +736,9 @@ namespace crnlib
 
       training_vecs.resize(m_num_chunks);
 
+      const uint training_vec_stride = get_training_vec_stride(m_total_tiles);
+      uint training_vec_index = 0;
+
       for (uint chunk_index = 0; chunk_index < m_num_chunks; chunk_index++)
       {
          if ((chunk_index & 255) == 0)
@@ -774,7 +804,9 @@ namespace crnlib
                vv[i*3+2] = v[i][2];
             }
 
-            vq.add_training_vec(vv, tile_weight);
+            // Every tile's vector is kept for the cluster assignment, but only a sample of them trains the codebook.
+            if ((training_vec_index++ % training_vec_stride) == 0)
+               vq.add_training_vec(vv, tile_weight);
 
             training_vecs[chunk_index][tile_index] = vv;
          }
@@ -788,7 +820,7 @@ namespace crnlib
 #endif
 
       uint codebook_size = math::minimum<uint>(m_total_tiles, m_params.m_color_endpoint_codebook_size);
-      vq.generate_codebook(codebook_size);
+      vq.generate_codebook(codebook_size, m_pTask_pool);
 
 #if CRNLIB_ENABLE_DEBUG_MESSAGES
       if (m_params.m_debugging)
@@ -806,6 +838,7 @@ namespace crnlib
 #endif
 
       assign_color_endpoint_clusters_state state(vq, training_vecs);
+      state.m_range.init(0, m_num_chunks, m_pTask_pool->get_num_threads() + 1);
 
       for (uint i = 0; i <= m_pTask_pool->get_num_threads(); i++)
          m_pTask_pool->queue_object_task(this, &dxt_hc::assign_color_endpoint_clusters_task, i, &state);
@@ -836,36 +869,31 @@ namespace crnlib
 
    void dxt_hc::determine_alpha_endpoint_clusters_task(uint64 data, void* pData_ptr)
    {
-      const uint thread_index = static_cast<uint>(data);
-      const determine_alpha_endpoint_clusters_state& state = *static_cast<determine_alpha_endpoint_clusters_state*>(pData_ptr);
+      data;
+      determine_alpha_endpoint_clusters_state& state = *static_cast<determine_alpha_endpoint_clusters_state*>(pData_ptr);
 
-      for (uint a = 0; a < m_num_alpha_blocks; a++)
+      // The range covers every (alpha block, chunk) pair, alpha block major.
+      for (uint index = 0, end_index = 0; state.m_range.next(index, end_index); index++)
       {
-         for (uint chunk_index = 0; chunk_index < m_num_chunks; chunk_index++)
+         if (m_canceled)
+            return;
+
+         if (crn_get_current_thread_id() == m_main_thread_id)
          {
-            if (m_canceled)
+            if (!update_progress(7, index, m_num_chunks * m_num_alpha_blocks))
                return;
+         }
 
-            if ((crn_get_current_thread_id() == m_main_thread_id) && ((chunk_index & 63) == 0))
-            {
-               if (!update_progress(7, m_num_chunks * a + chunk_index, m_num_chunks * m_num_alpha_blocks))
-                  return;
-            }
-
-            if (m_pTask_pool->get_num_threads())
-            {
-               if ((chunk_index % (m_pTask_pool->get_num_threads() + 1)) != thread_index)
-                  continue;
-            }
+         const uint a = index / m_num_chunks;
+         const uint chunk_index = index - a * m_num_chunks;
 
-            compressed_chunk& chunk = m_compressed_chunks[cAlpha0Chunks + a][chunk_index];
+         compressed_chunk& chunk = m_compressed_chunks[cAlpha0Chunks + a][chunk_index];
 
-            for (uint tile_index = 0; tile_index < chunk.m_num_tiles; tile_index++)
-            {
-               uint cluster_index = state.m_vq.find_best_codebook_entry_fs(state.m_training_vecs[a][chunk_index][tile_index]);
+         for (uint tile_index = 0; tile_index < chunk.m_num_tiles; tile_index++)
+         {
+            uint cluster_index = state.m_vq.find_best_codebook_entry_fs(state.m_training_vecs[a][chunk_index][tile_index]);
 
-               chunk.m_endpoint_cluster_index[tile_index] = static_cast<uint16>(cluster_index);
-            }
+            chunk.m_endpoint_cluster_index[tile_index] = static_cast<uint16>(cluster_index);
          }
       }
    }
@@ -882,6 +910,9 @@ namespace crnlib
 
       determine_alpha_endpoint_clusters_state state;
 
+      const uint training_vec_stride = get_training_vec_stride(m_total_tiles * m_num_alpha_blocks);
+      uint training_vec_index = 0;
+
       for (uint a = 0; a < m_num_alpha_blocks; a++)
       {
          state.m_training_vecs[a].resize(m_num_chunks);
@@ -934,7 +965,8 @@ namespace crnlib
 
                vec2F vv(v[0][0], v[1][0]);
 
-               state.m_vq.add_training_vec(vv, tile_weight);
+               if ((training_vec_index++ % training_vec_stride) == 0)
+                  state.m_vq.add_training_vec(vv, tile_weight);
 
                state.m_training_vecs[a][chunk_index][tile_index] = vv;
 
@@ -950,7 +982,7 @@ namespace crnlib
 #endif
 
       uint codebook_size = math::minimum<uint>(m_total_tiles, m_params.m_alpha_endpoint_codebook_size);
-      state.m_vq.generate_codebook(codebook_size);
+      state.m_vq.generate_codebook(codebook_size, m_pTask_pool);
 
 #if CRNLIB_ENABLE_DEBUG_MESSAGES
       if (m_params.m_debugging)
@@ -967,6 +999,8 @@ namespace crnlib
          console::info("Begin alpha cluster assignment");
 #endif
 
+      state.m_range.init(0, m_num_chunks * m_num_alpha_blocks, m_pTask_pool->get_num_threads() + 1);
+
       for (uint i = 0; i <= m_pTask_pool->get_num_threads(); i++)
          m_pTask_pool->queue_object_task(this, &dxt_hc::determine_alpha_endpoint_clusters_task, i, &state);
 
@@ -999,8 +1033,8 @@ namespace crnlib
 
    void dxt_hc::determine_color_endpoint_codebook_task(uint64 data, void* pData_ptr)
    {
-      pData_ptr;
-      const uint thread_index = static_cast<uint>(data);
+      data;
+      parallel_range& range = *static_cast<parallel_range*>(pData_ptr);
 
       if (!m_has_color_blocks)
          return;
@@ -1013,23 +1047,17 @@ namespace crnlib
       uint total_pixels = 0;
 
       uint total_empty_clusters = 0;
-      for (uint cluster_index = 0; cluster_index < m_color_clusters.size(); cluster_index++)
+      for (uint cluster_index = 0, end_cluster_index = 0; range.next(cluster_index, end_cluster_index); cluster_index++)
       {
          if (m_canceled)
             return;
 
-         if ((crn_get_current_thread_id() == m_main_thread_id) && ((cluster_index & 63) == 0))
+         if (crn_get_current_thread_id() == m_main_thread_id)
          {
             if (!update_progress(3, cluster_index, m_color_clusters.size()))
                return;
          }
 
-         if (m_pTask_pool->get_num_threads())
-         {
-            if ((cluster_index % (m_pTask_pool->get_num_threads() + 1)) != thread_index)
-               continue;
-         }
-
          tile_cluster& cluster = m_color_clusters[cluster_index];
          if (cluster.m_tiles.empty())
          {
@@ -1144,8 +1172,10 @@ namespace crnlib
          console::info("Computing optimal color cluster endpoints");
 #endif
 
+      parallel_range range(0, m_color_clusters.size(), m_pTask_pool->get_num_threads() + 1);
+
       for (uint i = 0; i <= m_pTask_pool->get_num_threads(); i++)
-         m_pTask_pool->queue_object_task(this, &dxt_hc::determine_color_endpoint_codebook_task, i, NULL);
+         m_pTask_pool->queue_object_task(this, &dxt_hc::determine_color_endpoint_codebook_task, i, &range);
 
       m_pTask_pool->join();
 
@@ -1154,9 +1184,8 @@ namespace crnlib
 
    void dxt_hc::determine_alpha_endpoint_codebook_task(uint64 data, void* pData_ptr)
    {
-      pData_ptr;
-
-      const uint thread_index = static_cast<uint>(data);
+      data;
+      parallel_range& range = *static_cast<parallel_range*>(pData_ptr);
 
       crnlib::vector<color_quad_u8> pixels;
       pixels.reserve(512);
@@ -1165,23 +1194,17 @@ namespace crnlib
       selectors.reserve(512);
 
       uint total_empty_clusters = 0;
-      for (uint cluster_index = 0; cluster_index < m_alpha_clusters.size(); cluster_index++)
+      for (uint cluster_index = 0, end_cluster_index = 0; range.next(cluster_index, end_cluster_index); cluster_index++)
       {
          if (m_canceled)
             return;
 
-         if ((crn_get_current_thread_id() == m_main_thread_id) && ((cluster_index & 63) == 0))
+         if (crn_get_current_thread_id() == m_main_thread_id)
          {
             if (!update_progress(8, cluster_index, m_alpha_clusters.size()))
                return;
          }
 
-         if (m_pTask_pool->get_num_threads())
-         {
-            if ((cluster_index % (m_pTask_pool->get_num_threads() + 1)) != thread_index)
-               continue;
-         }
-
          tile_cluster& cluster = m_alpha_clusters[cluster_index];
          if (cluster.m_tiles.empty())
          {
@@ -1304,8 +1327,10 @@ namespace crnlib
          console::info("Computing optimal alpha cluster endpoints");
 #endif
 
+      parallel_range range(0, m_alpha_clusters.size(), m_pTask_pool->get_num_threads() + 1);
+
       for (uint i = 0; i <= m_pTask_pool->get_num_threads(); i++)
-         m_pTask_pool->queue_object_task(this, &dxt_hc::determine_alpha_endpoint_codebook_task, i, NULL);
+         m_pTask_pool->queue_object_task(this, &dxt_hc::determine_alpha_endpoint_codebook_task, i, &range);
 
       m_pTask_pool->join();
 
@@ -1426,31 +1451,28 @@ namespace crnlib
 
    void dxt_hc::create_selector_codebook_task(uint64 data, void* pData_ptr)
    {
-      const uint thread_index = static_cast<uint>(data);
-      const create_selector_codebook_state& state = *static_cast<create_selector_codebook_state*>(pData_ptr);
+      data;
+      create_selector_codebook_state& state = *static_cast<create_selector_codebook_state*>(pData_ptr);
 
       for (uint comp_chunk_index = state.m_comp_index_start; comp_chunk_index <= state.m_comp_index_end; comp_chunk_index++)
       {
          const uint alpha_index = state.m_alpha_blocks ? (comp_chunk_index - cAlpha0Chunks) : 0;
          const uint alpha_pixel_comp = state.m_alpha_blocks ? m_params.m_alpha_component_indices[alpha_index] : 0;
 
-         for (uint chunk_index = 0; chunk_index < m_num_chunks; chunk_index++)
+         // Tasks which run out of chunks here move straight on to the next component's range.
+         parallel_range& range = state.m_ranges[comp_chunk_index];
+
+         for (uint chunk_index = 0, end_chunk_index = 0; range.next(chunk_index, end_chunk_index); chunk_index++)
          {
             if (m_canceled)
                return;
 
-            if ((crn_get_current_thread_id() == m_main_thread_id) && ((chunk_index & 127) == 0))
+            if (crn_get_current_thread_id() == m_main_thread_id)
             {
                if (!update_progress(12 + comp_chunk_index, chunk_index, m_num_chunks))
                   return;
             }
 
-            if (m_pTask_pool->get_num_threads())
-            {
-               if ((chunk_index % (m_pTask_pool->get_num_threads() + 1)) != thread_index)
-                  continue;
-            }
-
             compressed_chunk& chunk = m_compressed_chunks[comp_chunk_index][chunk_index];
 
             for (uint tile_index = 0; tile_index < chunk.m_num_tiles; tile_index++)
@@ -1515,13 +1537,6 @@ namespace crnlib
                         CRNLIB_ASSERT( (tile_block_ofs_y + by) < 2 );
 
                         chunk.m_selector_cluster_index[tile_block_ofs_y + by][tile_block_ofs_x + bx] = static_cast<uint16>(best_index);
-
-                        {
-                           scoped_spinlock lock(state.m_chunk_blocks_using_selectors_lock);
-                           state.m_chunk_blocks_using_selectors[best_index].push_back( block_id(chunk_index, alpha_index, tile_index, tile_block_ofs_x + bx, tile_block_ofs_y + by ) );
-                        }
-                        //   std::make_pair(chunk_index, (tile_index << 16) | ((tile_block_ofs_y + by) << 8) | (tile_block_ofs_x + bx) ) );
-
                      } // bx
                   } // by
 
@@ -1583,13 +1598,6 @@ namespace crnlib
                         CRNLIB_ASSERT( (tile_block_ofs_y + by) < 2 );
 
                         chunk.m_selector_cluster_index[tile_block_ofs_y + by][tile_block_ofs_x + bx] = static_cast<uint16>(best_index);
-
-                        {
-                           scoped_spinlock lock(state.m_chunk_blocks_using_selectors_lock);
-                           state.m_chunk_blocks_using_selectors[best_index].push_back( block_id(chunk_index, 0, tile_index, tile_block_ofs_x + bx, tile_block_ofs_y + by ) );
-                        }
-                        //   std::make_pair(chunk_index, (tile_index << 16) | ((tile_block_ofs_y + by) << 8) | (tile_block_ofs_x + bx) ) );
-
                      } // bx
                   } // by
 
@@ -1622,13 +1630,12 @@ namespace crnlib
          comp_index_end = cAlpha0Chunks + m_num_alpha_blocks - 1;
       }
 
-      crnlib::vector<vec16F> training_vecs[cNumCompressedChunkVecs][4];
+      // The blocks are assigned to the codebook by create_selector_codebook_task() straight from their pixels.
+      const uint training_vec_stride = get_training_vec_stride(m_num_chunks * cChunkBlockWidth * cChunkBlockHeight * (comp_index_end - comp_index_start + 1));
+      uint training_vec_index = 0;
 
       for (uint comp_chunk_index = comp_index_start; comp_chunk_index <= comp_index_end; comp_chunk_index++)
       {
-         for (uint i = 0; i < 4; i++)
-            training_vecs[comp_chunk_index][i].resize(m_num_chunks);
-
          for (uint chunk_index = 0; chunk_index < m_num_chunks; chunk_index++)
          {
             if ((chunk_index & 63) == 0)
@@ -1730,9 +1737,8 @@ namespace crnlib
                      v[i] = f;
                   } // i
 
-                  selector_vq.add_training_vec(v, block_weight[x][y]);
-
-                  training_vecs[comp_chunk_index][x+y*2][chunk_index] = v;
+                  if ((training_vec_index++ % training_vec_stride) == 0)
+                     selector_vq.add_training_vec(v, block_weight[x][y]);
                } // x
             } // y
 
@@ -1743,7 +1749,7 @@ namespace crnlib
       timer t;
       t.start();
 
-      selector_vq.generate_codebook(alpha_blocks ? m_params.m_alpha_selector_codebook_size : m_params.m_color_selector_codebook_size);
+      selector_vq.generate_codebook(alpha_blocks ? m_params.m_alpha_selector_codebook_size : m_params.m_color_selector_codebook_size, m_pTask_pool);
 
 #if CRNLIB_ENABLE_DEBUG_MESSAGES
       if (m_params.m_debugging)
@@ -1779,46 +1785,115 @@ namespace crnlib
          }  // j
       } // i
 
-      chunk_blocks_using_selectors_vec& chunk_blocks_using_selectors = alpha_blocks ? m_chunk_blocks_using_alpha_selectors : m_chunk_blocks_using_color_selectors;
-
-      chunk_blocks_using_selectors.clear();
-      chunk_blocks_using_selectors.resize(selectors_cb.size());
-
-      create_selector_codebook_state state(*this, alpha_blocks, comp_index_start, comp_index_end, selector_vq, chunk_blocks_using_selectors, selectors_cb);
+      create_selector_codebook_state state(*this, alpha_blocks, comp_index_start, comp_index_end, selector_vq, selectors_cb);
+      for (uint comp_chunk_index = comp_index_start; comp_chunk_index <= comp_index_end; comp_chunk_index++)
+         state.m_ranges[comp_chunk_index].init(0, m_num_chunks, m_pTask_pool->get_num_threads() + 1);
 
       for (uint i = 0; i <= m_pTask_pool->get_num_threads(); i++)
          m_pTask_pool->queue_object_task(this, &dxt_hc::create_selector_codebook_task, i, &state);
 
       m_pTask_pool->join();
 
-      return !m_canceled;
+      if (m_canceled)
+         return false;
+
+      create_chunk_blocks_using_selectors(alpha_blocks, comp_index_start, comp_index_end);
+
+      return true;
    }
 
-   bool dxt_hc::refine_quantized_color_selectors()
+   // Counting sort of every block by its selector cluster index, which the tasks have written to the chunks.
+   void dxt_hc::create_chunk_blocks_using_selectors(bool alpha_blocks, uint comp_index_start, uint comp_index_end)
    {
-      if (!m_has_color_blocks)
-         return true;
+      const uint num_selectors = alpha_blocks ? m_alpha_selectors.size() : m_color_selectors.size();
+      chunk_blocks_using_selectors_vec& chunk_blocks_using_selectors = alpha_blocks ? m_chunk_blocks_using_alpha_selectors : m_chunk_blocks_using_color_selectors;
 
-#if CRNLIB_ENABLE_DEBUG_MESSAGES
-      if (m_params.m_debugging)
-         console::info("Refining quantized color selectors");
-#endif
+      crnlib::vector<uint>& offsets = chunk_blocks_using_selectors.m_offsets;
+      offsets.resize(0);
+      offsets.resize(num_selectors + 1);
+
+      uint total_blocks = 0;
+      for (uint comp_chunk_index = comp_index_start; comp_chunk_index <= comp_index_end; comp_chunk_index++)
+      {
+         for (uint chunk_index = 0; chunk_index < m_num_chunks; chunk_index++)
+         {
+            const compressed_chunk& chunk = m_compressed_chunks[comp_chunk_index][chunk_index];
+
+            for (uint tile_index = 0; tile_index < chunk.m_num_tiles; tile_index++)
+            {
+               const chunk_tile_desc& layout = g_chunk_tile_layouts[chunk.m_quantized_tiles[tile_index].m_layout_index];
+
+               for (uint by = 0; by < (layout.m_height >> 2); by++)
+                  for (uint bx = 0; bx < (layout.m_width >> 2); bx++)
+                     offsets[chunk.m_selector_cluster_index[(layout.m_y_ofs >> 2) + by][(layout.m_x_ofs >> 2) + bx] + 1]++;
+
+               total_blocks += (layout.m_width >> 2) * (layout.m_height >> 2);
+            }
+         }
+      }
+
+      for (uint i = 0; i < num_selectors; i++)
+         offsets[i + 1] += offsets[i];
+
+      crnlib::vector<block_id>& block_ids = chunk_blocks_using_selectors.m_block_ids;
+      block_ids.resize(total_blocks);
+
+      crnlib::vector<uint> next_block(offsets);
+
+      for (uint comp_chunk_index = comp_index_start; comp_chunk_index <= comp_index_end; comp_chunk_index++)
+      {
+         const uint alpha_index = alpha_blocks ? (comp_chunk_index - cAlpha0Chunks) : 0;
+
+         for (uint chunk_index = 0; chunk_index < m_num_chunks; chunk_index++)
+         {
+            const compressed_chunk& chunk = m_compressed_chunks[comp_chunk_index][chunk_index];
+
+            for (uint tile_index = 0; tile_index < chunk.m_num_tiles; tile_index++)
+            {
+               const chunk_tile_desc& layout = g_chunk_tile_layouts[chunk.m_quantized_tiles[tile_index].m_layout_index];
+
+               const uint tile_block_ofs_x = layout.m_x_ofs >> 2;
+               const uint tile_block_ofs_y = layout.m_y_ofs >> 2;
+
+               for (uint by = 0; by < (layout.m_height >> 2); by++)
+               {
+                  for (uint bx = 0; bx < (layout.m_width >> 2); bx++)
+                  {
+                     const uint selector_index = chunk.m_selector_cluster_index[tile_block_ofs_y + by][tile_block_ofs_x + bx];
+                     block_ids[next_block[selector_index]++] = block_id(chunk_index, alpha_index, tile_index, tile_block_ofs_x + bx, tile_block_ofs_y + by);
+                  }
+               }
+            }
+         }
+      }
+   }
+
+   void dxt_hc::refine_quantized_color_selectors_task(uint64 data, void* pData_ptr)
+   {
+      data;
+      refine_quantized_state& state = *static_cast<refine_quantized_state*>(pData_ptr);
 
       uint total_refined_selectors = 0;
       uint total_refined_pixels = 0;
       uint total_selectors = 0;
 
-      for (uint selector_index = 0; selector_index < m_color_selectors.size(); selector_index++)
+      for (uint selector_index = 0, end_selector_index = 0; state.m_range.next(selector_index, end_selector_index); selector_index++)
       {
-         if ((selector_index & 255) == 0)
+         if (m_canceled)
+            return;
+
+         if (crn_get_current_thread_id() == m_main_thread_id)
          {
             if (!update_progress(15, selector_index, m_color_selectors.size()))
-               return false;
+               return;
          }
 
-         if (m_chunk_blocks_using_color_selectors[selector_index].empty())
+         const uint num_blocks = m_chunk_blocks_using_color_selectors.get_num_blocks(selector_index);
+         if (!num_blocks)
             continue;
 
+         const block_id* pBlock_ids = m_chunk_blocks_using_color_selectors.get_blocks(selector_index);
+
          selectors& sel = m_color_selectors[selector_index];
 
          for (uint y = 0; y < cBlockPixelHeight; y++)
@@ -1832,9 +1907,9 @@ namespace crnlib
                {
                   uint total_error = 0;
 
-                  for (uint block_iter = 0; block_iter < m_chunk_blocks_using_color_selectors[selector_index].size(); block_iter++)
+                  for (uint block_iter = 0; block_iter < num_blocks; block_iter++)
                   {
-                     const block_id& id = m_chunk_blocks_using_color_selectors[selector_index][block_iter];
+                     const block_id& id = pBlock_ids[block_iter];
                      const uint chunk_index = id.m_chunk_index;
                      const uint tile_index = id.m_tile_index;
                      const uint chunk_block_x = id.m_block_x;
@@ -1877,7 +1952,7 @@ namespace crnlib
                if (sel.m_selectors[y][x] != best_s)
                {
                   total_refined_selectors++;
-                  total_refined_pixels += m_chunk_blocks_using_color_selectors[selector_index].size();
+                  total_refined_pixels += num_blocks;
                   sel.m_selectors[y][x] = static_cast<uint8>(best_s);
                }
 
@@ -1889,39 +1964,67 @@ namespace crnlib
 
       } // selector_index
 
+      atomic_exchange_add32(&state.m_total_refined, total_refined_selectors);
+      atomic_exchange_add32(&state.m_total_refined_pixels, total_refined_pixels);
+      atomic_exchange_add32(&state.m_total_items, total_selectors);
+   }
+
+   bool dxt_hc::refine_quantized_color_selectors()
+   {
+      if (!m_has_color_blocks)
+         return true;
+
 #if CRNLIB_ENABLE_DEBUG_MESSAGES
       if (m_params.m_debugging)
-         console::info("Total refined pixels: %u, selectors: %u out of %u", total_refined_pixels, total_refined_selectors, total_selectors);
+         console::info("Refining quantized color selectors");
 #endif
 
-      return true;
-   }
+      // Each selector is refined against the blocks using it, and only the selector itself is written, so the entries can be
+      // refined in any order.
+      refine_quantized_state state;
+      state.m_range.init(0, m_color_selectors.size(), m_pTask_pool->get_num_threads() + 1);
 
-   bool dxt_hc::refine_quantized_alpha_selectors()
-   {
-      if (!m_num_alpha_blocks)
-         return true;
+      for (uint i = 0; i <= m_pTask_pool->get_num_threads(); i++)
+         m_pTask_pool->queue_object_task(this, &dxt_hc::refine_quantized_color_selectors_task, i, &state);
+
+      m_pTask_pool->join();
+      if (m_canceled)
+         return false;
 
 #if CRNLIB_ENABLE_DEBUG_MESSAGES
       if (m_params.m_debugging)
-         console::info("Refining quantized alpha selectors");
+         console::info("Total refined pixels: %u, selectors: %u out of %u", (uint)state.m_total_refined_pixels, (uint)state.m_total_refined, (uint)state.m_total_items);
 #endif
 
+      return true;
+   }
+
+   void dxt_hc::refine_quantized_alpha_selectors_task(uint64 data, void* pData_ptr)
+   {
+      data;
+      refine_quantized_state& state = *static_cast<refine_quantized_state*>(pData_ptr);
+
       uint total_refined_selectors = 0;
       uint total_refined_pixels = 0;
       uint total_selectors = 0;
 
-      for (uint selector_index = 0; selector_index < m_alpha_selectors.size(); selector_index++)
+      for (uint selector_index = 0, end_selector_index = 0; state.m_range.next(selector_index, end_selector_index); selector_index++)
       {
-         if ((selector_index & 255) == 0)
+         if (m_canceled)
+            return;
+
+         if (crn_get_current_thread_id() == m_main_thread_id)
          {
             if (!update_progress(16, selector_index, m_alpha_selectors.size()))
-               return false;
+               return;
          }
 
-         if (m_chunk_blocks_using_alpha_selectors[selector_index].empty())
+         const uint num_blocks = m_chunk_blocks_using_alpha_selectors.get_num_blocks(selector_index);
+         if (!num_blocks)
             continue;
 
+         const block_id* pBlock_ids = m_chunk_blocks_using_alpha_selectors.get_blocks(selector_index);
+
          selectors& sel = m_alpha_selectors[selector_index];
 
          for (uint y = 0; y < cBlockPixelHeight; y++)
@@ -1935,9 +2038,9 @@ namespace crnlib
                {
                   uint total_error = 0;
 
-                  for (uint block_iter = 0; block_iter < m_chunk_blocks_using_alpha_selectors[selector_index].size(); block_iter++)
+                  for (uint block_iter = 0; block_iter < num_blocks; block_iter++)
                   {
-                     const block_id& id = m_chunk_blocks_using_alpha_selectors[selector_index][block_iter];
+                     const block_id& id = pBlock_ids[block_iter];
                      const uint chunk_index = id.m_chunk_index;
                      const uint tile_index = id.m_tile_index;
                      const uint chunk_block_x = id.m_block_x;
@@ -1981,7 +2084,7 @@ namespace crnlib
                if (sel.m_selectors[y][x] != best_s)
                {
                   total_refined_selectors++;
-                  total_refined_pixels += m_chunk_blocks_using_alpha_selectors[selector_index].size();
+                  total_refined_pixels += num_blocks;
                   sel.m_selectors[y][x] = static_cast<uint8>(best_s);
                }
 
@@ -1993,33 +2096,61 @@ namespace crnlib
 
       } // selector_index
 
+      atomic_exchange_add32(&state.m_total_refined, total_refined_selectors);
+      atomic_exchange_add32(&state.m_total_refined_pixels, total_refined_pixels);
+      atomic_exchange_add32(&state.m_total_items, total_selectors);
+   }
+
+   bool dxt_hc::refine_quantized_alpha_selectors()
+   {
+      if (!m_num_alpha_blocks)
+         return true;
+
 #if CRNLIB_ENABLE_DEBUG_MESSAGES
       if (m_params.m_debugging)
-         console::info("Total refined pixels: %u, selectors: %u out of %u", total_refined_pixels, total_refined_selectors, total_selectors);
+         console::info("Refining quantized alpha selectors");
+#endif
+
+      // Each selector is refined against the blocks using it, and only the selector itself is written, so the entries can be
+      // refined in any order.
+      refine_quantized_state state;
+      state.m_range.init(0, m_alpha_selectors.size(), m_pTask_pool->get_num_threads() + 1);
+
+      for (uint i = 0; i <= m_pTask_pool->get_num_threads(); i++)
+         m_pTask_pool->queue_object_task(this, &dxt_hc::refine_quantized_alpha_selectors_task, i, &state);
+
+      m_pTask_pool->join();
+      if (m_canceled)
+         return false;
+
+#if CRNLIB_ENABLE_DEBUG_MESSAGES
+      if (m_params.m_debugging)
+         console::info("Total refined pixels: %u, selectors: %u out of %u", (uint)state.m_total_refined_pixels, (uint)state.m_total_refined, (uint)state.m_total_items);
 #endif
 
       return true;
    }
 
-   bool dxt_hc::refine_quantized_color_endpoints()
+   void dxt_hc::refine_quantized_color_endpoints_task(uint64 data, void* pData_ptr)
    {
-      if (!m_has_color_blocks)
-         return true;
+      data;
+      refine_quantized_state& state = *static_cast<refine_quantized_state*>(pData_ptr);
 
       uint total_refined_tiles = 0;
       uint total_refined_pixels = 0;
 
-#if CRNLIB_ENABLE_DEBUG_MESSAGES
-      if (m_params.m_debugging)
-         console::info("Refining quantized color endpoints");
-#endif
+      crnlib::vector<color_quad_u8> pixels;
+      crnlib::vector<uint8> selectors;
 
-      for (uint cluster_index = 0; cluster_index < m_color_clusters.size(); cluster_index++)
+      for (uint cluster_index = 0, end_cluster_index = 0; state.m_range.next(cluster_index, end_cluster_index); cluster_index++)
       {
-         if ((cluster_index & 255) == 0)
+         if (m_canceled)
+            return;
+
+         if (crn_get_current_thread_id() == m_main_thread_id)
          {
             if (!update_progress(17, cluster_index, m_color_clusters.size()))
-               return false;
+               return;
          }
 
          tile_cluster& cluster = m_color_clusters[cluster_index];
@@ -2042,8 +2173,8 @@ namespace crnlib
          if (!total_pixels)
             continue;
 
-         crnlib::vector<color_quad_u8> pixels;
-         crnlib::vector<uint8> selectors;
+         pixels.resize(0);
+         selectors.resize(0);
 
          pixels.reserve(total_pixels);
          selectors.reserve(total_pixels);
@@ -2110,32 +2241,59 @@ namespace crnlib
          }
       }
 
+      atomic_exchange_add32(&state.m_total_refined, total_refined_tiles);
+      atomic_exchange_add32(&state.m_total_refined_pixels, total_refined_pixels);
+   }
+
+   bool dxt_hc::refine_quantized_color_endpoints()
+   {
+      if (!m_has_color_blocks)
+         return true;
+
 #if CRNLIB_ENABLE_DEBUG_MESSAGES
       if (m_params.m_debugging)
-         console::info("Total refined pixels: %u, endpoints: %u out of %u", total_refined_pixels, total_refined_tiles, m_color_clusters.size());
+         console::info("Refining quantized color endpoints");
+#endif
+
+      // Every tile belongs to exactly one cluster, so clusters can be refined (and their tiles updated) in any order.
+      refine_quantized_state state;
+      state.m_range.init(0, m_color_clusters.size(), m_pTask_pool->get_num_threads() + 1);
+
+      for (uint i = 0; i <= m_pTask_pool->get_num_threads(); i++)
+         m_pTask_pool->queue_object_task(this, &dxt_hc::refine_quantized_color_endpoints_task, i, &state);
+
+      m_pTask_pool->join();
+      if (m_canceled)
+         return false;
+
+#if CRNLIB_ENABLE_DEBUG_MESSAGES
+      if (m_params.m_debugging)
+         console::info("Total refined pixels: %u, endpoints: %u out of %u", (uint)state.m_total_refined_pixels, (uint)state.m_total_refined, m_color_clusters.size());
 #endif
 
       return true;
    }
 
-   bool dxt_hc::refine_quantized_alpha_endpoints()
+   void dxt_hc::refine_quantized_alpha_endpoints_task(uint64 data, void* pData_ptr)
    {
-      if (!m_num_alpha_blocks)
-         return true;
+      data;
+      refine_quantized_state& state = *static_cast<refine_quantized_state*>(pData_ptr);
 
       uint total_refined_tiles = 0;
       uint total_refined_pixels = 0;
-#if CRNLIB_ENABLE_DEBUG_MESSAGES
-      if (m_params.m_debugging)
-         console::info("Refining quantized alpha endpoints");
-#endif
 
-      for (uint cluster_index = 0; cluster_index < m_alpha_clusters.size(); cluster_index++)
+      crnlib::vector<color_quad_u8> pixels;
+      crnlib::vector<uint8> selectors;
+
+      for (uint cluster_index = 0, end_cluster_index = 0; state.m_range.next(cluster_index, end_cluster_index); cluster_index++)
       {
-         if ((cluster_index & 255) == 0)
+         if (m_canceled)
+            return;
+
+         if (crn_get_current_thread_id() == m_main_thread_id)
          {
             if (!update_progress(18, cluster_index, m_alpha_clusters.size()))
-               return false;
+               return;
          }
 
          tile_cluster& cluster = m_alpha_clusters[cluster_index];
@@ -2159,8 +2317,8 @@ namespace crnlib
          if (!total_pixels)
             continue;
 
-         crnlib::vector<color_quad_u8> pixels;
-         crnlib::vector<uint8> selectors;
+         pixels.resize(0);
+         selectors.resize(0);
 
          pixels.reserve(total_pixels);
          selectors.reserve(total_pixels);
@@ -2229,9 +2387,34 @@ namespace crnlib
          }
       }
 
+      atomic_exchange_add32(&state.m_total_refined, total_refined_tiles);
+      atomic_exchange_add32(&state.m_total_refined_pixels, total_refined_pixels);
+   }
+
+   bool dxt_hc::refine_quantized_alpha_endpoints()
+   {
+      if (!m_num_alpha_blocks)
+         return true;
+
+#if CRNLIB_ENABLE_DEBUG_MESSAGES
+      if (m_params.m_debugging)
+         console::info("Refining quantized alpha endpoints");
+#endif
+
+      // Every tile belongs to exactly one cluster, so clusters can be refined (and their tiles updated) in any order.
+      refine_quantized_state state;
+      state.m_range.init(0, m_alpha_clusters.size(), m_pTask_pool->get_num_threads() + 1);
+
+      for (uint i = 0; i <= m_pTask_pool->get_num_threads(); i++)
+         m_pTask_pool->queue_object_task(this, &dxt_hc::refine_quantized_alpha_endpoints_task, i, &state);
+
+      m_pTask_pool->join();
+      if (m_canceled)
+         return false;
+
 #if CRNLIB_ENABLE_DEBUG_MESSAGES
       if (m_params.m_debugging)
-         console::info("Total refined pixels: %u, endpoints: %u out of %u", total_refined_pixels, total_refined_tiles, m_alpha_clusters.size());
+         console::info("Total refined pixels: %u, endpoints: %u out of %u", (uint)state.m_total_refined_pixels, (uint)state.m_total_refined, m_alpha_clusters.size());
 #endif
 
       return true;
@@ -73,7 +73,8 @@ namespace crnlib
             m_perceptual(true),
             m_debugging(false),
             m_pProgress_func(NULL),
-            m_pProgress_func_data(NULL)
+            m_pProgress_func_data(NULL),
+            m_pStats(NULL)
          {
             m_alpha_component_indices[0] = 3;
             m_alpha_component_indices[1] = 0;
@@ -125,10 +126,16 @@ namespace crnlib
 
          crn_progress_callback_func m_pProgress_func;
          void*       m_pProgress_func_data;
+
+         // Optional, phase timings are accumulated here.
+         crn_comp_stats* m_pStats;
       };
 
       void clear();
 
+      // Bytes of work buffers kept allocated by clear().
+      uint64 get_retained_bytes() const;
+
       // Main compression function
       bool compress(const params& p, uint num_chunks, const pixel_chunk* pChunks, task_pool& task_pool);
 
@@ -275,6 +282,12 @@ namespace crnlib
 
       atomic32_t m_total_tiles;
 
+      // The endpoint and selector codebooks are trained on at most this many vectors, larger inputs are sampled at a fixed stride.
+      // Every tile and block is still assigned to its closest codebook entry, so this only bounds the clusterizers' memory.
+      enum { cMaxCodebookTrainingVecs = 256 * 1024 };
+
+      static inline uint get_training_vec_stride(uint num_vecs) { return math::maximum<uint>(1U, (num_vecs + cMaxCodebookTrainingVecs - 1) / cMaxCodebookTrainingVecs); }
+
       void compress_dxt1_block(
          dxt1_endpoint_optimizer::results& results,
          uint chunk_index, const image_u8& chunk, uint x_ofs, uint y_ofs, uint width, uint height,
@@ -326,9 +339,21 @@ namespace crnlib
          uint8 m_block_y;
       };
 
-      typedef crnlib::vector< crnlib::vector< block_id > > chunk_blocks_using_selectors_vec;
+      // The blocks using each selector are stored back to back in m_block_ids (in chunk order), starting at m_offsets[selector_index].
+      struct chunk_blocks_using_selectors_vec
+      {
+         crnlib::vector<uint> m_offsets;
+         crnlib::vector<block_id> m_block_ids;
+
+         inline uint get_num_blocks(uint selector_index) const { return m_offsets[selector_index + 1] - m_offsets[selector_index]; }
+         inline const block_id* get_blocks(uint selector_index) const { return m_block_ids.get_ptr() + m_offsets[selector_index]; }
+
+         // Empties the arrays but keeps their memory.
+         inline void reset() { m_offsets.resize(0); m_block_ids.resize(0); }
+         inline uint64 capacity_in_bytes() const { return m_offsets.capacity_in_bytes() + m_block_ids.capacity_in_bytes(); }
+      };
       chunk_blocks_using_selectors_vec m_chunk_blocks_using_color_selectors;
-      chunk_blocks_using_selectors_vec m_chunk_blocks_using_alpha_selectors; // second's upper 16 bits contain alpha index!
+      chunk_blocks_using_selectors_vec m_chunk_blocks_using_alpha_selectors;
 
       crnlib::vector<uint> m_color_endpoints;   // not valid until end, only for user access
       crnlib::vector<uint> m_alpha_endpoints;   // not valid until end, only for user access
@@ -371,19 +396,19 @@ namespace crnlib
 
          vec6F_tree_vq& m_vq;
          crnlib::vector< crnlib::vector<vec6F> >& m_training_vecs;
+         parallel_range m_range;
       };
 
       struct create_selector_codebook_state
       {
          CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(create_selector_codebook_state);
 
-         create_selector_codebook_state(dxt_hc& hc, bool alpha_blocks, uint comp_index_start, uint comp_index_end, vec16F_tree_vq& selector_vq, chunk_blocks_using_selectors_vec& chunk_blocks_using_selectors, selectors_vec& selectors_cb) :
+         create_selector_codebook_state(dxt_hc& hc, bool alpha_blocks, uint comp_index_start, uint comp_index_end, vec16F_tree_vq& selector_vq, selectors_vec& selectors_cb) :
             m_hc(hc),
             m_alpha_blocks(alpha_blocks),
             m_comp_index_start(comp_index_start),
             m_comp_index_end(comp_index_end),
             m_selector_vq(selector_vq),
-            m_chunk_blocks_using_selectors(chunk_blocks_using_selectors),
             m_selectors_cb(selectors_cb)
          {
          }
@@ -393,10 +418,8 @@ namespace crnlib
          uint                                m_comp_index_start;
          uint                                m_comp_index_end;
          vec16F_tree_vq&                     m_selector_vq;
-         chunk_blocks_using_selectors_vec&   m_chunk_blocks_using_selectors;
          selectors_vec&                      m_selectors_cb;
-
-         mutable spinlock                    m_chunk_blocks_using_selectors_lock;
+         parallel_range                      m_ranges[cNumCompressedChunkVecs];
       };
 
       void assign_color_endpoint_clusters_task(uint64 data, void* pData_ptr);
@@ -406,6 +429,7 @@ namespace crnlib
       {
          vec2F_tree_vq m_vq;
          crnlib::vector< crnlib::vector<vec2F> > m_training_vecs[2];
+         parallel_range m_range;
       };
 
       void determine_alpha_endpoint_clusters_task(uint64 data, void* pData_ptr);
@@ -421,10 +445,27 @@ namespace crnlib
 
       void create_selector_codebook_task(uint64 data, void* pData_ptr);
       bool create_selector_codebook(bool alpha_blocks);
+      void create_chunk_blocks_using_selectors(bool alpha_blocks, uint comp_index_start, uint comp_index_end);
+
+      struct refine_quantized_state
+      {
+         refine_quantized_state() : m_total_refined(0), m_total_refined_pixels(0), m_total_items(0) { }
+
+         parallel_range m_range;
+
+         // Debug stats, summed by the tasks.
+         volatile atomic32_t m_total_refined;
+         volatile atomic32_t m_total_refined_pixels;
+         volatile atomic32_t m_total_items;
+      };
 
+      void refine_quantized_color_endpoints_task(uint64 data, void* pData_ptr);
       bool refine_quantized_color_endpoints();
+      void refine_quantized_color_selectors_task(uint64 data, void* pData_ptr);
       bool refine_quantized_color_selectors();
+      void refine_quantized_alpha_endpoints_task(uint64 data, void* pData_ptr);
       bool refine_quantized_alpha_endpoints();
+      void refine_quantized_alpha_selectors_task(uint64 data, void* pData_ptr);
       bool refine_quantized_alpha_selectors();
       void create_final_debug_image();
       bool create_chunk_encodings();
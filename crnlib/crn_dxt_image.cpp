@@ -6,6 +6,9 @@
 #include "crn_dxt_fast.h"
 #include "crn_console.h"
 #include "crn_threading.h"
+#if CRNLIB_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace crnlib
 {
@@ -202,11 +205,13 @@ namespace crnlib
 
    struct init_task_params
    {
-      dxt_format                    m_fmt;
-      const image_u8*               m_pImg;
-      const dxt_image::pack_params* m_pParams;
-      crn_thread_id_t               m_main_thread;
-      atomic32_t                    m_canceled;
+      const image_u8*                        m_pImg;
+      uint                                   m_first_block_y;
+      uint                                   m_end_block_y;
+      const dxt_image::pack_params*          m_pParams;
+      dxt_image::set_block_pixels_context*   m_pContexts;
+      crn_thread_id_t                        m_main_thread;
+      atomic32_t                             m_canceled;
    };
 
    void dxt_image::init_task(uint64 data, void* pData_ptr)
@@ -218,14 +223,14 @@ namespace crnlib
       const pack_params& p = *pInit_params->m_pParams;
       const bool is_main_thread = (crn_get_current_thread_id() == pInit_params->m_main_thread);
 
-      uint block_index = 0;
+      uint block_index = pInit_params->m_first_block_y * m_blocks_x;
 
-      set_block_pixels_context optimizer_context;
+      set_block_pixels_context& optimizer_context = pInit_params->m_pContexts[thread_index];
       int prev_progress_percentage = -1;
 
-      for (uint block_y = 0; block_y < m_blocks_y; block_y++)
+      for (uint block_y = pInit_params->m_first_block_y; block_y < pInit_params->m_end_block_y; block_y++)
       {
-         const uint pixel_ofs_y = block_y * cDXTBlockSize;
+         const uint pixel_ofs_y = (block_y - pInit_params->m_first_block_y) * cDXTBlockSize;
 
          for (uint block_x = 0; block_x < m_blocks_x; block_x++, block_index++)
          {
@@ -278,27 +283,98 @@ namespace crnlib
       if (!init(fmt, img.get_width(), img.get_height(), false))
          return false;
 
-      task_pool *pPool = p.m_pTask_pool;
+      band_packer packer;
+      if (!packer.init(*this, p))
+         return false;
+
+      return packer.pack_block_rows(img, 0);
+   }
+
+   dxt_image::band_packer::band_packer() :
+      m_pDst(NULL),
+      m_pParams(NULL),
+      m_pPool(NULL),
+      m_pTmp_pool(NULL),
+      m_pContexts(NULL),
+      m_num_contexts(0)
+   {
+   }
+
+   dxt_image::band_packer::~band_packer()
+   {
+      clear();
+   }
+
+   void dxt_image::band_packer::clear()
+   {
+      crnlib_delete_array(m_pContexts);
+      m_pContexts = NULL;
+      m_num_contexts = 0;
+
+      crnlib_delete(m_pTmp_pool);
+      m_pTmp_pool = NULL;
+      m_pPool = NULL;
+
+      m_pDst = NULL;
+      m_pParams = NULL;
+   }
+
+   bool dxt_image::band_packer::init(dxt_image& dst, const pack_params& p)
+   {
+      clear();
 
-      task_pool tmp_pool;
-      if (!pPool)
+      if (!dst.is_valid())
+         return false;
+
+      m_pPool = p.m_pTask_pool;
+      if (!m_pPool)
       {
-         if (!tmp_pool.init(p.m_num_helper_threads))
+         m_pTmp_pool = crnlib_new<task_pool>();
+         if (!m_pTmp_pool->init(p.m_num_helper_threads))
+         {
+            clear();
             return false;
-         pPool = &tmp_pool;
+         }
+         m_pPool = m_pTmp_pool;
       }
 
+      m_num_contexts = p.m_num_helper_threads + 1;
+      m_pContexts = crnlib_new_array<set_block_pixels_context>(m_num_contexts);
+
+      m_pDst = &dst;
+      m_pParams = &p;
+
+      return true;
+   }
+
+   bool dxt_image::band_packer::pack_block_rows(const image_u8& img, uint first_block_y)
+   {
+      CRNLIB_ASSERT(m_pDst);
+      if (!m_pDst)
+         return false;
+
+      dxt_image& dst = *m_pDst;
+      if ((img.get_width() != dst.m_width) || (!img.get_height()) || (first_block_y >= dst.m_blocks_y))
+         return false;
+
+      const uint end_block_y = math::minimum(dst.m_blocks_y, first_block_y + (img.get_height() + cDXTBlockSize - 1) / cDXTBlockSize);
+
+      // Only the bottom band may end mid-block, so the edge blocks are clamped exactly like they are when the whole image is packed.
+      CRNLIB_ASSERT(((img.get_height() & (cDXTBlockSize - 1)) == 0) || (end_block_y == dst.m_blocks_y));
+
       init_task_params init_params;
-      init_params.m_fmt = fmt;
       init_params.m_pImg = &img;
-      init_params.m_pParams = &p;
+      init_params.m_first_block_y = first_block_y;
+      init_params.m_end_block_y = end_block_y;
+      init_params.m_pParams = m_pParams;
+      init_params.m_pContexts = m_pContexts;
       init_params.m_main_thread = crn_get_current_thread_id();
       init_params.m_canceled = false;
 
-      for (uint i = 0; i <= p.m_num_helper_threads; i++)
-         pPool->queue_object_task(this, &dxt_image::init_task, i, &init_params);
+      for (uint i = 0; i < m_num_contexts; i++)
+         m_pPool->queue_object_task(&dst, &dxt_image::init_task, i, &init_params);
 
-      pPool->join();
+      m_pPool->join();
 
       if (init_params.m_canceled)
          return false;
@@ -306,48 +382,211 @@ namespace crnlib
       return true;
    }
 
-   bool dxt_image::unpack(image_u8& img) const
+   // Block decoders used by unpack(). Each one decodes a single element into a 4x4 block of pixels starting at pDst.
+
+   // Writes whole pixels, including the DXT1 alpha. For DXT3/5 the alpha element is decoded afterwards and overwrites it.
+   static void unpack_dxt1_block(const dxt1_block* pBlock, color_quad_u8* pDst, uint dst_pitch)
    {
-      if (!m_total_elements)
-         return false;
+      color_quad_u8 colors[cDXT1SelectorValues];
+      dxt1_block::get_block_colors(colors, static_cast<uint16>(pBlock->get_low_color()), static_cast<uint16>(pBlock->get_high_color()));
+
+#if CRNLIB_USE_SSE2
+      // Selects each pixel's color with compares against the lane's selector bits instead of a table lookup, one row at a time.
+      const __m128i color0 = _mm_set1_epi32(colors[0].m_u32);
+      const __m128i color1 = _mm_set1_epi32(colors[1].m_u32);
+      const __m128i color2 = _mm_set1_epi32(colors[2].m_u32);
+      const __m128i color3 = _mm_set1_epi32(colors[3].m_u32);
+      const __m128i selector_mask = _mm_setr_epi32(3 << 0, 3 << 2, 3 << 4, 3 << 6);
+      const __m128i selector1 = _mm_setr_epi32(1 << 0, 1 << 2, 1 << 4, 1 << 6);
+      const __m128i selector2 = _mm_setr_epi32(2 << 0, 2 << 2, 2 << 4, 2 << 6);
+
+      for (uint y = 0; y < cDXTBlockSize; y++)
+      {
+         const __m128i s = _mm_and_si128(_mm_set1_epi32(pBlock->m_selectors[y]), selector_mask);
 
-      img.resize(m_width, m_height);
+         __m128i c = _mm_and_si128(_mm_cmpeq_epi32(s, _mm_setzero_si128()), color0);
+         c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi32(s, selector1), color1));
+         c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi32(s, selector2), color2));
+         c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi32(s, selector_mask), color3));
+
+         _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst + y * dst_pitch), c);
+      }
+#else
+      for (uint y = 0; y < cDXTBlockSize; y++)
+      {
+         const uint s = pBlock->m_selectors[y];
+         color_quad_u8* pRow = pDst + y * dst_pitch;
+
+         pRow[0] = colors[s & 3];
+         pRow[1] = colors[(s >> 2) & 3];
+         pRow[2] = colors[(s >> 4) & 3];
+         pRow[3] = colors[s >> 6];
+      }
+#endif
+   }
+
+   // The alpha decoders only write component comp_index.
+   static void unpack_dxt5_block(const dxt5_block* pBlock, color_quad_u8* pDst, uint dst_pitch, uint comp_index)
+   {
+      uint values[cDXT5SelectorValues];
+      dxt5_block::get_block_values(values, pBlock->get_low_alpha(), pBlock->get_high_alpha());
+
+      uint64 s = 0;
+      for (uint i = 0; i < dxt5_block::cNumSelectorBytes; i++)
+         s |= static_cast<uint64>(pBlock->m_selectors[i]) << (i * 8U);
+
+      for (uint y = 0; y < cDXTBlockSize; y++)
+      {
+         uint8* pRow = &pDst[y * dst_pitch][comp_index];
+
+         pRow[0] = static_cast<uint8>(values[s & 7]);
+         pRow[4] = static_cast<uint8>(values[(s >> 3) & 7]);
+         pRow[8] = static_cast<uint8>(values[(s >> 6) & 7]);
+         pRow[12] = static_cast<uint8>(values[(s >> 9) & 7]);
+         s >>= 12;
+      }
+   }
+
+   static void unpack_dxt3_block(const dxt3_block* pBlock, color_quad_u8* pDst, uint dst_pitch, uint comp_index)
+   {
+      for (uint y = 0; y < cDXTBlockSize; y++)
+      {
+         uint8* pRow = &pDst[y * dst_pitch][comp_index];
+
+         const uint a0 = pBlock->m_alpha[y * 2];
+         const uint a1 = pBlock->m_alpha[y * 2 + 1];
 
-      color_quad_u8 pixels[cDXTBlockSize * cDXTBlockSize];
-      for (uint i = 0; i < cDXTBlockSize * cDXTBlockSize; i++)
-         pixels[i].set(0, 0, 0, 255);
+         pRow[0] = static_cast<uint8>((a0 & 0xF) * 17);
+         pRow[4] = static_cast<uint8>((a0 >> 4) * 17);
+         pRow[8] = static_cast<uint8>((a1 & 0xF) * 17);
+         pRow[12] = static_cast<uint8>((a1 >> 4) * 17);
+      }
+   }
+
+   void dxt_image::unpack_block(uint block_x, uint block_y, color_quad_u8* pDst, uint dst_pitch) const
+   {
+      const element* pElements = &get_element(block_x, block_y, 0);
+
+      // Formats without a color element leave the components they don't store at 0,0,0,255.
+      if (m_element_type[m_num_elements_per_block - 1] != cColorDXT1)
+      {
+         const color_quad_u8 default_color(0, 0, 0, 255);
+         for (uint y = 0; y < cDXTBlockSize; y++)
+            for (uint x = 0; x < cDXTBlockSize; x++)
+               pDst[x + y * dst_pitch] = default_color;
+      }
+
+      // The color element comes last in DXT3/5 blocks, but must be decoded first so the alpha element can replace its alpha.
+      for (int element_index = m_num_elements_per_block - 1; element_index >= 0; element_index--)
+      {
+         const element* pElement = &pElements[element_index];
+
+         switch (m_element_type[element_index])
+         {
+            case cColorDXT1:
+               unpack_dxt1_block(reinterpret_cast<const dxt1_block*>(pElement), pDst, dst_pitch);
+               break;
+            case cAlphaDXT5:
+               unpack_dxt5_block(reinterpret_cast<const dxt5_block*>(pElement), pDst, dst_pitch, m_element_component_index[element_index]);
+               break;
+            case cAlphaDXT3:
+               unpack_dxt3_block(reinterpret_cast<const dxt3_block*>(pElement), pDst, dst_pitch, m_element_component_index[element_index]);
+               break;
+            default: break;
+         }
+      }
+   }
 
-      bool all_blocks_valid = true;
-      for (uint block_y = 0; block_y < m_blocks_y; block_y++)
+   void dxt_image::unpack_block_rows(image_u8& img, uint first_block_y, uint end_block_y) const
+   {
+      const uint full_blocks_x = img.get_width() / cDXTBlockSize;
+
+      for (uint block_y = first_block_y; block_y < end_block_y; block_y++)
       {
          const uint pixel_ofs_y = block_y * cDXTBlockSize;
+         color_quad_u8* pDst = img.get_scanline(pixel_ofs_y);
+
+         // Blocks lying entirely inside the image are decoded straight into its scanlines.
+         if ((pixel_ofs_y + cDXTBlockSize) <= img.get_height())
+         {
+            for (uint block_x = 0; block_x < full_blocks_x; block_x++)
+               unpack_block(block_x, block_y, pDst + block_x * cDXTBlockSize, img.get_pitch());
+         }
+
+         const uint first_partial_block_x = ((pixel_ofs_y + cDXTBlockSize) <= img.get_height()) ? full_blocks_x : 0;
          const uint limit_y = math::minimum<uint>(cDXTBlockSize, img.get_height() - pixel_ofs_y);
 
-         for (uint block_x = 0; block_x < m_blocks_x; block_x++)
+         for (uint block_x = first_partial_block_x; block_x < m_blocks_x; block_x++)
          {
-            if (!get_block_pixels(block_x, block_y, pixels))
-               all_blocks_valid = false;
+            color_quad_u8 pixels[cDXTBlockSize * cDXTBlockSize];
+            unpack_block(block_x, block_y, pixels, cDXTBlockSize);
 
             const uint pixel_ofs_x = block_x * cDXTBlockSize;
-
             const uint limit_x = math::minimum<uint>(cDXTBlockSize, img.get_width() - pixel_ofs_x);
 
             for (uint y = 0; y < limit_y; y++)
             {
-               const uint iy = pixel_ofs_y + y;
-
+               color_quad_u8* pDst = img.get_scanline(pixel_ofs_y + y) + pixel_ofs_x;
+               const color_quad_u8* pSrc = &pixels[y * cDXTBlockSize];
                for (uint x = 0; x < limit_x; x++)
-               {
-                  const uint ix = pixel_ofs_x + x;
-
-                  img(ix, iy) = pixels[x + (y << cDXTBlockShift)];
-               }
+                  pDst[x] = pSrc[x];
             }
          }
       }
+   }
+
+   struct unpack_task_params
+   {
+      const dxt_image*  m_pDXT_image;
+      image_u8*         m_pImg;
+      uint              m_num_tasks;
+   };
+
+   void dxt_image::unpack_task(uint64 data, void* pData_ptr)
+   {
+      const unpack_task_params& params = *static_cast<const unpack_task_params*>(pData_ptr);
+      const dxt_image& dxt_img = *params.m_pDXT_image;
+
+      const uint task_index = static_cast<uint>(data);
+      const uint first_block_y = (dxt_img.m_blocks_y * task_index) / params.m_num_tasks;
+      const uint end_block_y = (dxt_img.m_blocks_y * (task_index + 1)) / params.m_num_tasks;
+
+      dxt_img.unpack_block_rows(*params.m_pImg, first_block_y, end_block_y);
+   }
+
+   bool dxt_image::unpack(image_u8& img) const
+   {
+      if (!m_total_elements)
+         return false;
+
+      img.resize(m_width, m_height);
+
+      // Smaller images aren't worth splitting up between the shared threads.
+      const uint cMinBlocksPerTask = 4096;
 
-      if (!all_blocks_valid)
-         console::error("dxt_image::unpack: One or more invalid blocks encountered!");
+      const uint max_tasks = math::minimum<uint>(m_blocks_y, m_total_blocks / cMinBlocksPerTask);
+      const uint num_tasks = math::minimum<uint>(max_tasks, task_pool::get_num_shared_threads() + 1);
+
+      if (num_tasks <= 1)
+         unpack_block_rows(img, 0, m_blocks_y);
+      else
+      {
+         task_pool tp;
+         if (!tp.init(num_tasks - 1))
+            return false;
+
+         unpack_task_params params;
+         params.m_pDXT_image = this;
+         params.m_pImg = &img;
+         params.m_num_tasks = num_tasks;
+
+         for (uint i = 1; i < num_tasks; i++)
+            tp.queue_task(unpack_task, i, &params);
+
+         unpack_task(0, &params);
+
+         tp.join();
+      }
 
       img.reset_comp_flags();
       img.set_component_valid(0, false);
@@ -143,6 +143,40 @@ namespace crnlib
       };
       
       bool init(dxt_format fmt, const image_u8& img, const pack_params& p = dxt_image::pack_params());
+
+      struct set_block_pixels_context
+      {
+         dxt1_endpoint_optimizer m_dxt1_optimizer;
+         dxt5_endpoint_optimizer m_dxt5_optimizer;
+      };
+
+      // Packs an image one band of block rows at a time, so only the current band of source pixels has to be in memory.
+      // Init the dxt_image with init(fmt, width, height, false), then call pack_block_rows() with the bands in top to bottom order.
+      // Each task keeps its optimizer context from band to band, so the blocks are identical to those written by init(fmt, img, p).
+      class band_packer
+      {
+         CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(band_packer);
+
+      public:
+         band_packer();
+         ~band_packer();
+
+         void clear();
+
+         bool init(dxt_image& dst, const pack_params& p);
+
+         // img holds the pixel rows starting at row first_block_y * cDXTBlockSize. Its height must be a multiple of cDXTBlockSize, unless it
+         // reaches the bottom of the image.
+         bool pack_block_rows(const image_u8& img, uint first_block_y);
+
+      private:
+         dxt_image*                 m_pDst;
+         const pack_params*         m_pParams;
+         task_pool*                 m_pPool;
+         task_pool*                 m_pTmp_pool;
+         set_block_pixels_context*  m_pContexts;
+         uint                       m_num_contexts;
+      };
       
       bool unpack(image_u8& img) const;
       
@@ -170,12 +204,6 @@ namespace crnlib
       // get_block_pixels() only sets those components stored in the image!
       bool get_block_pixels(uint block_x, uint block_y, color_quad_u8* pPixels) const;
 
-      struct set_block_pixels_context
-      {
-         dxt1_endpoint_optimizer m_dxt1_optimizer;
-         dxt5_endpoint_optimizer m_dxt5_optimizer;
-      };
-      
       void set_block_pixels(uint block_x, uint block_y, const color_quad_u8* pPixels, const pack_params& p, set_block_pixels_context& context);
       void set_block_pixels(uint block_x, uint block_y, const color_quad_u8* pPixels, const pack_params& p);
       
@@ -222,6 +250,10 @@ namespace crnlib
       bool init_internal(dxt_format fmt, uint width, uint height);
       void init_task(uint64 data, void* pData_ptr);
 
+      void unpack_block(uint block_x, uint block_y, color_quad_u8* pDst, uint dst_pitch) const;
+      void unpack_block_rows(image_u8& img, uint first_block_y, uint end_block_y) const;
+      static void unpack_task(uint64 data, void* pData_ptr);
+
       void flip_col(uint x);
       void flip_row(uint y);
    };
@@ -315,8 +315,8 @@ namespace crnlib
       if (pExt)
       {
          pExt->set(pBaseName);
-         get_extension(*pExt);
-         *pExt = "." + *pExt;
+         if (get_extension(*pExt))
+            *pExt = "." + *pExt;
       }
 #endif // #ifdef WIN32
 
@@ -417,7 +417,7 @@ namespace crnlib
          sep = filename.find_right('/');
 
       int dot = filename.find_right('.');
-      if (dot < sep)
+      if ((dot < 0) || (dot < sep))
       {
          filename.clear();
          return false;
@@ -438,7 +438,7 @@ namespace crnlib
          sep = filename.find_right('/');
 
       int dot = filename.find_right('.');
-      if (dot < sep)
+      if ((dot < 0) || (dot < sep))
          return false;
 
       filename.left(dot);
@@ -489,7 +489,7 @@ namespace crnlib
       {
          if ((CRNLIB_IS_BITWISE_COPYABLE(Key)) && (CRNLIB_IS_BITWISE_COPYABLE(Value)))
          {
-            memcpy(pDst, pSrc, sizeof(value_type));
+            memcpy(static_cast<void*>(pDst), pSrc, sizeof(value_type));
          }
          else
          {
@@ -519,7 +519,7 @@ namespace crnlib
 
          if (CRNLIB_IS_BITWISE_COPYABLE_OR_MOVABLE(Key) && CRNLIB_IS_BITWISE_COPYABLE_OR_MOVABLE(Value))
          {
-            memcpy(pDst, pSrc, sizeof(node));
+            memcpy(static_cast<void*>(pDst), pSrc, sizeof(node));
          }
          else
          {
@@ -11,6 +11,7 @@
 #include "crn_miniz.h"
 #include "crn_jpge.h"
 #include "crn_cfile_stream.h"
+#include "crn_mapped_file_stream.h"
 #include "crn_mipmapped_texture.h"
 #include "crn_buffer_stream.h"
 
@@ -34,11 +35,18 @@ namespace crnlib
       bool read_from_stream_stb(data_stream_serializer &serializer, image_u8& img)
       {
          uint8_vec buf;
-         if (!serializer.read_entire_file(buf))
-            return false;
+         const uint8* pSrc_data;
+         uint src_data_size;
+         if (!serializer.read_entire_file_in_place(pSrc_data, src_data_size))
+         {
+            if (!serializer.read_entire_file(buf))
+               return false;
+            pSrc_data = buf.get_ptr();
+            src_data_size = buf.size_in_bytes();
+         }
 
          int x = 0, y = 0, n = 0;
-         unsigned char* pData = stbi_load_from_memory(buf.get_ptr(), buf.size_in_bytes(), &x, &y, &n, 4);
+         unsigned char* pData = stbi_load_from_memory(pSrc_data, src_data_size, &x, &y, &n, 4);
 
          if (!pData)
             return false;
@@ -86,11 +94,18 @@ namespace crnlib
       bool read_from_stream_jpgd(data_stream_serializer &serializer, image_u8& img)
       {
          uint8_vec buf;
-         if (!serializer.read_entire_file(buf))
-            return false;
+         const uint8* pSrc_data;
+         uint src_data_size;
+         if (!serializer.read_entire_file_in_place(pSrc_data, src_data_size))
+         {
+            if (!serializer.read_entire_file(buf))
+               return false;
+            pSrc_data = buf.get_ptr();
+            src_data_size = buf.size_in_bytes();
+         }
 
          int width = 0, height = 0, actual_comps = 0;
-         unsigned char *pSrc_img = jpgd::decompress_jpeg_image_from_memory(buf.get_ptr(), buf.size_in_bytes(), &width, &height, &actual_comps, 4);
+         unsigned char *pSrc_img = jpgd::decompress_jpeg_image_from_memory(pSrc_data, src_data_size, &width, &height, &actual_comps, 4);
          if (!pSrc_img)
             return false;
 
@@ -150,11 +165,17 @@ namespace crnlib
             return false;
          }
 
+         mapped_file_stream mapped_stream;
          cfile_stream file_stream;
-         if (!file_stream.open(pFilename))
-            return false;
+         data_stream* pStream = &mapped_stream;
+         if (!mapped_stream.open(pFilename))
+         {
+            if (!file_stream.open(pFilename))
+               return false;
+            pStream = &file_stream;
+         }
 
-         data_stream_serializer serializer(file_stream);
+         data_stream_serializer serializer(*pStream);
          return read_from_stream(dest, serializer, read_flags);
       }
 
@@ -546,6 +567,131 @@ namespace crnlib
          return true;
       }
 
+      // Conversion tables between 8-bit sRGB and the linear light floats the threaded resampler works on.
+      class srgb_conversion_tables
+      {
+      public:
+         enum { cLinearToSRGBTableSize = 8192 };
+
+         void init(float source_gamma)
+         {
+            for (int i = 0; i < 256; ++i)
+               m_srgb_to_linear[i] = (float)pow(i * 1.0f/255.0f, source_gamma);
+
+            const float inv_linear_to_srgb_table_size = 1.0f / cLinearToSRGBTableSize;
+            const float inv_source_gamma = 1.0f / source_gamma;
+
+            for (int i = 0; i < cLinearToSRGBTableSize; ++i)
+            {
+               int k = (int)(255.0f * pow(i * inv_linear_to_srgb_table_size, inv_source_gamma) + .5f);
+               if (k < 0) k = 0; else if (k > 255) k = 255;
+               m_linear_to_srgb[i] = (unsigned char)k;
+            }
+         }
+
+         float m_srgb_to_linear[256];
+         unsigned char m_linear_to_srgb[cLinearToSRGBTableSize];
+      };
+
+      static inline uint get_resampler_comps(uint num_comps)
+      {
+         return (num_comps == 1) ? 1 : 4;
+      }
+
+      static void unpack_to_linear_float(const image_u8& src, float* pSamples, uint resampler_comps, const resample_params& params, const srgb_conversion_tables& tables)
+      {
+         const uint src_width = src.get_width();
+         const uint src_height = src.get_height();
+
+         for (uint src_y = 0; src_y < src_height; src_y++)
+         {
+            const color_quad_u8* pSrc = src.get_scanline(src_y);
+            float* pDst = pSamples + src_width * resampler_comps * src_y;
+
+            for (uint x = 0; x < src_width; x++)
+            {
+               for (uint c = 0; c < params.m_num_comps; c++)
+               {
+                  const uint comp_index = params.m_first_comp + c;
+                  const uint8 v = (*pSrc)[comp_index];
+
+                  if (!params.m_srgb || (comp_index == 3))
+                     pDst[c] = v * (1.0f/255.0f);
+                  else
+                     pDst[c] = tables.m_srgb_to_linear[v];
+               }
+
+               pSrc++;
+               pDst += resampler_comps;
+            }
+         }
+      }
+
+      static void pack_from_linear_float(image_u8& dst_img, const float* pSamples, uint resampler_comps, const resample_params& params, const srgb_conversion_tables& tables)
+      {
+         const uint dst_width = dst_img.get_width();
+         const uint dst_height = dst_img.get_height();
+         const int linear_to_srgb_table_size = srgb_conversion_tables::cLinearToSRGBTableSize;
+
+         for (uint dst_y = 0; dst_y < dst_height; dst_y++)
+         {
+            const float* pSrc = pSamples + dst_width * resampler_comps * dst_y;
+            color_quad_u8* pDst = dst_img.get_scanline(dst_y);
+
+            for (uint x = 0; x < dst_width; x++)
+            {
+               color_quad_u8 dst(0, 0, 0, 255);
+
+               for (uint c = 0; c < params.m_num_comps; c++)
+               {
+                  const uint comp_index = params.m_first_comp + c;
+                  const float v = pSrc[c];
+
+                  if ((!params.m_srgb) || (comp_index == 3))
+                  {
+                     int c = static_cast<int>(255.0f * v + .5f);
+                     if (c < 0) c = 0; else if (c > 255) c = 255;
+                     dst[comp_index] = (unsigned char)c;
+                  }
+                  else
+                  {
+                     int j = static_cast<int>(linear_to_srgb_table_size * v + .5f);
+                     if (j < 0) j = 0; else if (j >= linear_to_srgb_table_size) j = linear_to_srgb_table_size - 1;
+                     dst[comp_index] = tables.m_linear_to_srgb[j];
+                  }
+               }
+
+               *pDst++ = dst;
+
+               pSrc += resampler_comps;
+            }
+         }
+      }
+
+      static void init_resampler_params(threaded_resampler::params& p, uint src_width, uint src_height, uint dst_width, uint dst_height, const resample_params& params)
+      {
+         const uint resampler_comps = get_resampler_comps(params.m_num_comps);
+
+         p.m_src_width = src_width;
+         p.m_src_height = src_height;
+         p.m_dst_width = dst_width;
+         p.m_dst_height = dst_height;
+         p.m_sample_low = 0.0f;
+         p.m_sample_high = 1.0f;
+         p.m_boundary_op = params.m_wrapping ? Resampler::BOUNDARY_WRAP : Resampler::BOUNDARY_CLAMP;
+         p.m_Pfilter_name = params.m_pFilter;
+         p.m_filter_x_scale = params.m_filter_scale;
+         p.m_filter_y_scale = params.m_filter_scale;
+         if (params.m_num_comps == 1)
+            p.m_fmt = threaded_resampler::cPF_Y_F32;
+         else if (params.m_num_comps <= 3)
+            p.m_fmt = threaded_resampler::cPF_RGBX_F32;
+         else
+            p.m_fmt = threaded_resampler::cPF_RGBA_F32;
+         p.m_src_pitch = src_width * resampler_comps * sizeof(float);
+         p.m_dst_pitch = dst_width * resampler_comps * sizeof(float);
+      }
+
       bool resample_multithreaded(const image_u8& src, image_u8& dst, const resample_params& params)
       {
          const uint src_width = src.get_width();
@@ -579,57 +725,18 @@ namespace crnlib
          dst.clear();
 
          // Partial gamma correction looks better on mips. Set to 1.0 to disable gamma correction.
-         const float source_gamma = params.m_source_gamma;//1.75f;
-
-         float srgb_to_linear[256];
-         if (params.m_srgb)
-         {
-            for (int i = 0; i < 256; ++i)
-               srgb_to_linear[i] = (float)pow(i * 1.0f/255.0f, source_gamma);
-         }
-
-         const int linear_to_srgb_table_size = 8192;
-         unsigned char linear_to_srgb[linear_to_srgb_table_size];
-
-         const float inv_linear_to_srgb_table_size = 1.0f / linear_to_srgb_table_size;
-         const float inv_source_gamma = 1.0f / source_gamma;
-
+         srgb_conversion_tables tables;
          if (params.m_srgb)
-         {
-            for (int i = 0; i < linear_to_srgb_table_size; ++i)
-            {
-               int k = (int)(255.0f * pow(i * inv_linear_to_srgb_table_size, inv_source_gamma) + .5f);
-               if (k < 0) k = 0; else if (k > 255) k = 255;
-               linear_to_srgb[i] = (unsigned char)k;
-            }
-         }
+            tables.init(params.m_source_gamma);
 
          task_pool tp;
-         tp.init(g_number_of_processors - 1);
+         tp.init(task_pool::get_num_shared_threads());
 
          threaded_resampler resampler(tp);
          threaded_resampler::params p;
-         p.m_src_width = src_width;
-         p.m_src_height = src_height;
-         p.m_dst_width = dst_width;
-         p.m_dst_height = dst_height;
-         p.m_sample_low = 0.0f;
-         p.m_sample_high = 1.0f;
-         p.m_boundary_op = params.m_wrapping ? Resampler::BOUNDARY_WRAP : Resampler::BOUNDARY_CLAMP;
-         p.m_Pfilter_name = params.m_pFilter;
-         p.m_filter_x_scale = params.m_filter_scale;
-         p.m_filter_y_scale = params.m_filter_scale;
 
-         uint resampler_comps = 4;
-         if (params.m_num_comps == 1)
-         {
-            p.m_fmt = threaded_resampler::cPF_Y_F32;
-            resampler_comps = 1;
-         }
-         else if (params.m_num_comps <= 3)
-            p.m_fmt = threaded_resampler::cPF_RGBX_F32;
-         else
-            p.m_fmt = threaded_resampler::cPF_RGBA_F32;
+         const uint resampler_comps = get_resampler_comps(params.m_num_comps);
+         init_resampler_params(p, src_width, src_height, dst_width, dst_height, params);
 
          crnlib::vector<float> src_samples;
          crnlib::vector<float> dst_samples;
@@ -641,32 +748,9 @@ namespace crnlib
             return false;
 
          p.m_pSrc_pixels = src_samples.get_ptr();
-         p.m_src_pitch = src_width * resampler_comps * sizeof(float);
          p.m_pDst_pixels = dst_samples.get_ptr();
-         p.m_dst_pitch = dst_width * resampler_comps * sizeof(float);
 
-         for (uint src_y = 0; src_y < src_height; src_y++)
-         {
-            const color_quad_u8* pSrc = src.get_scanline(src_y);
-            float* pDst = src_samples.get_ptr() + src_width * resampler_comps * src_y;
-
-            for (uint x = 0; x < src_width; x++)
-            {
-               for (uint c = 0; c < params.m_num_comps; c++)
-               {
-                  const uint comp_index = params.m_first_comp + c;
-                  const uint8 v = (*pSrc)[comp_index];
-
-                  if (!params.m_srgb || (comp_index == 3))
-                     pDst[c] = v * (1.0f/255.0f);
-                  else
-                     pDst[c] = srgb_to_linear[v];
-               }
-
-               pSrc++;
-               pDst += resampler_comps;
-            }
-         }
+         unpack_to_linear_float(src, src_samples.get_ptr(), resampler_comps, params, tables);
 
          if (!resampler.resample(p))
             return false;
@@ -676,38 +760,177 @@ namespace crnlib
          if (!dst.resize(params.m_dst_width, params.m_dst_height))
             return false;
 
-         for (uint dst_y = 0; dst_y < dst_height; dst_y++)
+         pack_from_linear_float(dst, dst_samples.get_ptr(), resampler_comps, params, tables);
+
+         return true;
+      }
+
+      static bool resample_samples(threaded_resampler& resampler, const float* pSrc, uint src_width, uint src_height, float* pDst, uint dst_width, uint dst_height, const resample_params& params)
+      {
+         threaded_resampler::params p;
+         init_resampler_params(p, src_width, src_height, dst_width, dst_height, params);
+         p.m_pSrc_pixels = pSrc;
+         p.m_pDst_pixels = pDst;
+         return resampler.resample(p);
+      }
+
+      bool resample_mip_chain(threaded_resampler& resampler, const image_u8& src, uint num_levels, const resample_params& params, bool cascade, image_u8** ppMips)
+      {
+         const uint src_width = src.get_width();
+         const uint src_height = src.get_height();
+
+         if (math::maximum(src_width, src_height) > CRNLIB_RESAMPLER_MAX_DIMENSION)
+            return false;
+
+         const int cMaxComponents = 4;
+         if (((int)params.m_num_comps < 1) || ((int)params.m_num_comps > (int)cMaxComponents))
+            return false;
+
+         srgb_conversion_tables tables;
+         if (params.m_srgb)
+            tables.init(params.m_source_gamma);
+
+         const uint resampler_comps = get_resampler_comps(params.m_num_comps);
+
+         // The source is only converted to linear light once, and the levels share the resampler's contribution lists.
+         crnlib::vector<float> src_samples;
+         if (!src_samples.try_resize(src_width * src_height * resampler_comps))
+            return false;
+
+         unpack_to_linear_float(src, src_samples.get_ptr(), resampler_comps, params, tables);
+
+         // When cascading, levels 1 to anchor_level are each resampled from the previous level, and the levels below the anchor from
+         // the anchor, which is always resampled directly from the source.
+         uint anchor_level = 0;
+         if (cascade)
          {
-            const float* pSrc = dst_samples.get_ptr() + dst_width * resampler_comps * dst_y;
-            color_quad_u8* pDst = dst.get_scanline(dst_y);
+            while (((anchor_level + 1) < num_levels) && (math::maximum(src_width >> (anchor_level + 1), src_height >> (anchor_level + 1)) >= cMipCascadeAnchorDim))
+               anchor_level++;
 
-            for (uint x = 0; x < dst_width; x++)
+            // Level 1 is resampled from the source either way.
+            if (anchor_level < 2)
+               anchor_level = 0;
+         }
+
+         crnlib::vector<float> dst_samples;
+         crnlib::vector<float> anchor_samples;
+         uint anchor_width = 0;
+         uint anchor_height = 0;
+
+         if (anchor_level)
+         {
+            anchor_width = math::maximum<uint>(1U, src_width >> anchor_level);
+            anchor_height = math::maximum<uint>(1U, src_height >> anchor_level);
+
+            if (!anchor_samples.try_resize(anchor_width * anchor_height * resampler_comps))
+               return false;
+
+            if (!resample_samples(resampler, src_samples.get_ptr(), src_width, src_height, anchor_samples.get_ptr(), anchor_width, anchor_height, params))
+               return false;
+
+            image_u8& anchor = *ppMips[anchor_level - 1];
+            if (!anchor.resize(anchor_width, anchor_height))
+               return false;
+
+            pack_from_linear_float(anchor, anchor_samples.get_ptr(), resampler_comps, params, tables);
+
+            // Cascade down to the anchor, then compare the cascaded anchor against the direct one. Filter error compounds with each
+            // level, so the anchor is usually (not always) the furthest off.
+            crnlib::vector<float> prev_samples;
+            uint prev_width = src_width;
+            uint prev_height = src_height;
+
+            image_u8 cascaded_anchor;
+
+            for (uint l = 1; l <= anchor_level; l++)
             {
-               color_quad_u8 dst(0, 0, 0, 255);
+               const uint mip_width = math::maximum<uint>(1U, src_width >> l);
+               const uint mip_height = math::maximum<uint>(1U, src_height >> l);
 
-               for (uint c = 0; c < params.m_num_comps; c++)
-               {
-                  const uint comp_index = params.m_first_comp + c;
-                  const float v = pSrc[c];
+               if (!dst_samples.try_resize(mip_width * mip_height * resampler_comps))
+                  return false;
 
-                  if ((!params.m_srgb) || (comp_index == 3))
-                  {
-                     int c = static_cast<int>(255.0f * v + .5f);
-                     if (c < 0) c = 0; else if (c > 255) c = 255;
-                     dst[comp_index] = (unsigned char)c;
-                  }
-                  else
-                  {
-                     int j = static_cast<int>(linear_to_srgb_table_size * v + .5f);
-                     if (j < 0) j = 0; else if (j >= linear_to_srgb_table_size) j = linear_to_srgb_table_size - 1;
-                     dst[comp_index] = linear_to_srgb[j];
-                  }
-               }
+               const float* pPrev = (l == 1) ? src_samples.get_ptr() : prev_samples.get_ptr();
+               if (!resample_samples(resampler, pPrev, prev_width, prev_height, dst_samples.get_ptr(), mip_width, mip_height, params))
+                  return false;
 
-               *pDst++ = dst;
+               image_u8& mip = (l == anchor_level) ? cascaded_anchor : *ppMips[l - 1];
+               if (!mip.resize(mip_width, mip_height))
+                  return false;
 
-               pSrc += resampler_comps;
+               pack_from_linear_float(mip, dst_samples.get_ptr(), resampler_comps, params, tables);
+
+               prev_samples.swap(dst_samples);
+               prev_width = mip_width;
+               prev_height = mip_height;
             }
+
+            error_metrics em;
+            em.compute(cascaded_anchor, anchor, params.m_first_comp, params.m_num_comps);
+            if ((em.mPeakSNR < cMipCascadeMinPSNR) || (em.mMax > cMipCascadeMaxError))
+               cascade = false;
+
+            // The levels below the anchor are resampled from it, so check the first one against a direct resample too. The direct one is output.
+            if ((cascade) && ((anchor_level + 1) < num_levels))
+            {
+               const uint mip_width = math::maximum<uint>(1U, src_width >> (anchor_level + 1));
+               const uint mip_height = math::maximum<uint>(1U, src_height >> (anchor_level + 1));
+
+               if (!dst_samples.try_resize(mip_width * mip_height * resampler_comps))
+                  return false;
+
+               if (!resample_samples(resampler, anchor_samples.get_ptr(), anchor_width, anchor_height, dst_samples.get_ptr(), mip_width, mip_height, params))
+                  return false;
+
+               image_u8 derived;
+               if (!derived.resize(mip_width, mip_height))
+                  return false;
+
+               pack_from_linear_float(derived, dst_samples.get_ptr(), resampler_comps, params, tables);
+
+               if (!resample_samples(resampler, src_samples.get_ptr(), src_width, src_height, dst_samples.get_ptr(), mip_width, mip_height, params))
+                  return false;
+
+               image_u8& mip = *ppMips[anchor_level];
+               if (!mip.resize(mip_width, mip_height))
+                  return false;
+
+               pack_from_linear_float(mip, dst_samples.get_ptr(), resampler_comps, params, tables);
+
+               em.compute(derived, mip, params.m_first_comp, params.m_num_comps);
+               if ((em.mPeakSNR < cMipCascadeMinPSNR) || (em.mMax > cMipCascadeMaxError))
+                  cascade = false;
+            }
+
+            // Out of tolerance, so resample every level directly after all.
+            if (!cascade)
+               anchor_level = 0;
+         }
+
+         for (uint l = 1; l < num_levels; l++)
+         {
+            if ((anchor_level) && (l <= (anchor_level + 1)))
+               continue;
+
+            const uint mip_width = math::maximum<uint>(1U, src_width >> l);
+            const uint mip_height = math::maximum<uint>(1U, src_height >> l);
+
+            if (!dst_samples.try_resize(mip_width * mip_height * resampler_comps))
+               return false;
+
+            bool status;
+            if ((anchor_level) && (l > anchor_level))
+               status = resample_samples(resampler, anchor_samples.get_ptr(), anchor_width, anchor_height, dst_samples.get_ptr(), mip_width, mip_height, params);
+            else
+               status = resample_samples(resampler, src_samples.get_ptr(), src_width, src_height, dst_samples.get_ptr(), mip_width, mip_height, params);
+            if (!status)
+               return false;
+
+            image_u8& mip = *ppMips[l - 1];
+            if (!mip.resize(mip_width, mip_height))
+               return false;
+
+            pack_from_linear_float(mip, dst_samples.get_ptr(), resampler_comps, params, tables);
          }
 
          return true;
@@ -7,6 +7,7 @@
 namespace crnlib
 {
    enum pixel_format;
+   class threaded_resampler;
 
    namespace image_utils
    {
@@ -82,6 +83,19 @@ namespace crnlib
       bool resample_multithreaded(const image_u8& src, image_u8& dst, const resample_params& params);
       bool resample(const image_u8& src, image_u8& dst, const resample_params& params);
 
+      // Tolerance of cascaded mip chains against resampling each level directly from the source (PSNR, max component error).
+      const uint cMipCascadeAnchorDim = 128;
+      const double cMipCascadeMinPSNR = 40.0;
+      const uint cMipCascadeMaxError = 32;
+
+      // Generates mip levels 1 to num_levels-1 of src (ppMips[i] receives level i+1), ignoring params.m_dst_width/m_dst_height.
+      // src is converted to linear light once. By default each level is resampled from src, which matches resample().
+      // If cascade is true, levels down to the smallest one of at least cMipCascadeAnchorDim texels (the anchor) are each resampled
+      // from the previous level, and the levels below from the anchor, which is resampled from src. The cascaded anchor and the first
+      // level resampled from the anchor are compared against direct resamples, and if either isn't within cMipCascadeMinPSNR and
+      // cMipCascadeMaxError every level is resampled from src after all. Levels that aren't compared aren't guaranteed to be within it.
+      bool resample_mip_chain(threaded_resampler& resampler, const image_u8& src, uint num_levels, const resample_params& params, bool cascade, image_u8** ppMips);
+
       bool compute_delta(image_u8& dest, image_u8& a, image_u8& b, uint scale = 2);
 
       class error_metrics
@@ -0,0 +1,147 @@
+// File: crn_mapped_file_stream.cpp
+// This software is in the public domain. Please see license.txt.
+#include "crn_core.h"
+#include "crn_mapped_file_stream.h"
+
+#if CRNLIB_USE_WIN32_API
+#include "crn_winhdr.h"
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace crnlib
+{
+#if CRNLIB_USE_WIN32_API
+   bool mapped_file_stream::open(const char* pFilename)
+   {
+      CRNLIB_ASSERT(pFilename);
+
+      close();
+
+      HANDLE hFile = CreateFileA(pFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+      if (hFile == INVALID_HANDLE_VALUE)
+      {
+         set_error();
+         return false;
+      }
+
+      LARGE_INTEGER file_size;
+      if ((!GetFileSizeEx(hFile, &file_size)) || (!file_size.QuadPart) || (file_size.QuadPart > cUINT32_MAX))
+      {
+         CloseHandle(hFile);
+         set_error();
+         return false;
+      }
+
+      // The mapping keeps the file open, so the file handle can be closed right away.
+      HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+      CloseHandle(hFile);
+      if (!hMapping)
+      {
+         set_error();
+         return false;
+      }
+
+      const void* pData = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+      if (!pData)
+      {
+         CloseHandle(hMapping);
+         set_error();
+         return false;
+      }
+
+      set_name(pFilename);
+      m_pData = static_cast<const uint8*>(pData);
+      m_size = static_cast<uint>(file_size.QuadPart);
+      m_ofs = 0;
+      m_pMapping_handle = hMapping;
+      m_attribs = cDataStreamReadable | cDataStreamSeekable;
+      m_opened = true;
+
+      return true;
+   }
+
+   bool mapped_file_stream::close()
+   {
+      clear_error();
+
+      if (!m_opened)
+         return false;
+
+      bool status = UnmapViewOfFile(m_pData) != FALSE;
+      if (!CloseHandle(static_cast<HANDLE>(m_pMapping_handle)))
+         status = false;
+
+      m_pData = NULL;
+      m_size = 0;
+      m_ofs = 0;
+      m_pMapping_handle = NULL;
+      m_opened = false;
+
+      return status;
+   }
+#else
+   bool mapped_file_stream::open(const char* pFilename)
+   {
+      CRNLIB_ASSERT(pFilename);
+
+      close();
+
+      int fd = ::open(pFilename, O_RDONLY);
+      if (fd < 0)
+      {
+         set_error();
+         return false;
+      }
+
+      struct stat st;
+      if ((fstat(fd, &st) != 0) || (!S_ISREG(st.st_mode)) || (!st.st_size) || ((uint64)st.st_size > cUINT32_MAX))
+      {
+         ::close(fd);
+         set_error();
+         return false;
+      }
+
+      // The mapping keeps the file open, so the descriptor can be closed right away.
+      void* pData = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (pData == MAP_FAILED)
+      {
+         set_error();
+         return false;
+      }
+
+      madvise(pData, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+
+      set_name(pFilename);
+      m_pData = static_cast<const uint8*>(pData);
+      m_size = static_cast<uint>(st.st_size);
+      m_ofs = 0;
+      m_attribs = cDataStreamReadable | cDataStreamSeekable;
+      m_opened = true;
+
+      return true;
+   }
+
+   bool mapped_file_stream::close()
+   {
+      clear_error();
+
+      if (!m_opened)
+         return false;
+
+      bool status = munmap(const_cast<uint8*>(m_pData), m_size) == 0;
+
+      m_pData = NULL;
+      m_size = 0;
+      m_ofs = 0;
+      m_opened = false;
+
+      return status;
+   }
+#endif
+
+} // namespace crnlib
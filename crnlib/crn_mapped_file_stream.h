@@ -0,0 +1,101 @@
+// File: crn_mapped_file_stream.h
+// This software is in the public domain. Please see license.txt.
+#pragma once
+#include "crn_data_stream.h"
+
+namespace crnlib
+{
+   // Read only stream over a memory mapped file. get_ptr() exposes the mapping, so readers can parse the file in place
+   // instead of copying it into a buffer first.
+   class mapped_file_stream : public data_stream
+   {
+   public:
+      mapped_file_stream() : data_stream(), m_pData(NULL), m_size(0), m_ofs(0), m_pMapping_handle(NULL)
+      {
+      }
+
+      mapped_file_stream(const char* pFilename) : data_stream(), m_pData(NULL), m_size(0), m_ofs(0), m_pMapping_handle(NULL)
+      {
+         open(pFilename);
+      }
+
+      virtual ~mapped_file_stream()
+      {
+         close();
+      }
+
+      // Fails on empty files, files over 4GB, or if the platform can't map the file. Callers should fall back to cfile_stream.
+      bool open(const char* pFilename);
+
+      virtual bool close();
+
+      virtual const void* get_ptr() const { return m_pData; }
+
+      virtual uint read(void* pBuf, uint len)
+      {
+         CRNLIB_ASSERT(pBuf && (len <= 0x7FFFFFFF));
+
+         if ((!m_opened) || (!len))
+            return 0;
+
+         len = math::minimum<uint>(len, m_size - m_ofs);
+
+         if (len)
+            memcpy(pBuf, m_pData + m_ofs, len);
+
+         m_ofs += len;
+
+         return len;
+      }
+
+      virtual uint write(const void* pBuf, uint len)
+      {
+         pBuf, len;
+         return 0;
+      }
+
+      virtual bool flush()
+      {
+         return m_opened;
+      }
+
+      virtual uint64 get_size()
+      {
+         return m_opened ? m_size : 0;
+      }
+
+      virtual uint64 get_remaining()
+      {
+         return m_opened ? (m_size - m_ofs) : 0;
+      }
+
+      virtual uint64 get_ofs()
+      {
+         return m_opened ? m_ofs : 0;
+      }
+
+      virtual bool seek(int64 ofs, bool relative)
+      {
+         if (!m_opened)
+            return false;
+
+         int64 new_ofs = relative ? (m_ofs + ofs) : ofs;
+
+         if ((new_ofs < 0) || (new_ofs > m_size))
+            return false;
+
+         m_ofs = static_cast<uint>(new_ofs);
+
+         post_seek();
+
+         return true;
+      }
+
+   private:
+      const uint8*   m_pData;
+      uint           m_size;
+      uint           m_ofs;
+      void*          m_pMapping_handle;
+   };
+
+} // namespace crnlib
@@ -2,6 +2,7 @@
 // This software is in the public domain. Please see license.txt.
 #include "crn_core.h"
 #include "crn_console.h"
+#include "crn_atomics.h"
 #include "../inc/crnlib.h"
 #include <malloc.h>
 #if CRNLIB_USE_WIN32_API
@@ -17,17 +18,12 @@
 namespace crnlib
 {
 #if CRNLIB_MEM_STATS
-   #if CRNLIB_64BIT_POINTERS
-      typedef LONGLONG mem_stat_t;
-      #define CRNLIB_MEM_COMPARE_EXCHANGE InterlockedCompareExchange64
-   #else
-      typedef LONG mem_stat_t;
-      #define CRNLIB_MEM_COMPARE_EXCHANGE InterlockedCompareExchange
-   #endif
-
-   static volatile mem_stat_t g_total_blocks;
-   static volatile mem_stat_t g_total_allocated;
-   static volatile mem_stat_t g_max_allocated;
+   typedef atomic64_t mem_stat_t;
+   #define CRNLIB_MEM_COMPARE_EXCHANGE atomic_compare_exchange64
+
+   static CRNLIB_ALIGNED(8) volatile mem_stat_t g_total_blocks;
+   static CRNLIB_ALIGNED(8) volatile mem_stat_t g_total_allocated;
+   static CRNLIB_ALIGNED(8) volatile mem_stat_t g_max_allocated;
 
    static mem_stat_t update_total_allocated(int block_delta, mem_stat_t byte_delta)
    {
@@ -61,6 +57,27 @@ namespace crnlib
    }
 #endif // CRNLIB_MEM_STATS
 
+   static volatile atomic32_t g_alloc_counting;
+   static CRNLIB_ALIGNED(8) volatile atomic64_t g_total_alloc_bytes;
+   static volatile atomic32_t g_total_allocs;
+
+   static inline void count_alloc(size_t size)
+   {
+      if (!g_alloc_counting)
+         return;
+
+      atomic_increment32(&g_total_allocs);
+
+      atomic64_t cur_total = g_total_alloc_bytes;
+      for ( ; ; )
+      {
+         atomic64_t prev_total = atomic_compare_exchange64(&g_total_alloc_bytes, cur_total + size, cur_total);
+         if (prev_total == cur_total)
+            break;
+         cur_total = prev_total;
+      }
+   }
+
    static void* crnlib_default_realloc(void* p, size_t size, size_t* pActual_size, bool movable, void* pUser_data)
    {
       pUser_data;
@@ -138,6 +155,364 @@ namespace crnlib
    {
       crnlib_assert(p_msg, __FILE__, __LINE__);
    }
+
+#if defined(_MSC_VER)
+   #define CRNLIB_ARENA_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+   #define CRNLIB_ARENA_THREAD_LOCAL __thread
+#endif
+
+   // Live arena chunks are registered in a set associative table indexed by address >> cArenaChunkShift. A chunk is entered under each
+   // of the (at most two) cArenaChunkSize granules it overlaps, so a pointer is checked against the live chunks by reading the one set of
+   // its own granule, without touching the pointer's memory. When a set is full new blocks simply come from the memory callbacks.
+   const uint cArenaChunkShift = 18;
+   CRNLIB_ASSUME((1U << cArenaChunkShift) == cArenaChunkSize);
+   const uint cArenaTableWays = 8;
+   const uint cArenaTableSetBits = 4;
+   const uint cArenaTableSets = 1U << cArenaTableSetBits;
+   CRNLIB_ASSUME(cArenaTableSets * cArenaTableWays == cArenaMaxChunks * 2);
+
+   // Lives at the start of each chunk. Only the owning thread allocates from a chunk, frees only touch m_num_refs.
+   struct arena_chunk
+   {
+      // Number of live blocks, plus one while a thread owns the chunk.
+      volatile atomic32_t m_num_refs;
+      uint m_ofs;
+      uint m_num_blocks;
+      // Table entries of the chunk's first and last granule (the same if it only overlaps one).
+      uint m_slots[2];
+   };
+
+   // Precedes each arena block.
+   struct arena_block_header
+   {
+      arena_chunk* m_pChunk;
+      uint32 m_size;
+   };
+
+   const uint cArenaChunkHeaderSize = (sizeof(arena_chunk) + CRNLIB_MIN_ALLOC_ALIGNMENT - 1) & ~(CRNLIB_MIN_ALLOC_ALIGNMENT - 1);
+   const uint cArenaBlockHeaderSize = CRNLIB_MIN_ALLOC_ALIGNMENT;
+   CRNLIB_ASSUME(sizeof(arena_block_header) <= cArenaBlockHeaderSize);
+
+   // Base address of a live chunk overlapping the set's granules, or 0. Set i holds entries [i * cArenaTableWays, (i + 1) * cArenaTableWays).
+   static CRNLIB_ALIGNED(64) volatile atomic64_t g_arena_chunk_bases[cArenaTableSets * cArenaTableWays];
+
+   static volatile atomic32_t g_arena_enabled = true;
+   static volatile atomic32_t g_arena_table_full;
+   static volatile atomic32_t g_arena_total_chunks;
+   static volatile atomic32_t g_arena_live_chunks;
+   static volatile atomic32_t g_arena_max_live_chunks;
+   static CRNLIB_ALIGNED(8) volatile atomic64_t g_arena_total_blocks;
+
+#ifdef CRNLIB_ARENA_THREAD_LOCAL
+   static CRNLIB_ARENA_THREAD_LOCAL uint g_arena_depth;
+   static CRNLIB_ARENA_THREAD_LOCAL arena_chunk* g_pArena_chunk;
+   // Set when a new chunk couldn't be had (usually because the table was full), so the thread stops allocating and freeing chunks
+   // until its outermost scope ends.
+   static CRNLIB_ARENA_THREAD_LOCAL bool g_arena_refused;
+#endif
+
+   static inline uint arena_table_set(ptr_bits_t bits)
+   {
+      // Fibonacci hashing, consecutive granules are spread over the sets.
+      return (static_cast<uint32>(bits >> cArenaChunkShift) * 2654435761U) >> (32 - cArenaTableSetBits);
+   }
+
+   static inline arena_chunk* arena_find_chunk(const void* p)
+   {
+      const ptr_bits_t bits = reinterpret_cast<ptr_bits_t>(p);
+
+      volatile atomic64_t* pSet = &g_arena_chunk_bases[arena_table_set(bits) * cArenaTableWays];
+      for (uint i = 0; i < cArenaTableWays; i++)
+      {
+         const ptr_bits_t base = static_cast<ptr_bits_t>(atomic_load64(&pSet[i]));
+         if ((base) && (bits > base) && ((bits - base) < cArenaChunkSize))
+            return reinterpret_cast<arena_chunk*>(base);
+      }
+
+      return NULL;
+   }
+
+   // Returns the index of the table entry now holding base, or cUINT32_MAX if the granule's set is full.
+   static uint arena_register_granule(ptr_bits_t granule_bits, ptr_bits_t base)
+   {
+      const uint first_slot = arena_table_set(granule_bits) * cArenaTableWays;
+      for (uint slot = first_slot; slot < first_slot + cArenaTableWays; slot++)
+         if ((!atomic_load64(&g_arena_chunk_bases[slot])) && (!atomic_compare_exchange64(&g_arena_chunk_bases[slot], static_cast<atomic64_t>(base), 0)))
+            return slot;
+      return cUINT32_MAX;
+   }
+
+   static inline arena_block_header* arena_get_header(void* p)
+   {
+      return reinterpret_cast<arena_block_header*>(static_cast<uint8*>(p) - cArenaBlockHeaderSize);
+   }
+
+   static void arena_flush_block_count(arena_chunk* pChunk)
+   {
+      if (!pChunk->m_num_blocks)
+         return;
+
+      atomic64_t cur_total = atomic_load64(&g_arena_total_blocks);
+      for ( ; ; )
+      {
+         atomic64_t prev_total = atomic_compare_exchange64(&g_arena_total_blocks, cur_total + pChunk->m_num_blocks, cur_total);
+         if (prev_total == cur_total)
+            break;
+         cur_total = prev_total;
+      }
+      pChunk->m_num_blocks = 0;
+   }
+
+   static arena_chunk* arena_new_chunk()
+   {
+      size_t actual_size = cArenaChunkSize;
+      void* p = (*g_pRealloc)(NULL, cArenaChunkSize, &actual_size, true, g_pUser_data);
+      if ((!p) || (actual_size < cArenaChunkSize))
+      {
+         if (p)
+            (*g_pRealloc)(p, 0, NULL, true, g_pUser_data);
+         return NULL;
+      }
+
+      const ptr_bits_t base = reinterpret_cast<ptr_bits_t>(p);
+      const ptr_bits_t last = base + cArenaChunkSize - 1;
+
+      arena_chunk* pChunk = static_cast<arena_chunk*>(p);
+      pChunk->m_num_refs = 1;
+      pChunk->m_ofs = cArenaChunkHeaderSize;
+      pChunk->m_num_blocks = 0;
+      pChunk->m_slots[0] = arena_register_granule(base, base);
+      pChunk->m_slots[1] = pChunk->m_slots[0];
+      if ((pChunk->m_slots[0] != cUINT32_MAX) && ((base >> cArenaChunkShift) != (last >> cArenaChunkShift)))
+      {
+         pChunk->m_slots[1] = arena_register_granule(last, base);
+         if (pChunk->m_slots[1] == cUINT32_MAX)
+            atomic_compare_exchange64(&g_arena_chunk_bases[pChunk->m_slots[0]], 0, static_cast<atomic64_t>(base));
+      }
+
+      if ((pChunk->m_slots[0] == cUINT32_MAX) || (pChunk->m_slots[1] == cUINT32_MAX))
+      {
+         atomic_increment32(&g_arena_table_full);
+         (*g_pRealloc)(p, 0, NULL, true, g_pUser_data);
+         return NULL;
+      }
+
+      atomic_increment32(&g_arena_total_chunks);
+      const atomic32_t live_chunks = atomic_increment32(&g_arena_live_chunks);
+      for ( ; ; )
+      {
+         const atomic32_t max_live_chunks = atomic_load32(&g_arena_max_live_chunks);
+         if ((live_chunks <= max_live_chunks) || (atomic_compare_exchange32(&g_arena_max_live_chunks, live_chunks, max_live_chunks) == max_live_chunks))
+            break;
+      }
+
+      return pChunk;
+   }
+
+   static void arena_release_chunk_ref(arena_chunk* pChunk)
+   {
+      if (atomic_decrement32(&pChunk->m_num_refs))
+         return;
+
+      // Unregister the chunk before its memory can be handed out again.
+      const atomic64_t base = static_cast<atomic64_t>(reinterpret_cast<ptr_bits_t>(pChunk));
+      atomic_compare_exchange64(&g_arena_chunk_bases[pChunk->m_slots[0]], 0, base);
+      if (pChunk->m_slots[1] != pChunk->m_slots[0])
+         atomic_compare_exchange64(&g_arena_chunk_bases[pChunk->m_slots[1]], 0, base);
+      atomic_decrement32(&g_arena_live_chunks);
+
+      (*g_pRealloc)(pChunk, 0, NULL, true, g_pUser_data);
+   }
+
+   // Drops the thread's ownership of its chunk.
+   static void arena_retire_chunk(arena_chunk* pChunk)
+   {
+      arena_flush_block_count(pChunk);
+      arena_release_chunk_ref(pChunk);
+   }
+
+#ifdef CRNLIB_ARENA_THREAD_LOCAL
+   // size must be a multiple of CRNLIB_MIN_ALLOC_ALIGNMENT and no bigger than cArenaMaxBlockSize.
+   static void* arena_alloc(uint size)
+   {
+      const uint total_size = cArenaBlockHeaderSize + size;
+
+      arena_chunk* pChunk = g_pArena_chunk;
+      if ((!pChunk) || ((pChunk->m_ofs + total_size) > cArenaChunkSize))
+      {
+         if ((pChunk) && (atomic_load32(&pChunk->m_num_refs) == 1))
+         {
+            // All of the chunk's blocks have been freed, so start over at the beginning.
+            pChunk->m_ofs = cArenaChunkHeaderSize;
+         }
+         else
+         {
+            arena_chunk* pNew_chunk = arena_new_chunk();
+            if (!pNew_chunk)
+            {
+               g_arena_refused = true;
+               return NULL;
+            }
+
+            if (pChunk)
+               arena_retire_chunk(pChunk);
+
+            g_pArena_chunk = pChunk = pNew_chunk;
+         }
+      }
+
+      arena_block_header* pHeader = reinterpret_cast<arena_block_header*>(reinterpret_cast<uint8*>(pChunk) + pChunk->m_ofs);
+      pHeader->m_pChunk = pChunk;
+      pHeader->m_size = size;
+
+      pChunk->m_ofs += total_size;
+      pChunk->m_num_blocks++;
+      atomic_increment32(&pChunk->m_num_refs);
+
+      return reinterpret_cast<uint8*>(pHeader) + cArenaBlockHeaderSize;
+   }
+
+   static inline bool arena_can_alloc(size_t size)
+   {
+      return (g_arena_depth) && (!g_arena_refused) && (size <= cArenaMaxBlockSize);
+   }
+#else
+   static void* arena_alloc(uint size)
+   {
+      size;
+      return NULL;
+   }
+
+   static inline bool arena_can_alloc(size_t size)
+   {
+      size;
+      return false;
+   }
+#endif
+
+   static inline uint arena_block_size(size_t size)
+   {
+      return static_cast<uint>((size + CRNLIB_MIN_ALLOC_ALIGNMENT - 1) & ~(CRNLIB_MIN_ALLOC_ALIGNMENT - 1));
+   }
+
+   static void* arena_realloc(arena_chunk* pChunk, void* p, size_t size, size_t* pActual_size, bool movable)
+   {
+      arena_block_header* pHeader = arena_get_header(p);
+      CRNLIB_ASSERT(pHeader->m_pChunk == pChunk);
+
+      const uint cur_size = pHeader->m_size;
+
+      if (!size)
+      {
+         arena_release_chunk_ref(pChunk);
+         if (pActual_size)
+            *pActual_size = 0;
+         return NULL;
+      }
+
+      if (size <= cur_size)
+      {
+         if (pActual_size)
+            *pActual_size = cur_size;
+         return p;
+      }
+
+#ifdef CRNLIB_ARENA_THREAD_LOCAL
+      // Grow the block in place if it's the last one carved out of the thread's current chunk.
+      if ((pChunk == g_pArena_chunk) && (size <= cArenaMaxBlockSize) && ((static_cast<uint8*>(p) + cur_size) == (reinterpret_cast<uint8*>(pChunk) + pChunk->m_ofs)))
+      {
+         const uint new_size = arena_block_size(size);
+         if ((pChunk->m_ofs + (new_size - cur_size)) <= cArenaChunkSize)
+         {
+            pChunk->m_ofs += new_size - cur_size;
+            pHeader->m_size = new_size;
+            if (pActual_size)
+               *pActual_size = new_size;
+            count_alloc(new_size);
+            return p;
+         }
+      }
+#endif
+
+      if (!movable)
+      {
+         if (pActual_size)
+            *pActual_size = cur_size;
+         return NULL;
+      }
+
+      void* p_new = crnlib_malloc(size, pActual_size);
+      if (!p_new)
+         return NULL;
+
+      memcpy(p_new, p, cur_size);
+      arena_release_chunk_ref(pChunk);
+
+      return p_new;
+   }
+
+   mem_arena_scope::mem_arena_scope(bool enabled, bool retain_chunk) :
+      m_active(false),
+      m_retain_chunk(retain_chunk)
+   {
+#ifdef CRNLIB_ARENA_THREAD_LOCAL
+      if ((enabled) && (g_arena_enabled))
+      {
+         g_arena_depth++;
+         m_active = true;
+      }
+#else
+      enabled;
+#endif
+   }
+
+   mem_arena_scope::~mem_arena_scope()
+   {
+#ifdef CRNLIB_ARENA_THREAD_LOCAL
+      if (!m_active)
+         return;
+
+      CRNLIB_ASSERT(g_arena_depth);
+      if (--g_arena_depth)
+         return;
+
+      g_arena_refused = false;
+
+      arena_chunk* pChunk = g_pArena_chunk;
+      if (!pChunk)
+         return;
+
+      if (!m_retain_chunk)
+         crnlib_release_thread_arena();
+      else if (atomic_load32(&pChunk->m_num_refs) == 1)
+      {
+         arena_flush_block_count(pChunk);
+         pChunk->m_ofs = cArenaChunkHeaderSize;
+      }
+#endif
+   }
+
+   bool crnlib_arena_active()
+   {
+#ifdef CRNLIB_ARENA_THREAD_LOCAL
+      return g_arena_depth != 0;
+#else
+      return false;
+#endif
+   }
+
+   void crnlib_release_thread_arena()
+   {
+#ifdef CRNLIB_ARENA_THREAD_LOCAL
+      if (g_pArena_chunk)
+      {
+         arena_retire_chunk(g_pArena_chunk);
+         g_pArena_chunk = NULL;
+      }
+#endif
+   }
+
    void* crnlib_malloc(size_t size)
    {
       return crnlib_malloc(size, NULL);
@@ -155,6 +530,19 @@ namespace crnlib
          return NULL;
       }
 
+      if (arena_can_alloc(size))
+      {
+         const uint block_size = arena_block_size(size);
+         void* p = arena_alloc(block_size);
+         if (p)
+         {
+            if (pActual_size)
+               *pActual_size = block_size;
+            count_alloc(block_size);
+            return p;
+         }
+      }
+
       size_t actual_size = size;
       uint8* p_new = static_cast<uint8*>((*g_pRealloc)(NULL, size, &actual_size, true, g_pUser_data));
 
@@ -169,6 +557,8 @@ namespace crnlib
 
       CRNLIB_ASSERT((reinterpret_cast<ptr_bits_t>(p_new) & (CRNLIB_MIN_ALLOC_ALIGNMENT - 1)) == 0);
 
+      count_alloc(actual_size);
+
 #if CRNLIB_MEM_STATS
       CRNLIB_ASSERT((*g_pMSize)(p_new, g_pUser_data) == actual_size);
       update_total_allocated(1, static_cast<mem_stat_t>(actual_size));
@@ -191,6 +581,18 @@ namespace crnlib
          return NULL;
       }
 
+      if (!p)
+      {
+         if ((size) && (arena_can_alloc(size)))
+            return crnlib_malloc(size, pActual_size);
+      }
+      else if (atomic_load32(&g_arena_live_chunks))
+      {
+         arena_chunk* pChunk = arena_find_chunk(p);
+         if (pChunk)
+            return arena_realloc(pChunk, p, size, pActual_size, movable);
+      }
+
 #if CRNLIB_MEM_STATS
       size_t cur_size = p ? (*g_pMSize)(p, g_pUser_data) : 0;
       CRNLIB_ASSERT(!p || (cur_size >= sizeof(uint32)));
@@ -206,6 +608,9 @@ namespace crnlib
 
       CRNLIB_ASSERT((reinterpret_cast<ptr_bits_t>(p_new) & (CRNLIB_MIN_ALLOC_ALIGNMENT - 1)) == 0);
 
+      if ((p_new) && (size))
+         count_alloc(actual_size);
+
 #if CRNLIB_MEM_STATS
       CRNLIB_ASSERT(!p_new || ((*g_pMSize)(p_new, g_pUser_data) == actual_size));
 
@@ -244,6 +649,17 @@ namespace crnlib
          return;
       }
 
+      if (atomic_load32(&g_arena_live_chunks))
+      {
+         arena_chunk* pChunk = arena_find_chunk(p);
+         if (pChunk)
+         {
+            CRNLIB_ASSERT(arena_get_header(p)->m_pChunk == pChunk);
+            arena_release_chunk_ref(pChunk);
+            return;
+         }
+      }
+
 #if CRNLIB_MEM_STATS
       size_t cur_size = (*g_pMSize)(p, g_pUser_data);
       CRNLIB_ASSERT(cur_size >= sizeof(uint32));
@@ -264,22 +680,66 @@ namespace crnlib
          return 0;
       }
 
+      if ((atomic_load32(&g_arena_live_chunks)) && (arena_find_chunk(p)))
+         return arena_get_header(p)->m_size;
+
       return (*g_pMSize)(p, g_pUser_data);
    }
 
+   void crnlib_enable_alloc_counting(bool enable)
+   {
+      if (enable)
+         atomic_increment32(&g_alloc_counting);
+      else
+         atomic_decrement32(&g_alloc_counting);
+   }
+
+   void crnlib_get_alloc_counts(uint64& total_bytes, uint32& total_allocs)
+   {
+      total_bytes = static_cast<uint64>(atomic_compare_exchange64(&g_total_alloc_bytes, 0, 0));
+      total_allocs = static_cast<uint32>(atomic_add32(&g_total_allocs, 0));
+   }
+
+   // Only prints anything in CRNLIB_MEM_STATS builds, so applications can always call it.
    void crnlib_print_mem_stats()
    {
 #if CRNLIB_MEM_STATS
-      if (console::is_initialized())
-      {
+      const bool use_console = console::is_initialized();
+      if (use_console)
          console::debug("crnlib_print_mem_stats:");
-         console::debug("Current blocks: %u, allocated: " CRNLIB_INT64_FORMAT_SPECIFIER ", max ever allocated: " CRNLIB_INT64_FORMAT_SPECIFIER, g_total_blocks, (int64)g_total_allocated, (int64)g_max_allocated);
-      }
       else
-      {
          printf("crnlib_print_mem_stats:\n");
-         printf("Current blocks: %u, allocated: " CRNLIB_INT64_FORMAT_SPECIFIER ", max ever allocated: " CRNLIB_INT64_FORMAT_SPECIFIER "\n", g_total_blocks, (int64)g_total_allocated, (int64)g_max_allocated);
+
+      const int64 total_blocks = atomic_compare_exchange64(&g_total_blocks, 0, 0);
+      const int64 total_allocated = atomic_compare_exchange64(&g_total_allocated, 0, 0);
+      const int64 max_allocated = atomic_compare_exchange64(&g_max_allocated, 0, 0);
+      if (use_console)
+         console::debug("Current blocks: " CRNLIB_INT64_FORMAT_SPECIFIER ", allocated: " CRNLIB_INT64_FORMAT_SPECIFIER ", max ever allocated: " CRNLIB_INT64_FORMAT_SPECIFIER, total_blocks, total_allocated, max_allocated);
+      else
+         printf("Current blocks: " CRNLIB_INT64_FORMAT_SPECIFIER ", allocated: " CRNLIB_INT64_FORMAT_SPECIFIER ", max ever allocated: " CRNLIB_INT64_FORMAT_SPECIFIER "\n", total_blocks, total_allocated, max_allocated);
+
+      uint64 total_alloc_bytes;
+      uint32 total_allocs;
+      crnlib_get_alloc_counts(total_alloc_bytes, total_allocs);
+
+      const uint64 arena_total_blocks = static_cast<uint64>(atomic_compare_exchange64(&g_arena_total_blocks, 0, 0));
+      const uint arena_total_chunks = atomic_add32(&g_arena_total_chunks, 0);
+      const uint arena_live_chunks = atomic_add32(&g_arena_live_chunks, 0);
+      const uint arena_table_full = atomic_add32(&g_arena_table_full, 0);
+      const uint64 arena_max_bytes = static_cast<uint64>(atomic_add32(&g_arena_max_live_chunks, 0)) * cArenaChunkSize;
+
+      if (total_allocs)
+      {
+         if (use_console)
+            console::debug("Counted allocations: %u, bytes: " CRNLIB_UINT64_FORMAT_SPECIFIER, total_allocs, total_alloc_bytes);
+         else
+            printf("Counted allocations: %u, bytes: " CRNLIB_UINT64_FORMAT_SPECIFIER "\n", total_allocs, total_alloc_bytes);
       }
+
+      if (use_console)
+         console::debug("Arena blocks: " CRNLIB_UINT64_FORMAT_SPECIFIER ", chunks: %u, live chunks: %u, max ever allocated: " CRNLIB_UINT64_FORMAT_SPECIFIER ", chunks refused (table full): %u", arena_total_blocks, arena_total_chunks, arena_live_chunks, arena_max_bytes, arena_table_full);
+      else
+         printf("Arena blocks: " CRNLIB_UINT64_FORMAT_SPECIFIER ", chunks: %u, live chunks: %u, max ever allocated: " CRNLIB_UINT64_FORMAT_SPECIFIER ", chunks refused (table full): %u\n", arena_total_blocks, arena_total_chunks, arena_live_chunks, arena_max_bytes, arena_table_full);
 #endif
    }
 
@@ -300,3 +760,8 @@ void crn_set_memory_callbacks(crn_realloc_func pRealloc, crn_msize_func pMSize,
       crnlib::g_pUser_data = pUser_data;
    }
 }
+
+void crn_set_arena_allocation(bool enabled)
+{
+   crnlib::atomic_exchange32(&crnlib::g_arena_enabled, enabled);
+}
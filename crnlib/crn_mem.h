@@ -22,6 +22,41 @@ namespace crnlib
    size_t   crnlib_msize(void* p);
    void     crnlib_print_mem_stats();
    void     crnlib_mem_error(const char* p_msg);
+
+   // Allocation counters used by the compression stats. Counting is only done while at least one caller has it enabled (calls nest).
+   void     crnlib_enable_alloc_counting(bool enable);
+   void     crnlib_get_alloc_counts(uint64& total_bytes, uint32& total_allocs);
+
+   // Arena allocation of small temporaries. While a mem_arena_scope is alive on a thread, that thread's crnlib_malloc() and crnlib_realloc()
+   // calls carve blocks of up to cArenaMaxBlockSize bytes out of cArenaChunkSize chunks obtained from the memory callbacks. Arena blocks may
+   // outlive the scope and may be freed on any thread: each chunk goes back to the callbacks once all of its blocks have been freed.
+   // Scopes nest, and tasks queued to a task_pool from inside a scope run inside a scope too.
+   // A single long lived block (a buffer kept by a compressor context, etc.) pins its whole chunk, so the live chunks are bounded: the
+   // chunk table holds about cArenaMaxChunks chunks (16MB). Past that arena allocations fall back to the callbacks until the thread's
+   // outermost scope ends. In CRNLIB_MEM_STATS builds crnlib_print_mem_stats() reports how often chunks were refused.
+   const uint cArenaChunkSize = 256U * 1024U;
+   const uint cArenaMaxBlockSize = 4096U;
+   const uint cArenaMaxChunks = 64;
+
+   class mem_arena_scope
+   {
+      CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(mem_arena_scope);
+
+   public:
+      // If retain_chunk is true the thread keeps its partially used chunk when the outermost scope ends (used by the task_pool threads).
+      mem_arena_scope(bool enabled = true, bool retain_chunk = false);
+      ~mem_arena_scope();
+
+   private:
+      bool m_active;
+      bool m_retain_chunk;
+   };
+
+   // Returns true if the calling thread is inside an active mem_arena_scope.
+   bool     crnlib_arena_active();
+
+   // Gives up the calling thread's retained arena chunk (if any). Called by threads which used retaining scopes before they exit.
+   void     crnlib_release_thread_arena();
    
    // omfg - there must be a better way
    
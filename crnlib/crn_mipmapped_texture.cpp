@@ -3,10 +3,12 @@
 #include "crn_core.h"
 #include "crn_mipmapped_texture.h"
 #include "crn_cfile_stream.h"
+#include "crn_mapped_file_stream.h"
 #include "crn_image_utils.h"
 #include "crn_console.h"
 #include "crn_texture_comp.h"
 #include "crn_ktx_texture.h"
+#include "crn_threaded_resampler.h"
 
 #define CRND_HEADER_FILE_ONLY
 #include "../inc/crn_decomp.h"
@@ -142,23 +144,47 @@ namespace crnlib
          p.m_perceptual = false;
       }
 
-      image_u8 tmp_img(img);
+      dxt_format dxt_fmt = pixel_format_helpers::get_dxt_format(fmt);
 
-      clear();
+      dxt_image* pDXT_image = crnlib_new<dxt_image>();
 
-      m_format = fmt;
+      // img may be this level's own image, so it's only released once the DXT image is packed.
+      dxt_image::band_packer packer;
+      bool status = pDXT_image->init(dxt_fmt, img.get_width(), img.get_height(), false) && packer.init(*pDXT_image, p);
 
-      if (cook)
-         cook_image(tmp_img);
+      const image_utils::conversion_type conv_type = cook ? image_utils::get_conversion_type(true, fmt) : image_utils::cConversion_Invalid;
+      if ((status) && (conv_type == image_utils::cConversion_Invalid) && ((!pixel_format_helpers::is_alpha_only(fmt)) || (img.has_alpha())))
+      {
+         status = packer.pack_block_rows(img, 0);
+      }
+      else if (status)
+      {
+         // Cook and pack the image in bands, instead of making a full size copy of it.
+         image_u8 band_img;
+         for (uint first_block_y = 0; (status) && (first_block_y < pDXT_image->get_blocks_y()); first_block_y += cPackBandBlockRows)
+         {
+            const uint band_y = first_block_y * cDXTBlockSize;
+            const uint band_height = math::minimum<uint>(cPackBandBlockRows * cDXTBlockSize, img.get_height() - band_y);
 
-      if ((pixel_format_helpers::is_alpha_only(fmt)) && (!tmp_img.has_alpha()))
-         tmp_img.set_alpha_to_luma();
+            band_img.resize(img.get_width(), band_height);
+            band_img.unclipped_blit(0, band_y, img.get_width(), band_height, 0, 0, img);
+            band_img.set_comp_flags(img.get_comp_flags());
 
-      dxt_format dxt_fmt = pixel_format_helpers::get_dxt_format(fmt);
+            if (conv_type != image_utils::cConversion_Invalid)
+               image_utils::convert_image(band_img, conv_type);
 
-      dxt_image* pDXT_image = crnlib_new<dxt_image>();
-      if (!pDXT_image->init(dxt_fmt, tmp_img, p))
+            if ((pixel_format_helpers::is_alpha_only(fmt)) && (!band_img.has_alpha()))
+               band_img.set_alpha_to_luma();
+
+            status = packer.pack_block_rows(band_img, first_block_y);
+         }
+      }
+
+      packer.clear();
+
+      if (!status)
       {
+         crnlib_delete(pDXT_image);
          clear();
          return false;
       }
@@ -1953,7 +1979,7 @@ namespace crnlib
       if (fmt == get_format())
          return true;
 
-      uint total_pixels = 0;
+      uint64 total_pixels = 0;
       for (uint f = 0; f < m_faces.size(); f++)
          for (uint l = 0; l < m_faces[f].size(); l++)
             total_pixels += m_faces[f][l]->get_total_pixels();
@@ -1968,7 +1994,7 @@ namespace crnlib
          {
             const uint num_pixels = m_faces[f][l]->get_total_pixels();
 
-            uint progress_range = (num_pixels * p.m_progress_range) / total_pixels;
+            uint progress_range = static_cast<uint>((static_cast<uint64>(num_pixels) * p.m_progress_range) / total_pixels);
 
             dxt_image::pack_params tmp_params(p);
             tmp_params.m_progress_start = math::clamp<uint>(progress_start, 0, p.m_progress_range);
@@ -2281,44 +2307,52 @@ namespace crnlib
             faces[f][l] = crnlib_new<mip_level>();
       }
 
+      task_pool tp;
+      if ((params.m_multithreaded) && (g_number_of_processors > 1))
+         tp.init(task_pool::get_num_shared_threads());
+
+      // One resampler for all faces, so the faces share its contribution lists.
+      threaded_resampler resampler(tp);
+
+      crnlib::vector<image_u8*> mips(num_levels);
+
       for (uint f = 0; f < faces.size(); f++)
       {
          image_u8 tmp;
          image_u8* pImg = get_level(f, 0)->get_unpacked_image(tmp, cUnpackFlagUncook);
 
          for (uint l = 0; l < num_levels; l++)
-         {
-            const uint mip_width = math::maximum<uint>(1U, get_width() >> l);
-            const uint mip_height = math::maximum<uint>(1U, get_height() >> l);
+            mips[l] = crnlib_new<image_u8>();
 
-            image_u8* pMip = crnlib_new<image_u8>();
+         *mips[0] = *pImg;
 
-            if (!l)
-               *pMip = *pImg;
-            else
-            {
-               image_utils::resample_params rparams;
-               rparams.m_dst_width = mip_width;
-               rparams.m_dst_height = mip_height;
-               rparams.m_filter_scale = params.m_filter_scale;
-               rparams.m_first_comp = 0;
-               rparams.m_num_comps = pImg->is_component_valid(3) ? 4 : 3;
-               rparams.m_srgb = params.m_srgb;
-               rparams.m_wrapping = params.m_wrapping;
-               rparams.m_pFilter = params.m_pFilter;
-               rparams.m_multithreaded = params.m_multithreaded;
-
-               if (!image_utils::resample(*pImg, *pMip, rparams))
-               {
-                  crnlib_delete(pMip);
+         image_utils::resample_params rparams;
+         rparams.m_filter_scale = params.m_filter_scale;
+         rparams.m_first_comp = 0;
+         rparams.m_num_comps = pImg->is_component_valid(3) ? 4 : 3;
+         rparams.m_srgb = params.m_srgb;
+         rparams.m_wrapping = params.m_wrapping;
+         rparams.m_pFilter = params.m_pFilter;
+         rparams.m_multithreaded = params.m_multithreaded;
 
-                  for (uint f = 0; f < faces.size(); f++)
-                     for (uint l = 0; l < faces[f].size(); l++)
-                        crnlib_delete(faces[f][l]);
+         if (!image_utils::resample_mip_chain(resampler, *pImg, num_levels, rparams, params.m_cascade, mips.get_ptr() + 1))
+         {
+            for (uint l = 0; l < num_levels; l++)
+               crnlib_delete(mips[l]);
 
-                  return false;
-               }
+            for (uint f = 0; f < faces.size(); f++)
+               for (uint l = 0; l < faces[f].size(); l++)
+                  crnlib_delete(faces[f][l]);
+
+            return false;
+         }
 
+         for (uint l = 0; l < num_levels; l++)
+         {
+            image_u8* pMip = mips[l];
+
+            if (l)
+            {
                if (params.m_renormalize)
                   image_utils::renorm_normal_map(*pMip);
 
@@ -2752,10 +2786,18 @@ namespace crnlib
 
       bool success = false;
 
+      // Map the file if possible, so the readers don't have to copy it.
+      mapped_file_stream mapped_stream;
       cfile_stream in_stream;
-      if (in_stream.open(pFilename))
+      data_stream* pStream = NULL;
+      if (mapped_stream.open(pFilename))
+         pStream = &mapped_stream;
+      else if (in_stream.open(pFilename))
+         pStream = &in_stream;
+
+      if (pStream)
       {
-         data_stream_serializer serializer(in_stream);
+         data_stream_serializer serializer(*pStream);
          success = read_from_stream(serializer, file_format);
       }
             
@@ -2852,6 +2894,35 @@ namespace crnlib
 
    }
 
+   struct crnd_task_pool_job
+   {
+      crnd::crnd_task_func m_pTask_func;
+      void* m_pTask_data;
+   };
+
+   static void crnd_task_pool_job_callback(uint64 data, void* pData_ptr)
+   {
+      const crnd_task_pool_job* pJob = static_cast<const crnd_task_pool_job*>(pData_ptr);
+      pJob->m_pTask_func(static_cast<uint32>(data), pJob->m_pTask_data);
+   }
+
+   // crnd_parallel_for_func implementation used to transcode banded CRN levels on a task_pool.
+   static void crnd_task_pool_parallel_for(uint32 num_tasks, crnd::crnd_task_func pTask_func, void* pTask_data, void* pUser_data)
+   {
+      task_pool* pPool = static_cast<task_pool*>(pUser_data);
+
+      crnd_task_pool_job job;
+      job.m_pTask_func = pTask_func;
+      job.m_pTask_data = pTask_data;
+
+      // Bands which can't be queued are transcoded on this thread, so every band is always written.
+      for (uint32 i = 0; i < num_tasks; i++)
+         if (!pPool->queue_task(crnd_task_pool_job_callback, i, &job))
+            crnd_task_pool_job_callback(i, &job);
+
+      pPool->join();
+   }
+
    bool mipmapped_texture::read_crn_from_memory(const void *pData, uint data_size, const char* pFilename)
    {
       clear();
@@ -2907,6 +2978,11 @@ namespace crnlib
 
       uint total_pixels = 0;
 
+      // Banded files can be transcoded one band per thread.
+      task_pool tp;
+      if (crnd::crnd_get_level_num_bands(pContext, 0) > 1)
+         tp.init(task_pool::get_num_shared_threads());
+
       void* pFaces[cCRNMaxFaces];
       for (uint f = tex_info.m_faces; f < cCRNMaxFaces; f++)
          pFaces[f] = NULL;
@@ -2926,7 +3002,7 @@ namespace crnlib
          for (uint f = 0; f < tex_info.m_faces; f++)
             pFaces[f] = &dxt_data[f * size_of_face];
 
-         if (!crnd::crnd_unpack_level(pContext, pFaces, dxt_data.size(), row_pitch, l))
+         if (!crnd::crnd_unpack_level_parallel(pContext, pFaces, dxt_data.size(), row_pitch, l, tp.get_num_threads() ? crnd_task_pool_parallel_for : NULL, &tp))
          {
             crnd::crnd_unpack_end(pContext);
             for (uint f = 0; f < faces.size(); f++)
@@ -2971,6 +3047,11 @@ namespace crnlib
 
    bool mipmapped_texture::read_crn(data_stream_serializer& serializer)
    {
+      const uint8* pCRN_data;
+      uint crn_data_size;
+      if (serializer.read_entire_file_in_place(pCRN_data, crn_data_size))
+         return read_crn_from_memory(pCRN_data, crn_data_size, serializer.get_name().get_ptr());
+
       crnlib::vector<uint8> crn_data;
       if (!serializer.read_entire_file(crn_data))
       {
@@ -3105,7 +3186,7 @@ namespace crnlib
       if (pActual_quality_level) *pActual_quality_level = 0;
       if (pActual_bitrate) *pActual_bitrate = 0.0f;
 
-      if (math::maximum(get_height(), get_width()) > cCRNMaxLevelResolution)
+      if (math::maximum(get_height(), get_width()) > comp_params.get_max_level_resolution())
       {
          set_last_error("Texture resolution is too big!");
          return false;
@@ -106,6 +106,9 @@ namespace crnlib
 
       orientation_flags_t                    m_orient_flags;
 
+      // Block rows per band when an image has to be cooked before it's packed to DXT.
+      enum { cPackBandBlockRows = 16 };
+
       void cook_image(image_u8& img) const;
       void uncook_image(image_u8& img) const;
    };
@@ -241,12 +244,14 @@ namespace crnlib
          generate_mipmap_params() :
             resample_params(),
             m_min_mip_size(1),
-            m_max_mips(0)
+            m_max_mips(0),
+            m_cascade(false)
          {
          }
 
          uint        m_min_mip_size;
          uint        m_max_mips; // actually the max # of total levels
+         bool        m_cascade; // resample each level from the previous one (see image_utils::resample_mip_chain)
       };
 
       bool generate_mipmaps(const generate_mipmap_params& params, bool force);
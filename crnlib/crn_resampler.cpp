@@ -4,6 +4,10 @@
 #include "crn_resampler.h"
 #include "crn_resample_filters.h"
 
+#if CRNLIB_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace crnlib
 {
    #define resampler_assert CRNLIB_ASSERT
@@ -413,7 +417,15 @@ namespace crnlib
    #endif
 
       // Not += because temp buf wasn't cleared.
-      for (i = dst_x; i > 0; i--)
+      i = dst_x;
+
+   #if CRNLIB_USE_SSE2
+      const __m128 w = _mm_set1_ps(weight);
+      for ( ; i >= 4; i -= 4, Ptmp += 4, Psrc += 4)
+         _mm_storeu_ps(Ptmp, _mm_mul_ps(_mm_loadu_ps(Psrc), w));
+   #endif
+
+      for ( ; i > 0; i--)
          *Ptmp++ = *Psrc++ * weight;
    }
 
@@ -423,12 +435,27 @@ namespace crnlib
       total_ops += dst_x;
    #endif
 
-      for (int i = dst_x; i > 0; i--)
+      int i = dst_x;
+
+   #if CRNLIB_USE_SSE2
+      const __m128 w = _mm_set1_ps(weight);
+      for ( ; i >= 4; i -= 4, Ptmp += 4, Psrc += 4)
+         _mm_storeu_ps(Ptmp, _mm_add_ps(_mm_loadu_ps(Ptmp), _mm_mul_ps(_mm_loadu_ps(Psrc), w)));
+   #endif
+
+      for ( ; i > 0; i--)
          (*Ptmp++) += *Psrc++ * weight;
    }
 
    void Resampler::clamp(Sample* Pdst, int n)
    {
+   #if CRNLIB_USE_SSE2
+      const __m128 lo = _mm_set1_ps(m_lo);
+      const __m128 hi = _mm_set1_ps(m_hi);
+      for ( ; n >= 4; n -= 4, Pdst += 4)
+         _mm_storeu_ps(Pdst, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(Pdst), lo), hi));
+   #endif
+
       while (n > 0)
       {
          Sample x = *Pdst;
@@ -5,6 +5,7 @@
 #include "crn_dds_comp.h"
 #include "crn_console.h"
 #include "crn_rect.h"
+#include "crn_comp_stats.h"
 
 namespace crnlib
 {
@@ -18,8 +19,264 @@ namespace crnlib
          return NULL;
    }
 
-   bool create_compressed_texture(const crn_comp_params &params, crnlib::vector<uint8> &comp_data, uint32 *pActual_quality_level, float *pActual_bitrate)
+   texture_comp_context::texture_comp_context(uint max_helper_threads, uint64 max_retained_bytes) :
+      m_max_helper_threads(max_helper_threads),
+      m_max_retained_bytes(max_retained_bytes)
    {
+      utils::zero_object(m_pComps);
+   }
+
+   texture_comp_context::~texture_comp_context()
+   {
+      clear();
+   }
+
+   void texture_comp_context::clear()
+   {
+      for (uint i = 0; i < CRNLIB_ARRAY_SIZE(m_pComps); i++)
+      {
+         crnlib_delete(m_pComps[i]);
+         m_pComps[i] = NULL;
+      }
+   }
+
+   itexture_comp* texture_comp_context::get_comp(crn_file_type file_type)
+   {
+      if (file_type >= CRNLIB_ARRAY_SIZE(m_pComps))
+         return NULL;
+
+      if (!m_pComps[file_type])
+         m_pComps[file_type] = create_texture_comp(file_type);
+
+      return m_pComps[file_type];
+   }
+
+   void texture_comp_context::end_texture()
+   {
+      for (uint i = 0; i < CRNLIB_ARRAY_SIZE(m_pComps); i++)
+      {
+         if (!m_pComps[i])
+            continue;
+
+         // Drops the compressor's pointers to the caller's params and images, but not its buffers.
+         m_pComps[i]->compress_deinit();
+
+         if ((m_max_retained_bytes) && (m_pComps[i]->get_retained_bytes() > m_max_retained_bytes))
+         {
+            crnlib_delete(m_pComps[i]);
+            m_pComps[i] = NULL;
+         }
+      }
+   }
+
+   static void release_texture_comp(itexture_comp *pTexture_comp, texture_comp_context* pContext)
+   {
+      if (pContext)
+         pContext->end_texture();
+      else
+         crnlib_delete(pTexture_comp);
+   }
+
+   static inline bool is_better_bitrate(float bitrate, float best_bitrate, int best_quality_level, float target_bitrate)
+   {
+      return (best_quality_level < 0) ||
+             ((bitrate <= target_bitrate) && (best_bitrate > target_bitrate)) ||
+             (((bitrate <= target_bitrate) || (best_bitrate > target_bitrate)) && (fabs(bitrate - target_bitrate) < fabs(best_bitrate - target_bitrate)));
+   }
+
+   static const uint cMaxQualityProbes = 4;
+
+   struct quality_probe
+   {
+      crn_comp_params m_params;
+      crn_comp* m_pComp;
+      float m_bitrate;
+      bool m_status;
+   };
+
+   static void quality_probe_task(uint64 data, void* pData_ptr)
+   {
+      data;
+      quality_probe& probe = *static_cast<quality_probe*>(pData_ptr);
+      probe.m_status = probe.m_pComp->compress_pass(probe.m_params, &probe.m_bitrate);
+   }
+
+   // Picks up to max_probes untried quality levels in [low_quality, high_quality], spread around the level interpolated from the closest
+   // tried levels on either side of the bracket (or around the middle of the bracket if there aren't any yet). Returns them in ascending order.
+   static uint pick_quality_probes(int low_quality, int high_quality, const float* pCached_bitrates, float target_bitrate, uint max_probes, int* pProbes)
+   {
+      const int num_levels = high_quality - low_quality + 1;
+
+      int center = (low_quality + high_quality) / 2;
+      int step = math::maximum(1, num_levels / static_cast<int>(max_probes + 1));
+
+      if ((low_quality > 0) && (high_quality < cCRNMaxQualityLevel))
+      {
+         int bracket_low = low_quality - 1;
+         while ((pCached_bitrates[bracket_low] < 0) && (bracket_low > 0))
+            bracket_low--;
+
+         int bracket_high = high_quality + 1;
+         while ((pCached_bitrates[bracket_high] < 0) && (bracket_high < cCRNMaxQualityLevel))
+            bracket_high++;
+
+         const float bracket_low_bitrate = pCached_bitrates[bracket_low];
+         const float bracket_high_bitrate = pCached_bitrates[bracket_high];
+
+         if ((bracket_low_bitrate >= 0) && (bracket_low_bitrate < bracket_high_bitrate) &&
+             (bracket_low_bitrate < target_bitrate) && (bracket_high_bitrate >= target_bitrate))
+         {
+            int quality = bracket_low + static_cast<int>(((target_bitrate - bracket_low_bitrate) * (bracket_high - bracket_low)) / (bracket_high_bitrate - bracket_low_bitrate));
+            center = math::clamp(quality, low_quality, high_quality);
+            step = math::maximum(1, num_levels / static_cast<int>(max_probes * 2));
+         }
+      }
+
+      uint num_probes = 0;
+      for (int i = 0; (num_probes < max_probes) && (num_probes < static_cast<uint>(num_levels)); i++)
+      {
+         // center, center - step, center + step, center - 2 * step, ...
+         int quality = center + ((i & 1) ? -1 : 1) * ((i + 1) >> 1) * step;
+         quality = math::clamp(quality, low_quality, high_quality);
+
+         // Fall back to the closest untried level if this one was already picked.
+         for (uint j = 0; j < num_probes; )
+         {
+            if (pProbes[j] != quality)
+            {
+               j++;
+               continue;
+            }
+            quality = (quality < high_quality) ? (quality + 1) : low_quality;
+            j = 0;
+         }
+
+         pProbes[num_probes++] = quality;
+      }
+
+      // Insertion sort, there are at most cMaxQualityProbes entries.
+      for (uint i = 1; i < num_probes; i++)
+      {
+         const int quality = pProbes[i];
+
+         uint j = i;
+         for ( ; (j) && (pProbes[j - 1] > quality); j--)
+            pProbes[j] = pProbes[j - 1];
+
+         pProbes[j] = quality;
+      }
+
+      return num_probes;
+   }
+
+   // Like the sequential search in create_compressed_texture(), but compresses several quality levels of the bracket at once, each on its own
+   // crn_comp pass context which shares the source chunks of init_comp. The results of a round are always folded in ascending quality order,
+   // so the selected level only depends on the params. Every round tries cMaxQualityProbes levels whatever the thread count, the pool
+   // decides how many of them run at once.
+   static bool parallel_quality_search(const crn_comp& init_comp, const crn_comp_params& params, crnlib::vector<uint8>& comp_data, float& best_bitrate, int& best_quality_level, float& highest_bitrate)
+   {
+      const uint max_probes = cMaxQualityProbes;
+
+      crn_comp probe_comps[cMaxQualityProbes];
+      quality_probe probes[cMaxQualityProbes];
+
+      for (uint i = 0; i < max_probes; i++)
+      {
+         if (!probe_comps[i].compress_init_shared(init_comp))
+            return false;
+
+         probes[i].m_params = params;
+         probes[i].m_pComp = &probe_comps[i];
+
+         // Only the first probe, which runs on the calling thread, reports progress.
+         if (i)
+         {
+            probes[i].m_params.m_pProgress_func = NULL;
+            probes[i].m_params.m_pProgress_func_data = NULL;
+         }
+      }
+
+      float cached_bitrates[cCRNMaxQualityLevel + 1];
+      for (uint i = 0; i <= cCRNMaxQualityLevel; i++)
+         cached_bitrates[i] = -1.0f;
+
+      task_pool tp;
+      if (!tp.init(task_pool::get_num_shared_threads()))
+         return false;
+
+      int low_quality = 0;
+      int high_quality = cCRNMaxQualityLevel;
+
+      while (low_quality <= high_quality)
+      {
+         if (params.m_flags & cCRNCompFlagDebugging)
+         {
+            console::debug("Quality level bracket: [%u, %u]", low_quality, high_quality);
+         }
+
+         int qualities[cMaxQualityProbes];
+         const uint num_probes = pick_quality_probes(low_quality, high_quality, cached_bitrates, params.m_target_bitrate, max_probes, qualities);
+
+         for (uint i = 0; i < num_probes; i++)
+         {
+            console::info("Compressing to quality level %u", qualities[i]);
+
+            probes[i].m_params.m_quality_level = qualities[i];
+            probes[i].m_bitrate = 0.0f;
+            probes[i].m_status = false;
+         }
+
+         // Probes which can't be queued are compressed on this thread.
+         for (uint i = 1; i < num_probes; i++)
+            if (!tp.queue_task(quality_probe_task, 0, &probes[i]))
+               quality_probe_task(0, &probes[i]);
+
+         quality_probe_task(0, &probes[0]);
+
+         tp.join();
+
+         for (uint i = 0; i < num_probes; i++)
+         {
+            if (!probes[i].m_status)
+               return false;
+
+            const int trial_quality = qualities[i];
+            const float bitrate = probes[i].m_bitrate;
+
+            cached_bitrates[trial_quality] = bitrate;
+
+            highest_bitrate = math::maximum(highest_bitrate, bitrate);
+
+            console::info("\nTried quality level %u, bpp: %3.3f", trial_quality, bitrate);
+
+            if (is_better_bitrate(bitrate, best_bitrate, best_quality_level, params.m_target_bitrate))
+            {
+               best_bitrate = bitrate;
+               comp_data.swap(probe_comps[i].get_comp_data());
+               best_quality_level = trial_quality;
+               if (params.m_flags & cCRNCompFlagDebugging)
+               {
+                  console::debug("Choose new best quality level");
+               }
+            }
+
+            if (bitrate > params.m_target_bitrate)
+               high_quality = math::minimum(high_quality, trial_quality - 1);
+            else
+               low_quality = math::maximum(low_quality, trial_quality + 1);
+         }
+
+         if ((best_bitrate <= params.m_target_bitrate) && (fabs(best_bitrate - params.m_target_bitrate) < .005f))
+            break;
+      }
+
+      return true;
+   }
+
+   bool create_compressed_texture(const crn_comp_params &params, crnlib::vector<uint8> &comp_data, uint32 *pActual_quality_level, float *pActual_bitrate, texture_comp_context* pContext)
+   {
+      comp_stats_session stats_session(params.m_pStats, params.m_num_helper_threads);
+
       crn_comp_params local_params(params);
 
       if (pixel_format_helpers::is_crn_format_non_srgb(local_params.m_format))
@@ -38,13 +295,13 @@ namespace crnlib
 
       comp_data.resize(0);
 
-      itexture_comp *pTexture_comp = create_texture_comp(local_params.m_file_type);
+      itexture_comp *pTexture_comp = pContext ? pContext->get_comp(local_params.m_file_type) : create_texture_comp(local_params.m_file_type);
       if (!pTexture_comp)
          return false;
 
       if (!pTexture_comp->compress_init(local_params))
       {
-         crnlib_delete(pTexture_comp);
+         release_texture_comp(pTexture_comp, pContext);
          return false;
       }
 
@@ -67,7 +324,7 @@ namespace crnlib
          }
          if (!pTexture_comp->compress_pass(local_params, pActual_bitrate))
          {
-            crnlib_delete(pTexture_comp);
+            release_texture_comp(pTexture_comp, pContext);
             return false;
          }
 
@@ -76,7 +333,7 @@ namespace crnlib
          if ((pActual_quality_level) && (local_params.m_target_bitrate <= 0.0))
             *pActual_quality_level = local_params.m_quality_level;
 
-         crnlib_delete(pTexture_comp);
+         release_texture_comp(pTexture_comp, pContext);
          return true;
       }
 
@@ -91,108 +348,116 @@ namespace crnlib
 
       for ( ; ; )
       {
-         int low_quality = cLowestQuality;
-         int high_quality = cHighestQuality;
-
-         float cached_bitrates[cNumQualityLevels];
-         for (int i = 0; i < cNumQualityLevels; i++)
-            cached_bitrates[i] = -1.0f;
-
          float highest_bitrate = 0.0f;
 
-         uint iter_count = 0;
-         bool force_binary_search = false;
-
-         while (low_quality <= high_quality)
+         if ((local_params.m_file_type == cCRNFileTypeCRN) && (local_params.m_flags & cCRNCompFlagParallelQualitySearch))
          {
-            if (params.m_flags & cCRNCompFlagDebugging)
+            if (!parallel_quality_search(*static_cast<crn_comp*>(pTexture_comp), local_params, comp_data, best_bitrate, best_quality_level, highest_bitrate))
             {
-               console::debug("Quality level bracket: [%u, %u]", low_quality, high_quality);
+               release_texture_comp(pTexture_comp, pContext);
+               return false;
             }
+         }
+         else
+         {
+            int low_quality = cLowestQuality;
+            int high_quality = cHighestQuality;
 
-            int trial_quality = (low_quality + high_quality) / 2;
+            float cached_bitrates[cNumQualityLevels];
+            for (int i = 0; i < cNumQualityLevels; i++)
+               cached_bitrates[i] = -1.0f;
 
-            if ((iter_count) && (!force_binary_search))
+            uint iter_count = 0;
+            bool force_binary_search = false;
+
+            while (low_quality <= high_quality)
             {
-               int bracket_low = trial_quality;
-               while ((cached_bitrates[bracket_low] < 0) && (bracket_low > cLowestQuality))
-                  bracket_low--;
+               if (params.m_flags & cCRNCompFlagDebugging)
+               {
+                  console::debug("Quality level bracket: [%u, %u]", low_quality, high_quality);
+               }
 
-               if (cached_bitrates[bracket_low] < 0)
-                  trial_quality = static_cast<int>(math::lerp<float>((float)low_quality, (float)high_quality, .33f));
-               else
+               int trial_quality = (low_quality + high_quality) / 2;
+
+               if ((iter_count) && (!force_binary_search))
                {
-                  int bracket_high = trial_quality + 1;
-                  if (bracket_high <= cHighestQuality)
-                  {
-                     while ((cached_bitrates[bracket_high] < 0) && (bracket_high < cHighestQuality))
-                        bracket_high++;
+                  int bracket_low = trial_quality;
+                  while ((cached_bitrates[bracket_low] < 0) && (bracket_low > cLowestQuality))
+                     bracket_low--;
 
-                     if (cached_bitrates[bracket_high] >= 0)
+                  if (cached_bitrates[bracket_low] < 0)
+                     trial_quality = static_cast<int>(math::lerp<float>((float)low_quality, (float)high_quality, .33f));
+                  else
+                  {
+                     int bracket_high = trial_quality + 1;
+                     if (bracket_high <= cHighestQuality)
                      {
-                        float bracket_low_bitrate = cached_bitrates[bracket_low];
-                        float bracket_high_bitrate = cached_bitrates[bracket_high];
+                        while ((cached_bitrates[bracket_high] < 0) && (bracket_high < cHighestQuality))
+                           bracket_high++;
 
-                        if ((bracket_low_bitrate < bracket_high_bitrate) &&
-                           (bracket_low_bitrate < local_params.m_target_bitrate) &&
-                           (bracket_high_bitrate >= local_params.m_target_bitrate))
+                        if (cached_bitrates[bracket_high] >= 0)
                         {
-                           int quality = low_quality + static_cast<int>( ((local_params.m_target_bitrate - bracket_low_bitrate) * (high_quality - low_quality)) / (bracket_high_bitrate - bracket_low_bitrate) );
+                           float bracket_low_bitrate = cached_bitrates[bracket_low];
+                           float bracket_high_bitrate = cached_bitrates[bracket_high];
 
-                           if ((quality >= low_quality) && (quality <= high_quality))
+                           if ((bracket_low_bitrate < bracket_high_bitrate) &&
+                              (bracket_low_bitrate < local_params.m_target_bitrate) &&
+                              (bracket_high_bitrate >= local_params.m_target_bitrate))
                            {
-                              trial_quality = quality;
+                              int quality = low_quality + static_cast<int>( ((local_params.m_target_bitrate - bracket_low_bitrate) * (high_quality - low_quality)) / (bracket_high_bitrate - bracket_low_bitrate) );
+
+                              if ((quality >= low_quality) && (quality <= high_quality))
+                              {
+                                 trial_quality = quality;
+                              }
                            }
                         }
                      }
                   }
                }
-            }
 
-            console::info("Compressing to quality level %u", trial_quality);
+               console::info("Compressing to quality level %u", trial_quality);
 
-            float bitrate = 0.0f;
+               float bitrate = 0.0f;
 
-            local_params.m_quality_level = trial_quality;
+               local_params.m_quality_level = trial_quality;
 
-            if (!pTexture_comp->compress_pass(local_params, &bitrate))
-            {
-               crnlib_delete(pTexture_comp);
-               return false;
-            }
+               if (!pTexture_comp->compress_pass(local_params, &bitrate))
+               {
+                  release_texture_comp(pTexture_comp, pContext);
+                  return false;
+               }
 
-            cached_bitrates[trial_quality] = bitrate;
+               cached_bitrates[trial_quality] = bitrate;
 
-            highest_bitrate = math::maximum(highest_bitrate, bitrate);
+               highest_bitrate = math::maximum(highest_bitrate, bitrate);
 
-            console::info("\nTried quality level %u, bpp: %3.3f", trial_quality, bitrate);
+               console::info("\nTried quality level %u, bpp: %3.3f", trial_quality, bitrate);
 
-            if ( (best_quality_level < 0) ||
-                 ((bitrate <= local_params.m_target_bitrate) && (best_bitrate > local_params.m_target_bitrate)) ||
-                 (((bitrate <= local_params.m_target_bitrate) || (best_bitrate > local_params.m_target_bitrate)) && (fabs(bitrate - local_params.m_target_bitrate) < fabs(best_bitrate - local_params.m_target_bitrate)))
-                )
-            {
-               best_bitrate = bitrate;
-               comp_data.swap(pTexture_comp->get_comp_data());
-               best_quality_level = trial_quality;
-               if (params.m_flags & cCRNCompFlagDebugging)
+               if (is_better_bitrate(bitrate, best_bitrate, best_quality_level, local_params.m_target_bitrate))
                {
-                  console::debug("Choose new best quality level");
-               }
+                  best_bitrate = bitrate;
+                  comp_data.swap(pTexture_comp->get_comp_data());
+                  best_quality_level = trial_quality;
+                  if (params.m_flags & cCRNCompFlagDebugging)
+                  {
+                     console::debug("Choose new best quality level");
+                  }
 
-               if ((best_bitrate <= local_params.m_target_bitrate) && (fabs(best_bitrate - local_params.m_target_bitrate) < .005f))
-                  break;
-            }
+                  if ((best_bitrate <= local_params.m_target_bitrate) && (fabs(best_bitrate - local_params.m_target_bitrate) < .005f))
+                     break;
+               }
 
-            if (bitrate > local_params.m_target_bitrate)
-               high_quality = trial_quality - 1;
-            else
-               low_quality = trial_quality + 1;
+               if (bitrate > local_params.m_target_bitrate)
+                  high_quality = trial_quality - 1;
+               else
+                  low_quality = trial_quality + 1;
 
-            iter_count++;
-            if (iter_count > cMaxIterations)
-            {
-               force_binary_search = true;
+               iter_count++;
+               if (iter_count > cMaxIterations)
+               {
+                  force_binary_search = true;
+               }
             }
          }
 
@@ -204,12 +469,9 @@ namespace crnlib
 
             local_params.m_flags &= ~cCRNCompFlagHierarchical;
 
-            crnlib_delete(pTexture_comp);
-            pTexture_comp = create_texture_comp(local_params.m_file_type);
-
             if (!pTexture_comp->compress_init(local_params))
             {
-               crnlib_delete(pTexture_comp);
+               release_texture_comp(pTexture_comp, pContext);
                return false;
             }
          }
@@ -217,7 +479,7 @@ namespace crnlib
             break;
       }
 
-      crnlib_delete(pTexture_comp);
+      release_texture_comp(pTexture_comp, pContext);
       pTexture_comp = NULL;
 
       if (best_quality_level < 0)
@@ -427,8 +689,8 @@ namespace crnlib
          }
       }
 
-      new_width = math::clamp<int>(new_width, 1, cCRNMaxLevelResolution);
-      new_height = math::clamp<int>(new_height, 1, cCRNMaxLevelResolution);
+      new_width = math::clamp<int>(new_width, 1, params.get_max_level_resolution());
+      new_height = math::clamp<int>(new_height, 1, params.get_max_level_resolution());
 
       if ((new_width != (int)work_tex.get_width()) || (new_height != (int)work_tex.get_height()))
       {
@@ -472,6 +734,7 @@ namespace crnlib
          gen_params.m_multithreaded = params.m_num_helper_threads > 0;
          gen_params.m_max_mips = mipmap_params.m_max_levels;
          gen_params.m_min_mip_size = mipmap_params.m_min_mip_size;
+         gen_params.m_cascade = mipmap_params.m_cascade != 0;
 
          console::info("Generating mipmaps using filter \"%s\"", pFilter);
 
@@ -490,7 +753,7 @@ namespace crnlib
       return true;
    }
 
-   bool create_compressed_texture(const crn_comp_params &params, const crn_mipmap_params &mipmap_params, crnlib::vector<uint8> &comp_data, uint32 *pActual_quality_level, float *pActual_bitrate)
+   bool create_compressed_texture(const crn_comp_params &params, const crn_mipmap_params &mipmap_params, crnlib::vector<uint8> &comp_data, uint32 *pActual_quality_level, float *pActual_bitrate, texture_comp_context* pContext)
    {
       comp_data.resize(0);
       if (pActual_bitrate) *pActual_bitrate = 0.0f;
@@ -514,7 +777,7 @@ namespace crnlib
          for (uint l = 0; l < work_tex.get_num_levels(); l++)
             new_params.m_pImages[f][l] = (uint32*)work_tex.get_level(f, l)->get_image()->get_ptr();
 
-      return create_compressed_texture(new_params, comp_data, pActual_quality_level, pActual_bitrate);
+      return create_compressed_texture(new_params, comp_data, pActual_quality_level, pActual_bitrate, pContext);
    }
 
 } // namespace crnlib
@@ -24,10 +24,39 @@ namespace crnlib
 
       virtual const crnlib::vector<uint8>& get_comp_data() const = 0;
       virtual       crnlib::vector<uint8>& get_comp_data() = 0;
+
+      // Bytes of work buffers the compressor keeps allocated between textures.
+      virtual uint64 get_retained_bytes() const = 0;
+   };
+
+   // Keeps one compressor per file type alive between textures, so their work buffers (chunks, quantizer state, index streams, etc.)
+   // are reused instead of reallocated for every texture. Must only be used by one thread at a time.
+   class texture_comp_context
+   {
+      CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(texture_comp_context);
+
+   public:
+      // max_retained_bytes=0 means no limit.
+      texture_comp_context(uint max_helper_threads, uint64 max_retained_bytes);
+      ~texture_comp_context();
+
+      void clear();
+
+      uint get_max_helper_threads() const { return m_max_helper_threads; }
+
+      itexture_comp* get_comp(crn_file_type file_type);
+
+      // Called once a texture is done. Frees the compressors which retain more than the context's memory limit.
+      void end_texture();
+
+   private:
+      uint m_max_helper_threads;
+      uint64 m_max_retained_bytes;
+      itexture_comp* m_pComps[cCRNFileTypeDDS + 1];
    };
 
-   bool create_compressed_texture(const crn_comp_params &params, crnlib::vector<uint8> &comp_data, uint32 *pActual_quality_level, float *pActual_bitrate);
+   bool create_compressed_texture(const crn_comp_params &params, crnlib::vector<uint8> &comp_data, uint32 *pActual_quality_level, float *pActual_bitrate, texture_comp_context* pContext = NULL);
    bool create_texture_mipmaps(mipmapped_texture &work_tex, const crn_comp_params &params, const crn_mipmap_params &mipmap_params, bool generate_mipmaps);
-   bool create_compressed_texture(const crn_comp_params &params, const crn_mipmap_params &mipmap_params, crnlib::vector<uint8> &comp_data, uint32 *pActual_quality_level, float *pActual_bitrate);
+   bool create_compressed_texture(const crn_comp_params &params, const crn_mipmap_params &mipmap_params, crnlib::vector<uint8> &comp_data, uint32 *pActual_quality_level, float *pActual_bitrate, texture_comp_context* pContext = NULL);
 
 } // namespace crnlib
@@ -32,22 +32,42 @@ namespace crnlib
          texture_file_types::format dst_file_type,
          bool lzma_stats)
       {
-         m_src_filename = pSrc_filename;
-         m_dst_filename = pDst_filename;
-         m_dst_file_type = dst_file_type;
+         set_input(src_tex, true);
 
-         m_pInput_tex = &src_tex;
+         return init(pSrc_filename, pDst_filename, dst_file_type, lzma_stats);
+      }
 
-         file_utils::get_file_size(pSrc_filename, m_input_file_size);
-         file_utils::get_file_size(pDst_filename, m_output_file_size);
+      void convert_stats::set_input(mipmapped_texture& src_tex, bool keep_image)
+      {
+         m_pInput_tex = keep_image ? &src_tex : NULL;
+
+         m_input_width = src_tex.get_width();
+         m_input_height = src_tex.get_height();
+         m_input_levels = src_tex.get_num_levels();
+         m_input_faces = src_tex.get_num_faces();
+         m_input_format = src_tex.get_format();
 
          m_total_input_pixels = 0;
-         for (uint i = 0; i < src_tex.get_num_levels(); i++)
+         for (uint i = 0; i < m_input_levels; i++)
          {
-            uint width = math::maximum<uint>(1, src_tex.get_width() >> i);
-            uint height = math::maximum<uint>(1, src_tex.get_height() >> i);
-            m_total_input_pixels += width*height*src_tex.get_num_faces();
+            uint width = math::maximum<uint>(1, m_input_width >> i);
+            uint height = math::maximum<uint>(1, m_input_height >> i);
+            m_total_input_pixels += width*height*m_input_faces;
          }
+      }
+
+      bool convert_stats::init(
+         const char* pSrc_filename,
+         const char* pDst_filename,
+         texture_file_types::format dst_file_type,
+         bool lzma_stats)
+      {
+         m_src_filename = pSrc_filename;
+         m_dst_filename = pDst_filename;
+         m_dst_file_type = dst_file_type;
+
+         file_utils::get_file_size(pSrc_filename, m_input_file_size);
+         file_utils::get_file_size(pDst_filename, m_output_file_size);
 
          m_output_comp_file_size = 0;
 
@@ -93,15 +113,15 @@ namespace crnlib
 
       bool convert_stats::print(bool psnr_metrics, bool mip_stats, bool grayscale_sampling, const char *pCSVStatsFile) const
       {
-         if (!m_pInput_tex)
+         if (!m_input_width)
             return false;
 
          console::info("Input texture: %ux%u, Levels: %u, Faces: %u, Format: %s",
-            m_pInput_tex->get_width(),
-            m_pInput_tex->get_height(),
-            m_pInput_tex->get_num_levels(),
-            m_pInput_tex->get_num_faces(),
-            pixel_format_helpers::get_pixel_format_string(m_pInput_tex->get_format()));
+            m_input_width,
+            m_input_height,
+            m_input_levels,
+            m_input_faces,
+            pixel_format_helpers::get_pixel_format_string(m_input_format));
 
          // Just casting the uint64's filesizes to uint32 here to work around gcc issues - it's not even possible to have files that large anyway.
          console::info("Input pixels: %u, Input file size: %u, Input bits/pixel: %1.3f",
@@ -122,7 +142,11 @@ namespace crnlib
             console::info("LZMA compressed output file size: %u bytes, %1.3f bits/pixel",
                (uint32)m_output_comp_file_size, (m_output_comp_file_size * 8.0f) / m_total_output_pixels);
          }
-         if (psnr_metrics)
+         if ((psnr_metrics) && (!m_pInput_tex))
+         {
+            console::warning("Unable to compute image statistics - the input texture wasn't kept.");
+         }
+         else if (psnr_metrics)
          {
             if ( (m_pInput_tex->get_width() != m_output_tex.get_width()) || (m_pInput_tex->get_height() != m_output_tex.get_height()) || (m_pInput_tex->get_num_faces() != m_output_tex.get_num_faces()) )
             {
@@ -230,6 +254,12 @@ namespace crnlib
          m_pInput_tex = NULL;
          m_output_tex.clear();
 
+         m_input_width = 0;
+         m_input_height = 0;
+         m_input_levels = 0;
+         m_input_faces = 0;
+         m_input_format = PIXEL_FMT_INVALID;
+
          m_input_file_size = 0;
          m_total_input_pixels = 0;
 
@@ -409,6 +439,7 @@ namespace crnlib
          console::debug("   scale mode: %s", crn_get_scale_mode_desc(mipmap_params.m_scale_mode));
          console::debug("        scale: %f %f", mipmap_params.m_scale_x, mipmap_params.m_scale_y);
          console::debug("        clamp: %u %u, clamp_scale: %u", mipmap_params.m_clamp_width, mipmap_params.m_clamp_height, mipmap_params.m_clamp_scale);
+         console::debug("        Cascade: %u", mipmap_params.m_cascade);
          console::debug("");
       }
 
@@ -456,7 +487,7 @@ namespace crnlib
 
          if (!params.m_no_stats)
          {
-            if (!stats.init(params.m_pInput_texture->get_source_filename().get_ptr(), params.m_dst_filename.get_ptr(), *params.m_pIntermediate_texture, params.m_dst_file_type, params.m_lzma_stats))
+            if (!stats.init(params.m_pInput_texture->get_source_filename().get_ptr(), params.m_dst_filename.get_ptr(), params.m_dst_file_type, params.m_lzma_stats))
             {
                console::warning("Unable to compute output statistics for file: %s", params.m_pInput_texture->get_source_filename().get_ptr());
             }
@@ -551,7 +582,7 @@ namespace crnlib
 
             if (!params.m_no_stats)
             {
-               if (!stats.init(params.m_pInput_texture->get_source_filename().get_ptr(), params.m_dst_filename.get_ptr(), *params.m_pIntermediate_texture, params.m_dst_file_type, params.m_lzma_stats))
+               if (!stats.init(params.m_pInput_texture->get_source_filename().get_ptr(), params.m_dst_filename.get_ptr(), params.m_dst_file_type, params.m_lzma_stats))
                {
                   console::warning("Unable to compute output statistics for file: %s", params.m_pInput_texture->get_source_filename().get_ptr());
                }
@@ -582,8 +613,15 @@ namespace crnlib
             params.m_pIntermediate_texture = NULL;
          }
 
-         params.m_pIntermediate_texture = crnlib_new<mipmapped_texture>(*params.m_pInput_texture);
-         
+         // The other statistics only need the input's description, a full copy of the untouched input is only made for the image statistics.
+         if (!params.m_no_stats)
+         {
+            if (params.m_image_stats)
+               params.m_pIntermediate_texture = crnlib_new<mipmapped_texture>(*params.m_pInput_texture);
+
+            stats.set_input(params.m_pIntermediate_texture ? *params.m_pIntermediate_texture : *params.m_pInput_texture, params.m_pIntermediate_texture != NULL);
+         }
+
          mipmapped_texture& work_tex = *params.m_pInput_texture;
 
          if ((params.m_unflip) && (work_tex.is_flipped()))
@@ -690,6 +728,9 @@ namespace crnlib
             print_mipmap_params(mipmap_params);
          }
 
+         // The output file type determines the max. resolution the texture is clamped to.
+         comp_params.m_file_type = (params.m_dst_file_type == texture_file_types::cFormatCRN) ? cCRNFileTypeCRN : cCRNFileTypeDDS;
+
          if (!create_texture_mipmaps(work_tex, comp_params, mipmap_params, generate_mipmaps))
             return convert_error(params, "Failed creating texture mipmaps!");
 
@@ -22,6 +22,16 @@ namespace crnlib
             texture_file_types::format dst_file_type,
             bool lzma_stats);
 
+         // Records the input texture's description before it's converted. The image metrics also need its pixels, so src_tex
+         // is only kept if keep_image is true. Call init() without a texture once the output file has been written.
+         void set_input(mipmapped_texture& src_tex, bool keep_image);
+
+         bool init(
+            const char* pSrc_filename,
+            const char* pDst_filename,
+            texture_file_types::format dst_file_type,
+            bool lzma_stats);
+
          bool print(bool psnr_metrics, bool mip_stats, bool grayscale_sampling, const char *pCSVStatsFile = NULL) const;
 
          void clear();
@@ -33,6 +43,12 @@ namespace crnlib
          mipmapped_texture*               m_pInput_tex;
          mipmapped_texture                m_output_tex;
 
+         uint                       m_input_width;
+         uint                       m_input_height;
+         uint                       m_input_levels;
+         uint                       m_input_faces;
+         pixel_format               m_input_format;
+
          uint64                     m_input_file_size;
          uint                       m_total_input_pixels;
 
@@ -61,6 +77,7 @@ namespace crnlib
             m_debugging(false),
             m_param_debugging(false),
             m_no_stats(false),
+            m_image_stats(false),
             m_lzma_stats(false),
             m_status(false),
             m_canceled(false)
@@ -103,6 +120,9 @@ namespace crnlib
          bool                          m_param_debugging;
          bool                          m_no_stats;
 
+         // The image statistics compare the output to the input as it was before conversion, which needs a full copy of the input.
+         bool                          m_image_stats;
+
          bool                          m_lzma_stats;
          mutable bool                  m_status;
          mutable bool                  m_canceled;
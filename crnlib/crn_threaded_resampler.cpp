@@ -5,6 +5,10 @@
 #include "crn_resample_filters.h"
 #include "crn_threading.h"
 
+#if CRNLIB_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace crnlib
 {
    threaded_resampler::threaded_resampler(task_pool& tp) :
@@ -12,7 +16,8 @@ namespace crnlib
       m_pParams(NULL),
       m_pX_contribs(NULL),
       m_pY_contribs(NULL),
-      m_bytes_per_pixel(0)
+      m_bytes_per_pixel(0),
+      m_tmp_comps(0)
    {
    }
 
@@ -23,23 +28,46 @@ namespace crnlib
 
    void threaded_resampler::free_contrib_lists()
    {
-      if (m_pX_contribs)
+      for (uint i = 0; i < m_contrib_list_cache.size(); i++)
       {
-         crnlib_free(m_pX_contribs->p);
-         m_pX_contribs->p = NULL;
+         Resampler::Contrib_List* pContribs = m_contrib_list_cache[i].m_pContribs;
+
+         crnlib_free(pContribs->p);
+         pContribs->p = NULL;
 
-         crnlib_free(m_pX_contribs);
-         m_pX_contribs = NULL;
+         crnlib_free(pContribs);
       }
 
-      if (m_pY_contribs)
-      {
-         crnlib_free(m_pY_contribs->p);
-         m_pY_contribs->p = NULL;
+      m_contrib_list_cache.clear();
 
-         crnlib_free(m_pY_contribs);
-         m_pY_contribs = NULL;
+      m_pX_contribs = NULL;
+      m_pY_contribs = NULL;
+   }
+
+   Resampler::Contrib_List* threaded_resampler::get_contrib_list(uint src_size, uint dst_size, Resampler::Boundary_Op boundary_op, int filter_index, float filter_scale)
+   {
+      for (uint i = 0; i < m_contrib_list_cache.size(); i++)
+      {
+         const contrib_list_cache_entry& e = m_contrib_list_cache[i];
+         if ((e.m_src_size == src_size) && (e.m_dst_size == dst_size) && (e.m_boundary_op == boundary_op) && (e.m_filter_index == filter_index) && (e.m_filter_scale == filter_scale))
+            return e.m_pContribs;
       }
+
+      const resample_filter& filter = g_resample_filters[filter_index];
+
+      Resampler::Contrib_List* pContribs = Resampler::make_clist(src_size, dst_size, boundary_op, filter.func, filter.support, filter_scale, 0.0f);
+      if (!pContribs)
+         return NULL;
+
+      contrib_list_cache_entry* pEntry = m_contrib_list_cache.enlarge(1);
+      pEntry->m_src_size = src_size;
+      pEntry->m_dst_size = dst_size;
+      pEntry->m_boundary_op = boundary_op;
+      pEntry->m_filter_index = filter_index;
+      pEntry->m_filter_scale = filter_scale;
+      pEntry->m_pContribs = pContribs;
+
+      return pContribs;
    }
 
    void threaded_resampler::resample_x_task(uint64 data, void* pData_ptr)
@@ -47,6 +75,8 @@ namespace crnlib
       pData_ptr;
       const uint thread_index = (uint)data;
 
+      const uint tmp_pitch = m_pParams->m_dst_width * m_tmp_comps;
+
       for (uint src_y = 0; src_y < m_pParams->m_src_height; src_y++)
       {
          if (m_pTask_pool->get_num_threads())
@@ -58,26 +88,27 @@ namespace crnlib
          const Resampler::Contrib_List* pContribs = m_pX_contribs;
          const Resampler::Contrib_List* pContribs_end = m_pX_contribs + m_pParams->m_dst_width;
 
+         float* pDst = m_tmp_img.get_ptr() + tmp_pitch * src_y;
+
          switch (m_pParams->m_fmt)
          {
             case cPF_Y_F32:
             {
                const float* pSrc = reinterpret_cast<const float*>(static_cast<const uint8*>(m_pParams->m_pSrc_pixels) + m_pParams->m_src_pitch * src_y);
-               vec4F* pDst = m_tmp_img.get_ptr() + m_pParams->m_dst_width * src_y;
 
                do
                {
                   const Resampler::Contrib* p = pContribs->p;
                   const Resampler::Contrib* p_end = pContribs->p + pContribs->n;
 
-                  vec4F s(0.0f);
+                  float s = 0.0f;
 
                   while (p != p_end)
                   {
                      const uint src_pixel = p->pixel;
                      const float src_weight = p->weight;
 
-                     s[0] += pSrc[src_pixel] * src_weight;
+                     s += pSrc[src_pixel] * src_weight;
 
                      p++;
                   }
@@ -89,63 +120,65 @@ namespace crnlib
                break;
             }
             case cPF_RGBX_F32:
+            case cPF_RGBA_F32:
             {
-               const vec4F* pSrc = reinterpret_cast<const vec4F*>(static_cast<const uint8*>(m_pParams->m_pSrc_pixels) + m_pParams->m_src_pitch * src_y);
-               vec4F* pDst = m_tmp_img.get_ptr() + m_pParams->m_dst_width * src_y;
+               const float* pSrc = reinterpret_cast<const float*>(static_cast<const uint8*>(m_pParams->m_pSrc_pixels) + m_pParams->m_src_pitch * src_y);
 
                do
                {
                   const Resampler::Contrib* p = pContribs->p;
                   const Resampler::Contrib* p_end = pContribs->p + pContribs->n;
 
-                  vec4F s(0.0f);
+#if CRNLIB_USE_SSE2
+                  // All four channels of a source pixel are weighted by one instruction. RGBX's unused channel is ignored by resample_y_task().
+                  __m128 s = _mm_setzero_ps();
 
                   while (p != p_end)
                   {
-                     const float src_weight = p->weight;
-
-                     const vec4F& src_pixel = pSrc[p->pixel];
-
-                     s[0] += src_pixel[0] * src_weight;
-                     s[1] += src_pixel[1] * src_weight;
-                     s[2] += src_pixel[2] * src_weight;
-
+                     s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(pSrc + p->pixel * 4), _mm_set1_ps(p->weight)));
                      p++;
                   }
 
-                  *pDst++ = s;
-                  pContribs++;
-               } while (pContribs != pContribs_end);
+                  _mm_storeu_ps(pDst, s);
+#else
+                  vec4F s(0.0f);
 
-               break;
-            }
-            case cPF_RGBA_F32:
-            {
-               const vec4F* pSrc = reinterpret_cast<const vec4F*>(static_cast<const uint8*>(m_pParams->m_pSrc_pixels) + m_pParams->m_src_pitch * src_y);
-               vec4F* pDst = m_tmp_img.get_ptr() + m_pParams->m_dst_width * src_y;
+                  if (m_pParams->m_fmt == cPF_RGBX_F32)
+                  {
+                     while (p != p_end)
+                     {
+                        const float src_weight = p->weight;
 
-               do
-               {
-                  Resampler::Contrib* p = pContribs->p;
-                  Resampler::Contrib* p_end = pContribs->p + pContribs->n;
+                        const float* src_pixel = pSrc + p->pixel * 4;
 
-                  vec4F s(0.0f);
+                        s[0] += src_pixel[0] * src_weight;
+                        s[1] += src_pixel[1] * src_weight;
+                        s[2] += src_pixel[2] * src_weight;
 
-                  while (p != p_end)
+                        p++;
+                     }
+                  }
+                  else
                   {
-                     const float src_weight = p->weight;
+                     while (p != p_end)
+                     {
+                        const float src_weight = p->weight;
 
-                     const vec4F& src_pixel = pSrc[p->pixel];
+                        const float* src_pixel = pSrc + p->pixel * 4;
 
-                     s[0] += src_pixel[0] * src_weight;
-                     s[1] += src_pixel[1] * src_weight;
-                     s[2] += src_pixel[2] * src_weight;
-                     s[3] += src_pixel[3] * src_weight;
+                        s[0] += src_pixel[0] * src_weight;
+                        s[1] += src_pixel[1] * src_weight;
+                        s[2] += src_pixel[2] * src_weight;
+                        s[3] += src_pixel[3] * src_weight;
 
-                     p++;
+                        p++;
+                     }
                   }
 
-                  *pDst++ = s;
+                  memcpy(pDst, &s, sizeof(s));
+#endif
+
+                  pDst += 4;
                   pContribs++;
                } while (pContribs != pContribs_end);
 
@@ -156,13 +189,54 @@ namespace crnlib
       }
    }
 
+   // pDst[i] = pSrc[i] * weight (or += if accumulate is true), for a whole row of the intermediate image.
+   static inline void scale_row(float* pDst, const float* pSrc, float weight, uint n, bool accumulate)
+   {
+      uint i = 0;
+
+#if CRNLIB_USE_SSE2
+      const __m128 w = _mm_set1_ps(weight);
+      if (accumulate)
+      {
+         for ( ; (i + 4) <= n; i += 4)
+            _mm_storeu_ps(pDst + i, _mm_add_ps(_mm_loadu_ps(pDst + i), _mm_mul_ps(_mm_loadu_ps(pSrc + i), w)));
+      }
+      else
+      {
+         for ( ; (i + 4) <= n; i += 4)
+            _mm_storeu_ps(pDst + i, _mm_mul_ps(_mm_loadu_ps(pSrc + i), w));
+      }
+#endif
+
+      if (accumulate)
+      {
+         for ( ; i < n; i++)
+            pDst[i] += pSrc[i] * weight;
+      }
+      else
+      {
+         for ( ; i < n; i++)
+            pDst[i] = pSrc[i] * weight;
+      }
+   }
+
    void threaded_resampler::resample_y_task(uint64 data, void* pData_ptr)
    {
       pData_ptr;
 
       const uint thread_index = (uint)data;
 
-      crnlib::vector<vec4F> tmp(m_pParams->m_dst_width);
+      const uint tmp_pitch = m_pParams->m_dst_width * m_tmp_comps;
+
+      crnlib::vector<float> tmp(tmp_pitch);
+
+      const float l = m_pParams->m_sample_low;
+      const float h = m_pParams->m_sample_high;
+
+#if CRNLIB_USE_SSE2
+      const __m128 lo = _mm_set1_ps(l);
+      const __m128 hi = _mm_set1_ps(h);
+#endif
 
       for (uint dst_y = 0; dst_y < m_pParams->m_dst_height; dst_y++)
       {
@@ -174,88 +248,60 @@ namespace crnlib
 
          const Resampler::Contrib_List& contribs = m_pY_contribs[dst_y];
 
-         const vec4F* pSrc;
+         const float* pSrc;
 
          if (contribs.n == 1)
          {
-            pSrc = m_tmp_img.get_ptr() + m_pParams->m_dst_width * contribs.p[0].pixel;
+            pSrc = m_tmp_img.get_ptr() + tmp_pitch * contribs.p[0].pixel;
          }
          else
          {
             for (uint src_y_iter = 0; src_y_iter < contribs.n; src_y_iter++)
             {
-               const vec4F* p = m_tmp_img.get_ptr() + m_pParams->m_dst_width * contribs.p[src_y_iter].pixel;
+               const float* p = m_tmp_img.get_ptr() + tmp_pitch * contribs.p[src_y_iter].pixel;
                const float weight = contribs.p[src_y_iter].weight;
 
-               if (!src_y_iter)
-               {
-                  for (uint i = 0; i < m_pParams->m_dst_width; i++)
-                     tmp[i] = p[i] * weight;
-               }
-               else
-               {
-                  for (uint i = 0; i < m_pParams->m_dst_width; i++)
-                     tmp[i] += p[i] * weight;
-               }
+               scale_row(tmp.get_ptr(), p, weight, tmp_pitch, src_y_iter != 0);
             }
 
             pSrc = tmp.get_ptr();
          }
 
-         const vec4F* pSrc_end = pSrc + m_pParams->m_dst_width;
-
-         const float l = m_pParams->m_sample_low;
-         const float h = m_pParams->m_sample_high;
-
          switch (m_pParams->m_fmt)
          {
             case cPF_Y_F32:
             {
                float* pDst = reinterpret_cast<float*>(static_cast<uint8*>(m_pParams->m_pDst_pixels) + m_pParams->m_dst_pitch * dst_y);
 
-               do
-               {
-                  *pDst++ = math::clamp((*pSrc)[0], l, h);
-
-                  pSrc++;
-
-               } while (pSrc != pSrc_end);
+               uint x = 0;
+#if CRNLIB_USE_SSE2
+               for ( ; (x + 4) <= m_pParams->m_dst_width; x += 4)
+                  _mm_storeu_ps(pDst + x, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pSrc + x), lo), hi));
+#endif
+               for ( ; x < m_pParams->m_dst_width; x++)
+                  pDst[x] = math::clamp(pSrc[x], l, h);
 
                break;
             }
             case cPF_RGBX_F32:
-            {
-               vec4F* pDst = reinterpret_cast<vec4F*>(static_cast<uint8*>(m_pParams->m_pDst_pixels) + m_pParams->m_dst_pitch * dst_y);
-
-               do
-               {
-                  (*pDst)[0] = math::clamp((*pSrc)[0], l, h);
-                  (*pDst)[1] = math::clamp((*pSrc)[1], l, h);
-                  (*pDst)[2] = math::clamp((*pSrc)[2], l, h);
-                  (*pDst)[3] = h;
-
-                  pSrc++;
-                  pDst++;
-
-               } while (pSrc != pSrc_end);
-
-               break;
-            }
             case cPF_RGBA_F32:
             {
-               vec4F* pDst = reinterpret_cast<vec4F*>(static_cast<uint8*>(m_pParams->m_pDst_pixels) + m_pParams->m_dst_pitch * dst_y);
+               float* pDst = reinterpret_cast<float*>(static_cast<uint8*>(m_pParams->m_pDst_pixels) + m_pParams->m_dst_pitch * dst_y);
+               const bool has_alpha = (m_pParams->m_fmt == cPF_RGBA_F32);
 
-               do
+               for (uint x = 0; x < m_pParams->m_dst_width; x++, pSrc += 4, pDst += 4)
                {
-                  (*pDst)[0] = math::clamp((*pSrc)[0], l, h);
-                  (*pDst)[1] = math::clamp((*pSrc)[1], l, h);
-                  (*pDst)[2] = math::clamp((*pSrc)[2], l, h);
-                  (*pDst)[3] = math::clamp((*pSrc)[3], l, h);
-
-                  pSrc++;
-                  pDst++;
-
-               } while (pSrc != pSrc_end);
+#if CRNLIB_USE_SSE2
+                  _mm_storeu_ps(pDst, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pSrc), lo), hi));
+#else
+                  pDst[0] = math::clamp(pSrc[0], l, h);
+                  pDst[1] = math::clamp(pSrc[1], l, h);
+                  pDst[2] = math::clamp(pSrc[2], l, h);
+                  pDst[3] = math::clamp(pSrc[3], l, h);
+#endif
+                  if (!has_alpha)
+                     pDst[3] = h;
+               }
 
                break;
             }
@@ -266,8 +312,6 @@ namespace crnlib
 
    bool threaded_resampler::resample(const params& p)
    {
-      free_contrib_lists();
-
       m_pParams = &p;
 
       CRNLIB_ASSERT(m_pParams->m_src_width && m_pParams->m_src_height);
@@ -277,10 +321,12 @@ namespace crnlib
       {
          case cPF_Y_F32:
             m_bytes_per_pixel = 4;
+            m_tmp_comps = 1;
             break;
          case cPF_RGBX_F32:
          case cPF_RGBA_F32:
             m_bytes_per_pixel = 16;
+            m_tmp_comps = 4;
             break;
          default:
             CRNLIB_ASSERT(false);
@@ -291,17 +337,15 @@ namespace crnlib
       if (filter_index < 0)
          return false;
 
-      const resample_filter& filter = g_resample_filters[filter_index];
-
-      m_pX_contribs = Resampler::make_clist(m_pParams->m_src_width, m_pParams->m_dst_width, m_pParams->m_boundary_op, filter.func, filter.support, p.m_filter_x_scale, 0.0f);
+      m_pX_contribs = get_contrib_list(m_pParams->m_src_width, m_pParams->m_dst_width, m_pParams->m_boundary_op, filter_index, p.m_filter_x_scale);
       if (!m_pX_contribs)
          return false;
 
-      m_pY_contribs = Resampler::make_clist(m_pParams->m_src_height, m_pParams->m_dst_height, m_pParams->m_boundary_op, filter.func, filter.support, p.m_filter_y_scale, 0.0f);
+      m_pY_contribs = get_contrib_list(m_pParams->m_src_height, m_pParams->m_dst_height, m_pParams->m_boundary_op, filter_index, p.m_filter_y_scale);
       if (!m_pY_contribs)
          return false;
 
-      if (!m_tmp_img.try_resize(m_pParams->m_dst_width * m_pParams->m_src_height))
+      if (!m_tmp_img.try_resize(m_pParams->m_dst_width * m_pParams->m_src_height * m_tmp_comps))
          return false;
 
       for (uint i = 0; i <= m_pTask_pool->get_num_threads(); i++)
@@ -312,8 +356,7 @@ namespace crnlib
          m_pTask_pool->queue_object_task(this, &threaded_resampler::resample_y_task, i, NULL);
       m_pTask_pool->join();
 
-      m_tmp_img.clear();
-      free_contrib_lists();
+      m_pParams = NULL;
 
       return true;
    }
@@ -65,6 +65,8 @@ namespace crnlib
          float                   m_filter_y_scale;
       };
 
+      // The contribution lists are cached until the resampler is destroyed, so resampling many images of the same
+      // dimensions (cubemap faces, mip chains) only builds them once.
       bool resample(const params& p);
 
    private:
@@ -76,8 +78,23 @@ namespace crnlib
       Resampler::Contrib_List*   m_pY_contribs;
       uint                       m_bytes_per_pixel;
 
-      crnlib::vector<vec4F>       m_tmp_img;
+      // Horizontally resampled rows, m_tmp_comps floats per pixel (Y_F32 rows are packed, so the vertical pass works on 4 pixels at a time).
+      uint                       m_tmp_comps;
+      crnlib::vector<float>      m_tmp_img;
 
+      struct contrib_list_cache_entry
+      {
+         uint                       m_src_size;
+         uint                       m_dst_size;
+         Resampler::Boundary_Op     m_boundary_op;
+         int                        m_filter_index;
+         float                      m_filter_scale;
+         Resampler::Contrib_List*   m_pContribs;
+      };
+
+      crnlib::vector<contrib_list_cache_entry> m_contrib_list_cache;
+
+      Resampler::Contrib_List* get_contrib_list(uint src_size, uint dst_size, Resampler::Boundary_Op boundary_op, int filter_index, float filter_scale);
       void free_contrib_lists();
 
       void resample_x_task(uint64 data, void* pData_ptr);
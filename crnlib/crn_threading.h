@@ -1,5 +1,6 @@
 // File: crn_threading.h
 // This software is in the public domain. Please see license.txt.
+#pragma once
 
 #if CRNLIB_USE_WIN32_API
    #include "crn_threading_win32.h"
@@ -8,3 +9,59 @@
 #else
    #include "crn_threading_null.h"
 #endif
+
+namespace crnlib
+{
+   // Load balanced parallel loop helper. The tasks of a loop share one parallel_range, and each task pulls contiguous runs of
+   // indices from an atomic counter until the range is exhausted. Threads which draw expensive items simply claim fewer runs,
+   // instead of idling at join() while others finish a fixed interleaved share.
+   //
+   // Typical use, from each of the (get_num_threads() + 1) queued tasks:
+   //    for (uint i = 0, end = 0; range.next(i, end); i++)
+   //       process(i);
+   class parallel_range
+   {
+      CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(parallel_range);
+
+   public:
+      // Aim for about this many runs per task: enough to even out uneven items, few enough to keep the counter uncontended.
+      enum { cRunsPerTask = 16 };
+
+      inline parallel_range() : m_next(0), m_end(0), m_run_size(1) { }
+      inline parallel_range(uint begin, uint end, uint num_tasks) { init(begin, end, num_tasks); }
+
+      inline void init(uint begin, uint end, uint num_tasks)
+      {
+         CRNLIB_ASSERT((begin <= end) && (end <= (cUINT32_MAX >> 1)));
+
+         m_next = begin;
+         m_end = end;
+         m_run_size = math::maximum<uint>(1U, (end - begin) / (math::maximum<uint>(1U, num_tasks) * cRunsPerTask));
+      }
+
+      // index/end is the caller's current run. Returns true if index is still inside it, otherwise claims the next run into
+      // index/end. Returns false once every run has been handed out. Start with index == end.
+      inline bool next(uint& index, uint& end)
+      {
+         if (index < end)
+            return true;
+
+         if (static_cast<uint>(m_next) >= m_end)
+            return false;
+
+         const uint first = static_cast<uint>(atomic_exchange_add32(&m_next, m_run_size));
+         if (first >= m_end)
+            return false;
+
+         index = first;
+         end = math::minimum<uint>(m_end, first + m_run_size);
+         return true;
+      }
+
+   private:
+      volatile atomic32_t m_next;
+      uint m_end;
+      uint m_run_size;
+   };
+
+} // namespace crnlib
@@ -147,6 +147,9 @@ namespace crnlib
 
       inline uint get_num_threads() const { return 0; }
       inline uint get_num_outstanding_tasks() const { return 0; }
+      static inline uint32 get_total_queued_tasks() { return 0; }
+      static inline bool configure(uint num_threads, uint64 affinity_mask) { num_threads, affinity_mask; return true; }
+      static inline uint get_num_shared_threads() { return 0; }
 
       // C-style task callback
       typedef void (*task_callback_func)(uint64 data, void* pData_ptr);
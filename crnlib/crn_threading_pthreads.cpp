@@ -168,19 +168,36 @@ namespace crnlib
       int status;
       if (milliseconds == cUINT32_MAX)
       {
-         status = sem_wait(&m_sem);
+         do
+         {
+            status = sem_wait(&m_sem);
+         } while ((status) && (errno == EINTR));
       }
       else
       {
+#ifdef WIN32
          struct timespec interval;
          interval.tv_sec = milliseconds / 1000;
          interval.tv_nsec = (milliseconds % 1000) * 1000000L;
          status = sem_timedwait(&m_sem, &interval);
+#else
+         // sem_timedwait() takes an absolute deadline.
+         struct timespec deadline;
+         clock_gettime(CLOCK_REALTIME, &deadline);
+         deadline.tv_sec += milliseconds / 1000;
+         deadline.tv_nsec += (milliseconds % 1000) * 1000000L;
+         if (deadline.tv_nsec >= 1000000000L)
+         {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+         }
+         status = sem_timedwait(&m_sem, &deadline);
+#endif
       }
 
       if (status)
       {
-         if (errno != ETIMEDOUT)
+         if ((errno != ETIMEDOUT) && (errno != EINTR))
          {
             CRNLIB_FAIL("semaphore: sem_wait() or sem_timedwait() failed");
          }
@@ -219,27 +236,80 @@ namespace crnlib
       }
    }
 
+   volatile atomic32_t task_pool::g_total_queued_tasks;
+
+   // Worker threads shared by all task pools. g_shared_thread_mutex guards the threads, their configuration, and attaching or
+   // detaching pools. The shared threads themselves never take it.
+   static mutex g_shared_thread_mutex;
+   static pthread_t g_shared_threads[task_pool::cMaxThreads];
+   static uint g_num_shared_threads;
+   static uint g_config_num_threads;
+   static uint64 g_config_affinity_mask;
+   static semaphore g_tasks_available(0, 32767);
+   static volatile atomic32_t g_shared_threads_exit_flag;
+
+   // Holds the shared thread's index + 1 on the shared threads, 0 on any other thread.
+   static pthread_key_t g_shared_thread_index_key;
+   static bool g_shared_thread_index_key_created;
+
+   // Attached pools live in a fixed table the shared threads scan without locking. A thread bumps a slot's reader count before it
+   // reads the slot's pool, and detach() waits for the count to drop to 0 after clearing the slot, so a pool's deques can't be freed
+   // while a shared thread is looking at them.
+   struct attached_pool_slot
+   {
+      task_pool* volatile m_pPool;
+      volatile atomic32_t m_num_readers;
+   };
+
+   const uint cMaxAttachedPools = 1024;
+   static attached_pool_slot g_attached_pool_slots[cMaxAttachedPools];
+
+   // Number of slots the shared threads scan (the highest slot used since the threads were started + 1).
+   static volatile atomic32_t g_num_attached_pool_slots;
+
+   // The shared threads are started by the first attached pool, and then live until the process exits or configure() replaces them.
+   // Creating them per pool would respawn every thread for each top level pool (each level packed, each mip chain generated, etc).
+   static bool g_shared_threads_started;
+   static uint g_num_attached_pools;
+
+   // Stops the shared threads before the state above is destroyed (statics are destroyed in reverse order).
+   class task_pool_shared_threads_cleanup
+   {
+   public:
+      ~task_pool_shared_threads_cleanup()
+      {
+         scoped_mutex lock(g_shared_thread_mutex);
+         task_pool::stop_shared_threads();
+      }
+   };
+   static task_pool_shared_threads_cleanup g_shared_threads_cleanup;
+
    task_pool::task_pool() :
+      m_pDeques(NULL),
+      m_num_deques(0),
+      m_next_deque(0),
       m_num_threads(0),
-      m_tasks_available(0, 32767),
+      m_initialized(false),
+      m_attached_slot(-1),
       m_all_tasks_completed(0, 1),
       m_total_submitted_tasks(0),
-      m_total_completed_tasks(0),
-      m_exit_flag(false)
+      m_total_completed_tasks(0)
    {
-      utils::zero_object(m_threads);
+      bool status = init(0);
+      CRNLIB_VERIFY(status);
    }
 
    task_pool::task_pool(uint num_threads) :
+      m_pDeques(NULL),
+      m_num_deques(0),
+      m_next_deque(0),
       m_num_threads(0),
-      m_tasks_available(0, 32767),
+      m_initialized(false),
+      m_attached_slot(-1),
       m_all_tasks_completed(0, 1),
       m_total_submitted_tasks(0),
-      m_total_completed_tasks(0),
-      m_exit_flag(false)
+      m_total_completed_tasks(0)
    {
-      utils::zero_object(m_threads);
-
       bool status = init(num_threads);
       CRNLIB_VERIFY(status);
    }
@@ -256,51 +326,284 @@ namespace crnlib
 
       deinit();
 
-      bool succeeded = true;
+      // Tasks queued to a pool without helper threads (or one which couldn't be attached) are simply executed by join().
+      if ((!num_threads) || (!attach(this)))
+      {
+         m_pDeques = crnlib_new_array< tsdeque<task> >(1);
+         if (!m_pDeques)
+            return false;
+         m_num_deques = 1;
+      }
+
+      m_num_threads = num_threads;
+      m_initialized = true;
+
+      return true;
+   }
+
+   void task_pool::deinit()
+   {
+      if (m_initialized)
+         join();
+
+      if (m_attached_slot >= 0)
+         detach(this);
+
+      // Wait for the thread which completed the last task to stop touching the pool.
+      m_completion_lock.lock();
+      m_completion_lock.unlock();
+
+      while (m_all_tasks_completed.wait(0))
+      {
+      }
+
+      crnlib_delete_array(m_pDeques);
+      m_pDeques = NULL;
+      m_num_deques = 0;
+      m_next_deque = 0;
 
       m_num_threads = 0;
-      while (m_num_threads < num_threads)
+      m_initialized = false;
+
+      m_total_submitted_tasks = 0;
+      m_total_completed_tasks = 0;
+   }
+
+   bool task_pool::configure(uint num_threads, uint64 affinity_mask)
+   {
+      scoped_mutex lock(g_shared_thread_mutex);
+
+      if (g_num_attached_pools)
+         return false;
+
+      stop_shared_threads();
+
+      g_config_num_threads = math::minimum<uint>(num_threads, cMaxThreads);
+      g_config_affinity_mask = affinity_mask;
+      return true;
+   }
+
+   uint task_pool::get_num_shared_threads()
+   {
+      scoped_mutex lock(g_shared_thread_mutex);
+
+      if (g_shared_threads_started)
+         return g_num_shared_threads;
+
+      return g_config_num_threads ? g_config_num_threads : crn_get_max_helper_threads();
+   }
+
+   // Gives the pool one deque per shared thread and publishes it to the shared threads, starting them on first use.
+   // Returns false if the pool can't be attached, in which case the caller executes its tasks.
+   bool task_pool::attach(task_pool* pPool)
+   {
+      scoped_mutex lock(g_shared_thread_mutex);
+
+      uint slot = 0;
+      while ((slot < cMaxAttachedPools) && (g_attached_pool_slots[slot].m_pPool))
+         slot++;
+      if (slot == cMaxAttachedPools)
+         return false;
+
+      if (!g_shared_threads_started)
+         start_shared_threads();
+
+      if (g_num_shared_threads)
+         pPool->m_pDeques = crnlib_new_array< tsdeque<task> >(g_num_shared_threads);
+
+      if (!pPool->m_pDeques)
+         return false;
+
+      pPool->m_num_deques = g_num_shared_threads;
+      pPool->m_attached_slot = slot;
+      g_num_attached_pools++;
+
+      // The exchange is a full barrier, so the pool's deques are visible before the pool is.
+      atomic_exchange32(&g_num_attached_pool_slots, math::maximum<atomic32_t>(g_num_attached_pool_slots, slot + 1));
+      g_attached_pool_slots[slot].m_pPool = pPool;
+
+      return true;
+   }
+
+   // The pool must have been joined.
+   void task_pool::detach(task_pool* pPool)
+   {
+      scoped_mutex lock(g_shared_thread_mutex);
+
+      attached_pool_slot& slot = g_attached_pool_slots[pPool->m_attached_slot];
+      slot.m_pPool = NULL;
+
+      // Wait for the shared threads which read the slot before it was cleared (atomic_add32() is a full barrier).
+      while (atomic_add32(&slot.m_num_readers, 0))
+         crnlib_yield_processor();
+
+      pPool->m_attached_slot = -1;
+
+      // The slots are all free again, so the shared threads can stop scanning them.
+      if (!--g_num_attached_pools)
+         atomic_exchange32(&g_num_attached_pool_slots, 0);
+   }
+
+   // Caller must hold g_shared_thread_mutex. If some threads can't be created the pools still work, join() executes whatever isn't picked up.
+   void task_pool::start_shared_threads()
+   {
+      if (!g_shared_thread_index_key_created)
       {
-         int status = pthread_create(&m_threads[m_num_threads], NULL, thread_func, this);
-         if (status)
-         {
-            succeeded = false;
+         if (pthread_key_create(&g_shared_thread_index_key, NULL))
+            return;
+         g_shared_thread_index_key_created = true;
+      }
+
+      const uint num_threads = g_config_num_threads ? g_config_num_threads : crn_get_max_helper_threads();
+
+      g_num_shared_threads = 0;
+      while (g_num_shared_threads < num_threads)
+      {
+         pthread_t& thread = g_shared_threads[g_num_shared_threads];
+         if (pthread_create(&thread, NULL, thread_func, reinterpret_cast<void*>(static_cast<ptr_bits_t>(g_num_shared_threads))))
             break;
+
+#if defined(__linux__)
+         if (g_config_affinity_mask)
+         {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            for (uint i = 0; i < 64; i++)
+               if (g_config_affinity_mask & (1ULL << i))
+                  CPU_SET(i, &cpu_set);
+            pthread_setaffinity_np(thread, sizeof(cpu_set), &cpu_set);
          }
+#endif
 
-         m_num_threads++;
+         g_num_shared_threads++;
       }
 
-      if (!succeeded)
+      g_shared_threads_started = true;
+   }
+
+   // Caller must hold g_shared_thread_mutex, and no pools may be attached.
+   void task_pool::stop_shared_threads()
+   {
+      if (g_num_shared_threads)
+      {
+         atomic_exchange32(&g_shared_threads_exit_flag, true);
+
+         g_tasks_available.release(g_num_shared_threads);
+
+         for (uint i = 0; i < g_num_shared_threads; i++)
+            pthread_join(g_shared_threads[i], NULL);
+
+         g_num_shared_threads = 0;
+
+         atomic_exchange32(&g_shared_threads_exit_flag, false);
+      }
+
+      // Consume any semaphore counts left over from tasks which were executed by join().
+      while (g_tasks_available.wait(0))
+      {
+      }
+
+      g_shared_threads_started = false;
+   }
+
+   bool task_pool::push_task(const task& queued_tsk)
+   {
+      atomic_increment32(&m_total_submitted_tasks);
+      atomic_increment32(&g_total_queued_tasks);
+
+      task tsk(queued_tsk);
+      if (crnlib_arena_active())
+         tsk.m_flags |= cTaskFlagArena;
+
+      if (!m_initialized)
+      {
+         // The pool has been deinitialized - just execute the task on the caller's thread.
+         process_task(tsk);
+         return true;
+      }
+
+      // Nested tasks stay on the queuing shared thread's deque, everything else is spread across the deques.
+      uint deque_index = 0;
+      if (m_num_deques > 1)
       {
-         deinit();
+         deque_index = static_cast<uint>(reinterpret_cast<ptr_bits_t>(pthread_getspecific(g_shared_thread_index_key)));
+         if (deque_index)
+            deque_index--;
+         else
+            deque_index = static_cast<uint>(atomic_increment32(&m_next_deque)) % m_num_deques;
+      }
+
+      if (!m_pDeques[deque_index].try_push_back(tsk))
+      {
+         atomic_increment32(&m_total_completed_tasks);
          return false;
       }
 
+      // If the semaphore is saturated the shared threads are already busy, and join() executes whatever they don't get to.
+      if (m_attached_slot >= 0)
+         g_tasks_available.try_release(1);
+
       return true;
    }
 
-   void task_pool::deinit()
+   // Called by join(): takes the most recently queued task from any of the pool's deques.
+   bool task_pool::pop_task(task& tsk)
+   {
+      for (uint i = 0; i < m_num_deques; i++)
+         if ((m_pDeques[i].size()) && (m_pDeques[i].pop_back(tsk)))
+            return true;
+
+      return false;
+   }
+
+   // Called by the shared threads: prefers the most recently queued task on the thread's own deque, otherwise steals the oldest task from another deque.
+   bool task_pool::take_task(uint thread_index, task& tsk)
    {
-      if (m_num_threads)
+      if ((m_pDeques[thread_index].size()) && (m_pDeques[thread_index].pop_back(tsk)))
+         return true;
+
+      for (uint i = 1; i < m_num_deques; i++)
       {
-         join();
+         uint victim = thread_index + i;
+         if (victim >= m_num_deques)
+            victim -= m_num_deques;
+
+         if ((m_pDeques[victim].size()) && (m_pDeques[victim].pop_front(tsk)))
+            return true;
+      }
+
+      return false;
+   }
 
-         atomic_exchange32(&m_exit_flag, true);
+   // Scans the attached pools without locking, starting at next_slot so each shared thread services the pools round robin.
+   bool task_pool::steal_task(uint thread_index, uint& next_slot, task_pool*& pPool, task& tsk)
+   {
+      const uint num_slots = g_num_attached_pool_slots;
+      for (uint i = 0; i < num_slots; i++)
+      {
+         const uint index = (next_slot + i) % num_slots;
 
-         m_tasks_available.release(m_num_threads);
+         attached_pool_slot& slot = g_attached_pool_slots[index];
+         if (!slot.m_pPool)
+            continue;
 
-         for (uint i = 0; i < m_num_threads; i++)
-            pthread_join(m_threads[i], NULL);
+         atomic_increment32(&slot.m_num_readers);
 
-         m_num_threads = 0;
+         task_pool* pSlot_pool = slot.m_pPool;
+         const bool found = (pSlot_pool) && (pSlot_pool->take_task(thread_index, tsk));
 
-         atomic_exchange32(&m_exit_flag, false);
+         atomic_decrement32(&slot.m_num_readers);
+
+         // The pool can't go away now, it has an outstanding task.
+         if (found)
+         {
+            pPool = pSlot_pool;
+            next_slot = index + 1;
+            return true;
+         }
       }
 
-      m_task_stack.clear();
-      m_total_submitted_tasks = 0;
-      m_total_completed_tasks = 0;
+      return false;
    }
 
    bool task_pool::queue_task(task_callback_func pFunc, uint64 data, void* pData_ptr)
@@ -313,16 +616,7 @@ namespace crnlib
       tsk.m_pData_ptr = pData_ptr;
       tsk.m_flags = 0;
 
-      atomic_increment32(&m_total_submitted_tasks);
-      if (!m_task_stack.try_push(tsk))
-      {
-         atomic_increment32(&m_total_completed_tasks);
-         return false;
-      }
-
-      m_tasks_available.release(1);
-
-      return true;
+      return push_task(tsk);
    }
 
    // It's the object's responsibility to delete pObj within the execute_task() method, if needed!
@@ -336,24 +630,22 @@ namespace crnlib
       tsk.m_pData_ptr = pData_ptr;
       tsk.m_flags = cTaskFlagObject;
 
-      atomic_increment32(&m_total_submitted_tasks);
-      if (!m_task_stack.try_push(tsk))
-      {
-         atomic_increment32(&m_total_completed_tasks);
-         return false;
-      }
-
-      m_tasks_available.release(1);
-
-      return true;
+      return push_task(tsk);
    }
 
    void task_pool::process_task(task& tsk)
    {
-      if (tsk.m_flags & cTaskFlagObject)
-         tsk.m_pObj->execute_task(tsk.m_data, tsk.m_pData_ptr);
-      else
-         tsk.m_callback(tsk.m_data, tsk.m_pData_ptr);
+      {
+         // The shared threads keep their arena chunk between tasks.
+         mem_arena_scope arena_scope((tsk.m_flags & cTaskFlagArena) != 0, true);
+
+         if (tsk.m_flags & cTaskFlagObject)
+            tsk.m_pObj->execute_task(tsk.m_data, tsk.m_pData_ptr);
+         else
+            tsk.m_callback(tsk.m_data, tsk.m_pData_ptr);
+      }
+
+      scoped_spinlock lock(m_completion_lock);
 
       if (atomic_increment32(&m_total_completed_tasks) == m_total_submitted_tasks)
       {
@@ -364,45 +656,71 @@ namespace crnlib
 
    void task_pool::join()
    {
-      // Try to steal any outstanding tasks. This could cause one or more worker threads to wake up and immediately go back to sleep, which is wasteful but should be harmless.
+      // Execute any of our tasks the shared threads haven't started yet.
       task tsk;
-      while (m_task_stack.pop(tsk))
+      while (pop_task(tsk))
          process_task(tsk);
 
-      // At this point the task stack is empty.
-      // Now wait for all concurrent tasks to complete. The m_all_tasks_completed semaphore has a max count of 1, so it's possible it could have saturated to 1 as the tasks
-      // where issued and asynchronously completed, so this loop may iterate a few times.
-      const int total_submitted_tasks = atomic_add32(&m_total_submitted_tasks, 0);
-      while (m_total_completed_tasks != total_submitted_tasks)
+      // Now wait for all concurrent tasks to complete. The completed count is read first: running tasks may still queue more tasks,
+      // but they're counted as submitted before the running task completes, so the counts can only match once everything is done.
+      for ( ; ; )
       {
-         // If the previous (m_total_completed_tasks != total_submitted_tasks) check failed the semaphore MUST be eventually signalled once the last task completes.
-         // So I think this can actually be an INFINITE delay, but it shouldn't really matter if it's 1ms.
+         const int total_completed_tasks = atomic_add32(&m_total_completed_tasks, 0);
+         if (total_completed_tasks == atomic_add32(&m_total_submitted_tasks, 0))
+            break;
+
+         // Help out with any tasks the running tasks have queued up.
+         if (pop_task(tsk))
+         {
+            process_task(tsk);
+            continue;
+         }
+
+         // The semaphore is signalled once the last task completes, the timeout is just a safety net.
          m_all_tasks_completed.wait(1);
       }
    }
 
    void * task_pool::thread_func(void *pContext)
    {
-      task_pool* pPool = static_cast<task_pool*>(pContext);
+      const uint thread_index = static_cast<uint>(reinterpret_cast<ptr_bits_t>(pContext));
+
+      pthread_setspecific(g_shared_thread_index_key, reinterpret_cast<void*>(static_cast<ptr_bits_t>(thread_index + 1)));
+
       task tsk;
+      task_pool* pPool = NULL;
+      uint next_slot = 0;
 
       for ( ; ; )
       {
-         if (!pPool->m_tasks_available.wait())
+         if (!g_tasks_available.wait())
             break;
 
-         if (pPool->m_exit_flag)
+         if (g_shared_threads_exit_flag)
             break;
 
-         if (pPool->m_task_stack.pop(tsk))
-         {
+         // Keep going while there's work, the semaphore may have saturated. If the joining threads have already executed
+         // everything there's nothing to do.
+         while (steal_task(thread_index, next_slot, pPool, tsk))
             pPool->process_task(tsk);
-         }
       }
 
+      crnlib_release_thread_arena();
+
       return NULL;
    }
 
+   uint crn_get_max_helper_threads()
+   {
+      if (g_number_of_processors > 1)
+      {
+         // use all CPU's
+         return CRNLIB_MIN((int)task_pool::cMaxThreads, (int)g_number_of_processors - 1);
+      }
+
+      return 0;
+   }
+
 } // namespace crnlib
 
 #endif // CRNLIB_USE_PTHREADS_API
@@ -155,20 +155,141 @@ namespace crnlib
       int m_top;
    };
 
+   // Double ended, growable queue of tasks. The joining thread pops at the back (LIFO, so recently queued work is still in cache),
+   // while the worker threads take from the front. A spinlock is sufficient because the critical sections are tiny.
+   template<typename T>
+   class tsdeque
+   {
+      CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(tsdeque);
+
+   public:
+      inline tsdeque() :
+         m_head(0),
+         m_size(0)
+      {
+      }
+
+      inline ~tsdeque()
+      {
+      }
+
+      inline void clear()
+      {
+         m_spinlock.lock();
+         m_head = 0;
+         m_size = 0;
+         m_spinlock.unlock();
+      }
+
+      inline uint size() const
+      {
+         return m_size;
+      }
+
+      inline bool try_push_back(const T& obj)
+      {
+         bool result = true;
+         m_spinlock.lock();
+         if ((m_size == m_buf.size()) && (!grow()))
+            result = false;
+         else
+         {
+            m_buf[(m_head + m_size) & (m_buf.size() - 1)] = obj;
+            m_size++;
+         }
+         m_spinlock.unlock();
+         return result;
+      }
+
+      inline bool pop_back(T& obj)
+      {
+         bool result = false;
+         m_spinlock.lock();
+         if (m_size)
+         {
+            m_size--;
+            obj = m_buf[(m_head + m_size) & (m_buf.size() - 1)];
+            result = true;
+         }
+         m_spinlock.unlock();
+         return result;
+      }
+
+      inline bool pop_front(T& obj)
+      {
+         bool result = false;
+         m_spinlock.lock();
+         if (m_size)
+         {
+            obj = m_buf[m_head];
+            m_head = (m_head + 1) & (m_buf.size() - 1);
+            m_size--;
+            result = true;
+         }
+         m_spinlock.unlock();
+         return result;
+      }
+
+   private:
+      spinlock m_spinlock;
+      crnlib::vector<T> m_buf;
+      uint m_head;
+      volatile uint m_size;
+
+      // Doubles the ring buffer's capacity (always a power of 2), unwrapping the existing contents. Caller must hold the lock.
+      bool grow()
+      {
+         const uint old_capacity = m_buf.size();
+         const uint new_capacity = old_capacity ? (old_capacity * 2) : 64;
+
+         crnlib::vector<T> new_buf;
+         if (!new_buf.try_resize(new_capacity))
+            return false;
+
+         for (uint i = 0; i < m_size; i++)
+            new_buf[i] = m_buf[(m_head + i) & (old_capacity - 1)];
+
+         m_buf.swap(new_buf);
+         m_head = 0;
+         return true;
+      }
+   };
+
+   // Task pools are lightweight handles: the worker threads are shared by every task_pool in the process. The shared threads are
+   // created on first use, and live until the process exits or configure() replaces them. Each pool has one task deque per shared
+   // thread, nested tasks stay on the queuing thread's deque and idle threads steal from the other deques of every pool. join() only
+   // runs and waits for the tasks queued to its own pool, so pools may be used concurrently, and tasks may safely create and join
+   // their own pools.
    class task_pool
    {
+      CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(task_pool);
+
    public:
       task_pool();
       task_pool(uint num_threads);
       ~task_pool();
 
-      enum { cMaxThreads = 16 };
+      // Sanity limit only - thread count is normally g_number_of_processors - 1.
+      enum { cMaxThreads = 256 };
+
+      // num_threads is the number of helper threads callers should split their work for (get_num_threads()). It doesn't create
+      // any threads. With 0 helper threads all tasks are executed by the thread calling join().
       bool init(uint num_threads);
       void deinit();
 
       inline uint get_num_threads() const { return m_num_threads; }
       inline uint32 get_num_outstanding_tasks() const { return m_total_submitted_tasks - m_total_completed_tasks; }
 
+      // Number of tasks queued to all task pools so far (used by the compression stats).
+      static inline uint32 get_total_queued_tasks() { return g_total_queued_tasks; }
+
+      // Sets the number of shared worker threads (0 = g_number_of_processors - 1) and their CPU affinity (0 = any CPU).
+      // Fails if any pool is currently initialized with helper threads.
+      static bool configure(uint num_threads, uint64 affinity_mask);
+
+      // Number of shared worker threads, whether or not they've been created yet.
+      static uint get_num_shared_threads();
+
       // C-style task callback
       typedef void (*task_callback_func)(uint64 data, void* pData_ptr);
       bool queue_task(task_callback_func pFunc, uint64 data = 0, void* pData_ptr = NULL);
@@ -188,6 +309,8 @@ namespace crnlib
       template<typename S, typename T>
       inline bool queue_multiple_object_tasks(S* pObject, T pObject_method, uint64 first_data, uint num_tasks, void* pData_ptr = NULL);
 
+      // Waits for all outstanding tasks (if any) queued to this pool to complete.
+      // The calling thread executes any of the pool's tasks which haven't been started by the shared threads yet.
       void join();
 
    private:
@@ -207,29 +330,49 @@ namespace crnlib
          uint m_flags;
       };
 
-      tsstack<task, cMaxThreads> m_task_stack;
+      // One deque per shared thread (a single deque if the pool isn't attached). Tasks queued by other threads are spread round robin.
+      tsdeque<task>* m_pDeques;
+      uint m_num_deques;
+      volatile atomic32_t m_next_deque;
 
       uint m_num_threads;
-      pthread_t m_threads[cMaxThreads];
+      bool m_initialized;
 
-      // Signalled whenever a task is queued up.
-      semaphore m_tasks_available;
+      // Index of the pool's slot in the attached pool table while the pool is registered with the shared threads, otherwise -1.
+      int m_attached_slot;
 
       // Signalled when all outstanding tasks are completed.
       semaphore m_all_tasks_completed;
 
+      // Held while a task's completion is signalled, so deinit() can't free the pool under the completing thread.
+      spinlock m_completion_lock;
+
       enum task_flags
       {
-         cTaskFlagObject = 1
+         cTaskFlagObject = 1,
+
+         // Queued from inside a mem_arena_scope.
+         cTaskFlagArena = 2
       };
 
       volatile atomic32_t m_total_submitted_tasks;
       volatile atomic32_t m_total_completed_tasks;
-      volatile atomic32_t m_exit_flag;
 
-      void process_task(task& tsk);
+      static volatile atomic32_t g_total_queued_tasks;
 
+      bool push_task(const task& tsk);
+      void process_task(task& tsk);
+      bool pop_task(task& tsk);
+      bool take_task(uint thread_index, task& tsk);
+
+      static bool attach(task_pool* pPool);
+      static void detach(task_pool* pPool);
+      static void start_shared_threads();
+      static void stop_shared_threads();
+      static bool steal_task(uint thread_index, uint& next_slot, task_pool*& pPool, task& tsk);
       static void* thread_func(void *pContext);
+
+      friend class task_pool_shared_threads_cleanup;
    };
 
    enum object_task_flags
@@ -322,22 +465,15 @@ namespace crnlib
          tsk.m_pData_ptr = pData_ptr;
          tsk.m_flags = cTaskFlagObject;
 
-         atomic_increment32(&m_total_submitted_tasks);
-
-         if (!m_task_stack.try_push(tsk))
+         if (!push_task(tsk))
          {
-            atomic_increment32(&m_total_completed_tasks);
+            crnlib_delete(tsk.m_pObj);
 
             status = false;
             break;
          }
       }
 
-      if (i)
-      {
-         m_tasks_available.release(i);
-      }
-
       return status;
    }
 
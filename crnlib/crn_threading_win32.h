@@ -221,7 +221,10 @@ namespace crnlib
       }
    };
 
-   // Simple multithreaded task pool. This class assumes a single global thread will be issuing tasks and joining.
+   // Task pools are lightweight handles: the worker threads are shared by every task_pool in the process. The shared threads are
+   // created on first use, and live until the process exits or configure() replaces them. Each pool has its own lock-free task
+   // stack, which the shared threads service round robin. join() only runs and waits for the tasks queued to its own pool, so pools
+   // may be used concurrently, and tasks may safely create and join their own pools.
    class task_pool
    {
       CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(task_pool);
@@ -230,13 +233,27 @@ namespace crnlib
       task_pool(uint num_threads);
       ~task_pool();
 
-      enum { cMaxThreads = 16 };
+      // Sanity limit only - thread count is normally g_number_of_processors - 1.
+      enum { cMaxThreads = 256 };
+
+      // num_threads is the number of helper threads callers should split their work for (get_num_threads()). It doesn't create
+      // any threads. With 0 helper threads all tasks are executed by the thread calling join().
       bool init(uint num_threads);
       void deinit();
 
       inline uint get_num_threads() const { return m_num_threads; }
       inline uint32 get_num_outstanding_tasks() const { return m_total_submitted_tasks - m_total_completed_tasks; }
 
+      // Number of tasks queued to all task pools so far (used by the compression stats).
+      static inline uint32 get_total_queued_tasks() { return g_total_queued_tasks; }
+
+      // Sets the number of shared worker threads (0 = g_number_of_processors - 1) and their CPU affinity (0 = any CPU).
+      // Fails if any pool is currently initialized with helper threads.
+      static bool configure(uint num_threads, uint64 affinity_mask);
+
+      // Number of shared worker threads, whether or not they've been created yet.
+      static uint get_num_shared_threads();
+
       // C-style task callback
       typedef void (*task_callback_func)(uint64 data, void* pData_ptr);
       bool queue_task(task_callback_func pFunc, uint64 data = 0, void* pData_ptr = NULL);
@@ -256,8 +273,8 @@ namespace crnlib
       template<typename S, typename T>
       inline bool queue_multiple_object_tasks(S* pObject, T pObject_method, uint64 first_data, uint num_tasks, void* pData_ptr = NULL);
 
-      // Waits for all outstanding tasks (if any) to complete.
-      // The calling thread will steal any outstanding tasks from worker threads, if possible.
+      // Waits for all outstanding tasks (if any) queued to this pool to complete.
+      // The calling thread executes any of the pool's tasks which haven't been started by the shared threads yet.
       void join();
 
    private:
@@ -281,26 +298,41 @@ namespace crnlib
       ts_task_stack_t* m_pTask_stack;
 
       uint m_num_threads;
-      HANDLE m_threads[cMaxThreads];
+      bool m_initialized;
+
+      // Index of the pool's slot in the attached pool table while the pool is registered with the shared threads, otherwise -1.
+      int m_attached_slot;
 
-      // Signalled whenever a task is queued up.
-      semaphore m_tasks_available;
-      
       // Signalled when all outstanding tasks are completed.
       semaphore m_all_tasks_completed;
 
+      // Held while a task's completion is signalled, so deinit() can't free the pool under the completing thread.
+      spinlock m_completion_lock;
+
       enum task_flags
       {
-         cTaskFlagObject = 1
+         cTaskFlagObject = 1,
+
+         // Queued from inside a mem_arena_scope.
+         cTaskFlagArena = 2
       };
 
       volatile atomic32_t m_total_submitted_tasks;
       volatile atomic32_t m_total_completed_tasks;
-      volatile atomic32_t m_exit_flag;
 
+      static volatile atomic32_t g_total_queued_tasks;
+
+      bool push_task(const task& tsk);
       void process_task(task& tsk);
 
+      static bool attach(task_pool* pPool);
+      static void detach(task_pool* pPool);
+      static void start_shared_threads();
+      static void stop_shared_threads();
+      static bool steal_task(uint& next_slot, task_pool*& pPool, task& tsk);
       static unsigned __stdcall thread_func(void* pContext);
+
+      friend class task_pool_shared_threads_cleanup;
    };
 
    enum object_task_flags
@@ -393,22 +425,15 @@ namespace crnlib
          tsk.m_pData_ptr = pData_ptr;
          tsk.m_flags = cTaskFlagObject;
          
-         atomic_increment32(&m_total_submitted_tasks);
-         
-         if (!m_pTask_stack->try_push(tsk))
+         if (!push_task(tsk))
          {
-            atomic_increment32(&m_total_completed_tasks);
-            
+            crnlib_delete(tsk.m_pObj);
+
             status = false;
             break;
          }
       }
 
-      if (i)
-      {
-         m_tasks_available.release(i);
-      }
-
       return status;
    }
 
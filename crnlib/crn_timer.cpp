@@ -25,8 +25,19 @@ namespace crnlib
    {
       QueryPerformanceFrequency(reinterpret_cast<LARGE_INTEGER*>(pTicks));
    }
+   inline double query_process_cpu_secs()
+   {
+      FILETIME creation_time, exit_time, kernel_time, user_time;
+      if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+         return 0.0f;
+      unsigned long long total = ((static_cast<unsigned long long>(kernel_time.dwHighDateTime) << 32U) | kernel_time.dwLowDateTime) +
+                                 ((static_cast<unsigned long long>(user_time.dwHighDateTime) << 32U) | user_time.dwLowDateTime);
+      // FILETIME units are 100ns
+      return total * .0000001;
+   }
 #elif defined(__GNUC__)
    #include <sys/timex.h>
+   #include <sys/resource.h>
    inline void query_counter(timer_ticks *pTicks)
    {
       struct timeval cur_time;
@@ -37,6 +48,13 @@ namespace crnlib
    {
       *pTicks = 1000000;
    }
+   inline double query_process_cpu_secs()
+   {
+      struct rusage usage;
+      if (getrusage(RUSAGE_SELF, &usage) != 0)
+         return 0.0f;
+      return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * .000001;
+   }
 #else
    #error Unimplemented
 #endif
@@ -152,4 +170,9 @@ namespace crnlib
       return ticks * g_inv_freq;
    }
 
+   double timer::get_process_cpu_secs()
+   {
+      return query_process_cpu_secs();
+   }
+
 } // namespace crnlib
@@ -30,6 +30,9 @@ namespace crnlib
       static inline double get_secs() { return ticks_to_secs(get_ticks()); }
       static inline double get_ms() { return ticks_to_ms(get_ticks()); }
 
+      // User + kernel CPU time consumed so far by all threads of the process.
+      static double get_process_cpu_secs();
+
    private:
       static timer_ticks g_init_ticks;
       static timer_ticks g_freq;
@@ -2,6 +2,8 @@
 // This software is in the public domain. Please see license.txt.
 #pragma once
 #include "crn_matrix.h"
+#include "crn_hash_map.h"
+#include "crn_threading.h"
 
 namespace crnlib
 {
@@ -19,12 +21,20 @@ namespace crnlib
          m_hist.clear();
          m_codebook.clear();
          m_nodes.clear();
+         m_splits.clear();
+         m_sorted_codebook.clear();
+         m_sorted_projections.clear();
+         m_sorted_indices.clear();
          m_overall_variance = 0.0f;
       }
 
       void add_training_vec(const VectorType& v, uint weight)
       {
-         const std::pair<typename vector_map_type::iterator, bool> insert_result( m_hist.insert( std::make_pair(v, 0U) ) );
+         hist_key key;
+         for (uint i = 0; i < VectorType::num_elements; i++)
+            key.m_s[i] = v[i];
+
+         const typename vector_map_type::insert_result insert_result( m_hist.insert(key, 0U) );
 
          typename vector_map_type::iterator it(insert_result.first);
 
@@ -35,7 +45,9 @@ namespace crnlib
             it->second = it->second + weight;
       }
 
-      bool generate_codebook(uint max_size)
+      // If pTask_pool is not NULL, the splits of the highest variance leaves are computed in parallel ahead of time.
+      // Splits are still applied in the same order, so the codebook doesn't depend on the number of threads.
+      bool generate_codebook(uint max_size, task_pool* pTask_pool = NULL)
       {
          if (m_hist.empty())
             return false;
@@ -43,16 +55,41 @@ namespace crnlib
          double ttsum = 0.0f;
 
          vq_node root;
-         root.m_vectors.reserve(static_cast<uint>(m_hist.size()));
+         root.m_vectors.reserve(m_hist.size());
 
          for (typename vector_map_type::const_iterator it = m_hist.begin(); it != m_hist.end(); ++it)
          {
-            const VectorType& v = it->first;
-            const uint weight = it->second;
+            training_vec* pVec = root.m_vectors.enlarge(1);
+            for (uint i = 0; i < VectorType::num_elements; i++)
+               pVec->first[i] = it->first.m_s[i];
+            pVec->second = it->second;
+         }
+
+         // The splitting below is sensitive to the order of the training vectors, so always process them in sorted order.
+         std::sort(root.m_vectors.begin(), root.m_vectors.end(), training_vec_less());
+
+         // Merge any keys that compare equal without being bitwise equal (i.e. -0.0f and 0.0f).
+         uint num_vectors = 0;
+         for (uint i = 0; i < root.m_vectors.size(); i++)
+         {
+            if ((num_vectors) && (root.m_vectors[num_vectors - 1].first == root.m_vectors[i].first))
+            {
+               uint& total = root.m_vectors[num_vectors - 1].second;
+               const uint weight = root.m_vectors[i].second;
+               total = (weight > (UINT_MAX - total)) ? UINT_MAX : (total + weight);
+            }
+            else
+               root.m_vectors[num_vectors++] = root.m_vectors[i];
+         }
+         root.m_vectors.resize(num_vectors);
+
+         for (uint i = 0; i < root.m_vectors.size(); i++)
+         {
+            const VectorType& v = root.m_vectors[i].first;
+            const uint weight = root.m_vectors[i].second;
 
             root.m_centroid += (v * (float)weight);
             root.m_total_weight += weight;
-            root.m_vectors.push_back( std::make_pair(v, weight) );
 
             ttsum += v.dot(v) * weight;
          }
@@ -68,35 +105,79 @@ namespace crnlib
 
          // Warning: if this code is NOT compiled with -fno-strict-aliasing, m_nodes.get_ptr() can be NULL here. (Argh!)
 
+         const uint num_threads = pTask_pool ? pTask_pool->get_num_threads() : 0;
+         const uint max_splits_in_flight = (num_threads + 1) * 2;
+
+         m_splits.resize(0);
+         m_node_splits.resize(0);
+         m_free_splits.resize(0);
+         if (num_threads)
+         {
+            m_node_splits.resize(max_size * 2 + 1);
+            m_node_splits.set_all(-1);
+         }
+
+         // Heap of the splittable leaves, worst (highest variance, then lowest index) first.
+         node_index_vec leaves;
+         node_variance_less leaf_less(m_nodes);
+         add_leaf(leaves, 0);
+
          uint total_leaves = 1;
 
-         while (total_leaves < max_size)
+         while ((total_leaves < max_size) && (!leaves.empty()))
          {
-            int worst_node_index = -1;
-            float worst_variance = -1.0f;
+            const uint worst_node_index = leaves[0];
 
-            for (uint i = 0; i < m_nodes.size(); i++)
+            if ((num_threads) && (m_node_splits[worst_node_index] < 0))
             {
-               vq_node& node = m_nodes[i];
-
-               // Skip internal and unsplittable nodes.
-               if ((node.m_left != -1) || (node.m_unsplittable))
-                  continue;
+               // Compute the split of the worst leaf, along with the next worst leaves which will most likely be split soon.
+               node_index_vec next_worst;
+               while ((next_worst.size() < max_splits_in_flight) && (!leaves.empty()))
+               {
+                  next_worst.push_back(leaves[0]);
+                  std::pop_heap(leaves.begin(), leaves.end(), leaf_less);
+                  leaves.pop_back();
+               }
 
-               if (node.m_variance > worst_variance)
+               node_index_vec split_indices;
+               for (uint i = 0; i < next_worst.size(); i++)
                {
-                  worst_variance = node.m_variance;
-                  worst_node_index = i;
+                  if (m_node_splits[next_worst[i]] < 0)
+                     split_indices.push_back(alloc_split(next_worst[i]));
+
+                  add_leaf(leaves, next_worst[i]);
                }
+
+               for (uint i = 1; i < split_indices.size(); i++)
+                  pTask_pool->queue_object_task(this, &tree_clusterizer::compute_split_task, split_indices[i]);
+
+               compute_split(m_splits[split_indices[0]]);
+
+               pTask_pool->join();
             }
 
-            if (worst_variance <= 0.0f)
-               break;
+            std::pop_heap(leaves.begin(), leaves.end(), leaf_less);
+            leaves.pop_back();
+
+            if (!split_node(worst_node_index))
+            {
+               // A leaf with a single training vector can't be split, and would remain the worst leaf from now on.
+               if (!m_nodes[worst_node_index].m_unsplittable)
+                  break;
+               total_leaves++;
+               continue;
+            }
+
+            add_leaf(leaves, m_nodes[worst_node_index].m_left);
+            add_leaf(leaves, m_nodes[worst_node_index].m_right);
 
-            split_node(worst_node_index);
             total_leaves++;
          }
 
+         m_splits.clear();
+         m_node_splits.clear();
+         m_free_splits.clear();
+
          m_codebook.clear();
 
          m_overall_variance = 0.0f;
@@ -118,6 +199,8 @@ namespace crnlib
             m_overall_variance += node.m_variance;
          }
 
+         create_search_index();
+
          return true;
       }
 
@@ -163,7 +246,58 @@ namespace crnlib
          }
       }
 
+      // Returns the index of the codebook entry nearest to v (the lowest index if several are equally near).
       uint find_best_codebook_entry_fs(const VectorType& v) const
+      {
+         if (m_sorted_indices.empty())
+            return find_best_codebook_entry_linear(v);
+
+         // Search outwards from v's position in the codebook sorted along the search axis, always taking the entry nearest along the axis.
+         // The distance along the axis is a lower bound of the distance to v, so once it exceeds the best distance (padded for rounding
+         // errors) every remaining entry is further away.
+         // Relative slack on the pruning bounds, far larger than the rounding error of a squared distance.
+         const float cSearchMargin = 1e-4f;
+
+         const double v_proj = project(v);
+         const uint num_entries = m_sorted_projections.size();
+
+         uint hi = static_cast<uint>(std::lower_bound(m_sorted_projections.begin(), m_sorted_projections.end(), v_proj) - m_sorted_projections.begin());
+         int lo = static_cast<int>(hi) - 1;
+
+         float best_dist = math::cNearlyInfinite;
+         uint best_index = 0;
+
+         for ( ; ; )
+         {
+            const double lo_gap = (lo >= 0) ? (v_proj - m_sorted_projections[lo]) : math::cNearlyInfinite;
+            const double hi_gap = (hi < num_entries) ? (m_sorted_projections[hi] - v_proj) : math::cNearlyInfinite;
+
+            const bool use_hi = hi_gap < lo_gap;
+            const double gap = use_hi ? hi_gap : lo_gap;
+            if ((gap >= math::cNearlyInfinite) || ((gap * gap) > (best_dist * (1.0 + cSearchMargin))))
+               break;
+
+            const uint sorted_index = use_hi ? hi++ : lo--;
+            const VectorType& entry = m_sorted_codebook[sorted_index];
+
+            const float max_dist = best_dist * (1.0f + cSearchMargin);
+            if (entry.squared_distance(v, max_dist) > max_dist)
+               continue;
+
+            // Same distance computation and tie breaking as the linear search.
+            const float dist = entry.squared_distance(v);
+            const uint index = m_sorted_indices[sorted_index];
+            if ((dist < best_dist) || ((dist == best_dist) && (index < best_index)))
+            {
+               best_dist = dist;
+               best_index = index;
+            }
+         }
+
+         return best_index;
+      }
+
+      uint find_best_codebook_entry_linear(const VectorType& v) const
       {
          float best_dist = math::cNearlyInfinite;
          uint best_index = 0;
@@ -184,10 +318,125 @@ namespace crnlib
       }
 
    private:
-      typedef std::map<VectorType, uint> vector_map_type;
+      // The histogram is keyed on a POD copy of the vector's components, so the hash map can move its keys with memcpy.
+      struct hist_key
+      {
+         float m_s[VectorType::num_elements];
+
+         inline bool operator== (const hist_key& other) const { return memcmp(m_s, other.m_s, sizeof(m_s)) == 0; }
+      };
+
+      typedef crnlib::hash_map<hist_key, uint, bit_hasher<hist_key> > vector_map_type;
+
+      inline double project(const VectorType& v) const
+      {
+         double proj = 0.0f;
+         for (uint i = 0; i < VectorType::num_elements; i++)
+            proj += m_search_axis[i] * v[i];
+         return proj;
+      }
+
+      struct sorted_entry_less
+      {
+         inline sorted_entry_less(const crnlib::vector<double>& projections) : m_projections(projections) { }
+
+         inline bool operator() (uint lhs, uint rhs) const
+         {
+            if (m_projections[lhs] != m_projections[rhs])
+               return m_projections[lhs] < m_projections[rhs];
+            return lhs < rhs;
+         }
+
+         const crnlib::vector<double>& m_projections;
+      };
+
+      void create_search_index()
+      {
+         const uint N = VectorType::num_elements;
+         const uint num_entries = m_codebook.size();
+
+         m_sorted_codebook.clear();
+         m_sorted_projections.clear();
+         m_sorted_indices.clear();
+
+         if (num_entries < cMinSearchIndexSize)
+            return;
+
+         double mean[N];
+         for (uint j = 0; j < N; j++)
+            mean[j] = 0.0f;
+         for (uint i = 0; i < num_entries; i++)
+            for (uint j = 0; j < N; j++)
+               mean[j] += m_codebook[i][j];
+         for (uint j = 0; j < N; j++)
+            mean[j] /= num_entries;
+
+         double cov[N][N];
+         for (uint j = 0; j < N; j++)
+            for (uint k = 0; k < N; k++)
+               cov[j][k] = 0.0f;
+         for (uint i = 0; i < num_entries; i++)
+            for (uint j = 0; j < N; j++)
+               for (uint k = 0; k < N; k++)
+                  cov[j][k] += (m_codebook[i][j] - mean[j]) * (m_codebook[i][k] - mean[k]);
+
+         // Power iteration, starting from the axis with the highest variance. Any unit axis gives exact results, this one prunes best.
+         uint max_axis = 0;
+         for (uint j = 1; j < N; j++)
+            if (cov[j][j] > cov[max_axis][max_axis])
+               max_axis = j;
+
+         for (uint j = 0; j < N; j++)
+            m_search_axis[j] = (j == max_axis) ? 1.0f : 0.0f;
+
+         for (uint iter = 0; iter < 16; iter++)
+         {
+            double axis[N];
+            double len = 0.0f;
+            for (uint j = 0; j < N; j++)
+            {
+               axis[j] = 0.0f;
+               for (uint k = 0; k < N; k++)
+                  axis[j] += cov[j][k] * m_search_axis[k];
+               len += axis[j] * axis[j];
+            }
+
+            if (len <= 0.0f)
+               break;
+
+            len = sqrt(len);
+            for (uint j = 0; j < N; j++)
+               m_search_axis[j] = axis[j] / len;
+         }
+
+         crnlib::vector<double> projections(num_entries);
+         for (uint i = 0; i < num_entries; i++)
+            projections[i] = project(m_codebook[i]);
+
+         m_sorted_indices.resize(num_entries);
+         for (uint i = 0; i < num_entries; i++)
+            m_sorted_indices[i] = i;
+         std::sort(m_sorted_indices.begin(), m_sorted_indices.end(), sorted_entry_less(projections));
+
+         m_sorted_codebook.resize(num_entries);
+         m_sorted_projections.resize(num_entries);
+         for (uint i = 0; i < num_entries; i++)
+         {
+            m_sorted_codebook[i] = m_codebook[m_sorted_indices[i]];
+            m_sorted_projections[i] = projections[m_sorted_indices[i]];
+         }
+      }
 
       vector_map_type m_hist;
 
+      typedef std::pair<VectorType, uint> training_vec;
+      typedef crnlib::vector<training_vec> training_vec_array;
+
+      struct training_vec_less
+      {
+         inline bool operator() (const training_vec& lhs, const training_vec& rhs) const { return lhs.first < rhs.first; }
+      };
+
       struct vq_node
       {
          vq_node() : m_centroid(cClear), m_total_weight(0), m_left(-1), m_right(-1), m_codebook_index(-1), m_unsplittable(false) { }
@@ -197,7 +446,7 @@ namespace crnlib
 
          float             m_variance;
 
-         crnlib::vector< std::pair<VectorType, uint> > m_vectors;
+         training_vec_array m_vectors;
 
          int               m_left;
          int               m_right;
@@ -213,13 +462,123 @@ namespace crnlib
 
       vector_vec_type m_codebook;
 
+      // Search index for find_best_codebook_entry_fs(): the codebook sorted by each entry's projection onto the codebook's principal axis.
+      enum { cMinSearchIndexSize = 32 };
+
+      double m_search_axis[VectorType::num_elements];
+      vector_vec_type m_sorted_codebook;
+      crnlib::vector<double> m_sorted_projections;
+      crnlib::vector<uint> m_sorted_indices;
+
       float m_overall_variance;
 
       random m_rand;
 
-      void split_node(uint index)
+      // The result of splitting a leaf, computed before the leaf's children are added to m_nodes.
+      struct vq_split
+      {
+         vq_split() : m_node_index(0), m_split(false), m_unsplittable(false) { }
+
+         uint              m_node_index;
+         bool              m_split;
+         bool              m_unsplittable;
+
+         VectorType        m_left_child;
+         VectorType        m_right_child;
+         uint64            m_left_weight;
+         uint64            m_right_weight;
+         float             m_left_variance;
+         float             m_right_variance;
+         training_vec_array m_left_children;
+         training_vec_array m_right_children;
+      };
+
+      crnlib::vector<vq_split> m_splits;
+      crnlib::vector<int> m_node_splits;
+      crnlib::vector<uint> m_free_splits;
+
+      typedef crnlib::vector<uint> node_index_vec;
+
+      struct node_variance_less
+      {
+         node_variance_less(const node_vec_type& nodes) : m_nodes(nodes) { }
+
+         // Same tie breaking as a linear scan for the first node with the highest variance.
+         inline bool operator() (uint lhs, uint rhs) const
+         {
+            const float lhs_variance = m_nodes[lhs].m_variance;
+            const float rhs_variance = m_nodes[rhs].m_variance;
+            if (lhs_variance != rhs_variance)
+               return lhs_variance < rhs_variance;
+            return lhs > rhs;
+         }
+
+         const node_vec_type& m_nodes;
+      };
+
+      void add_leaf(node_index_vec& leaves, uint node_index)
+      {
+         // Leaves without any variance are never split.
+         if (!(m_nodes[node_index].m_variance > 0.0f))
+            return;
+
+         leaves.push_back(node_index);
+         std::push_heap(leaves.begin(), leaves.end(), node_variance_less(m_nodes));
+      }
+
+      uint alloc_split(uint node_index)
       {
-         vq_node& parent_node = m_nodes[index];
+         uint split_index;
+         if (m_free_splits.empty())
+         {
+            split_index = m_splits.size();
+            m_splits.resize(split_index + 1);
+         }
+         else
+         {
+            split_index = m_free_splits.back();
+            m_free_splits.pop_back();
+         }
+
+         m_splits[split_index].m_node_index = node_index;
+         m_node_splits[node_index] = split_index;
+         return split_index;
+      }
+
+      void compute_split_task(uint64 data, void* pData_ptr)
+      {
+         pData_ptr;
+         compute_split(m_splits[static_cast<uint>(data)]);
+      }
+
+      // Returns false if the node wasn't split.
+      bool split_node(uint index)
+      {
+         const int split_index = m_node_splits.size() ? m_node_splits[index] : -1;
+
+         vq_split temp_split;
+         vq_split* pSplit = &temp_split;
+         if (split_index >= 0)
+         {
+            pSplit = &m_splits[split_index];
+            m_node_splits[index] = -1;
+            m_free_splits.push_back(split_index);
+         }
+         else
+         {
+            temp_split.m_node_index = index;
+            compute_split(temp_split);
+         }
+
+         return apply_split(*pSplit);
+      }
+
+      void compute_split(vq_split& split) const
+      {
+         const vq_node& parent_node = m_nodes[split.m_node_index];
+
+         split.m_split = false;
+         split.m_unsplittable = false;
 
          if (parent_node.m_vectors.size() == 1)
             return;
@@ -350,8 +709,8 @@ namespace crnlib
          uint64 left_weight = 0;
          uint64 right_weight = 0;
 
-         crnlib::vector< std::pair<VectorType, uint> > left_children;
-         crnlib::vector< std::pair<VectorType, uint> > right_children;
+         training_vec_array& left_children = split.m_left_children;
+         training_vec_array& right_children = split.m_right_children;
 
          left_children.reserve(parent_node.m_vectors.size() / 2);
          right_children.reserve(parent_node.m_vectors.size() / 2);
@@ -407,7 +766,7 @@ namespace crnlib
 
             if ((!left_weight) || (!right_weight))
             {
-               parent_node.m_unsplittable = true;
+               split.m_unsplittable = true;
                return;
             }
 
@@ -433,6 +792,25 @@ namespace crnlib
             prev_total_variance = total_variance;
          }
 
+         split.m_split = true;
+         split.m_left_child = left_child;
+         split.m_right_child = right_child;
+         split.m_left_weight = left_weight;
+         split.m_right_weight = right_weight;
+         split.m_left_variance = left_variance;
+         split.m_right_variance = right_variance;
+      }
+
+      bool apply_split(vq_split& split)
+      {
+         vq_node& parent_node = m_nodes[split.m_node_index];
+
+         if (split.m_unsplittable)
+            parent_node.m_unsplittable = true;
+
+         if (!split.m_split)
+            return false;
+
          const uint left_child_index = m_nodes.size();
          const uint right_child_index = m_nodes.size() + 1;
 
@@ -446,15 +824,20 @@ namespace crnlib
          vq_node& left_child_node = m_nodes[left_child_index];
          vq_node& right_child_node = m_nodes[right_child_index];
 
-         left_child_node.m_centroid = left_child;
-         left_child_node.m_total_weight = left_weight;
-         left_child_node.m_vectors.swap(left_children);
-         left_child_node.m_variance = left_variance;
+         left_child_node.m_centroid = split.m_left_child;
+         left_child_node.m_total_weight = split.m_left_weight;
+         left_child_node.m_vectors.swap(split.m_left_children);
+         left_child_node.m_variance = split.m_left_variance;
+
+         right_child_node.m_centroid = split.m_right_child;
+         right_child_node.m_total_weight = split.m_right_weight;
+         right_child_node.m_vectors.swap(split.m_right_children);
+         right_child_node.m_variance = split.m_right_variance;
 
-         right_child_node.m_centroid = right_child;
-         right_child_node.m_total_weight = right_weight;
-         right_child_node.m_vectors.swap(right_children);
-         right_child_node.m_variance = right_variance;
+         split.m_left_children.clear();
+         split.m_right_children.clear();
+
+         return true;
       }
 
    };
@@ -118,6 +118,7 @@ namespace crnlib
       inline bool empty() const { return !m_size; }
       inline uint size() const { return m_size; }
       inline uint size_in_bytes() const { return m_size * sizeof(T); }
+      inline uint capacity_in_bytes() const { return m_capacity * sizeof(T); }
       inline uint capacity() const { return m_capacity; }
 
       // operator[] will assert on out of range indices, but in final builds there is (and will never be) any range checking on this method.
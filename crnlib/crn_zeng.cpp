@@ -5,204 +5,445 @@
 // http://citeseerx.ist.psu.edu/viewdoc/summary?doi=10.1.1.88.7221 
 #include "crn_core.h"
 #include "crn_zeng.h"
-#include "crn_sparse_array.h"
-#include <deque>
-
-#define USE_SPARSE_ARRAY 1
+#include "crn_threading.h"
+#include <algorithm>
 
 namespace crnlib
 {
-#if USE_SPARSE_ARRAY         
-   typedef sparse_array<uint, 4> hist_type;
-#else   
-   typedef crnlib::vector<uint> hist_type;
-#endif   
-   
-   static inline void update_hist(hist_type& hist, int i, int j, int n)
-   {  
-      if (i == j)
-         return;
-         
-      if ((i != -1) && (j != -1) && (i < j))
-      {  
-         CRNLIB_ASSERT( (i >= 0) && (i < (int)n) );
-         CRNLIB_ASSERT( (j >= 0) && (j < (int)n) );
-
-         uint index = i * n + j;
-                  
-#if USE_SPARSE_ARRAY         
-         uint freq = hist[index];
-         freq++;
-         hist.set(index, freq);
-#else
-         hist[index]++;         
-#endif         
-      }
-   }
-   
-   static inline uint read_hist(hist_type& hist, int i, int j, int n)
+   // Greedily grows the ordering from the most frequent pair of neighboring indices, each step adding the value with the highest
+   // co-occurrence count (optionally weighted by its similarity to the ordering's current ends) to the end it co-occurs with most.
+   // The co-occurrence histogram is kept as compact adjacency lists, so each step only touches the chosen value's neighbors.
+   class zeng_reorderer
    {
-      if (i > j)
-         utils::swap(i, j);
-      
-      return hist[i * n + j];
-   }
-         
-   void create_zeng_reorder_table(uint n, uint num_indices, const uint* pIndices, crnlib::vector<uint>& remap_table, zeng_similarity_func pFunc, void* pContext, float similarity_func_weight)
-   {
-      CRNLIB_ASSERT((n > 0) && (num_indices > 0));
-      CRNLIB_ASSERT_CLOSED_RANGE(similarity_func_weight, 0.0f, 1.0f);
-      
-//      printf("create_zeng_reorder_table start:\n");
+      CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(zeng_reorderer);
+
+   public:
+      zeng_reorderer(uint n, zeng_similarity_func pFunc, void* pContext, float similarity_func_weight, uint num_helper_threads) :
+         m_n(n),
+         m_pFunc(pFunc),
+         m_pContext(pContext),
+         m_similarity_func_weight(similarity_func_weight),
+         m_num_helper_threads(num_helper_threads),
+         m_refresh_front(false),
+         m_refresh_back(false)
+      {
+      }
 
-      remap_table.clear();
-      remap_table.resize(n);
+      void create(uint num_indices, const uint* pIndices, crnlib::vector<uint>& remap_table);
 
-      if (num_indices <= 1)
-         return;
+   private:
+      uint                       m_n;
+      zeng_similarity_func       m_pFunc;
+      void*                      m_pContext;
+      float                      m_similarity_func_weight;
+      uint                       m_num_helper_threads;
 
-      const uint t = n * n;
-      hist_type xhist(t);
+      // Neighbors of value v are m_adj_values[m_adj_offsets[v]] to m_adj_values[m_adj_offsets[v + 1] - 1], with matching co-occurrence counts in m_adj_freqs.
+      crnlib::vector<uint>       m_adj_offsets;
+      crnlib::vector<uint16>     m_adj_values;
+      crnlib::vector<uint>       m_adj_freqs;
 
-      for (uint i = 0; i < num_indices; i++)
-      {
-         const int prev_val = (i > 0) ? pIndices[i-1] : -1;
-         const int cur_val = pIndices[i];
-         const int next_val = (i < (num_indices - 1)) ? pIndices[i+1] : -1;
+      crnlib::vector<uint16>     m_values_chosen;
+      crnlib::vector<int>        m_chosen_pos;
+      int                        m_front_pos;
+      int                        m_back_pos;
+
+      // Sorted by value, so ties go to the lowest value.
+      crnlib::vector<uint16>     m_values_remaining;
+      crnlib::vector<bool>       m_is_remaining;
+      crnlib::vector<uint>       m_total_freq_to_chosen_values;
+
+      // Similarity of each remaining value to the current front and back of the ordering, only refreshed when that end changes.
+      crnlib::vector<float>      m_sim_to_front;
+      crnlib::vector<float>      m_sim_to_back;
+      bool                       m_refresh_front;
+      bool                       m_refresh_back;
 
-         update_hist(xhist, cur_val, prev_val, n);
-         update_hist(xhist, cur_val, next_val, n);
+      enum { cMinParallelScanSize = 1024 };
+
+      struct scan_result
+      {
+         double m_best_freq;
+         int m_best_i;
+      };
+      crnlib::vector<scan_result> m_scan_results;
+
+      // Max heap of (total freq << 16) | (0xFFFF - value) entries, used without a similarity func. Entries go stale as values are chosen or their totals grow.
+      crnlib::vector<uint64>     m_heap;
+
+      void create_adjacency_lists(uint num_indices, const uint* pIndices, uint& first_value, uint& second_value);
+      void scan_remaining(uint first, uint last, scan_result& result);
+      void scan_task(uint64 data, void* pData_ptr);
+      uint select_weighted(task_pool* pTask_pool);
+      uint select_unweighted();
+      void push_heap_entry(uint value);
+      bool choose_front(uint u);
+   };
+
+   void zeng_reorderer::create_adjacency_lists(uint num_indices, const uint* pIndices, uint& first_value, uint& second_value)
+   {
+      // Each neighboring pair of different indices is counted once, keyed by (lower value * n + higher value).
+      crnlib::vector<uint> pair_keys;
+      pair_keys.reserve(num_indices - 1);
+      for (uint i = 1; i < num_indices; i++)
+      {
+         uint a = pIndices[i - 1];
+         uint b = pIndices[i];
+         if (a == b)
+            continue;
+         if (a > b)
+            utils::swap(a, b);
+
+         CRNLIB_ASSERT(b < m_n);
+         pair_keys.push_back(a * m_n + b);
       }
 
+      std::sort(pair_keys.begin(), pair_keys.end());
+
+      crnlib::vector<uint> pairs;
+      crnlib::vector<uint> pair_freqs;
+
+      m_adj_offsets.resize(m_n + 1);
+      m_adj_offsets.set_all(0);
+
+      // The most frequent pair (the lowest key on ties) seeds the ordering. Values 0 and 0 are used if there are no pairs at all.
       uint max_freq = 0;
-      uint max_index = 0;
-      for (uint i = 0; i < t; i++)
+      uint max_key = 0;
+
+      for (uint i = 0; i < pair_keys.size(); )
       {
-         if (xhist[i] > max_freq)
+         const uint key = pair_keys[i];
+
+         uint j = i + 1;
+         while ((j < pair_keys.size()) && (pair_keys[j] == key))
+            j++;
+
+         const uint freq = j - i;
+         if (freq > max_freq)
          {
-            max_freq = xhist[i];
-            max_index = i;
+            max_freq = freq;
+            max_key = key;
          }
+
+         pairs.push_back(key);
+         pair_freqs.push_back(freq);
+
+         m_adj_offsets[key / m_n]++;
+         m_adj_offsets[key % m_n]++;
+
+         i = j;
       }
 
-      uint x = max_index / n;
-      uint y = max_index % n;
+      first_value = max_key / m_n;
+      second_value = max_key % m_n;
 
-      crnlib::vector<uint16> values_chosen; 
-      values_chosen.reserve(n);
-      
-      values_chosen.push_back(static_cast<uint16>(x));
-      values_chosen.push_back(static_cast<uint16>(y));
+      uint total = 0;
+      for (uint v = 0; v <= m_n; v++)
+      {
+         const uint count = m_adj_offsets[v];
+         m_adj_offsets[v] = total;
+         total += count;
+      }
 
-      crnlib::vector<uint16> values_remaining;
-      if (n > 2)
-         values_remaining.reserve(n - 2);
-      for (uint i = 0; i < n; i++)
-         if ((i != x) && (i != y))
-            values_remaining.push_back(static_cast<uint16>(i));
+      m_adj_values.resize(total);
+      m_adj_freqs.resize(total);
 
-      crnlib::vector<uint> total_freq_to_chosen_values(n);
-      for (uint i = 0; i < values_remaining.size(); i++)
+      crnlib::vector<uint> next(m_adj_offsets);
+      for (uint i = 0; i < pairs.size(); i++)
       {
-         uint u = values_remaining[i];
+         const uint a = pairs[i] / m_n;
+         const uint b = pairs[i] % m_n;
 
-         uint total_freq = 0;
+         m_adj_values[next[a]] = static_cast<uint16>(b);
+         m_adj_freqs[next[a]++] = pair_freqs[i];
 
-         for (uint j = 0; j < values_chosen.size(); j++)
-         {
-            uint l = values_chosen[j];
+         m_adj_values[next[b]] = static_cast<uint16>(a);
+         m_adj_freqs[next[b]++] = pair_freqs[i];
+      }
+   }
+
+   void zeng_reorderer::scan_remaining(uint first, uint last, scan_result& result)
+   {
+      const uint front = m_values_chosen.front();
+      const uint back = m_values_chosen.back();
+
+      result.m_best_freq = 0;
+      result.m_best_i = -1;
+
+      for (uint i = first; i < last; i++)
+      {
+         const uint u = m_values_remaining[i];
+
+         if (m_refresh_front)
+            m_sim_to_front[u] = (*m_pFunc)(u, front, m_pContext);
+         if (m_refresh_back)
+            m_sim_to_back[u] = (*m_pFunc)(u, back, m_pContext);
+
+         double total_freq = m_total_freq_to_chosen_values[u];
+
+         float weight = math::maximum<float>(m_sim_to_front[u], m_sim_to_back[u]);
 
-            total_freq += read_hist(xhist, u, l, n); //[u * n + l];
+         CRNLIB_ASSERT_CLOSED_RANGE(weight, 0.0f, 1.0f);
+
+         weight = math::lerp(1.0f - m_similarity_func_weight, 1.0f + m_similarity_func_weight, weight);
+
+         total_freq = (total_freq + 1.0f) * weight;
+
+         if (total_freq > result.m_best_freq)
+         {
+            result.m_best_freq = total_freq;
+            result.m_best_i = i;
          }
+      }
+   }
+
+   void zeng_reorderer::scan_task(uint64 data, void* pData_ptr)
+   {
+      pData_ptr;
 
-         total_freq_to_chosen_values[u] = total_freq;
+      const uint num_slices = m_scan_results.size();
+      const uint num_remaining = m_values_remaining.size();
+      const uint slice_index = static_cast<uint>(data);
+
+      scan_remaining((num_remaining * slice_index) / num_slices, (num_remaining * (slice_index + 1)) / num_slices, m_scan_results[slice_index]);
+   }
+
+   // Returns the index into m_values_remaining of the best candidate, scanning slices of the remaining values in parallel when there are many of them.
+   uint zeng_reorderer::select_weighted(task_pool* pTask_pool)
+   {
+      if ((pTask_pool) && (m_values_remaining.size() >= cMinParallelScanSize))
+      {
+         m_scan_results.resize(pTask_pool->get_num_threads() + 1);
+
+         pTask_pool->queue_multiple_object_tasks(this, &zeng_reorderer::scan_task, 0, m_scan_results.size());
+         pTask_pool->join();
+      }
+      else
+      {
+         m_scan_results.resize(1);
+         scan_remaining(0, m_values_remaining.size(), m_scan_results[0]);
       }
 
-      while (!values_remaining.empty())
+      m_refresh_front = false;
+      m_refresh_back = false;
+
+      // Slices are combined in order, so the result is identical to a single scan.
+      double best_freq = 0;
+      uint best_i = 0;
+      for (uint i = 0; i < m_scan_results.size(); i++)
       {
-         double best_freq = 0;
-         uint best_i = 0;
-         
-         for (uint i = 0; i < values_remaining.size(); i++)
+         if ((m_scan_results[i].m_best_i >= 0) && (m_scan_results[i].m_best_freq > best_freq))
          {
-            uint u = values_remaining[i];
-
-            double total_freq = total_freq_to_chosen_values[u];
-   
-            if (pFunc)
-            {
-               float weight = math::maximum<float>(
-                  (*pFunc)(u, values_chosen.front(), pContext), 
-                  (*pFunc)(u, values_chosen.back(), pContext) );
-                  
-               CRNLIB_ASSERT_CLOSED_RANGE(weight, 0.0f, 1.0f);
-               
-               weight = math::lerp(1.0f - similarity_func_weight, 1.0f + similarity_func_weight, weight);
-                                          
-               total_freq = (total_freq + 1.0f) * weight;
-            }
-            
-            if (total_freq > best_freq)
-            {
-               best_freq = total_freq;
-               best_i = i;  
-            }            
+            best_freq = m_scan_results[i].m_best_freq;
+            best_i = m_scan_results[i].m_best_i;
          }
+      }
 
-         const uint u = values_remaining[best_i];
+      return best_i;
+   }
 
-         float side = 0;
-         int left_freq = 0;
-         int right_freq = 0;
+   void zeng_reorderer::push_heap_entry(uint value)
+   {
+      m_heap.push_back((static_cast<uint64>(m_total_freq_to_chosen_values[value]) << 16U) | (0xFFFFU - value));
+      std::push_heap(m_heap.begin(), m_heap.end());
+   }
 
-         for (uint j = 0; j < values_chosen.size(); j++)
-         {
-            const uint l = values_chosen[j];
+   // Returns the remaining value with the highest total, without a similarity func the candidates can be kept in a heap.
+   uint zeng_reorderer::select_unweighted()
+   {
+      for ( ; ; )
+      {
+         CRNLIB_ASSERT(m_heap.size());
 
-            int freq = read_hist(xhist, u, l, n); //[u * n + l];
-            int scale = (values_chosen.size() + 1 - 2 * (j + 1));
+         std::pop_heap(m_heap.begin(), m_heap.end());
+         const uint64 entry = m_heap.back();
+         m_heap.pop_back();
 
-            side = side + (float)(scale * freq);
+         const uint u = 0xFFFFU - static_cast<uint>(entry & 0xFFFFU);
+         const uint total_freq = static_cast<uint>(entry >> 16U);
 
-            if (scale < 0)
-               right_freq += -scale * freq;
-            else
-               left_freq += scale * freq;
-         }
+         if ((m_is_remaining[u]) && (total_freq == m_total_freq_to_chosen_values[u]))
+            return u;
+      }
+   }
+
+   bool zeng_reorderer::choose_front(uint u)
+   {
+      const int num_chosen = m_values_chosen.size();
+
+      int left_freq = 0;
+      int right_freq = 0;
+
+      // Without a similarity func the side is summed in floating point in ordering position order.
+      crnlib::vector<uint64> side_terms;
+
+      for (uint i = m_adj_offsets[u]; i < m_adj_offsets[u + 1]; i++)
+      {
+         const uint l = m_adj_values[i];
+         if (m_is_remaining[l])
+            continue;
+
+         const int freq = m_adj_freqs[i];
+         const int j = m_chosen_pos[l] - m_front_pos;
+         const int scale = num_chosen + 1 - 2 * (j + 1);
+
+         if (scale < 0)
+            right_freq += -scale * freq;
+         else
+            left_freq += scale * freq;
+
+         if (!m_pFunc)
+            side_terms.push_back((static_cast<uint64>(j) << 32U) | static_cast<uint32>(scale * freq));
+      }
+
+      float side = 0;
+
+      if (m_pFunc)
+      {
+         float weight_left = m_sim_to_front[u];
+         float weight_right = m_sim_to_back[u];
 
-         if (pFunc)
+         weight_left = math::lerp(1.0f - m_similarity_func_weight, 1.0f + m_similarity_func_weight, weight_left);
+         weight_right = math::lerp(1.0f - m_similarity_func_weight, 1.0f + m_similarity_func_weight, weight_right);
+
+         side = weight_left * left_freq - weight_right * right_freq;
+      }
+      else
+      {
+         std::sort(side_terms.begin(), side_terms.end());
+
+         for (uint i = 0; i < side_terms.size(); i++)
+            side = side + (float)static_cast<int>(static_cast<uint32>(side_terms[i]));
+      }
+
+      return side > 0;
+   }
+
+   void zeng_reorderer::create(uint num_indices, const uint* pIndices, crnlib::vector<uint>& remap_table)
+   {
+      uint x, y;
+      create_adjacency_lists(num_indices, pIndices, x, y);
+
+      m_values_chosen.reserve(m_n + 1);
+      m_values_chosen.push_back(static_cast<uint16>(x));
+      m_values_chosen.push_back(static_cast<uint16>(y));
+
+      m_chosen_pos.resize(m_n);
+      m_chosen_pos[x] = 0;
+      m_chosen_pos[y] = 1;
+      m_front_pos = 0;
+      m_back_pos = 1;
+
+      m_is_remaining.resize(m_n);
+      m_total_freq_to_chosen_values.resize(m_n);
+
+      if (m_n > 2)
+         m_values_remaining.reserve(m_n - 2);
+      for (uint i = 0; i < m_n; i++)
+      {
+         m_is_remaining[i] = (i != x) && (i != y);
+         m_total_freq_to_chosen_values[i] = 0;
+         if (m_is_remaining[i])
+            m_values_remaining.push_back(static_cast<uint16>(i));
+      }
+
+      for (uint k = 0; k < 2; k++)
+      {
+         const uint v = k ? y : x;
+         if ((k) && (x == y))
+            break;
+
+         for (uint i = m_adj_offsets[v]; i < m_adj_offsets[v + 1]; i++)
+            if (m_is_remaining[m_adj_values[i]])
+               m_total_freq_to_chosen_values[m_adj_values[i]] += m_adj_freqs[i];
+      }
+
+      task_pool tp;
+
+      if (m_pFunc)
+      {
+         m_sim_to_front.resize(m_n);
+         m_sim_to_back.resize(m_n);
+         m_refresh_front = true;
+         m_refresh_back = true;
+
+         if ((m_num_helper_threads) && (m_values_remaining.size() >= cMinParallelScanSize))
+            tp.init(m_num_helper_threads);
+      }
+      else
+      {
+         m_heap.reserve(m_values_remaining.size() * 2);
+         for (uint i = 0; i < m_values_remaining.size(); i++)
+            push_heap_entry(m_values_remaining[i]);
+      }
+
+      while (!m_values_remaining.empty())
+      {
+         uint best_i;
+         uint u;
+
+         if (m_pFunc)
+         {
+            best_i = select_weighted(tp.get_num_threads() ? &tp : NULL);
+            u = m_values_remaining[best_i];
+         }
+         else
          {
-            float weight_left = (*pFunc)(u, values_chosen.front(), pContext);
-            float weight_right = (*pFunc)(u, values_chosen.back(), pContext);
-            
-            weight_left = math::lerp(1.0f - similarity_func_weight, 1.0f + similarity_func_weight, weight_left);
-            weight_right = math::lerp(1.0f - similarity_func_weight, 1.0f + similarity_func_weight, weight_right);
-            
-            side = weight_left * left_freq - weight_right * right_freq;
+            u = select_unweighted();
+            best_i = static_cast<uint>(std::lower_bound(m_values_remaining.begin(), m_values_remaining.end(), static_cast<uint16>(u)) - m_values_remaining.begin());
          }
 
-         if (side > 0)
-            values_chosen.push_front(static_cast<uint16>(u));
+         CRNLIB_ASSERT(m_values_remaining[best_i] == u);
+
+         if (choose_front(u))
+         {
+            m_values_chosen.push_front(static_cast<uint16>(u));
+            m_chosen_pos[u] = --m_front_pos;
+            m_refresh_front = true;
+         }
          else
-            values_chosen.push_back(static_cast<uint16>(u));
+         {
+            m_values_chosen.push_back(static_cast<uint16>(u));
+            m_chosen_pos[u] = ++m_back_pos;
+            m_refresh_back = true;
+         }
 
-         values_remaining.erase(values_remaining.begin() + best_i);
+         m_values_remaining.erase(m_values_remaining.begin() + best_i);
+         m_is_remaining[u] = false;
 
-         for (uint i = 0; i < values_remaining.size(); i++)
+         for (uint i = m_adj_offsets[u]; i < m_adj_offsets[u + 1]; i++)
          {
-            const uint r = values_remaining[i];
+            const uint r = m_adj_values[i];
+            if (!m_is_remaining[r])
+               continue;
+
+            m_total_freq_to_chosen_values[r] += m_adj_freqs[i];
 
-            total_freq_to_chosen_values[r] += read_hist(xhist, r, u, n); //[r * n + u];
+            if (!m_pFunc)
+               push_heap_entry(r);
          }
       }
 
-      for (uint i = 0; i < n; i++)   
+      for (uint i = 0; i < m_n; i++)
       {
-         uint v = values_chosen[i];
+         uint v = m_values_chosen[i];
          remap_table[v] = i;
       }
-//      printf("create_zeng_reorder_table end:\n");
+   }
+
+   void create_zeng_reorder_table(uint n, uint num_indices, const uint* pIndices, crnlib::vector<uint>& remap_table, zeng_similarity_func pFunc, void* pContext, float similarity_func_weight, uint num_helper_threads)
+   {
+      CRNLIB_ASSERT((n > 0) && (num_indices > 0));
+      CRNLIB_ASSERT_CLOSED_RANGE(similarity_func_weight, 0.0f, 1.0f);
+
+      remap_table.clear();
+      remap_table.resize(n);
+
+      if (num_indices <= 1)
+         return;
+
+      zeng_reorderer reorderer(n, pFunc, pContext, similarity_func_weight, num_helper_threads);
+      reorderer.create(num_indices, pIndices, remap_table);
    }
 
 } // namespace crnlib
-   
@@ -5,6 +5,8 @@ namespace crnlib
 {
    typedef float (*zeng_similarity_func)(uint index_a, uint index_b, void* pContext);
    
-   void create_zeng_reorder_table(uint n, uint num_indices, const uint* pIndices, crnlib::vector<uint>& remap_table, zeng_similarity_func pFunc, void* pContext, float similarity_func_weight);
+   // Returns a remapping of the n palette entries referenced by pIndices which places frequently neighboring entries next to each other.
+   // pFunc (optional) must be thread safe if num_helper_threads is non-zero.
+   void create_zeng_reorder_table(uint n, uint num_indices, const uint* pIndices, crnlib::vector<uint>& remap_table, zeng_similarity_func pFunc, void* pContext, float similarity_func_weight, uint num_helper_threads = 0);
    
 } // namespace crnlib
@@ -152,12 +152,46 @@ const char* crn_get_dxt_quality_string(crn_dxt_quality q)
    return "?";
 }
 
+const char* crn_get_comp_phase_string(crn_comp_phase phase)
+{
+   switch (phase)
+   {
+      case cCRNCompPhaseInit:                   return "Init";
+      case cCRNCompPhaseChunkCompression:       return "ChunkCompression";
+      case cCRNCompPhaseColorEndpointClusters:  return "ColorEndpointClusters";
+      case cCRNCompPhaseColorEndpointCodebook:  return "ColorEndpointCodebook";
+      case cCRNCompPhaseAlphaEndpointClusters:  return "AlphaEndpointClusters";
+      case cCRNCompPhaseAlphaEndpointCodebook:  return "AlphaEndpointCodebook";
+      case cCRNCompPhaseColorSelectorCodebook:  return "ColorSelectorCodebook";
+      case cCRNCompPhaseAlphaSelectorCodebook:  return "AlphaSelectorCodebook";
+      case cCRNCompPhaseRefineColorSelectors:   return "RefineColorSelectors";
+      case cCRNCompPhaseRefineColorEndpoints:   return "RefineColorEndpoints";
+      case cCRNCompPhaseRefineAlphaEndpoints:   return "RefineAlphaEndpoints";
+      case cCRNCompPhaseRefineAlphaSelectors:   return "RefineAlphaSelectors";
+      case cCRNCompPhaseChunkEncodings:         return "ChunkEncodings";
+      case cCRNCompPhaseColorEndpointReorder:   return "ColorEndpointReorder";
+      case cCRNCompPhaseColorSelectorReorder:   return "ColorSelectorReorder";
+      case cCRNCompPhaseAlphaEndpointReorder:   return "AlphaEndpointReorder";
+      case cCRNCompPhaseAlphaSelectorReorder:   return "AlphaSelectorReorder";
+      case cCRNCompPhasePackChunks:             return "PackChunks";
+      case cCRNCompPhasePackModels:             return "PackModels";
+      case cCRNCompPhaseDXTBlocks:              return "DXTBlocks";
+      default: break;
+   }
+   return "?";
+}
+
 
 void crn_free_block(void *pBlock)
 {
    crnlib_free(pBlock);
 }
 
+crn_bool crn_set_thread_pool_config(crn_uint32 num_threads, crn_uint64 cpu_affinity_mask)
+{
+   return task_pool::configure(math::minimum<uint>(num_threads, cCRNMaxHelperThreads), cpu_affinity_mask);
+}
+
 void *crn_compress(const crn_comp_params &comp_params, crn_uint32 &compressed_size, crn_uint32 *pActual_quality_level, float *pActual_bitrate)
 {
    compressed_size = 0;
@@ -192,6 +226,60 @@ void *crn_compress(const crn_comp_params &comp_params, const crn_mipmap_params &
    return crn_file_data.assume_ownership();
 }
 
+crn_compressor_context_t crn_create_compressor_context(crn_uint32 max_num_helper_threads, crn_uint64 max_retained_bytes)
+{
+   return crnlib_new<texture_comp_context>(math::minimum<uint>(max_num_helper_threads, cCRNMaxHelperThreads), max_retained_bytes);
+}
+
+void *crn_compress(crn_compressor_context_t pContext, const crn_comp_params &comp_params, crn_uint32 &compressed_size, crn_uint32 *pActual_quality_level, float *pActual_bitrate)
+{
+   compressed_size = 0;
+   if (pActual_quality_level) *pActual_quality_level = 0;
+   if (pActual_bitrate) *pActual_bitrate = 0.0f;
+
+   if ((!pContext) || (!comp_params.check()))
+      return NULL;
+
+   texture_comp_context* pComp_context = static_cast<texture_comp_context*>(pContext);
+
+   crn_comp_params params(comp_params);
+   params.m_num_helper_threads = math::minimum<uint>(params.m_num_helper_threads, pComp_context->get_max_helper_threads());
+
+   crnlib::vector<uint8> crn_file_data;
+   if (!create_compressed_texture(params, crn_file_data, pActual_quality_level, pActual_bitrate, pComp_context))
+      return NULL;
+
+   compressed_size = crn_file_data.size();
+   return crn_file_data.assume_ownership();
+}
+
+void *crn_compress(crn_compressor_context_t pContext, const crn_comp_params &comp_params, const crn_mipmap_params &mip_params, crn_uint32 &compressed_size, crn_uint32 *pActual_quality_level, float *pActual_bitrate)
+{
+   compressed_size = 0;
+   if (pActual_quality_level) *pActual_quality_level = 0;
+   if (pActual_bitrate) *pActual_bitrate = 0.0f;
+
+   if ((!pContext) || (!comp_params.check()) || (!mip_params.check()))
+      return NULL;
+
+   texture_comp_context* pComp_context = static_cast<texture_comp_context*>(pContext);
+
+   crn_comp_params params(comp_params);
+   params.m_num_helper_threads = math::minimum<uint>(params.m_num_helper_threads, pComp_context->get_max_helper_threads());
+
+   crnlib::vector<uint8> crn_file_data;
+   if (!create_compressed_texture(params, mip_params, crn_file_data, pActual_quality_level, pActual_bitrate, pComp_context))
+      return NULL;
+
+   compressed_size = crn_file_data.size();
+   return crn_file_data.assume_ownership();
+}
+
+void crn_free_compressor_context(crn_compressor_context_t pContext)
+{
+   crnlib_delete(static_cast<texture_comp_context*>(pContext));
+}
+
 void *crn_decompress_crn_to_dds(const void *pCRN_file_data, crn_uint32 &file_size)
 {
    mipmapped_texture tex;
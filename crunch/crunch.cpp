@@ -18,7 +18,10 @@
 
 #include "crn_dxt.h"
 #include "crn_cfile_stream.h"
+#include "crn_mapped_file_stream.h"
 #include "crn_texture_conversion.h"
+#include "crn_threading.h"
+#include "crn_build_cache.h"
 
 #define CRND_HEADER_FILE_ONLY
 #include "crn_decomp.h"
@@ -27,12 +30,17 @@ using namespace crnlib;
 
 const int cDefaultCRNQualityLevel = 128;
 
+// In batch mode, a texture gets one extra compressor thread per this many pixels, up to the thread budget.
+const uint32 cBatchPixelsPerThread = 512 * 512;
+
 class crunch
 {
     CRNLIB_NO_COPY_OR_ASSIGNMENT_OP(crunch);
 
     cfile_stream m_log_stream;
 
+    build_cache m_build_cache;
+
     uint32 m_num_processed;
     uint32 m_num_failed;
     uint32 m_num_succeeded;
@@ -43,7 +51,13 @@ public:
         m_num_processed(0),
         m_num_failed(0),
         m_num_succeeded(0),
-        m_num_skipped(0)
+        m_num_skipped(0),
+        m_pBatch_files(NULL),
+        m_batch_job_done(0, cINT32_MAX),
+        m_batch_threads_freed(0, cINT32_MAX),
+        m_batch_num_threads(0),
+        m_batch_free_threads(0),
+        m_batch_num_waiting(0)
     {
     }
 
@@ -57,6 +71,7 @@ public:
         cCSSucceeded,
         cCSSkipped,
         cCSBadParam,
+        cCSUpToDate,
     };
 
     inline uint32 get_num_processed() const { return m_num_processed; }
@@ -86,13 +101,16 @@ public:
         console::printf("-forcewrite - Overwrite read-only files");
         console::printf("-recreate - Recreate directory structure");
         console::printf("-fileformat [dds,ktx,crn,tga,bmp,png] - Output file format, default=crn or dds");
+        console::printf("-cachedir dir - Reuse outputs from a build cache keyed on source pixels and all options");
 
         console::message("\nModes:");
         console::printf("-compare - Compare input and output files (no output files are written).");
         console::printf("-info - Only display input file statistics (no output files are written).");
 
         console::message("\nMisc. options:");
-        console::printf("-helperThreads # - Set number of helper threads, 0-16, default=(# of CPU's)-1");
+        console::printf("-helperThreads # - Set number of helper threads, 0-255, default=(# of CPU's)-1");
+        console::printf("-batch - Process multiple files concurrently, sharing the helper threads between");
+        console::printf("         files and large textures. Console output is still written in file order.");
         console::printf("-noprogress - Disable progress output");
         console::printf("-quiet - Disable all console output");
         console::printf("-ignoreerrors - Continue processing files after errors. Note: The default");
@@ -106,6 +124,8 @@ public:
         console::printf("-imagestats - Print various image qualilty statistics");
         console::printf("-mipstats - Print statistics for each mipmap, not just the top mip");
         console::printf("-lzmastats - Print size of output file compressed with LZMA codec");
+        console::printf("-phasestats - Print time, CPU utilization, allocations and tasks for each compression phase");
+        console::printf("-trace filename - Write compression phase timings to a Chrome trace (about:tracing) JSON file");
         console::printf("-split - Write faces/mip levels to multiple separate output PNG files");
         console::printf("-yflip - Always flip texture on Y axis before processing");
         console::printf("-unflip - Unflip texture if read from source file as flipped");
@@ -123,6 +143,8 @@ public:
         console::printf("-bitrate # - Set the desired output bitrate of DDS or CRN output files.");
         console::printf("             This option causes crunch to find the quality factor");
         console::printf("             closest to the desired bitrate using a binary search.");
+        console::printf("-parallelBitrateSearch - Try several CRN quality factors at once during");
+        console::printf("             the -bitrate search (faster, uses more memory).");
 
         console::message("\nLow-level CRN specific options:");
         console::printf("-c # - Color endpoint palette size, 32-8192, default=3072");
@@ -143,6 +165,7 @@ public:
         console::printf("-blurriness # - Scale filter kernel, >1=blur, <1=sharpen, .01-8, default=.9");
         console::printf("-wrap - Assume texture is tiled when filtering, default=clamping");
         console::printf("-renormalize - Renormalize filtered normal map texels, default=disabled");
+        console::printf("-mipCascade - Faster: generate each mipmap from the previous one (slightly different output), default=disabled");
         console::printf("-maxmips # - Limit number of generated texture mipmap levels, 1-16, default=16");
         console::printf("-minmipsize # - Smallest allowable mipmap resolution, default=1");
 
@@ -152,6 +175,7 @@ public:
         console::printf(" prefer DXT1A over DXT5 for images with alpha channels (.DDS only).");
         console::printf("-uniformMetrics - Use uniform color metrics, default=use perceptual metrics");
         console::printf("-noAdaptiveBlocks - Disable adaptive block sizes (i.e. disable macroblocks).");
+        console::printf("-bandedLevels - Split CRN mip levels into independently decodable bands (for multithreaded transcoding)");
         console::printf("-compressor [CRN,CRNF,RYG] - Set DXTn compressor, default=CRN");
         console::printf("-dxtQuality [superfast,fast,normal,better,uber] - Endpoint optimizer speed.");
         console::printf("            Sets endpoint optimizer's max iteration depth. Default=uber.");
@@ -188,8 +212,10 @@ public:
            { "outsamedir", 0, false },
            { "deep", 0, false },
            { "fileformat", 1, false },
+           { "cachedir", 1, false },
 
            { "helperThreads", 1, false },
+           { "batch", 0, false },
            { "noprogress", 0, false },
            { "quiet", 0, false },
            { "ignoreerrors", 0, false },
@@ -209,6 +235,7 @@ public:
            { "blurriness", 1, false },
            { "wrap", 0, false },
            { "renormalize", 0, false },
+           { "mipCascade", 0, false },
            { "noprogress", 0, false },
            { "paramdebug", 0, false },
            { "debug", 0, false },
@@ -220,6 +247,7 @@ public:
            { "alphaThreshold", 1, false },
            { "uniformMetrics", 0, false },
            { "noAdaptiveBlocks", 0, false },
+           { "bandedLevels", 0, false },
            { "compressor", 1, false },
            { "dxtQuality", 1, false },
            { "noendpointcaching", 0, false },
@@ -248,8 +276,11 @@ public:
            { "minmipsize", 1, false },
 
            { "bitrate", 1, false },
+           { "parallelBitrateSearch", 0, false },
 
            { "lzmastats", 0, false },
+           { "phasestats", 0, false },
+           { "trace", 1, false },
            { "split", 0, false },
            { "csvfile", 1, false },
 
@@ -313,8 +344,20 @@ public:
             console::set_log_stream(&m_log_stream);
         }
 
+        dynamic_string cache_dir;
+        if (m_params.get_value_as_string("cachedir", 0, cache_dir))
+        {
+            if (!m_build_cache.init(cache_dir.get_ptr()))
+            {
+                console::error("Unable to use build cache directory: \"%s\"", cache_dir.get_ptr());
+                return false;
+            }
+        }
+
         bool status = convert();
 
+        m_build_cache.clear();
+
         if (m_log_stream.is_opened())
         {
             console::set_log_stream(NULL);
@@ -328,6 +371,42 @@ public:
 private:
     command_line_params m_params;
 
+    // Batch mode state. Each file is converted by a task on a pool sized to the thread budget. A file holds one
+    // thread of the budget while it runs, and large files wait for more for their compressor's helper threads.
+    // The number of helpers only depends on the texture's size, because DDS/CRN output depends on it.
+    struct batch_job
+    {
+        batch_job() : m_status(cCSFailed), m_num_threads(0), m_done(false) { }
+
+        console_buffer m_output;
+        convert_status m_status;
+        uint32 m_num_threads;
+        bool m_done;
+    };
+
+    const find_files::file_desc_vec* m_pBatch_files;
+    crnlib::vector<batch_job> m_batch_jobs;
+    mutex m_batch_mutex;
+    mutex m_batch_helpers_mutex;
+    semaphore m_batch_job_done;
+    semaphore m_batch_threads_freed;
+    uint32 m_batch_num_threads;
+    uint32 m_batch_free_threads;
+    uint32 m_batch_num_waiting;
+
+    // Compression phase timings collected for -trace, written once all files are processed.
+    struct traced_file
+    {
+        dynamic_string m_filename;
+        uint32 m_file_index;
+        double m_start_time;
+        double m_duration;
+        crnlib::vector<crn_comp_trace_event> m_events;
+    };
+
+    crnlib::vector<traced_file> m_traced_files;
+    mutex m_trace_mutex;
+
     bool convert()
     {
         find_files::file_desc_vec files;
@@ -380,6 +459,10 @@ private:
 
         double total_time = tm.get_elapsed_secs();
 
+        dynamic_string trace_filename;
+        if ((m_params.get_value_as_string("trace", 0, trace_filename)) && (!write_trace(trace_filename.get_ptr())))
+            console::error("Unable to write trace file: \"%s\"", trace_filename.get_ptr());
+
         console::printf("Total time: %3.3fs", total_time);
 
         console::printf(
@@ -459,185 +542,371 @@ private:
 
     bool process_files(find_files::file_desc_vec& files)
     {
-        const bool compare_mode = m_params.get_value_as_bool("compare");
-        const bool info_mode = m_params.get_value_as_bool("info");
+        if ((m_params.get_value_as_bool("batch")) && (files.size() > 1))
+            return process_files_batch(files);
+
+        // Size crnlib's shared worker threads to match the helper threads the compressors will be given.
+        crn_set_thread_pool_config(get_num_helper_threads());
 
         for (uint32 file_index = 0; file_index < files.size(); file_index++)
         {
-            const find_files::file_desc& file_desc = files[file_index];
-            const dynamic_string& in_filename = file_desc.m_fullname;
+            convert_status status = process_file(files, file_index, NULL);
+
+            if (!tally_status(status))
+                return false;
+        }
+
+        return true;
+    }
+
+    // Updates the file counters. Returns false if processing should stop.
+    bool tally_status(convert_status status)
+    {
+        if (status == cCSUpToDate)
+        {
+            m_num_skipped++;
+            return true;
+        }
+
+        m_num_processed++;
+
+        switch (status)
+        {
+        case cCSSucceeded:
+        {
+            console::info("");
+            m_num_succeeded++;
+            break;
+        }
+        case cCSSkipped:
+        {
+            console::info("Skipping file.\n");
+            m_num_skipped++;
+            break;
+        }
+        case cCSBadParam:
+        {
+            return false;
+        }
+        default:
+        {
+            if (!m_params.get_value_as_bool("ignoreerrors"))
+                return false;
+
+            console::info("");
+
+            m_num_failed++;
+            break;
+        }
+        }
+
+        return true;
+    }
+
+    uint32 get_num_helper_threads()
+    {
+        if (m_params.has_key("helperThreads"))
+            return m_params.get_value_as_int("helperThreads", 0, cCRNMaxHelperThreads, 0, cCRNMaxHelperThreads);
+        else if (g_number_of_processors > 1)
+            return math::minimum<uint>(g_number_of_processors - 1, cCRNMaxHelperThreads);
+        return 0;
+    }
+
+    bool process_files_batch(find_files::file_desc_vec& files)
+    {
+        const uint32 num_threads = get_num_helper_threads() + 1;
 
-            dynamic_string in_drive, in_path, in_fname, in_ext;
-            file_utils::split_path(in_filename.get_ptr(), &in_drive, &in_path, &in_fname, &in_ext);
+        // The file tasks run on crnlib's shared worker threads (the main thread only schedules), so there must be one for each batch thread.
+        // The threads the file tasks lend to their compressors are taken from the same budget.
+        if (!crn_set_thread_pool_config(num_threads))
+            return false;
+
+        task_pool tp;
+        if (!tp.init(num_threads))
+            return false;
+
+        m_pBatch_files = &files;
+        m_batch_jobs.clear();
+        m_batch_jobs.resize(files.size());
+        m_batch_num_threads = num_threads;
+        m_batch_free_threads = num_threads;
+        m_batch_num_waiting = 0;
 
-            texture_file_types::format out_file_type = texture_file_types::cFormatCRN;
-            dynamic_string fmt;
-            if (m_params.get_value_as_string("fileformat", 0, fmt))
+        uint32 next_job = 0, next_flush = 0;
+        bool aborted = false;
+
+        for (;;)
+        {
+            // Emit the output of finished files in order, stopping at the first file that's still running.
+            while (next_flush < next_job)
             {
-                if (fmt == "tga")
-                    out_file_type = texture_file_types::cFormatTGA;
-                else if (fmt == "bmp")
-                    out_file_type = texture_file_types::cFormatBMP;
-                else if (fmt == "dds")
-                    out_file_type = texture_file_types::cFormatDDS;
-                else if (fmt == "ktx")
-                    out_file_type = texture_file_types::cFormatKTX;
-                else if (fmt == "crn")
-                    out_file_type = texture_file_types::cFormatCRN;
-                else if (fmt == "png")
-                    out_file_type = texture_file_types::cFormatPNG;
+                batch_job& job = m_batch_jobs[next_flush];
+
+                m_batch_mutex.lock();
+                const bool done = job.m_done;
+                m_batch_mutex.unlock();
+
+                if (!done)
+                    break;
+
+                // Once a file has failed, later files are discarded like the serial path never reaching them.
+                if (aborted)
+                    job.m_output.clear();
                 else
                 {
-                    console::error("Unsupported output file type: %s", fmt.get_ptr());
-                    return false;
+                    job.m_output.flush();
+
+                    if (!tally_status(job.m_status))
+                        aborted = true;
                 }
+
+                next_flush++;
             }
 
-            // No explicit output format has been specified - try to determine something doable.
-            if (!m_params.has_key("fileformat"))
+            if ((next_flush == files.size()) || ((aborted) && (next_flush == next_job)))
+                break;
+
+            bool start_job = false;
+            if ((!aborted) && (next_job < files.size()))
             {
-                if (m_params.has_key("split"))
+                // Files waiting for helper threads go first, or they could wait forever.
+                scoped_mutex lock(m_batch_mutex);
+                if ((m_batch_free_threads) && (!m_batch_num_waiting))
                 {
-                    out_file_type = texture_file_types::cFormatPNG;
-                }
-                else
-                {
-                    texture_file_types::format input_file_type = texture_file_types::determine_file_format(in_filename.get_ptr());
-                    if (input_file_type == texture_file_types::cFormatCRN)
-                    {
-                        // Automatically transcode CRN->DXTc and write to DDS files, unless the user specifies either the /fileformat or /split options.
-                        out_file_type = texture_file_types::cFormatDDS;
-                    }
-                    else if (input_file_type == texture_file_types::cFormatKTX)
-                    {
-                        // Default to converting KTX files to PNG
-                        out_file_type = texture_file_types::cFormatPNG;
-                    }
+                    m_batch_free_threads--;
+                    m_batch_jobs[next_job].m_num_threads = 1;
+                    start_job = true;
                 }
             }
 
-            dynamic_string out_filename;
-            if (m_params.get_value_as_bool("outsamedir"))
-                out_filename.format("%s%s%s.%s", in_drive.get_ptr(), in_path.get_ptr(), in_fname.get_ptr(), texture_file_types::get_extension(out_file_type));
-            else if (m_params.has_key("out"))
+            if (start_job)
             {
-                out_filename = m_params.get_value_as_string_or_empty("out");
+                tp.queue_object_task(this, &crunch::batch_job_task, next_job);
+                next_job++;
+                continue;
+            }
 
-                if (files.size() > 1)
-                {
-                    dynamic_string out_drive, out_dir, out_name, out_ext;
-                    file_utils::split_path(out_filename.get_ptr(), &out_drive, &out_dir, &out_name, &out_ext);
+            m_batch_job_done.wait();
+        }
 
-                    out_name.format("%s_%u", out_name.get_ptr(), file_index);
+        tp.join();
+        tp.deinit();
 
-                    out_filename.format("%s%s%s%s", out_drive.get_ptr(), out_dir.get_ptr(), out_name.get_ptr(), out_ext.get_ptr());
-                }
+        m_batch_jobs.clear();
+        m_pBatch_files = NULL;
+
+        return !aborted;
+    }
 
-                if (!m_params.has_key("fileformat"))
-                    out_file_type = texture_file_types::determine_file_format(out_filename.get_ptr());
+    void batch_job_task(uint64 data, void* pData_ptr)
+    {
+        pData_ptr;
+
+        const uint32 file_index = static_cast<uint32>(data);
+        batch_job& job = m_batch_jobs[file_index];
+
+        console::set_thread_buffer(&job.m_output);
+
+        job.m_status = process_file(*m_pBatch_files, file_index, &job);
+
+        console::set_thread_buffer(NULL);
+
+        m_batch_mutex.lock();
+        m_batch_free_threads += job.m_num_threads;
+        job.m_done = true;
+        m_batch_mutex.unlock();
+
+        m_batch_threads_freed.release();
+        m_batch_job_done.release();
+    }
+
+    // Takes threads from the batch budget for a texture's compressor, waiting until enough are free. Returns the number of helper
+    // threads to use, which only depends on the texture's size and the budget.
+    uint32 acquire_batch_helper_threads(batch_job& job, const mipmapped_texture& tex)
+    {
+        const uint32 total_pixels = tex.get_width() * tex.get_height() * tex.get_num_faces();
+        const uint32 num_helpers = math::minimum<uint32>(total_pixels / cBatchPixelsPerThread, m_batch_num_threads - 1);
+        if (!num_helpers)
+            return 0;
+
+        // While waiting the file gives its own thread back, so files that are all waiting can't hold the budget between them.
+        // Only one file waits at a time, and no new files are started until it has its threads.
+        m_batch_mutex.lock();
+        m_batch_num_waiting++;
+        m_batch_free_threads += job.m_num_threads;
+        job.m_num_threads = 0;
+        m_batch_mutex.unlock();
+
+        m_batch_threads_freed.release();
+
+        scoped_mutex helpers_lock(m_batch_helpers_mutex);
+
+        for ( ; ; )
+        {
+            m_batch_mutex.lock();
+            if (m_batch_free_threads > num_helpers)
+            {
+                m_batch_free_threads -= num_helpers + 1;
+                job.m_num_threads = num_helpers + 1;
+                m_batch_num_waiting--;
+                m_batch_mutex.unlock();
+                break;
             }
+            m_batch_mutex.unlock();
+
+            m_batch_threads_freed.wait();
+        }
+
+        // Let the main thread start more files with whatever is left.
+        m_batch_job_done.release();
+
+        return num_helpers;
+    }
+
+    convert_status process_file(const find_files::file_desc_vec& files, uint32 file_index, batch_job* pJob)
+    {
+        const bool compare_mode = m_params.get_value_as_bool("compare");
+        const bool info_mode = m_params.get_value_as_bool("info");
+
+        const find_files::file_desc& file_desc = files[file_index];
+        const dynamic_string& in_filename = file_desc.m_fullname;
+
+        dynamic_string in_drive, in_path, in_fname, in_ext;
+        file_utils::split_path(in_filename.get_ptr(), &in_drive, &in_path, &in_fname, &in_ext);
+
+        texture_file_types::format out_file_type = texture_file_types::cFormatCRN;
+        dynamic_string fmt;
+        if (m_params.get_value_as_string("fileformat", 0, fmt))
+        {
+            if (fmt == "tga")
+                out_file_type = texture_file_types::cFormatTGA;
+            else if (fmt == "bmp")
+                out_file_type = texture_file_types::cFormatBMP;
+            else if (fmt == "dds")
+                out_file_type = texture_file_types::cFormatDDS;
+            else if (fmt == "ktx")
+                out_file_type = texture_file_types::cFormatKTX;
+            else if (fmt == "crn")
+                out_file_type = texture_file_types::cFormatCRN;
+            else if (fmt == "png")
+                out_file_type = texture_file_types::cFormatPNG;
             else
             {
-                dynamic_string out_dir(m_params.get_value_as_string_or_empty("outdir"));
-
-                if (m_params.get_value_as_bool("recreate") && file_desc.m_rel.get_len())
-                {
-                    file_utils::combine_path(out_dir, out_dir.get_ptr(), file_desc.m_rel.get_ptr());
-                }
+                console::error("Unsupported output file type: %s", fmt.get_ptr());
+                return cCSBadParam;
+            }
+        }
 
-                if (out_dir.get_len())
-                {
-                    if (file_utils::is_path_separator(out_dir.back()))
-                        out_filename.format("%s%s.%s", out_dir.get_ptr(), in_fname.get_ptr(), texture_file_types::get_extension(out_file_type));
-                    else
-                        out_filename.format("%s\\%s.%s", out_dir.get_ptr(), in_fname.get_ptr(), texture_file_types::get_extension(out_file_type));
-                }
-                else
+        // No explicit output format has been specified - try to determine something doable.
+        if (!m_params.has_key("fileformat"))
+        {
+            if (m_params.has_key("split"))
+            {
+                out_file_type = texture_file_types::cFormatPNG;
+            }
+            else
+            {
+                texture_file_types::format input_file_type = texture_file_types::determine_file_format(in_filename.get_ptr());
+                if (input_file_type == texture_file_types::cFormatCRN)
                 {
-                    out_filename.format("%s.%s", in_fname.get_ptr(), texture_file_types::get_extension(out_file_type));
+                    // Automatically transcode CRN->DXTc and write to DDS files, unless the user specifies either the /fileformat or /split options.
+                    out_file_type = texture_file_types::cFormatDDS;
                 }
-
-                if (m_params.get_value_as_bool("recreate"))
+                else if (input_file_type == texture_file_types::cFormatKTX)
                 {
-                    if (file_utils::full_path(out_filename))
-                    {
-                        if ((!compare_mode) && (!info_mode))
-                        {
-                            dynamic_string out_drive, out_path;
-                            file_utils::split_path(out_filename.get_ptr(), &out_drive, &out_path, NULL, NULL);
-                            out_drive += out_path;
-                            file_utils::create_path(out_drive.get_ptr());
-                        }
-                    }
+                    // Default to converting KTX files to PNG
+                    out_file_type = texture_file_types::cFormatPNG;
                 }
             }
+        }
 
-            if ((!compare_mode) && (!info_mode))
-            {
-                if (file_utils::does_file_exist(out_filename.get_ptr()))
-                {
-                    if (m_params.get_value_as_bool("nooverwrite"))
-                    {
-                        console::warning("Skipping already existing file: %s\n", out_filename.get_ptr());
-                        m_num_skipped++;
-                        continue;
-                    }
+        dynamic_string out_filename;
+        if (m_params.get_value_as_bool("outsamedir"))
+            out_filename.format("%s%s%s.%s", in_drive.get_ptr(), in_path.get_ptr(), in_fname.get_ptr(), texture_file_types::get_extension(out_file_type));
+        else if (m_params.has_key("out"))
+        {
+            out_filename = m_params.get_value_as_string_or_empty("out");
 
-                    if (m_params.get_value_as_bool("timestamp"))
-                    {
-                        if (file_utils::is_older_than(in_filename.get_ptr(), out_filename.get_ptr()))
-                        {
-                            console::warning("Skipping up to date file: %s\n", out_filename.get_ptr());
-                            m_num_skipped++;
-                            continue;
-                        }
-                    }
-                }
-            }
+            if (files.size() > 1)
+            {
+                dynamic_string out_drive, out_dir, out_name, out_ext;
+                file_utils::split_path(out_filename.get_ptr(), &out_drive, &out_dir, &out_name, &out_ext);
 
-            convert_status status = cCSFailed;
+                out_name.format("%s_%u", out_name.get_ptr(), file_index);
 
-            if (info_mode)
-                status = display_file_info(file_index, files.size(), in_filename.get_ptr());
-            else if (compare_mode)
-                status = compare_file(file_index, files.size(), in_filename.get_ptr(), out_filename.get_ptr(), out_file_type);
-            else if (read_only_file_check(out_filename.get_ptr()))
-                status = convert_file(file_index, files.size(), in_filename.get_ptr(), out_filename.get_ptr(), out_file_type);
+                out_filename.format("%s%s%s%s", out_drive.get_ptr(), out_dir.get_ptr(), out_name.get_ptr(), out_ext.get_ptr());
+            }
 
-            m_num_processed++;
+            if (!m_params.has_key("fileformat"))
+                out_file_type = texture_file_types::determine_file_format(out_filename.get_ptr());
+        }
+        else
+        {
+            dynamic_string out_dir(m_params.get_value_as_string_or_empty("outdir"));
 
-            switch (status)
+            if (m_params.get_value_as_bool("recreate") && file_desc.m_rel.get_len())
             {
-            case cCSSucceeded:
-            {
-                console::info("");
-                m_num_succeeded++;
-                break;
+                file_utils::combine_path(out_dir, out_dir.get_ptr(), file_desc.m_rel.get_ptr());
             }
-            case cCSSkipped:
+
+            if (out_dir.get_len())
             {
-                console::info("Skipping file.\n");
-                m_num_skipped++;
-                break;
+                if (file_utils::is_path_separator(out_dir.back()))
+                    out_filename.format("%s%s.%s", out_dir.get_ptr(), in_fname.get_ptr(), texture_file_types::get_extension(out_file_type));
+                else
+                    out_filename.format("%s\\%s.%s", out_dir.get_ptr(), in_fname.get_ptr(), texture_file_types::get_extension(out_file_type));
             }
-            case cCSBadParam:
+            else
             {
-                return false;
+                out_filename.format("%s.%s", in_fname.get_ptr(), texture_file_types::get_extension(out_file_type));
             }
-            default:
+
+            if (m_params.get_value_as_bool("recreate"))
             {
-                if (!m_params.get_value_as_bool("ignoreerrors"))
-                    return false;
+                if (file_utils::full_path(out_filename))
+                {
+                    if ((!compare_mode) && (!info_mode))
+                    {
+                        dynamic_string out_drive, out_path;
+                        file_utils::split_path(out_filename.get_ptr(), &out_drive, &out_path, NULL, NULL);
+                        out_drive += out_path;
+                        file_utils::create_path(out_drive.get_ptr());
+                    }
+                }
+            }
+        }
 
-                console::info("");
+        if ((!compare_mode) && (!info_mode))
+        {
+            if (file_utils::does_file_exist(out_filename.get_ptr()))
+            {
+                if (m_params.get_value_as_bool("nooverwrite"))
+                {
+                    console::warning("Skipping already existing file: %s\n", out_filename.get_ptr());
+                    return cCSUpToDate;
+                }
 
-                m_num_failed++;
-                break;
-            }
+                if (m_params.get_value_as_bool("timestamp"))
+                {
+                    if (file_utils::is_older_than(in_filename.get_ptr(), out_filename.get_ptr()))
+                    {
+                        console::warning("Skipping up to date file: %s\n", out_filename.get_ptr());
+                        return cCSUpToDate;
+                    }
+                }
             }
         }
 
-        return true;
+        convert_status status = cCSFailed;
+
+        if (info_mode)
+            status = display_file_info(file_index, files.size(), in_filename.get_ptr());
+        else if (compare_mode)
+            status = compare_file(file_index, files.size(), in_filename.get_ptr(), out_filename.get_ptr(), out_file_type);
+        else if (read_only_file_check(out_filename.get_ptr()))
+            status = convert_file(file_index, files.size(), in_filename.get_ptr(), out_filename.get_ptr(), out_file_type, pJob);
+
+        return status;
     }
 
     void print_texture_info(const char* pTex_desc, texture_conversion::convert_params& params, mipmapped_texture& tex)
@@ -748,6 +1017,7 @@ private:
 
         mip_params.m_renormalize = m_params.get_value_as_bool("renormalize", 0, mip_params.m_renormalize != 0);
         mip_params.m_tiled = m_params.get_value_as_bool("wrap");
+        mip_params.m_cascade = m_params.get_value_as_bool("mipCascade");
 
         mip_params.m_max_levels = m_params.get_value_as_int("maxmips", 0, cCRNMaxLevels, 1, cCRNMaxLevels);
         mip_params.m_min_mip_size = m_params.get_value_as_int("minmipsize", 0, 1, 1, cCRNMaxLevelResolution);
@@ -759,8 +1029,8 @@ private:
     {
         if (m_params.has_key("rescale"))
         {
-            int w = m_params.get_value_as_int("rescale", 0, -1, 1, cCRNMaxLevelResolution, 0);
-            int h = m_params.get_value_as_int("rescale", 0, -1, 1, cCRNMaxLevelResolution, 1);
+            int w = m_params.get_value_as_int("rescale", 0, -1, 1, cCRNMaxDDSLevelResolution, 0);
+            int h = m_params.get_value_as_int("rescale", 0, -1, 1, cCRNMaxDDSLevelResolution, 1);
 
             mipmap_params.m_scale_mode = cCRNSMAbsolute;
             mipmap_params.m_scale_x = (float)w;
@@ -795,8 +1065,8 @@ private:
 
         if (m_params.has_key("clamp"))
         {
-            uint32 w = m_params.get_value_as_int("clamp", 0, 1, 1, cCRNMaxLevelResolution, 0);
-            uint32 h = m_params.get_value_as_int("clamp", 0, 1, 1, cCRNMaxLevelResolution, 1);
+            uint32 w = m_params.get_value_as_int("clamp", 0, 1, 1, cCRNMaxDDSLevelResolution, 0);
+            uint32 h = m_params.get_value_as_int("clamp", 0, 1, 1, cCRNMaxDDSLevelResolution, 1);
 
             mipmap_params.m_clamp_scale = false;
             mipmap_params.m_clamp_width = w;
@@ -804,8 +1074,8 @@ private:
         }
         else if (m_params.has_key("clampScale"))
         {
-            uint32 w = m_params.get_value_as_int("clampscale", 0, 1, 1, cCRNMaxLevelResolution, 0);
-            uint32 h = m_params.get_value_as_int("clampscale", 0, 1, 1, cCRNMaxLevelResolution, 1);
+            uint32 w = m_params.get_value_as_int("clampscale", 0, 1, 1, cCRNMaxDDSLevelResolution, 0);
+            uint32 h = m_params.get_value_as_int("clampscale", 0, 1, 1, cCRNMaxDDSLevelResolution, 1);
 
             mipmap_params.m_clamp_scale = true;
             mipmap_params.m_clamp_width = w;
@@ -814,10 +1084,10 @@ private:
 
         if (m_params.has_key("window"))
         {
-            uint32 xl = m_params.get_value_as_int("window", 0, 0, 0, cCRNMaxLevelResolution, 0);
-            uint32 yl = m_params.get_value_as_int("window", 0, 0, 0, cCRNMaxLevelResolution, 1);
-            uint32 xh = m_params.get_value_as_int("window", 0, 0, 0, cCRNMaxLevelResolution, 2);
-            uint32 yh = m_params.get_value_as_int("window", 0, 0, 0, cCRNMaxLevelResolution, 3);
+            uint32 xl = m_params.get_value_as_int("window", 0, 0, 0, cCRNMaxDDSLevelResolution, 0);
+            uint32 yl = m_params.get_value_as_int("window", 0, 0, 0, cCRNMaxDDSLevelResolution, 1);
+            uint32 xh = m_params.get_value_as_int("window", 0, 0, 0, cCRNMaxDDSLevelResolution, 2);
+            uint32 yh = m_params.get_value_as_int("window", 0, 0, 0, cCRNMaxDDSLevelResolution, 3);
 
             mipmap_params.m_window_left = math::minimum(xl, xh);
             mipmap_params.m_window_top = math::minimum(yl, yh);
@@ -856,6 +1126,7 @@ private:
             {
                 comp_params.m_target_bitrate = desired_bitrate;
             }
+            comp_params.set_flag(cCRNCompFlagParallelQualitySearch, m_params.get_value_as_bool("parallelBitrateSearch"));
         }
 
         int color_endpoints = m_params.get_value_as_int("c", 0, 0, cCRNMinPaletteSize, cCRNMaxPaletteSize);
@@ -884,11 +1155,9 @@ private:
 
         comp_params.set_flag(cCRNCompFlagPerceptual, !m_params.get_value_as_bool("uniformMetrics"));
         comp_params.set_flag(cCRNCompFlagHierarchical, !m_params.get_value_as_bool("noAdaptiveBlocks"));
+        comp_params.set_flag(cCRNCompFlagBandedLevels, m_params.get_value_as_bool("bandedLevels"));
 
-        if (m_params.has_key("helperThreads"))
-            comp_params.m_num_helper_threads = m_params.get_value_as_int("helperThreads", 0, cCRNMaxHelperThreads, 0, cCRNMaxHelperThreads);
-        else if (g_number_of_processors > 1)
-            comp_params.m_num_helper_threads = g_number_of_processors - 1;
+        comp_params.m_num_helper_threads = get_num_helper_threads();
 
         dynamic_string comp_name;
         if (m_params.get_value_as_string("compressor", 0, comp_name))
@@ -979,14 +1248,28 @@ private:
             total_in_pixels += width * height * src_tex.get_num_faces();
         }
 
-        vector<uint8> src_tex_bytes;
-        if (!cfile_stream::read_file_into_array(pSrc_filename, src_tex_bytes))
+        // Map the source file instead of reading it into memory when possible.
+        mapped_file_stream src_tex_stream;
+        vector<uint8> src_tex_buf;
+        const uint8* pSrc_tex_bytes = NULL;
+        uint32 src_tex_size = 0;
+        if (src_tex_stream.open(pSrc_filename))
         {
-            console::error("Failed loading source file: %s", pSrc_filename);
-            return cCSFailed;
+            pSrc_tex_bytes = static_cast<const uint8*>(src_tex_stream.get_ptr());
+            src_tex_size = static_cast<uint32>(src_tex_stream.get_size());
+        }
+        else
+        {
+            if (!cfile_stream::read_file_into_array(pSrc_filename, src_tex_buf))
+            {
+                console::error("Failed loading source file: %s", pSrc_filename);
+                return cCSFailed;
+            }
+            pSrc_tex_bytes = src_tex_buf.get_ptr();
+            src_tex_size = src_tex_buf.size();
         }
 
-        if (!src_tex_bytes.size())
+        if (!src_tex_size)
         {
             console::warning("Source file is empty: %s", pSrc_filename);
             return cCSSkipped;
@@ -997,7 +1280,7 @@ private:
         {
             lzma_codec lossless_codec;
             vector<uint8> cmp_tex_bytes;
-            if (lossless_codec.pack(src_tex_bytes.get_ptr(), src_tex_bytes.size(), cmp_tex_bytes))
+            if (lossless_codec.pack(pSrc_tex_bytes, src_tex_size, cmp_tex_bytes))
             {
                 compressed_size = cmp_tex_bytes.size();
             }
@@ -1019,14 +1302,14 @@ private:
                 compressed_size, compressed_size * 8.0f / total_in_pixels);
         }
 
-        double entropy = math::compute_entropy(src_tex_bytes.get_ptr(), src_tex_bytes.size());
-        console::info("Source file entropy: %3.6f bits per byte", entropy / src_tex_bytes.size());
+        double entropy = math::compute_entropy(pSrc_tex_bytes, src_tex_size);
+        console::info("Source file entropy: %3.6f bits per byte", entropy / src_tex_size);
 
         if (src_file_format == texture_file_types::cFormatCRN)
         {
             crnd::crn_texture_info tex_info;
             tex_info.m_struct_size = sizeof(crnd::crn_texture_info);
-            crn_bool success = crnd::crnd_get_texture_info(src_tex_bytes.get_ptr(), src_tex_bytes.size(), &tex_info);
+            crn_bool success = crnd::crnd_get_texture_info(pSrc_tex_bytes, src_tex_size, &tex_info);
             if (!success)
                 console::error("Failed retrieving CRN texture info!");
             else
@@ -1048,12 +1331,18 @@ private:
         return cCSSucceeded;
     }
 
+    // The image statistics compare the output's pixels to the input's.
+    bool image_stats_requested()
+    {
+        return m_params.get_value_as_bool("imagestats") || m_params.get_value_as_bool("mipstats") || m_params.has_key("csvfile");
+    }
+
     void print_stats(texture_conversion::convert_stats& stats, bool force_image_stats = false)
     {
         dynamic_string csv_filename;
         const char* pCSVStatsFilename = m_params.get_value_as_string("csvfile", 0, csv_filename) ? csv_filename.get_ptr() : NULL;
 
-        bool image_stats = force_image_stats || m_params.get_value_as_bool("imagestats") || m_params.get_value_as_bool("mipstats") || (pCSVStatsFilename != NULL);
+        bool image_stats = force_image_stats || image_stats_requested();
         bool mip_stats = m_params.get_value_as_bool("mipstats");
         bool grayscale_sampling = m_params.get_value_as_bool("grayscalesampling");
         if (!stats.print(image_stats, mip_stats, grayscale_sampling, pCSVStatsFilename))
@@ -1097,7 +1386,7 @@ private:
         return cCSSucceeded;
     }
 
-    convert_status convert_file(uint32 file_index, uint32 num_files, const char* pSrc_filename, const char* pDst_filename, texture_file_types::format out_file_type)
+    convert_status convert_file(uint32 file_index, uint32 num_files, const char* pSrc_filename, const char* pDst_filename, texture_file_types::format out_file_type, batch_job* pJob)
     {
         timer tim;
 
@@ -1144,7 +1433,7 @@ private:
         params.m_y_flip = m_params.has_key("yflip");
         params.m_unflip = m_params.has_key("unflip");
 
-        if ((!m_params.get_value_as_bool("noprogress")) && (!m_params.get_value_as_bool("quiet")))
+        if ((!pJob) && (!m_params.get_value_as_bool("noprogress")) && (!m_params.get_value_as_bool("quiet")))
             params.m_pProgress_func = progress_callback_func;
 
         if (m_params.get_value_as_bool("debug"))
@@ -1160,6 +1449,7 @@ private:
             params.m_quick = true;
 
         params.m_no_stats = m_params.get_value_as_bool("nostats");
+        params.m_image_stats = image_stats_requested();
 
         params.m_dst_format = PIXEL_FMT_INVALID;
 
@@ -1187,6 +1477,13 @@ private:
         if (!parse_scale_params(params.m_mipmap_params))
             return cCSBadParam;
 
+        if (pJob)
+            params.m_comp_params.m_num_helper_threads = acquire_batch_helper_threads(*pJob, src_tex);
+
+        crn_comp_stats comp_stats;
+        if ((m_params.has_key("trace")) || (m_params.get_value_as_bool("phasestats")))
+            params.m_comp_params.m_pStats = &comp_stats;
+
         print_texture_info("Source texture", params, src_tex);
 
         if (params.m_texture_type == cTextureTypeNormalMap)
@@ -1194,6 +1491,25 @@ private:
             params.m_comp_params.set_flag(cCRNCompFlagPerceptual, false);
         }
 
+        crnlib::vector<uint8> cache_key;
+        const bool use_cache = (m_build_cache.is_enabled()) && (!params.m_write_mipmaps_to_multiple_files);
+        if (use_cache)
+        {
+            build_cache::compute_key(params, cache_key);
+
+            build_cache::lookup_status cache_status = m_build_cache.lookup(cache_key, pDst_filename);
+            if (cache_status == build_cache::cUpToDate)
+            {
+                console::info("Output file is up to date (build cache hit): \"%s\"\n", pDst_filename);
+                return cCSUpToDate;
+            }
+            else if (cache_status == build_cache::cHit)
+            {
+                console::info("Copied output file from build cache: \"%s\"", pDst_filename);
+                return cCSSucceeded;
+            }
+        }
+
         texture_conversion::convert_stats stats;
 
         tim.start();
@@ -1211,11 +1527,115 @@ private:
 
         console::info("Texture successfully processed in %3.3fs", total_time);
 
+        if ((use_cache) && (!m_build_cache.insert(cache_key, pDst_filename)))
+            console::warning("Unable to add output file to build cache: \"%s\"", pDst_filename);
+
         if (!m_params.get_value_as_bool("nostats"))
             print_stats(stats);
 
+        // The stats are only filled in if the texture was actually compressed.
+        if ((params.m_comp_params.m_pStats) && (comp_stats.m_total.m_num_calls))
+        {
+            if (m_params.get_value_as_bool("phasestats"))
+                print_phase_stats(comp_stats);
+
+            if (m_params.has_key("trace"))
+                add_trace(file_index, pSrc_filename, comp_stats);
+        }
+
         return cCSSucceeded;
     }
+
+    static void print_phase_stats_line(const char* pName, const crn_comp_stats& comp_stats, const crn_comp_phase_stats& s)
+    {
+        console::info("%-22s %5u %10.1f %10.1f %5.0f%% %10.2f %8u %6u", pName, s.m_num_calls, s.m_wall_time * 1000.0f, s.m_cpu_time * 1000.0f,
+            comp_stats.get_thread_utilization(s) * 100.0f, s.m_alloc_bytes / (1024.0f * 1024.0f), s.m_num_allocs, s.m_num_tasks);
+    }
+
+    void print_phase_stats(const crn_comp_stats& comp_stats)
+    {
+        console::info("Compression phases (%u threads):", comp_stats.m_num_threads);
+        console::info("%-22s %5s %10s %10s %6s %10s %8s %6s", "Phase", "Calls", "Wall ms", "CPU ms", "Util", "Alloc MB", "Allocs", "Tasks");
+
+        for (uint32 i = 0; i < cCRNTotalCompPhases; i++)
+        {
+            const crn_comp_phase_stats& s = comp_stats.m_phases[i];
+            if (s.m_num_calls)
+                print_phase_stats_line(crn_get_comp_phase_string(static_cast<crn_comp_phase>(i)), comp_stats, s);
+        }
+
+        print_phase_stats_line("Total", comp_stats, comp_stats.m_total);
+    }
+
+    void add_trace(uint32 file_index, const char* pSrc_filename, const crn_comp_stats& comp_stats)
+    {
+        scoped_mutex lock(m_trace_mutex);
+
+        traced_file& file = *m_traced_files.enlarge(1);
+        file.m_filename = pSrc_filename;
+        file.m_file_index = file_index;
+        file.m_start_time = comp_stats.m_trace_origin;
+        file.m_duration = comp_stats.m_total.m_wall_time;
+        file.m_events.append(comp_stats.m_trace_events, comp_stats.m_num_trace_events);
+    }
+
+    static void write_json_string(FILE* pFile, const char* p)
+    {
+        fputc('"', pFile);
+        for ( ; *p; ++p)
+        {
+            const uint8 c = static_cast<uint8>(*p);
+            if (c < 0x20)
+                fprintf(pFile, "\\u%04x", c);
+            else
+            {
+                if ((c == '"') || (c == '\\'))
+                    fputc('\\', pFile);
+                fputc(c, pFile);
+            }
+        }
+        fputc('"', pFile);
+    }
+
+    // Writes the Chrome trace event format: one "thread" per source file, one complete ("X") event per phase. Times are in microseconds.
+    bool write_trace(const char* pFilename)
+    {
+        FILE* pFile = NULL;
+        crn_fopen(&pFile, pFilename, "w");
+        if (!pFile)
+            return false;
+
+        fprintf(pFile, "{\"traceEvents\":[\n");
+
+        bool first = true;
+        for (uint32 i = 0; i < m_traced_files.size(); i++)
+        {
+            const traced_file& file = m_traced_files[i];
+            const uint32 tid = file.m_file_index + 1;
+
+            fprintf(pFile, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", tid);
+            write_json_string(pFile, file.m_filename.get_ptr());
+            fprintf(pFile, "}}");
+            first = false;
+
+            fprintf(pFile, ",\n{\"name\":\"Compress\",\"cat\":\"crnlib\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                tid, file.m_start_time * 1000000.0, file.m_duration * 1000000.0);
+
+            for (uint32 j = 0; j < file.m_events.size(); j++)
+            {
+                const crn_comp_trace_event& e = file.m_events[j];
+                fprintf(pFile, ",\n{\"name\":\"%s\",\"cat\":\"crnlib\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    crn_get_comp_phase_string(e.m_phase), tid, (file.m_start_time + e.m_start_time) * 1000000.0, e.m_duration * 1000000.0);
+            }
+        }
+
+        fprintf(pFile, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+        bool status = ferror(pFile) == 0;
+        if (fclose(pFile) == EOF)
+            status = false;
+        return status;
+    }
 };
 
 //-----------------------------------------------------------------------------------------------------------------------
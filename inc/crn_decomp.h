@@ -15,8 +15,8 @@
 // Include crnlib.h (only to bring in some basic CRN-related types).
 #include "crnlib.h"
 
-#define CRND_LIB_VERSION 104
-#define CRND_VERSION_STRING "01.04"
+#define CRND_LIB_VERSION 107
+#define CRND_VERSION_STRING "01.07"
 
 #ifdef _DEBUG
 #define CRND_BUILD_DEBUG
@@ -177,6 +177,84 @@ namespace crnd
       void** ppDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
       uint32 level_index);
 
+   // crnd_get_level_num_bands() - Returns the number of independently decodable bands in the specified mipmap level, or 0 on error.
+   // Files compressed with the cCRNCompFlagBandedLevels flag split each level into bands of chunk rows, all other files have 1 band per level.
+   uint32 crnd_get_level_num_bands(crnd_unpack_context pContext, uint32 level_index);
+
+   // crnd_unpack_level_band() - Transcodes a single band of the specified mipmap level to the destination buffer(s).
+   // The parameters are the same as crnd_unpack_level(), the whole level's destination buffer(s) must be supplied.
+   // Different bands of the same context may be unpacked at the same time from multiple threads.
+   bool crnd_unpack_level_band(
+      crnd_unpack_context pContext,
+      void** ppDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+      uint32 level_index, uint32 band_index);
+
+   // Parallel for callback used by crnd_unpack_level_parallel(). The implementation must call pTask_func(i, pTask_data) once for every i in [0, num_tasks),
+   // in any order and on any thread(s), and must not return until all of the calls have returned.
+   typedef void (*crnd_task_func)(uint32 task_index, void* pTask_data);
+   typedef void (*crnd_parallel_for_func)(uint32 num_tasks, crnd_task_func pTask_func, void* pTask_data, void* pUser_data);
+
+   // crnd_unpack_level_parallel() - Transcodes the specified mipmap level, unpacking its bands concurrently using the caller's job system.
+   // The parameters are the same as crnd_unpack_level(). If pParallel_for is NULL, or the level only has 1 band, the bands are unpacked on the calling thread.
+   bool crnd_unpack_level_parallel(
+      crnd_unpack_context pContext,
+      void** ppDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+      uint32 level_index,
+      crnd_parallel_for_func pParallel_for, void* pUser_data);
+
+   // Output formats of crnd_unpack_next_rows() and crnd_unpack_level_pixels().
+   // Channels not present in the texture's format are set to 0 (color) or 255 (alpha). DXN stores X and Y in R and G.
+   enum crnd_row_format
+   {
+      cCRNDRowFormatDXT = 0,     // DXTn blocks, laid out the same way as crnd_unpack_level()'s output.
+      cCRNDRowFormatRGBA8 = 1,   // 32bpp pixels in R,G,B,A byte order. The swizzled DXT5 formats are not unswizzled.
+      cCRNDRowFormatA8 = 2       // 8bpp pixels holding the alpha channel of the RGBA8 output, such as the value of a DXT5A texture.
+   };
+
+   // crnd_unpack_begin_rows() - Starts unpacking the specified mipmap level a few chunk rows at a time with crnd_unpack_next_rows(),
+   // so the level can be streamed through a small buffer (such as mapped staging memory) instead of being unpacked all at once.
+   // A chunk row is 2 rows of DXT blocks, or 8 rows of pixels. The faces of cubemaps are unpacked one after another.
+   // A context streams one level at a time. The other unpack functions may still be called while a level is being streamed.
+   // Pixel output is decoded straight from the palettes, see crnd_unpack_level_pixels().
+   // Returns false if any of the input parameters, or the level's data, are invalid.
+   bool crnd_unpack_begin_rows(crnd_unpack_context pContext, uint32 level_index, crnd_row_format fmt);
+
+   // crnd_unpack_begin_rows_segmented() - crnd_unpack_begin_rows() for "segmented" CRN files. pSrc must be stable until the level has been unpacked.
+   bool crnd_unpack_begin_rows_segmented(crnd_unpack_context pContext, const void* pSrc, uint32 src_size_in_bytes, uint32 level_index, crnd_row_format fmt);
+
+   // crnd_unpack_next_rows() - Unpacks up to max_chunk_rows chunk rows of the level started by crnd_unpack_begin_rows() to pDst.
+   // row_pitch_in_bytes - The pitch in bytes from one row of DXT blocks (or pixels, for pixel output) to the next, or 0 for the minimum pitch. Must be a multiple of 4,
+   // except for A8 output.
+   // dst_size_in_bytes - Must be at least row_pitch_in_bytes times the number of rows written.
+   // *pFace, *pFirst_row and *pNum_rows are set to the face and range of rows that were written, in blocks (or pixels, for pixel output).
+   // Only the rows and columns inside the level are written. A single call never crosses a face, or a band of a banded level, so it may return less than
+   // max_chunk_rows chunk rows. *pNum_rows is set to 0 once the whole level has been unpacked.
+   // Returns false if any of the input parameters, or the compressed stream, are invalid. This function does not allocate any memory.
+   bool crnd_unpack_next_rows(
+      crnd_unpack_context pContext,
+      void* pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+      uint32 max_chunk_rows,
+      uint32* pFace, uint32* pFirst_row, uint32* pNum_rows);
+
+   // crnd_unpack_level_pixels() - Decodes the specified mipmap level straight to RGBA8 or A8 pixels, without creating any DXTn blocks.
+   // The first call decodes every palette entry once into lookup tables owned by the context (freed by crnd_unpack_end()), after which
+   // each pixel is written directly from the chunk indices. This is much faster than transcoding to DXTn and then decoding the blocks.
+   // ppDst - A pointer to an array of 1 or 6 destination buffer pointers. Cubemaps require an array of 6 pointers, 2D textures require an array of 1 pointer.
+   // row_pitch_in_bytes - The pitch in bytes from one row of pixels to the next, or 0 for the minimum pitch. Must be a multiple of 4 for RGBA8 output.
+   // dst_size_in_bytes - The size of each destination buffer, which must be at least row_pitch_in_bytes times the level's height.
+   // Returns false if any of the input parameters, or the compressed stream, are invalid, or if the lookup tables couldn't be allocated.
+   bool crnd_unpack_level_pixels(
+      crnd_unpack_context pContext,
+      void** ppDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+      uint32 level_index, crnd_row_format fmt);
+
+   // crnd_unpack_level_pixels_segmented() - crnd_unpack_level_pixels() for "segmented" CRN files.
+   bool crnd_unpack_level_pixels_segmented(
+      crnd_unpack_context pContext,
+      const void* pSrc, uint32 src_size_in_bytes,
+      void** ppDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+      uint32 level_index, crnd_row_format fmt);
+
    // crnd_unpack_end() - Frees the decompress tables and unpacked palettes associated with the specified unpack context.
    // Returns false if the context is NULL, or if it points to an invalid context.
    // This function frees all memory associated with the context.
@@ -260,7 +338,11 @@ namespace crnd
    enum crn_header_flags
    {
       // If set, the compressed mipmap level data is not located after the file's base data - it will be separately managed by the user instead.
-      cCRNHeaderFlagSegmented = 1
+      cCRNHeaderFlagSegmented = 1,
+
+      // If set, each level's data starts with a crn_band_table, and each band of chunk rows is an independently decodable stream.
+      // Decoders older than v1.05 don't know about this flag and will not unpack these files correctly.
+      cCRNHeaderFlagBanded = 2
    };
 
    struct crn_header
@@ -302,6 +384,20 @@ namespace crnd
 
    const unsigned int cCRNHeaderMinSize = 62U;
 
+   // Located at the beginning of each level's data in banded files (see cCRNHeaderFlagBanded).
+   // Bands are ordered by face, then by chunk row. Each band covers m_band_chunk_rows chunk rows (the last band of each face may cover less),
+   // and the chunk encodings, endpoint indices and selector indices are delta coded from scratch at the start of each band.
+   struct crn_band_table
+   {
+      crn_packed_uint<2>    m_band_chunk_rows;
+      crn_packed_uint<2>    m_num_bands;
+
+      // m_band_ofs[] is actually an array of offsets relative to the start of the level's data: m_band_ofs[m_num_bands]
+      crn_packed_uint<4>    m_band_ofs[1];
+   };
+
+   const unsigned int cCRNBandTableMinSize = 8U;
+
 #pragma pack(pop)
 
 } // namespace crnd
@@ -3624,7 +3720,8 @@ namespace crnd
          m_magic(cMagicValue),
          m_pData(NULL),
          m_data_size(0),
-         m_pHeader(NULL)
+         m_pHeader(NULL),
+         m_pixel_tables_valid(false)
       {
       }
 
@@ -3653,10 +3750,12 @@ namespace crnd
          return true;
       }
 
-      bool unpack_level(
-         void** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
-         uint32 level_index)
+      bool get_level_data(uint32 level_index, const uint8*& pSrc, uint32& src_size_in_bytes) const
       {
+         // The level data of segmented files is managed by the user.
+         if ((level_index >= m_pHeader->m_levels) || (m_pHeader->m_flags & cCRNHeaderFlagSegmented))
+            return false;
+
          uint32 cur_level_ofs = m_pHeader->m_level_ofs[level_index];
 
          uint32 next_level_ofs = m_data_size;
@@ -3665,251 +3764,1014 @@ namespace crnd
 
          CRND_ASSERT(next_level_ofs > cur_level_ofs);
 
-         return unpack_level(m_pData + cur_level_ofs, next_level_ofs - cur_level_ofs, pDst, dst_size_in_bytes, row_pitch_in_bytes, level_index);
+         pSrc = m_pData + cur_level_ofs;
+         src_size_in_bytes = next_level_ofs - cur_level_ofs;
+         return true;
       }
 
       bool unpack_level(
-         const void* pSrc, uint32 src_size_in_bytes,
          void** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
          uint32 level_index)
       {
-         dst_size_in_bytes;
+         const uint8* pSrc;
+         uint32 src_size_in_bytes;
+         if (!get_level_data(level_index, pSrc, src_size_in_bytes))
+            return false;
 
+         return unpack_level(pSrc, src_size_in_bytes, pDst, dst_size_in_bytes, row_pitch_in_bytes, level_index);
+      }
+
+      bool unpack_level(
+         const void* pSrc, uint32 src_size_in_bytes,
+         void** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+         uint32 level_index)
+      {
 #ifdef CRND_BUILD_DEBUG
          for (uint32 f = 0; f < m_pHeader->m_faces; f++)
             if (!pDst[f])
                return false;
 #endif
 
-         const uint32 width = math::maximum(m_pHeader->m_width >> level_index, 1U);
-         const uint32 height = math::maximum(m_pHeader->m_height >> level_index, 1U);
-         const uint32 blocks_x = (width + 3U) >> 2U;
-         const uint32 blocks_y = (height + 3U) >> 2U;
-         const uint32 block_size = ((m_pHeader->m_format == cCRNFmtDXT1) || (m_pHeader->m_format == cCRNFmtDXT5A)) ? 8 : 16;
-
-         uint32 minimal_row_pitch = block_size * blocks_x;
-         if (!row_pitch_in_bytes)
-            row_pitch_in_bytes = minimal_row_pitch;
-         else if ((row_pitch_in_bytes < minimal_row_pitch) || (row_pitch_in_bytes & 3))
-            return false;
-         if (dst_size_in_bytes < row_pitch_in_bytes * blocks_y)
+         level_desc desc;
+         if (!get_level_desc(level_index, dst_size_in_bytes, row_pitch_in_bytes, desc))
             return false;
 
-         const uint32 chunks_x = (blocks_x + 1) >> 1;
-         const uint32 chunks_y = (blocks_y + 1) >> 1;
-
 #if CRND_CREATE_BYTE_STREAMS
          crnd_trace("Index stream: %u bytes\n", src_size_in_bytes);
 #endif
 
-         if (!m_codec.start_decoding(static_cast<const crnd::uint8*>(pSrc), src_size_in_bytes))
-            return false;
-
-         bool status = false;
-         switch (m_pHeader->m_format)
+         if (m_pHeader->m_flags & cCRNHeaderFlagBanded)
          {
-         case cCRNFmtDXT1:
-            status = unpack_dxt1((uint8**)pDst, dst_size_in_bytes, row_pitch_in_bytes, blocks_x, blocks_y, chunks_x, chunks_y);
-            break;
-         case cCRNFmtDXT5:
-         case cCRNFmtDXT5_CCxY:
-         case cCRNFmtDXT5_xGBR:
-         case cCRNFmtDXT5_AGBR:
-         case cCRNFmtDXT5_xGxR:
-            status = unpack_dxt5((uint8**)pDst, dst_size_in_bytes, row_pitch_in_bytes, blocks_x, blocks_y, chunks_x, chunks_y);
-            break;
-         case cCRNFmtDXT5A:
-            status = unpack_dxt5a((uint8**)pDst, dst_size_in_bytes, row_pitch_in_bytes, blocks_x, blocks_y, chunks_x, chunks_y);
-            break;
-         case cCRNFmtDXN_XY:
-         case cCRNFmtDXN_YX:
-            status = unpack_dxn((uint8**)pDst, dst_size_in_bytes, row_pitch_in_bytes, blocks_x, blocks_y, chunks_x, chunks_y);
-            break;
-         default:
-            return false;
-         }
-         if (!status)
-            return false;
-
-         m_codec.stop_decoding();
-         return true;
-      }
+            // Banded levels can still be unpacked serially, one band after another.
+            const uint32 num_bands = get_num_bands(static_cast<const uint8*>(pSrc), src_size_in_bytes, desc);
+            if (!num_bands)
+               return false;
 
-      inline const void* get_data() const { return m_pData; }
-      inline uint32 get_data_size() const { return m_data_size; }
+            for (uint32 band_index = 0; band_index < num_bands; band_index++)
+               if (!unpack_band(static_cast<const uint8*>(pSrc), src_size_in_bytes, (uint8**)pDst, dst_size_in_bytes, desc, band_index))
+                  return false;
 
-   private:
-      enum { cMagicValue = 0x1EF9CABD };
-      uint32             m_magic;
+            return true;
+         }
 
-      const uint8*       m_pData;
-      uint32             m_data_size;
-      crn_header         m_tmp_header;
-      const crn_header*  m_pHeader;
+         return unpack_chunk_rows(m_codec, static_cast<const uint8*>(pSrc), src_size_in_bytes, (uint8**)pDst, dst_size_in_bytes, desc, 0, m_pHeader->m_faces, 0, desc.m_chunks_y);
+      }
 
-      symbol_codec       m_codec;
+      // Returns the number of independently decodable bands in the level, or 0 on error. Levels in files without cCRNHeaderFlagBanded consist of a single band.
+      uint32 get_level_num_bands(uint32 level_index)
+      {
+         if (!(m_pHeader->m_flags & cCRNHeaderFlagBanded))
+            return (level_index < m_pHeader->m_levels) ? 1 : 0;
 
-      static_huffman_data_model m_chunk_encoding_dm;
-      static_huffman_data_model m_endpoint_delta_dm[2];
-      static_huffman_data_model m_selector_delta_dm[2];
+         const uint8* pSrc;
+         uint32 src_size_in_bytes;
+         if (!get_level_data(level_index, pSrc, src_size_in_bytes))
+            return 0;
 
-      crnd::vector<uint32> m_color_endpoints;
-      crnd::vector<uint32> m_color_selectors;
+         level_desc desc;
+         uint32 row_pitch_in_bytes = 0;
+         if (!get_level_desc(level_index, cUINT32_MAX, row_pitch_in_bytes, desc))
+            return 0;
 
-      crnd::vector<uint16> m_alpha_endpoints;
-      crnd::vector<uint16> m_alpha_selectors;
+         return get_num_bands(pSrc, src_size_in_bytes, desc);
+      }
 
-      bool init_tables()
+      // Unpacks a single band of a level. This method doesn't modify the unpacker, so different bands may be unpacked concurrently into the same destination buffers.
+      bool unpack_level_band(
+         void** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+         uint32 level_index, uint32 band_index) const
       {
-         if (!m_codec.start_decoding(m_pData + m_pHeader->m_tables_ofs, m_pHeader->m_tables_size))
-            return false;
-
-         if (!m_codec.decode_receive_static_data_model(m_chunk_encoding_dm))
+         const uint8* pSrc;
+         uint32 src_size_in_bytes;
+         if (!get_level_data(level_index, pSrc, src_size_in_bytes))
             return false;
 
-         if ((!m_pHeader->m_color_endpoints.m_num) && (!m_pHeader->m_alpha_endpoints.m_num))
+         level_desc desc;
+         if (!get_level_desc(level_index, dst_size_in_bytes, row_pitch_in_bytes, desc))
             return false;
 
-         if (m_pHeader->m_color_endpoints.m_num)
+         if (!(m_pHeader->m_flags & cCRNHeaderFlagBanded))
          {
-            if (!m_codec.decode_receive_static_data_model(m_endpoint_delta_dm[0])) return false;
-            if (!m_codec.decode_receive_static_data_model(m_selector_delta_dm[0])) return false;
-         }
+            if (band_index)
+               return false;
 
-         if (m_pHeader->m_alpha_endpoints.m_num)
-         {
-            if (!m_codec.decode_receive_static_data_model(m_endpoint_delta_dm[1])) return false;
-            if (!m_codec.decode_receive_static_data_model(m_selector_delta_dm[1])) return false;
+            symbol_codec codec;
+            return unpack_chunk_rows(codec, pSrc, src_size_in_bytes, (uint8**)pDst, dst_size_in_bytes, desc, 0, m_pHeader->m_faces, 0, desc.m_chunks_y);
          }
 
-         m_codec.stop_decoding();
-
-         return true;
+         return unpack_band(pSrc, src_size_in_bytes, (uint8**)pDst, dst_size_in_bytes, desc, band_index);
       }
 
-      bool decode_palettes()
+      // Starts unpacking a level a few chunk rows at a time with next_rows(). If pSrc is NULL, the level's data is taken from the file.
+      bool begin_rows(const void* pSrc, uint32 src_size_in_bytes, uint32 level_index, crnd_row_format fmt)
       {
-         if (m_pHeader->m_color_endpoints.m_num)
+         m_rows.m_active = false;
+
+         if ((fmt != cCRNDRowFormatDXT) && (!get_bytes_per_pixel(fmt)))
+            return false;
+
+         if ((fmt != cCRNDRowFormatDXT) && (!init_pixel_tables()))
+            return false;
+
+         if (!pSrc)
          {
-            if (!decode_color_endpoints()) return false;
-            if (!decode_color_selectors()) return false;
+            const uint8* pLevel_src;
+            if (!get_level_data(level_index, pLevel_src, src_size_in_bytes))
+               return false;
+            pSrc = pLevel_src;
          }
 
-         if (m_pHeader->m_alpha_endpoints.m_num)
+         level_desc desc;
+         uint32 row_pitch_in_bytes = 0;
+         if (!get_level_desc(level_index, cUINT32_MAX, row_pitch_in_bytes, desc))
+            return false;
+
+         m_rows.m_band_chunk_rows = 0;
+         if (m_pHeader->m_flags & cCRNHeaderFlagBanded)
          {
-            if (!decode_alpha_endpoints()) return false;
-            if (!decode_alpha_selectors()) return false;
+            // Each band's stream is started when next_rows() reaches it.
+            if (!get_num_bands(static_cast<const uint8*>(pSrc), src_size_in_bytes, desc))
+               return false;
+            m_rows.m_band_chunk_rows = static_cast<const crn_band_table*>(pSrc)->m_band_chunk_rows;
          }
+         else if (!m_rows.m_codec.start_decoding(static_cast<const uint8*>(pSrc), src_size_in_bytes))
+            return false;
 
+         m_rows.m_format = fmt;
+         m_rows.m_level_index = level_index;
+         m_rows.m_desc = desc;
+         m_rows.m_pSrc = static_cast<const uint8*>(pSrc);
+         m_rows.m_src_size_in_bytes = src_size_in_bytes;
+         m_rows.m_face = 0;
+         m_rows.m_chunk_y = 0;
+         m_rows.m_state = chunk_stream_state();
+         m_rows.m_active = true;
          return true;
       }
 
-      bool decode_color_endpoints()
+      // Unpacks the next chunk rows of the level started by begin_rows(). num_rows is set to 0 once the whole level has been unpacked.
+      bool next_rows(void* pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes, uint32 max_chunk_rows, uint32& face, uint32& first_row, uint32& num_rows)
       {
-         const uint32 num_color_endpoints = m_pHeader->m_color_endpoints.m_num;
+         face = 0;
+         first_row = 0;
+         num_rows = 0;
 
-         if (!m_color_endpoints.resize(num_color_endpoints))
+         if ((!m_rows.m_active) || (!max_chunk_rows))
             return false;
 
-         if (!m_codec.start_decoding(m_pData + m_pHeader->m_color_endpoints.m_ofs, m_pHeader->m_color_endpoints.m_size))
-            return false;
+         if (m_rows.m_face >= m_pHeader->m_faces)
+         {
+            face = m_rows.m_face;
+            return true;
+         }
 
-         static_huffman_data_model dm[2];
-         for (uint32 i = 0; i < 2; i++)
-            if (!m_codec.decode_receive_static_data_model(dm[i]))
-               return false;
+         const level_desc& desc = m_rows.m_desc;
+         const uint32 first_chunk_y = m_rows.m_chunk_y;
+         uint32 end_chunk_y = math::minimum(desc.m_chunks_y, first_chunk_y + max_chunk_rows);
 
-         uint32 a = 0, b = 0, c = 0;
-         uint32 d = 0, e = 0, f = 0;
+         if (m_rows.m_band_chunk_rows)
+         {
+            const uint32 bands_per_face = (desc.m_chunks_y + m_rows.m_band_chunk_rows - 1) / m_rows.m_band_chunk_rows;
+            const uint32 band_index = m_rows.m_face * bands_per_face + first_chunk_y / m_rows.m_band_chunk_rows;
 
-         uint32* CRND_RESTRICT pDst = &m_color_endpoints[0];
+            const uint8* pBand_src;
+            uint32 band_size_in_bytes, band_face, band_first_chunk_y, band_end_chunk_y;
+            if (!get_band(m_rows.m_pSrc, m_rows.m_src_size_in_bytes, desc, band_index, pBand_src, band_size_in_bytes, band_face, band_first_chunk_y, band_end_chunk_y))
+               return fail_rows();
 
-         CRND_HUFF_DECODE_BEGIN(m_codec);
+            if (first_chunk_y == band_first_chunk_y)
+            {
+               if (!m_rows.m_codec.start_decoding(pBand_src, band_size_in_bytes))
+                  return fail_rows();
+               m_rows.m_state = chunk_stream_state();
+            }
 
-#if CRND_CREATE_BYTE_STREAMS
-         vector<uint8> byte_stream;
-#endif
+            end_chunk_y = math::minimum(end_chunk_y, band_end_chunk_y);
+         }
 
-         for (uint32 i = 0; i < num_color_endpoints; i++)
+         const uint32 width = math::maximum(m_pHeader->m_width >> m_rows.m_level_index, 1U);
+         const uint32 height = math::maximum(m_pHeader->m_height >> m_rows.m_level_index, 1U);
+
+         uint8* pRows[cCRNMaxFaces];
+
+         if (m_rows.m_format == cCRNDRowFormatDXT)
          {
-            uint32 da, db, dc, dd, de, df;
-            CRND_HUFF_DECODE(m_codec, dm[0], da); a = (a + da) & 31;
-            CRND_HUFF_DECODE(m_codec, dm[1], db); b = (b + db) & 63;
-            CRND_HUFF_DECODE(m_codec, dm[0], dc); c = (c + dc) & 31;
+            first_row = first_chunk_y * 2;
+            num_rows = math::minimum((end_chunk_y - first_chunk_y) * 2, desc.m_blocks_y - first_row);
 
-            CRND_HUFF_DECODE(m_codec, dm[0], dd); d = (d + dd) & 31;
-            CRND_HUFF_DECODE(m_codec, dm[1], de); e = (e + de) & 63;
-            CRND_HUFF_DECODE(m_codec, dm[0], df); f = (f + df) & 31;
+            level_desc dst_desc(desc);
+            if (row_pitch_in_bytes)
+            {
+               if ((row_pitch_in_bytes < desc.m_row_pitch_in_bytes) || (row_pitch_in_bytes & 3))
+                  return false;
+               dst_desc.m_row_pitch_in_bytes = row_pitch_in_bytes;
+            }
 
-#if CRND_CREATE_BYTE_STREAMS
-            byte_stream.push_back(da);
-            byte_stream.push_back(db);
-            byte_stream.push_back(dc);
-            byte_stream.push_back(dd);
-            byte_stream.push_back(de);
-            byte_stream.push_back(df);
-#endif
+            if (dst_size_in_bytes < dst_desc.m_row_pitch_in_bytes * num_rows)
+               return false;
 
-            if (c_crnd_little_endian_platform)
-               *pDst++ = c | (b << 5U) | (a << 11U) | (f << 16U) | (e << 21U) | (d << 27U);
-            else
-               *pDst++ = f | (e << 5U) | (d << 11U) | (c << 16U) | (b << 21U) | (a << 27U);
+            pRows[m_rows.m_face] = static_cast<uint8*>(pDst);
+            if (!decode_chunk_rows(m_rows.m_codec, m_rows.m_state, pRows, dst_size_in_bytes, dst_desc, m_rows.m_face, m_rows.m_face + 1, first_chunk_y, end_chunk_y))
+               return fail_rows();
          }
+         else
+         {
+            first_row = first_chunk_y * 8;
+            num_rows = math::minimum((end_chunk_y - first_chunk_y) * 8, height - first_row);
 
-         CRND_HUFF_DECODE_END(m_codec);
+            if (!get_pixel_row_pitch(m_rows.m_format, width, row_pitch_in_bytes))
+               return false;
 
-         m_codec.stop_decoding();
+            if (dst_size_in_bytes < row_pitch_in_bytes * num_rows)
+               return false;
 
-#if CRND_CREATE_BYTE_STREAMS
-         write_array_to_file(L"colorendpoints.bin", byte_stream);
-         crnd_trace("color endpoints: %u\n", (uint)m_pHeader->m_color_endpoints.m_size);
-#endif
+            pRows[m_rows.m_face] = static_cast<uint8*>(pDst);
+            if (!decode_chunk_rows_to_pixels(m_rows.m_codec, m_rows.m_state, pRows, row_pitch_in_bytes, m_rows.m_format, desc, width, height, m_rows.m_face, m_rows.m_face + 1, first_chunk_y, end_chunk_y))
+               return fail_rows();
+         }
+
+         face = m_rows.m_face;
+
+         m_rows.m_chunk_y = end_chunk_y;
+         if (m_rows.m_chunk_y == desc.m_chunks_y)
+         {
+            m_rows.m_chunk_y = 0;
+            m_rows.m_face++;
+         }
 
          return true;
       }
 
-      bool decode_color_selectors()
+      // Decodes a whole level straight to pixels. If pSrc is NULL, the level's data is taken from the file.
+      bool unpack_level_pixels(
+         const void* pSrc, uint32 src_size_in_bytes,
+         void** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+         uint32 level_index, crnd_row_format fmt)
       {
-         const uint32 cMaxSelectorValue = 3U;
-         const uint32 cMaxUniqueSelectorDeltas = cMaxSelectorValue * 2U + 1U;
+         if (!get_bytes_per_pixel(fmt))
+            return false;
 
-         const uint32 num_color_selectors = m_pHeader->m_color_selectors.m_num;
+         if (!pSrc)
+         {
+            const uint8* pLevel_src;
+            if (!get_level_data(level_index, pLevel_src, src_size_in_bytes))
+               return false;
+            pSrc = pLevel_src;
+         }
 
-         if (!m_codec.start_decoding(m_pData + m_pHeader->m_color_selectors.m_ofs, m_pHeader->m_color_selectors.m_size))
+         level_desc desc;
+         uint32 block_row_pitch_in_bytes = 0;
+         if (!get_level_desc(level_index, cUINT32_MAX, block_row_pitch_in_bytes, desc))
             return false;
 
-         static_huffman_data_model dm;
-         if (!m_codec.decode_receive_static_data_model(dm))
+         const uint32 width = math::maximum(m_pHeader->m_width >> level_index, 1U);
+         const uint32 height = math::maximum(m_pHeader->m_height >> level_index, 1U);
+
+         if (!get_pixel_row_pitch(fmt, width, row_pitch_in_bytes))
+            return false;
+         if (dst_size_in_bytes < row_pitch_in_bytes * height)
             return false;
 
-         int32 delta0[cMaxUniqueSelectorDeltas * cMaxUniqueSelectorDeltas];
-         int32 delta1[cMaxUniqueSelectorDeltas * cMaxUniqueSelectorDeltas];
-         int32 l = -(int32)cMaxSelectorValue, m = -(int32)cMaxSelectorValue;
-         for (uint32 i = 0; i < (cMaxUniqueSelectorDeltas * cMaxUniqueSelectorDeltas); i++)
+         for (uint32 f = 0; f < m_pHeader->m_faces; f++)
+            if (!pDst[f])
+               return false;
+
+         if (!init_pixel_tables())
+            return false;
+
+         uint8* pRows[cCRNMaxFaces];
+
+         if (m_pHeader->m_flags & cCRNHeaderFlagBanded)
          {
-            delta0[i] = l;
-            delta1[i] = m;
+            const uint32 num_bands = get_num_bands(static_cast<const uint8*>(pSrc), src_size_in_bytes, desc);
+            if (!num_bands)
+               return false;
 
-            if (++l > (int32)cMaxSelectorValue)
+            for (uint32 band_index = 0; band_index < num_bands; band_index++)
             {
-               l = -(int32)cMaxSelectorValue;
-               m++;
-            }
-         }
+               const uint8* pBand_src;
+               uint32 band_size_in_bytes, face, first_chunk_y, end_chunk_y;
+               if (!get_band(static_cast<const uint8*>(pSrc), src_size_in_bytes, desc, band_index, pBand_src, band_size_in_bytes, face, first_chunk_y, end_chunk_y))
+                  return false;
 
-         uint32 cur[16];
-         utils::zero_object(cur);
+               if (!m_codec.start_decoding(pBand_src, band_size_in_bytes))
+                  return false;
 
-         if (!m_color_selectors.resize(num_color_selectors))
-            return false;
+               pRows[face] = static_cast<uint8*>(pDst[face]) + first_chunk_y * 8 * row_pitch_in_bytes;
 
-         uint32* CRND_RESTRICT pDst = &m_color_selectors[0];
+               chunk_stream_state state;
+               if (!decode_chunk_rows_to_pixels(m_codec, state, pRows, row_pitch_in_bytes, fmt, desc, width, height, face, face + 1, first_chunk_y, end_chunk_y))
+                  return false;
 
-         const uint8* pFrom_linear = g_dxt1_from_linear;
+               m_codec.stop_decoding();
+            }
 
-         CRND_HUFF_DECODE_BEGIN(m_codec);
+            return true;
+         }
 
-#if CRND_CREATE_BYTE_STREAMS
+         if (!m_codec.start_decoding(static_cast<const uint8*>(pSrc), src_size_in_bytes))
+            return false;
+
+         for (uint32 f = 0; f < m_pHeader->m_faces; f++)
+            pRows[f] = static_cast<uint8*>(pDst[f]);
+
+         chunk_stream_state state;
+         if (!decode_chunk_rows_to_pixels(m_codec, state, pRows, row_pitch_in_bytes, fmt, desc, width, height, 0, m_pHeader->m_faces, 0, desc.m_chunks_y))
+            return false;
+
+         m_codec.stop_decoding();
+         return true;
+      }
+
+      inline const void* get_data() const { return m_pData; }
+      inline uint32 get_data_size() const { return m_data_size; }
+
+   private:
+      enum { cMagicValue = 0x1EF9CABD };
+      uint32             m_magic;
+
+      const uint8*       m_pData;
+      uint32             m_data_size;
+      crn_header         m_tmp_header;
+      const crn_header*  m_pHeader;
+
+      symbol_codec       m_codec;
+
+      static_huffman_data_model m_chunk_encoding_dm;
+      static_huffman_data_model m_endpoint_delta_dm[2];
+      static_huffman_data_model m_selector_delta_dm[2];
+
+      crnd::vector<uint32> m_color_endpoints;
+      crnd::vector<uint32> m_color_selectors;
+
+      crnd::vector<uint16> m_alpha_endpoints;
+      crnd::vector<uint16> m_alpha_selectors;
+
+      struct level_desc
+      {
+         uint32 m_blocks_x, m_blocks_y;
+         uint32 m_chunks_x, m_chunks_y;
+         uint32 m_row_pitch_in_bytes;
+      };
+
+      // Prediction state of a chunk stream, carried over from one chunk row (and face) to the next.
+      struct chunk_stream_state
+      {
+         inline chunk_stream_state() :
+            m_chunk_encoding_bits(1),
+            m_prev_color_endpoint_index(0),
+            m_prev_color_selector_index(0),
+            m_prev_alpha0_endpoint_index(0),
+            m_prev_alpha0_selector_index(0),
+            m_prev_alpha1_endpoint_index(0),
+            m_prev_alpha1_selector_index(0)
+         {
+         }
+
+         uint32 m_chunk_encoding_bits;
+         uint32 m_prev_color_endpoint_index;
+         uint32 m_prev_color_selector_index;
+         uint32 m_prev_alpha0_endpoint_index;
+         uint32 m_prev_alpha0_selector_index;
+         uint32 m_prev_alpha1_endpoint_index;
+         uint32 m_prev_alpha1_selector_index;
+      };
+
+      // The level being unpacked by begin_rows()/next_rows().
+      struct row_stream
+      {
+         inline row_stream() : m_active(false) { }
+
+         bool               m_active;
+         crnd_row_format    m_format;
+         uint32             m_level_index;
+         level_desc         m_desc;
+         const uint8*       m_pSrc;
+         uint32             m_src_size_in_bytes;
+         uint32             m_band_chunk_rows;      // 0 if the level isn't banded
+         uint32             m_face;
+         uint32             m_chunk_y;
+         symbol_codec       m_codec;
+         chunk_stream_state m_state;
+      };
+
+      row_stream         m_rows;
+
+      // Palette lookup tables used to decode straight to pixels, built by init_pixel_tables() on first use.
+      crnd::vector<color_quad_u8> m_color_endpoint_colors;   // The 4 colors of each color endpoint pair
+      crnd::vector<uint8> m_alpha_endpoint_values;           // The 8 values of each alpha endpoint pair
+      crnd::vector<uint64> m_alpha_selector_bits;            // Each alpha selector's 16 3-bit selectors, pixel i at bit i*3
+      bool               m_pixel_tables_valid;
+
+      bool fail_rows()
+      {
+         m_rows.m_active = false;
+         return false;
+      }
+
+      bool get_level_desc(uint32 level_index, uint32 dst_size_in_bytes, uint32& row_pitch_in_bytes, level_desc& desc) const
+      {
+         const uint32 width = math::maximum(m_pHeader->m_width >> level_index, 1U);
+         const uint32 height = math::maximum(m_pHeader->m_height >> level_index, 1U);
+         const uint32 blocks_x = (width + 3U) >> 2U;
+         const uint32 blocks_y = (height + 3U) >> 2U;
+         const uint32 block_size = ((m_pHeader->m_format == cCRNFmtDXT1) || (m_pHeader->m_format == cCRNFmtDXT5A)) ? 8 : 16;
+
+         uint32 minimal_row_pitch = block_size * blocks_x;
+         if (!row_pitch_in_bytes)
+            row_pitch_in_bytes = minimal_row_pitch;
+         else if ((row_pitch_in_bytes < minimal_row_pitch) || (row_pitch_in_bytes & 3))
+            return false;
+         if (dst_size_in_bytes < row_pitch_in_bytes * blocks_y)
+            return false;
+
+         desc.m_blocks_x = blocks_x;
+         desc.m_blocks_y = blocks_y;
+         desc.m_chunks_x = (blocks_x + 1) >> 1;
+         desc.m_chunks_y = (blocks_y + 1) >> 1;
+         desc.m_row_pitch_in_bytes = row_pitch_in_bytes;
+         return true;
+      }
+
+      uint32 get_num_bands(const uint8* pSrc, uint32 src_size_in_bytes, const level_desc& desc) const
+      {
+         if (src_size_in_bytes < cCRNBandTableMinSize)
+            return 0;
+
+         const crn_band_table* pTable = reinterpret_cast<const crn_band_table*>(pSrc);
+         const uint32 band_chunk_rows = pTable->m_band_chunk_rows;
+         const uint32 num_bands = pTable->m_num_bands;
+         if ((!band_chunk_rows) || (num_bands != m_pHeader->m_faces * ((desc.m_chunks_y + band_chunk_rows - 1) / band_chunk_rows)))
+            return 0;
+
+         if (src_size_in_bytes < (cCRNBandTableMinSize + sizeof(pTable->m_band_ofs[0]) * (num_bands - 1)))
+            return 0;
+
+         return num_bands;
+      }
+
+      bool get_band(const uint8* pSrc, uint32 src_size_in_bytes, const level_desc& desc, uint32 band_index,
+         const uint8*& pBand_src, uint32& band_size_in_bytes, uint32& face, uint32& first_chunk_y, uint32& end_chunk_y) const
+      {
+         const uint32 num_bands = get_num_bands(pSrc, src_size_in_bytes, desc);
+         if (band_index >= num_bands)
+            return false;
+
+         const crn_band_table* pTable = reinterpret_cast<const crn_band_table*>(pSrc);
+         const uint32 band_chunk_rows = pTable->m_band_chunk_rows;
+         const uint32 bands_per_face = num_bands / m_pHeader->m_faces;
+
+         face = band_index / bands_per_face;
+         first_chunk_y = (band_index % bands_per_face) * band_chunk_rows;
+         end_chunk_y = math::minimum(first_chunk_y + band_chunk_rows, desc.m_chunks_y);
+
+         const uint32 band_ofs = pTable->m_band_ofs[band_index];
+         const uint32 next_band_ofs = ((band_index + 1) < num_bands) ? (uint32)pTable->m_band_ofs[band_index + 1] : src_size_in_bytes;
+         if ((next_band_ofs < band_ofs) || (next_band_ofs > src_size_in_bytes))
+            return false;
+
+         pBand_src = pSrc + band_ofs;
+         band_size_in_bytes = next_band_ofs - band_ofs;
+         return true;
+      }
+
+      bool unpack_band(const uint8* pSrc, uint32 src_size_in_bytes, uint8** pDst, uint32 dst_size_in_bytes, const level_desc& desc, uint32 band_index) const
+      {
+         const uint8* pBand_src;
+         uint32 band_size_in_bytes, face, first_chunk_y, end_chunk_y;
+         if (!get_band(pSrc, src_size_in_bytes, desc, band_index, pBand_src, band_size_in_bytes, face, first_chunk_y, end_chunk_y))
+            return false;
+
+         // Each band is a separate Huffman stream with its own prediction state, so it only shares read-only state with the other bands.
+         symbol_codec codec;
+         return unpack_chunk_rows(codec, pBand_src, band_size_in_bytes, pDst, dst_size_in_bytes, desc, face, face + 1, first_chunk_y, end_chunk_y);
+      }
+
+      bool unpack_chunk_rows(
+         symbol_codec& codec, const uint8* pSrc, uint32 src_size_in_bytes,
+         uint8** pDst, uint32 dst_size_in_bytes, const level_desc& desc,
+         uint32 first_face, uint32 end_face, uint32 first_chunk_y, uint32 end_chunk_y) const
+      {
+         if (!codec.start_decoding(pSrc, src_size_in_bytes))
+            return false;
+
+         uint8* pRows[cCRNMaxFaces];
+         for (uint32 f = first_face; f < end_face; f++)
+            pRows[f] = pDst[f] + first_chunk_y * desc.m_row_pitch_in_bytes * 2;
+
+         chunk_stream_state state;
+         if (!decode_chunk_rows(codec, state, pRows, dst_size_in_bytes, desc, first_face, end_face, first_chunk_y, end_chunk_y))
+            return false;
+
+         codec.stop_decoding();
+         return true;
+      }
+
+      // Decodes the next chunk rows of a stream that has already been started. pDst[f] points to the first decoded row of face f.
+      bool decode_chunk_rows(
+         symbol_codec& codec, chunk_stream_state& state,
+         uint8** pDst, uint32 dst_size_in_bytes, const level_desc& desc,
+         uint32 first_face, uint32 end_face, uint32 first_chunk_y, uint32 end_chunk_y) const
+      {
+         const uint32 row_pitch_in_bytes = desc.m_row_pitch_in_bytes;
+         const uint32 blocks_x = desc.m_blocks_x, blocks_y = desc.m_blocks_y;
+         const uint32 chunks_x = desc.m_chunks_x, chunks_y = desc.m_chunks_y;
+
+         switch (m_pHeader->m_format)
+         {
+         case cCRNFmtDXT1:
+            return unpack_dxt1(codec, state, pDst, dst_size_in_bytes, row_pitch_in_bytes, blocks_x, blocks_y, chunks_x, chunks_y, first_face, end_face, first_chunk_y, end_chunk_y);
+         case cCRNFmtDXT5:
+         case cCRNFmtDXT5_CCxY:
+         case cCRNFmtDXT5_xGBR:
+         case cCRNFmtDXT5_AGBR:
+         case cCRNFmtDXT5_xGxR:
+            return unpack_dxt5(codec, state, pDst, dst_size_in_bytes, row_pitch_in_bytes, blocks_x, blocks_y, chunks_x, chunks_y, first_face, end_face, first_chunk_y, end_chunk_y);
+         case cCRNFmtDXT5A:
+            return unpack_dxt5a(codec, state, pDst, dst_size_in_bytes, row_pitch_in_bytes, blocks_x, blocks_y, chunks_x, chunks_y, first_face, end_face, first_chunk_y, end_chunk_y);
+         case cCRNFmtDXN_XY:
+         case cCRNFmtDXN_YX:
+            return unpack_dxn(codec, state, pDst, dst_size_in_bytes, row_pitch_in_bytes, blocks_x, blocks_y, chunks_x, chunks_y, first_face, end_face, first_chunk_y, end_chunk_y);
+         default:
+            break;
+         }
+
+         return false;
+      }
+
+      static inline uint32 get_bytes_per_pixel(crnd_row_format fmt)
+      {
+         return (fmt == cCRNDRowFormatRGBA8) ? 4 : ((fmt == cCRNDRowFormatA8) ? 1 : 0);
+      }
+
+      // Validates row_pitch_in_bytes for a row of pixels, or sets it to the minimum pitch if it's 0.
+      static bool get_pixel_row_pitch(crnd_row_format fmt, uint32 width, uint32& row_pitch_in_bytes)
+      {
+         const uint32 bytes_per_pixel = get_bytes_per_pixel(fmt);
+         if (!row_pitch_in_bytes)
+            row_pitch_in_bytes = width * bytes_per_pixel;
+         else if ((row_pitch_in_bytes < width * bytes_per_pixel) || ((bytes_per_pixel == 4) && (row_pitch_in_bytes & 3)))
+            return false;
+         return true;
+      }
+
+      // Decodes every palette entry once into the tables used by decode_chunk_rows_to_pixels().
+      bool init_pixel_tables()
+      {
+         if (m_pixel_tables_valid)
+            return true;
+
+         const uint32 num_color_endpoints = m_color_endpoints.size();
+         if (!m_color_endpoint_colors.resize(num_color_endpoints * cDXT1SelectorValues))
+            return false;
+
+         for (uint32 i = 0; i < num_color_endpoints; i++)
+         {
+            // The palette holds the endpoints in the order they're written to the blocks.
+            const uint32 e = m_color_endpoints[i];
+            const uint16 low_color = static_cast<uint16>(c_crnd_little_endian_platform ? (e & 0xFFFFU) : (e >> 16U));
+            const uint16 high_color = static_cast<uint16>(c_crnd_little_endian_platform ? (e >> 16U) : (e & 0xFFFFU));
+
+            // Like crnlib's dxt_image::unpack(), the 3 color mode is also used for the color blocks of DXT5.
+            dxt1_block::get_block_colors(&m_color_endpoint_colors[i * cDXT1SelectorValues], low_color, high_color);
+         }
+
+         const uint32 num_alpha_endpoints = m_alpha_endpoints.size();
+         if (!m_alpha_endpoint_values.resize(num_alpha_endpoints * cDXT5SelectorValues))
+            return false;
+
+         for (uint32 i = 0; i < num_alpha_endpoints; i++)
+         {
+            uint32 values[cDXT5SelectorValues];
+            dxt5_block::get_block_values(values, m_alpha_endpoints[i] & 0xFFU, m_alpha_endpoints[i] >> 8U);
+
+            for (uint32 j = 0; j < cDXT5SelectorValues; j++)
+               m_alpha_endpoint_values[i * cDXT5SelectorValues + j] = static_cast<uint8>(values[j]);
+         }
+
+         const uint32 num_alpha_selectors = m_pHeader->m_alpha_selectors.m_num;
+         if (!m_alpha_selector_bits.resize(num_alpha_selectors))
+            return false;
+
+         for (uint32 i = 0; i < num_alpha_selectors; i++)
+         {
+            const uint16* pSelectors = &m_alpha_selectors[i * 3];
+            m_alpha_selector_bits[i] = pSelectors[0] | (static_cast<uint64>(pSelectors[1]) << 16U) | (static_cast<uint64>(pSelectors[2]) << 32U);
+         }
+
+         m_pixel_tables_valid = true;
+         return true;
+      }
+
+      // The palette entries used by one block, in the form of the pixel lookup tables.
+      struct block_pixel_source
+      {
+         const color_quad_u8* m_pColors;
+         uint32 m_color_selectors;        // pixel i at bit i*2
+         const uint8* m_pAlpha_values[2];
+         uint64 m_alpha_selectors[2];     // pixel i at bit i*3
+      };
+
+      enum pixel_layout
+      {
+         cPixelLayoutColor,               // DXT1
+         cPixelLayoutColorAlpha,          // DXT5 and the swizzled DXT5 formats
+         cPixelLayoutAlpha,               // DXT5A
+         cPixelLayoutTwoAlpha             // DXN, m_pAlpha_values[0] is stored in R
+      };
+
+      template<uint32 cLayout, uint32 cBytesPerPixel>
+      static inline void write_pixel(uint8* CRND_RESTRICT pDst, const block_pixel_source& src, uint32 color_selector, uint32 alpha0_selector, uint32 alpha1_selector)
+      {
+         if (cBytesPerPixel == 1)
+         {
+            switch (cLayout)
+            {
+            case cPixelLayoutColor: *pDst = src.m_pColors[color_selector].a; break;
+            case cPixelLayoutTwoAlpha: *pDst = 255; break;
+            default: *pDst = src.m_pAlpha_values[0][alpha0_selector]; break;
+            }
+            return;
+         }
+
+         color_quad_u8& p = *reinterpret_cast<color_quad_u8*>(pDst);
+         switch (cLayout)
+         {
+         case cPixelLayoutColor:
+            p = src.m_pColors[color_selector];
+            break;
+         case cPixelLayoutColorAlpha:
+            p = src.m_pColors[color_selector];
+            p.a = src.m_pAlpha_values[0][alpha0_selector];
+            break;
+         case cPixelLayoutAlpha:
+            p.set(0, 0, 0, src.m_pAlpha_values[0][alpha0_selector]);
+            break;
+         default:
+            p.set(src.m_pAlpha_values[0][alpha0_selector], src.m_pAlpha_values[1][alpha1_selector], 0, 255);
+            break;
+         }
+      }
+
+      // Writes the visible part of a 4x4 block. pDst points to the block's top left pixel.
+      template<uint32 cLayout, uint32 cBytesPerPixel>
+      static inline void write_block_pixels(const block_pixel_source& src, uint8* CRND_RESTRICT pDst, uint32 row_pitch_in_bytes, uint32 num_cols, uint32 num_rows)
+      {
+         for (uint32 y = 0; y < num_rows; y++, pDst += row_pitch_in_bytes)
+         {
+            const uint32 color_selectors = src.m_color_selectors >> (y * 8U);
+            const uint32 alpha0_selectors = static_cast<uint32>(src.m_alpha_selectors[0] >> (y * 12U));
+            const uint32 alpha1_selectors = static_cast<uint32>(src.m_alpha_selectors[1] >> (y * 12U));
+
+            if (num_cols == 4)
+            {
+               for (uint32 x = 0; x < 4; x++)
+                  write_pixel<cLayout, cBytesPerPixel>(pDst + x * cBytesPerPixel, src, (color_selectors >> (x * 2U)) & 3, (alpha0_selectors >> (x * 3U)) & 7, (alpha1_selectors >> (x * 3U)) & 7);
+            }
+            else
+            {
+               for (uint32 x = 0; x < num_cols; x++)
+                  write_pixel<cLayout, cBytesPerPixel>(pDst + x * cBytesPerPixel, src, (color_selectors >> (x * 2U)) & 3, (alpha0_selectors >> (x * 3U)) & 7, (alpha1_selectors >> (x * 3U)) & 7);
+            }
+         }
+      }
+
+      // Decodes the next chunk rows of a stream that has already been started straight to pixels, using the tables built by init_pixel_tables().
+      // pDst[f] points to the first pixel row of chunk row first_chunk_y of face f.
+      bool decode_chunk_rows_to_pixels(
+         symbol_codec& codec, chunk_stream_state& state,
+         uint8** pDst, uint32 row_pitch_in_bytes, crnd_row_format fmt, const level_desc& desc, uint32 width, uint32 height,
+         uint32 first_face, uint32 end_face, uint32 first_chunk_y, uint32 end_chunk_y) const
+      {
+         CRND_ASSERT(m_pixel_tables_valid);
+
+         const bool a8 = (fmt == cCRNDRowFormatA8);
+
+#define CRND_DECODE_PIXELS(layout, swap_alpha) \
+         return a8 ? \
+            decode_chunk_rows_to_pixels<layout, 1>(codec, state, pDst, row_pitch_in_bytes, swap_alpha, desc, width, height, first_face, end_face, first_chunk_y, end_chunk_y) : \
+            decode_chunk_rows_to_pixels<layout, 4>(codec, state, pDst, row_pitch_in_bytes, swap_alpha, desc, width, height, first_face, end_face, first_chunk_y, end_chunk_y);
+
+         switch (m_pHeader->m_format)
+         {
+         case cCRNFmtDXT1:
+            CRND_DECODE_PIXELS(cPixelLayoutColor, false)
+         case cCRNFmtDXT5:
+         case cCRNFmtDXT5_CCxY:
+         case cCRNFmtDXT5_xGBR:
+         case cCRNFmtDXT5_AGBR:
+         case cCRNFmtDXT5_xGxR:
+            CRND_DECODE_PIXELS(cPixelLayoutColorAlpha, false)
+         case cCRNFmtDXT5A:
+            CRND_DECODE_PIXELS(cPixelLayoutAlpha, false)
+         case cCRNFmtDXN_XY:
+            CRND_DECODE_PIXELS(cPixelLayoutTwoAlpha, false)
+         case cCRNFmtDXN_YX:
+            CRND_DECODE_PIXELS(cPixelLayoutTwoAlpha, true)
+         default:
+            break;
+         }
+
+#undef CRND_DECODE_PIXELS
+
+         return false;
+      }
+
+      // The symbols are read in the same order as the unpack_*() functions read them: the alpha0, alpha1 and color endpoints of each chunk's tiles,
+      // then the alpha0, alpha1 and color selectors of each of its blocks.
+      template<uint32 cLayout, uint32 cBytesPerPixel>
+      bool decode_chunk_rows_to_pixels(
+         symbol_codec& codec, chunk_stream_state& state,
+         uint8** pDst, uint32 row_pitch_in_bytes, bool swap_alpha, const level_desc& desc, uint32 width, uint32 height,
+         uint32 first_face, uint32 end_face, uint32 first_chunk_y, uint32 end_chunk_y) const
+      {
+         const bool has_color = (cLayout == cPixelLayoutColor) || (cLayout == cPixelLayoutColorAlpha);
+         const uint32 num_alpha = (cLayout == cPixelLayoutTwoAlpha) ? 2 : ((cLayout == cPixelLayoutColor) ? 0 : 1);
+
+         const uint32 blocks_x = desc.m_blocks_x, blocks_y = desc.m_blocks_y;
+         const uint32 chunks_x = desc.m_chunks_x;
+
+         const uint32 num_color_endpoints = m_color_endpoints.size();
+         const uint32 num_color_selectors = m_color_selectors.size();
+         const uint32 num_alpha_endpoints = m_alpha_endpoints.size();
+         const uint32 num_alpha_selectors = m_pHeader->m_alpha_selectors.m_num;
+
+         uint32 chunk_encoding_bits = state.m_chunk_encoding_bits;
+         uint32 prev_color_endpoint_index = state.m_prev_color_endpoint_index;
+         uint32 prev_color_selector_index = state.m_prev_color_selector_index;
+         uint32 prev_alpha_endpoint_index[2] = { state.m_prev_alpha0_endpoint_index, state.m_prev_alpha1_endpoint_index };
+         uint32 prev_alpha_selector_index[2] = { state.m_prev_alpha0_selector_index, state.m_prev_alpha1_selector_index };
+
+         block_pixel_source src;
+         src.m_pColors = NULL;
+         src.m_color_selectors = 0;
+         src.m_pAlpha_values[0] = src.m_pAlpha_values[1] = NULL;
+         src.m_alpha_selectors[0] = src.m_alpha_selectors[1] = 0;
+
+         CRND_HUFF_DECODE_BEGIN(codec);
+
+         for (uint32 f = first_face; f < end_face; f++)
+         {
+            for (uint32 y = first_chunk_y; y < end_chunk_y; y++)
+            {
+               uint8* pChunk_row = pDst[f] + (y - first_chunk_y) * 8 * row_pitch_in_bytes;
+
+               int32 start_x = 0;
+               int32 end_x = chunks_x;
+               int32 dir_x = 1;
+               if (y & 1)
+               {
+                  start_x = chunks_x - 1;
+                  end_x = -1;
+                  dir_x = -1;
+               }
+
+               for (int32 x = start_x; x != end_x; x += dir_x)
+               {
+                  if (chunk_encoding_bits == 1)
+                  {
+                     CRND_HUFF_DECODE(codec, m_chunk_encoding_dm, chunk_encoding_bits);
+                     chunk_encoding_bits |= 512;
+                  }
+
+                  const uint32 chunk_encoding_index = chunk_encoding_bits & 7;
+                  chunk_encoding_bits >>= 3;
+
+                  const uint32 num_tiles = g_crnd_chunk_encoding_num_tiles[chunk_encoding_index];
+                  const uint8* pTile_indices = g_crnd_chunk_encoding_tiles[chunk_encoding_index].m_tiles;
+
+                  uint32 alpha_endpoints[2][4];
+                  uint32 color_endpoints[4];
+
+                  for (uint32 a = 0; a < num_alpha; a++)
+                  {
+                     for (uint32 i = 0; i < num_tiles; i++)
+                     {
+                        uint32 delta; CRND_HUFF_DECODE(codec, m_endpoint_delta_dm[1], delta);
+                        prev_alpha_endpoint_index[a] += delta;
+                        limit(prev_alpha_endpoint_index[a], num_alpha_endpoints);
+                        alpha_endpoints[a][i] = prev_alpha_endpoint_index[a];
+                     }
+                  }
+
+                  if (has_color)
+                  {
+                     for (uint32 i = 0; i < num_tiles; i++)
+                     {
+                        uint32 delta; CRND_HUFF_DECODE(codec, m_endpoint_delta_dm[0], delta);
+                        prev_color_endpoint_index += delta;
+                        limit(prev_color_endpoint_index, num_color_endpoints);
+                        color_endpoints[i] = prev_color_endpoint_index;
+                     }
+                  }
+
+                  for (uint32 by = 0; by < 2; by++)
+                  {
+                     for (uint32 bx = 0; bx < 2; bx++)
+                     {
+                        const uint32 tile_index = pTile_indices[bx + by * 2];
+
+                        for (uint32 a = 0; a < num_alpha; a++)
+                        {
+                           uint32 delta; CRND_HUFF_DECODE(codec, m_selector_delta_dm[1], delta);
+                           prev_alpha_selector_index[a] += delta;
+                           limit(prev_alpha_selector_index[a], num_alpha_selectors);
+
+                           const uint32 s = swap_alpha ? (a ^ 1) : a;
+                           src.m_pAlpha_values[s] = &m_alpha_endpoint_values[alpha_endpoints[a][tile_index] * cDXT5SelectorValues];
+                           src.m_alpha_selectors[s] = m_alpha_selector_bits[prev_alpha_selector_index[a]];
+                        }
+
+                        if (has_color)
+                        {
+                           uint32 delta; CRND_HUFF_DECODE(codec, m_selector_delta_dm[0], delta);
+                           prev_color_selector_index += delta;
+                           limit(prev_color_selector_index, num_color_selectors);
+
+                           // The palette holds the selectors in the order they're written to the blocks.
+                           const uint32 s = m_color_selectors[prev_color_selector_index];
+                           src.m_pColors = &m_color_endpoint_colors[color_endpoints[tile_index] * cDXT1SelectorValues];
+                           src.m_color_selectors = c_crnd_little_endian_platform ? s : ((s >> 16U) | (s << 16U));
+                        }
+
+                        const uint32 block_x = x * 2 + bx;
+                        const uint32 block_y = y * 2 + by;
+                        if ((block_x >= blocks_x) || (block_y >= blocks_y))
+                           continue;
+
+                        write_block_pixels<cLayout, cBytesPerPixel>(src,
+                           pChunk_row + by * 4 * row_pitch_in_bytes + block_x * 4 * cBytesPerPixel, row_pitch_in_bytes,
+                           math::minimum(4U, width - block_x * 4), math::minimum(4U, height - block_y * 4));
+                     }
+                  }
+               } // x
+            } // y
+         } // f
+
+         CRND_HUFF_DECODE_END(codec);
+
+         state.m_chunk_encoding_bits = chunk_encoding_bits;
+         state.m_prev_color_endpoint_index = prev_color_endpoint_index;
+         state.m_prev_color_selector_index = prev_color_selector_index;
+         state.m_prev_alpha0_endpoint_index = prev_alpha_endpoint_index[0];
+         state.m_prev_alpha0_selector_index = prev_alpha_selector_index[0];
+         state.m_prev_alpha1_endpoint_index = prev_alpha_endpoint_index[1];
+         state.m_prev_alpha1_selector_index = prev_alpha_selector_index[1];
+
+         return true;
+      }
+
+      bool init_tables()
+      {
+         if (!m_codec.start_decoding(m_pData + m_pHeader->m_tables_ofs, m_pHeader->m_tables_size))
+            return false;
+
+         if (!m_codec.decode_receive_static_data_model(m_chunk_encoding_dm))
+            return false;
+
+         if ((!m_pHeader->m_color_endpoints.m_num) && (!m_pHeader->m_alpha_endpoints.m_num))
+            return false;
+
+         if (m_pHeader->m_color_endpoints.m_num)
+         {
+            if (!m_codec.decode_receive_static_data_model(m_endpoint_delta_dm[0])) return false;
+            if (!m_codec.decode_receive_static_data_model(m_selector_delta_dm[0])) return false;
+         }
+
+         if (m_pHeader->m_alpha_endpoints.m_num)
+         {
+            if (!m_codec.decode_receive_static_data_model(m_endpoint_delta_dm[1])) return false;
+            if (!m_codec.decode_receive_static_data_model(m_selector_delta_dm[1])) return false;
+         }
+
+         m_codec.stop_decoding();
+
+         return true;
+      }
+
+      bool decode_palettes()
+      {
+         if (m_pHeader->m_color_endpoints.m_num)
+         {
+            if (!decode_color_endpoints()) return false;
+            if (!decode_color_selectors()) return false;
+         }
+
+         if (m_pHeader->m_alpha_endpoints.m_num)
+         {
+            if (!decode_alpha_endpoints()) return false;
+            if (!decode_alpha_selectors()) return false;
+         }
+
+         return true;
+      }
+
+      bool decode_color_endpoints()
+      {
+         const uint32 num_color_endpoints = m_pHeader->m_color_endpoints.m_num;
+
+         if (!m_color_endpoints.resize(num_color_endpoints))
+            return false;
+
+         if (!m_codec.start_decoding(m_pData + m_pHeader->m_color_endpoints.m_ofs, m_pHeader->m_color_endpoints.m_size))
+            return false;
+
+         static_huffman_data_model dm[2];
+         for (uint32 i = 0; i < 2; i++)
+            if (!m_codec.decode_receive_static_data_model(dm[i]))
+               return false;
+
+         uint32 a = 0, b = 0, c = 0;
+         uint32 d = 0, e = 0, f = 0;
+
+         uint32* CRND_RESTRICT pDst = &m_color_endpoints[0];
+
+         CRND_HUFF_DECODE_BEGIN(m_codec);
+
+#if CRND_CREATE_BYTE_STREAMS
+         vector<uint8> byte_stream;
+#endif
+
+         for (uint32 i = 0; i < num_color_endpoints; i++)
+         {
+            uint32 da, db, dc, dd, de, df;
+            CRND_HUFF_DECODE(m_codec, dm[0], da); a = (a + da) & 31;
+            CRND_HUFF_DECODE(m_codec, dm[1], db); b = (b + db) & 63;
+            CRND_HUFF_DECODE(m_codec, dm[0], dc); c = (c + dc) & 31;
+
+            CRND_HUFF_DECODE(m_codec, dm[0], dd); d = (d + dd) & 31;
+            CRND_HUFF_DECODE(m_codec, dm[1], de); e = (e + de) & 63;
+            CRND_HUFF_DECODE(m_codec, dm[0], df); f = (f + df) & 31;
+
+#if CRND_CREATE_BYTE_STREAMS
+            byte_stream.push_back(da);
+            byte_stream.push_back(db);
+            byte_stream.push_back(dc);
+            byte_stream.push_back(dd);
+            byte_stream.push_back(de);
+            byte_stream.push_back(df);
+#endif
+
+            if (c_crnd_little_endian_platform)
+               *pDst++ = c | (b << 5U) | (a << 11U) | (f << 16U) | (e << 21U) | (d << 27U);
+            else
+               *pDst++ = f | (e << 5U) | (d << 11U) | (c << 16U) | (b << 21U) | (a << 27U);
+         }
+
+         CRND_HUFF_DECODE_END(m_codec);
+
+         m_codec.stop_decoding();
+
+#if CRND_CREATE_BYTE_STREAMS
+         write_array_to_file(L"colorendpoints.bin", byte_stream);
+         crnd_trace("color endpoints: %u\n", (uint)m_pHeader->m_color_endpoints.m_size);
+#endif
+
+         return true;
+      }
+
+      bool decode_color_selectors()
+      {
+         const uint32 cMaxSelectorValue = 3U;
+         const uint32 cMaxUniqueSelectorDeltas = cMaxSelectorValue * 2U + 1U;
+
+         const uint32 num_color_selectors = m_pHeader->m_color_selectors.m_num;
+
+         if (!m_codec.start_decoding(m_pData + m_pHeader->m_color_selectors.m_ofs, m_pHeader->m_color_selectors.m_size))
+            return false;
+
+         static_huffman_data_model dm;
+         if (!m_codec.decode_receive_static_data_model(dm))
+            return false;
+
+         int32 delta0[cMaxUniqueSelectorDeltas * cMaxUniqueSelectorDeltas];
+         int32 delta1[cMaxUniqueSelectorDeltas * cMaxUniqueSelectorDeltas];
+         int32 l = -(int32)cMaxSelectorValue, m = -(int32)cMaxSelectorValue;
+         for (uint32 i = 0; i < (cMaxUniqueSelectorDeltas * cMaxUniqueSelectorDeltas); i++)
+         {
+            delta0[i] = l;
+            delta1[i] = m;
+
+            if (++l > (int32)cMaxSelectorValue)
+            {
+               l = -(int32)cMaxSelectorValue;
+               m++;
+            }
+         }
+
+         uint32 cur[16];
+         utils::zero_object(cur);
+
+         if (!m_color_selectors.resize(num_color_selectors))
+            return false;
+
+         uint32* CRND_RESTRICT pDst = &m_color_selectors[0];
+
+         const uint8* pFrom_linear = g_dxt1_from_linear;
+
+         CRND_HUFF_DECODE_BEGIN(m_codec);
+
+#if CRND_CREATE_BYTE_STREAMS
          vector<uint8> byte_stream;
 #endif
 
@@ -4095,25 +4957,24 @@ namespace crnd
          x = (x & msk) | (v & ~msk);
       }
 
-      bool unpack_dxt1(uint8** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes, uint32 blocks_x, uint32 blocks_y, uint32 chunks_x, uint32 chunks_y)
+      bool unpack_dxt1(symbol_codec& codec, chunk_stream_state& state, uint8** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes, uint32 blocks_x, uint32 blocks_y, uint32 chunks_x, uint32 chunks_y,
+         uint32 first_face, uint32 end_face, uint32 first_chunk_y, uint32 end_chunk_y) const
       {
          dst_size_in_bytes;
 
-         uint32 chunk_encoding_bits = 1;
+         uint32 chunk_encoding_bits = state.m_chunk_encoding_bits;
 
          const uint32 num_color_endpoints = m_color_endpoints.size();
          const uint32 num_color_selectors = m_color_selectors.size();
 
-         uint32 prev_color_endpoint_index = 0;
-         uint32 prev_color_selector_index = 0;
-
-         const uint32 num_faces = m_pHeader->m_faces;
+         uint32 prev_color_endpoint_index = state.m_prev_color_endpoint_index;
+         uint32 prev_color_selector_index = state.m_prev_color_selector_index;
 
          const uint32 row_pitch_in_dwords = row_pitch_in_bytes >> 2U;
 
          const int32 cBytesPerBlock = 8;
 
-         CRND_HUFF_DECODE_BEGIN(m_codec);
+         CRND_HUFF_DECODE_BEGIN(codec);
 
 #if CRND_CREATE_BYTE_STREAMS
          vector<uint8> tile_encoding_stream;
@@ -4121,11 +4982,11 @@ namespace crnd
          vector<uint8> selector_indices_stream;
 #endif
 
-         for (uint32 f = 0; f < num_faces; f++)
+         for (uint32 f = first_face; f < end_face; f++)
          {
             uint8* CRND_RESTRICT pRow = pDst[f];
 
-            for (uint32 y = 0; y < chunks_y; y++)
+            for (uint32 y = first_chunk_y; y < end_chunk_y; y++)
             {
                int32 start_x = 0;
                int32 end_x = chunks_x;
@@ -4150,7 +5011,7 @@ namespace crnd
 
                   if (chunk_encoding_bits == 1)
                   {
-                     CRND_HUFF_DECODE(m_codec, m_chunk_encoding_dm, chunk_encoding_bits);
+                     CRND_HUFF_DECODE(codec, m_chunk_encoding_dm, chunk_encoding_bits);
 #if CRND_CREATE_BYTE_STREAMS
                      tile_encoding_stream.push_back(chunk_encoding_bits & 7);
                      tile_encoding_stream.push_back((chunk_encoding_bits >> 3) & 7);
@@ -4167,7 +5028,7 @@ namespace crnd
                   for (uint32 i = 0; i < num_tiles; i++)
                   {
                      uint32 delta;
-                     CRND_HUFF_DECODE(m_codec, m_endpoint_delta_dm[0], delta);
+                     CRND_HUFF_DECODE(codec, m_endpoint_delta_dm[0], delta);
 #if CRND_CREATE_BYTE_STREAMS
                      endpoint_indices_stream.push_back(delta);
 #endif
@@ -4189,7 +5050,7 @@ namespace crnd
                      pD[0] = color_endpoints[pTile_indices[0]];
                      CRND_WRITE_BARRIER
                      uint32 delta0;
-                     CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[0], delta0);
+                     CRND_HUFF_DECODE(codec, m_selector_delta_dm[0], delta0);
 #if CRND_CREATE_BYTE_STREAMS
                      selector_indices_stream.push_back(delta0);
 #endif
@@ -4201,7 +5062,7 @@ namespace crnd
                      pD[2] = color_endpoints[pTile_indices[1]];
                      CRND_WRITE_BARRIER
                      uint32 delta1;
-                     CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[0], delta1);
+                     CRND_HUFF_DECODE(codec, m_selector_delta_dm[0], delta1);
 #if CRND_CREATE_BYTE_STREAMS
                      selector_indices_stream.push_back(delta1);
 #endif
@@ -4213,7 +5074,7 @@ namespace crnd
                      pD[0 + row_pitch_in_dwords] = color_endpoints[pTile_indices[2]];
                      CRND_WRITE_BARRIER
                      uint32 delta2;
-                     CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[0], delta2);
+                     CRND_HUFF_DECODE(codec, m_selector_delta_dm[0], delta2);
 #if CRND_CREATE_BYTE_STREAMS
                      selector_indices_stream.push_back(delta2);
 #endif
@@ -4225,7 +5086,7 @@ namespace crnd
                      pD[2 + row_pitch_in_dwords] = color_endpoints[pTile_indices[3]];
                      CRND_WRITE_BARRIER
                      uint32 delta3;
-                     CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[0], delta3);
+                     CRND_HUFF_DECODE(codec, m_selector_delta_dm[0], delta3);
 #if CRND_CREATE_BYTE_STREAMS
                      selector_indices_stream.push_back(delta3);
 #endif
@@ -4242,7 +5103,7 @@ namespace crnd
                         for (uint32 bx = 0; bx < 2; bx++, pD += 2)
                         {
                            uint32 delta;
-                           CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[0], delta);
+                           CRND_HUFF_DECODE(codec, m_selector_delta_dm[0], delta);
 #if CRND_CREATE_BYTE_STREAMS
                            selector_indices_stream.push_back(delta);
 #endif
@@ -4270,7 +5131,11 @@ namespace crnd
 
          } // f
 
-         CRND_HUFF_DECODE_END(m_codec);
+         CRND_HUFF_DECODE_END(codec);
+
+         state.m_chunk_encoding_bits = chunk_encoding_bits;
+         state.m_prev_color_endpoint_index = prev_color_endpoint_index;
+         state.m_prev_color_selector_index = prev_color_selector_index;
 
 #if CRND_CREATE_BYTE_STREAMS
          write_array_to_file(L"tile_encodings.bin", tile_encoding_stream);
@@ -4281,35 +5146,34 @@ namespace crnd
          return true;
       }
 
-      bool unpack_dxt5(uint8** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes, uint32 blocks_x, uint32 blocks_y, uint32 chunks_x, uint32 chunks_y)
+      bool unpack_dxt5(symbol_codec& codec, chunk_stream_state& state, uint8** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes, uint32 blocks_x, uint32 blocks_y, uint32 chunks_x, uint32 chunks_y,
+         uint32 first_face, uint32 end_face, uint32 first_chunk_y, uint32 end_chunk_y) const
       {
          dst_size_in_bytes;
 
-         uint32 chunk_encoding_bits = 1;
+         uint32 chunk_encoding_bits = state.m_chunk_encoding_bits;
 
          const uint32 num_color_endpoints = m_color_endpoints.size();
          const uint32 num_color_selectors = m_color_selectors.size();
          const uint32 num_alpha_endpoints = m_alpha_endpoints.size();
          const uint32 num_alpha_selectors = m_pHeader->m_alpha_selectors.m_num;
 
-         uint32 prev_color_endpoint_index = 0;
-         uint32 prev_color_selector_index = 0;
-         uint32 prev_alpha_endpoint_index = 0;
-         uint32 prev_alpha_selector_index = 0;
-
-         const uint32 num_faces = m_pHeader->m_faces;
+         uint32 prev_color_endpoint_index = state.m_prev_color_endpoint_index;
+         uint32 prev_color_selector_index = state.m_prev_color_selector_index;
+         uint32 prev_alpha_endpoint_index = state.m_prev_alpha0_endpoint_index;
+         uint32 prev_alpha_selector_index = state.m_prev_alpha0_selector_index;
 
          //const uint32 row_pitch_in_dwords = row_pitch_in_bytes >> 2U;
 
          const int32 cBytesPerBlock = 16;
 
-         CRND_HUFF_DECODE_BEGIN(m_codec);
+         CRND_HUFF_DECODE_BEGIN(codec);
 
-         for (uint32 f = 0; f < num_faces; f++)
+         for (uint32 f = first_face; f < end_face; f++)
          {
             uint8* CRND_RESTRICT pRow = pDst[f];
 
-            for (uint32 y = 0; y < chunks_y; y++)
+            for (uint32 y = first_chunk_y; y < end_chunk_y; y++)
             {
                int32 start_x = 0;
                int32 end_x = chunks_x;
@@ -4335,7 +5199,7 @@ namespace crnd
 
                   if (chunk_encoding_bits == 1)
                   {
-                     CRND_HUFF_DECODE(m_codec, m_chunk_encoding_dm, chunk_encoding_bits);
+                     CRND_HUFF_DECODE(codec, m_chunk_encoding_dm, chunk_encoding_bits);
                      chunk_encoding_bits |= 512;
                   }
 
@@ -4352,7 +5216,7 @@ namespace crnd
 
                   for (uint32 i = 0; i < num_tiles; i++)
                   {
-                     uint32 delta; CRND_HUFF_DECODE(m_codec, m_endpoint_delta_dm[1], delta);
+                     uint32 delta; CRND_HUFF_DECODE(codec, m_endpoint_delta_dm[1], delta);
                      prev_alpha_endpoint_index += delta;
                      limit(prev_alpha_endpoint_index, num_alpha_endpoints);
                      alpha_endpoints[i] = m_alpha_endpoints[prev_alpha_endpoint_index];
@@ -4360,7 +5224,7 @@ namespace crnd
 
                   for (uint32 i = 0; i < num_tiles; i++)
                   {
-                     uint32 delta; CRND_HUFF_DECODE(m_codec, m_endpoint_delta_dm[0], delta);
+                     uint32 delta; CRND_HUFF_DECODE(codec, m_endpoint_delta_dm[0], delta);
                      prev_color_endpoint_index += delta;
                      limit(prev_color_endpoint_index, num_color_endpoints);
                      color_endpoints[i] = m_color_endpoints[prev_color_endpoint_index];
@@ -4371,11 +5235,11 @@ namespace crnd
                   {
                      for (uint32 bx = 0; bx < 2; bx++, pD += 4)
                      {
-                        uint32 delta0; CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[1], delta0);
+                        uint32 delta0; CRND_HUFF_DECODE(codec, m_selector_delta_dm[1], delta0);
                         prev_alpha_selector_index += delta0;
                         limit(prev_alpha_selector_index, num_alpha_selectors);
 
-                        uint32 delta1; CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[0], delta1);
+                        uint32 delta1; CRND_HUFF_DECODE(codec, m_selector_delta_dm[0], delta1);
                         prev_color_selector_index += delta1;
                         limit(prev_color_selector_index, num_color_selectors);
 
@@ -4419,38 +5283,43 @@ namespace crnd
 
          } // f
 
-         CRND_HUFF_DECODE_END(m_codec);
+         CRND_HUFF_DECODE_END(codec);
+
+         state.m_chunk_encoding_bits = chunk_encoding_bits;
+         state.m_prev_color_endpoint_index = prev_color_endpoint_index;
+         state.m_prev_color_selector_index = prev_color_selector_index;
+         state.m_prev_alpha0_endpoint_index = prev_alpha_endpoint_index;
+         state.m_prev_alpha0_selector_index = prev_alpha_selector_index;
 
          return true;
       }
 
-      bool unpack_dxn(uint8** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes, uint32 blocks_x, uint32 blocks_y, uint32 chunks_x, uint32 chunks_y)
+      bool unpack_dxn(symbol_codec& codec, chunk_stream_state& state, uint8** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes, uint32 blocks_x, uint32 blocks_y, uint32 chunks_x, uint32 chunks_y,
+         uint32 first_face, uint32 end_face, uint32 first_chunk_y, uint32 end_chunk_y) const
       {
          dst_size_in_bytes;
 
-         uint32 chunk_encoding_bits = 1;
+         uint32 chunk_encoding_bits = state.m_chunk_encoding_bits;
 
          const uint32 num_alpha_endpoints = m_alpha_endpoints.size();
          const uint32 num_alpha_selectors = m_pHeader->m_alpha_selectors.m_num;
 
-         uint32 prev_alpha0_endpoint_index = 0;
-         uint32 prev_alpha0_selector_index = 0;
-         uint32 prev_alpha1_endpoint_index = 0;
-         uint32 prev_alpha1_selector_index = 0;
-
-         const uint32 num_faces = m_pHeader->m_faces;
+         uint32 prev_alpha0_endpoint_index = state.m_prev_alpha0_endpoint_index;
+         uint32 prev_alpha0_selector_index = state.m_prev_alpha0_selector_index;
+         uint32 prev_alpha1_endpoint_index = state.m_prev_alpha1_endpoint_index;
+         uint32 prev_alpha1_selector_index = state.m_prev_alpha1_selector_index;
 
          //const uint32 row_pitch_in_dwords = row_pitch_in_bytes >> 2U;
 
          const int32 cBytesPerBlock = 16;
 
-         CRND_HUFF_DECODE_BEGIN(m_codec);
+         CRND_HUFF_DECODE_BEGIN(codec);
 
-         for (uint32 f = 0; f < num_faces; f++)
+         for (uint32 f = first_face; f < end_face; f++)
          {
             uint8* CRND_RESTRICT pRow = pDst[f];
 
-            for (uint32 y = 0; y < chunks_y; y++)
+            for (uint32 y = first_chunk_y; y < end_chunk_y; y++)
             {
                int32 start_x = 0;
                int32 end_x = chunks_x;
@@ -4476,7 +5345,7 @@ namespace crnd
 
                   if (chunk_encoding_bits == 1)
                   {
-                     CRND_HUFF_DECODE(m_codec, m_chunk_encoding_dm, chunk_encoding_bits);
+                     CRND_HUFF_DECODE(codec, m_chunk_encoding_dm, chunk_encoding_bits);
                      chunk_encoding_bits |= 512;
                   }
 
@@ -4493,7 +5362,7 @@ namespace crnd
 
                   for (uint32 i = 0; i < num_tiles; i++)
                   {
-                     uint32 delta; CRND_HUFF_DECODE(m_codec, m_endpoint_delta_dm[1], delta);
+                     uint32 delta; CRND_HUFF_DECODE(codec, m_endpoint_delta_dm[1], delta);
                      prev_alpha0_endpoint_index += delta;
                      limit(prev_alpha0_endpoint_index, num_alpha_endpoints);
                      alpha0_endpoints[i] = m_alpha_endpoints[prev_alpha0_endpoint_index];
@@ -4501,7 +5370,7 @@ namespace crnd
 
                   for (uint32 i = 0; i < num_tiles; i++)
                   {
-                     uint32 delta; CRND_HUFF_DECODE(m_codec, m_endpoint_delta_dm[1], delta);
+                     uint32 delta; CRND_HUFF_DECODE(codec, m_endpoint_delta_dm[1], delta);
                      prev_alpha1_endpoint_index += delta;
                      limit(prev_alpha1_endpoint_index, num_alpha_endpoints);
                      alpha1_endpoints[i] = m_alpha_endpoints[prev_alpha1_endpoint_index];
@@ -4512,11 +5381,11 @@ namespace crnd
                   {
                      for (uint32 bx = 0; bx < 2; bx++, pD += 4)
                      {
-                        uint32 delta0; CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[1], delta0);
+                        uint32 delta0; CRND_HUFF_DECODE(codec, m_selector_delta_dm[1], delta0);
                         prev_alpha0_selector_index += delta0;
                         limit(prev_alpha0_selector_index, num_alpha_selectors);
 
-                        uint32 delta1; CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[1], delta1);
+                        uint32 delta1; CRND_HUFF_DECODE(codec, m_selector_delta_dm[1], delta1);
                         prev_alpha1_selector_index += delta1;
                         limit(prev_alpha1_selector_index, num_alpha_selectors);
 
@@ -4561,34 +5430,39 @@ namespace crnd
 
          } // f
 
-         CRND_HUFF_DECODE_END(m_codec);
+         CRND_HUFF_DECODE_END(codec);
+
+         state.m_chunk_encoding_bits = chunk_encoding_bits;
+         state.m_prev_alpha0_endpoint_index = prev_alpha0_endpoint_index;
+         state.m_prev_alpha0_selector_index = prev_alpha0_selector_index;
+         state.m_prev_alpha1_endpoint_index = prev_alpha1_endpoint_index;
+         state.m_prev_alpha1_selector_index = prev_alpha1_selector_index;
 
          return true;
       }
 
-      bool unpack_dxt5a(uint8** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes, uint32 blocks_x, uint32 blocks_y, uint32 chunks_x, uint32 chunks_y)
+      bool unpack_dxt5a(symbol_codec& codec, chunk_stream_state& state, uint8** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes, uint32 blocks_x, uint32 blocks_y, uint32 chunks_x, uint32 chunks_y,
+         uint32 first_face, uint32 end_face, uint32 first_chunk_y, uint32 end_chunk_y) const
       {
          dst_size_in_bytes;
 
-         uint32 chunk_encoding_bits = 1;
+         uint32 chunk_encoding_bits = state.m_chunk_encoding_bits;
 
          const uint32 num_alpha_endpoints = m_alpha_endpoints.size();
          const uint32 num_alpha_selectors = m_pHeader->m_alpha_selectors.m_num;
 
-         uint32 prev_alpha0_endpoint_index = 0;
-         uint32 prev_alpha0_selector_index = 0;
-
-         const uint32 num_faces = m_pHeader->m_faces;
+         uint32 prev_alpha0_endpoint_index = state.m_prev_alpha0_endpoint_index;
+         uint32 prev_alpha0_selector_index = state.m_prev_alpha0_selector_index;
 
          const int32 cBytesPerBlock = 8;
 
-         CRND_HUFF_DECODE_BEGIN(m_codec);
+         CRND_HUFF_DECODE_BEGIN(codec);
 
-         for (uint32 f = 0; f < num_faces; f++)
+         for (uint32 f = first_face; f < end_face; f++)
          {
             uint8* CRND_RESTRICT pRow = pDst[f];
 
-            for (uint32 y = 0; y < chunks_y; y++)
+            for (uint32 y = first_chunk_y; y < end_chunk_y; y++)
             {
                int32 start_x = 0;
                int32 end_x = chunks_x;
@@ -4613,7 +5487,7 @@ namespace crnd
 
                   if (chunk_encoding_bits == 1)
                   {
-                     CRND_HUFF_DECODE(m_codec, m_chunk_encoding_dm, chunk_encoding_bits);
+                     CRND_HUFF_DECODE(codec, m_chunk_encoding_dm, chunk_encoding_bits);
                      chunk_encoding_bits |= 512;
                   }
 
@@ -4630,7 +5504,7 @@ namespace crnd
 
                   for (uint32 i = 0; i < num_tiles; i++)
                   {
-                     uint32 delta; CRND_HUFF_DECODE(m_codec, m_endpoint_delta_dm[1], delta);
+                     uint32 delta; CRND_HUFF_DECODE(codec, m_endpoint_delta_dm[1], delta);
                      prev_alpha0_endpoint_index += delta;
                      limit(prev_alpha0_endpoint_index, num_alpha_endpoints);
                      alpha0_endpoints[i] = m_alpha_endpoints[prev_alpha0_endpoint_index];
@@ -4641,7 +5515,7 @@ namespace crnd
                   {
                      for (uint32 bx = 0; bx < 2; bx++, pD += 2)
                      {
-                        uint32 delta; CRND_HUFF_DECODE(m_codec, m_selector_delta_dm[1], delta);
+                        uint32 delta; CRND_HUFF_DECODE(codec, m_selector_delta_dm[1], delta);
                         prev_alpha0_selector_index += delta;
                         limit(prev_alpha0_selector_index, num_alpha_selectors);
 
@@ -4677,7 +5551,11 @@ namespace crnd
 
          } // f
 
-         CRND_HUFF_DECODE_END(m_codec);
+         CRND_HUFF_DECODE_END(codec);
+
+         state.m_chunk_encoding_bits = chunk_encoding_bits;
+         state.m_prev_alpha0_endpoint_index = prev_alpha0_endpoint_index;
+         state.m_prev_alpha0_selector_index = prev_alpha0_selector_index;
 
          return true;
       }
@@ -4753,6 +5631,163 @@ namespace crnd
       return pUnpacker->unpack_level(pSrc, src_size_in_bytes, pDst, dst_size_in_bytes, row_pitch_in_bytes, level_index);
    }
 
+   uint32 crnd_get_level_num_bands(crnd_unpack_context pContext, uint32 level_index)
+   {
+      if ((!pContext) || (level_index >= cCRNMaxLevels))
+         return 0;
+
+      crn_unpacker* pUnpacker = static_cast<crn_unpacker*>(pContext);
+
+      if (!pUnpacker->is_valid())
+         return 0;
+
+      return pUnpacker->get_level_num_bands(level_index);
+   }
+
+   bool crnd_unpack_level_band(
+      crnd_unpack_context pContext,
+      void** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+      uint32 level_index, uint32 band_index)
+   {
+      if ((!pContext) || (!pDst) || (dst_size_in_bytes < 8U) || (level_index >= cCRNMaxLevels))
+         return false;
+
+      crn_unpacker* pUnpacker = static_cast<crn_unpacker*>(pContext);
+
+      if (!pUnpacker->is_valid())
+         return false;
+
+      return pUnpacker->unpack_level_band(pDst, dst_size_in_bytes, row_pitch_in_bytes, level_index, band_index);
+   }
+
+   struct crnd_unpack_band_task_data
+   {
+      const crn_unpacker* m_pUnpacker;
+      void** m_pDst;
+      uint32 m_dst_size_in_bytes;
+      uint32 m_row_pitch_in_bytes;
+      uint32 m_level_index;
+      volatile bool m_failed;
+   };
+
+   static void crnd_unpack_band_task(uint32 task_index, void* pTask_data)
+   {
+      crnd_unpack_band_task_data* pData = static_cast<crnd_unpack_band_task_data*>(pTask_data);
+
+      if (!pData->m_pUnpacker->unpack_level_band(pData->m_pDst, pData->m_dst_size_in_bytes, pData->m_row_pitch_in_bytes, pData->m_level_index, task_index))
+         pData->m_failed = true;
+   }
+
+   bool crnd_unpack_level_parallel(
+      crnd_unpack_context pContext,
+      void** pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+      uint32 level_index,
+      crnd_parallel_for_func pParallel_for, void* pUser_data)
+   {
+      if ((!pContext) || (!pDst) || (dst_size_in_bytes < 8U) || (level_index >= cCRNMaxLevels))
+         return false;
+
+      crn_unpacker* pUnpacker = static_cast<crn_unpacker*>(pContext);
+
+      if (!pUnpacker->is_valid())
+         return false;
+
+      const uint32 num_bands = pUnpacker->get_level_num_bands(level_index);
+      if (!num_bands)
+         return false;
+
+      if ((!pParallel_for) || (num_bands == 1))
+         return pUnpacker->unpack_level(pDst, dst_size_in_bytes, row_pitch_in_bytes, level_index);
+
+      crnd_unpack_band_task_data task_data;
+      task_data.m_pUnpacker = pUnpacker;
+      task_data.m_pDst = pDst;
+      task_data.m_dst_size_in_bytes = dst_size_in_bytes;
+      task_data.m_row_pitch_in_bytes = row_pitch_in_bytes;
+      task_data.m_level_index = level_index;
+      task_data.m_failed = false;
+
+      (*pParallel_for)(num_bands, crnd_unpack_band_task, &task_data, pUser_data);
+
+      return !task_data.m_failed;
+   }
+
+   bool crnd_unpack_begin_rows(crnd_unpack_context pContext, uint32 level_index, crnd_row_format fmt)
+   {
+      if ((!pContext) || (level_index >= cCRNMaxLevels))
+         return false;
+
+      crn_unpacker* pUnpacker = static_cast<crn_unpacker*>(pContext);
+
+      if (!pUnpacker->is_valid())
+         return false;
+
+      return pUnpacker->begin_rows(NULL, 0, level_index, fmt);
+   }
+
+   bool crnd_unpack_begin_rows_segmented(crnd_unpack_context pContext, const void* pSrc, uint32 src_size_in_bytes, uint32 level_index, crnd_row_format fmt)
+   {
+      if ((!pContext) || (!pSrc) || (level_index >= cCRNMaxLevels))
+         return false;
+
+      crn_unpacker* pUnpacker = static_cast<crn_unpacker*>(pContext);
+
+      if (!pUnpacker->is_valid())
+         return false;
+
+      return pUnpacker->begin_rows(pSrc, src_size_in_bytes, level_index, fmt);
+   }
+
+   bool crnd_unpack_next_rows(
+      crnd_unpack_context pContext,
+      void* pDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+      uint32 max_chunk_rows,
+      uint32* pFace, uint32* pFirst_row, uint32* pNum_rows)
+   {
+      if ((!pContext) || (!pDst) || (!pFace) || (!pFirst_row) || (!pNum_rows))
+         return false;
+
+      crn_unpacker* pUnpacker = static_cast<crn_unpacker*>(pContext);
+
+      if (!pUnpacker->is_valid())
+         return false;
+
+      return pUnpacker->next_rows(pDst, dst_size_in_bytes, row_pitch_in_bytes, max_chunk_rows, *pFace, *pFirst_row, *pNum_rows);
+   }
+
+   bool crnd_unpack_level_pixels(
+      crnd_unpack_context pContext,
+      void** ppDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+      uint32 level_index, crnd_row_format fmt)
+   {
+      if ((!pContext) || (!ppDst) || (level_index >= cCRNMaxLevels))
+         return false;
+
+      crn_unpacker* pUnpacker = static_cast<crn_unpacker*>(pContext);
+
+      if (!pUnpacker->is_valid())
+         return false;
+
+      return pUnpacker->unpack_level_pixels(NULL, 0, ppDst, dst_size_in_bytes, row_pitch_in_bytes, level_index, fmt);
+   }
+
+   bool crnd_unpack_level_pixels_segmented(
+      crnd_unpack_context pContext,
+      const void* pSrc, uint32 src_size_in_bytes,
+      void** ppDst, uint32 dst_size_in_bytes, uint32 row_pitch_in_bytes,
+      uint32 level_index, crnd_row_format fmt)
+   {
+      if ((!pContext) || (!pSrc) || (!ppDst) || (level_index >= cCRNMaxLevels))
+         return false;
+
+      crn_unpacker* pUnpacker = static_cast<crn_unpacker*>(pContext);
+
+      if (!pUnpacker->is_valid())
+         return false;
+
+      return pUnpacker->unpack_level_pixels(pSrc, src_size_in_bytes, ppDst, dst_size_in_bytes, row_pitch_in_bytes, level_index, fmt);
+   }
+
    bool crnd_unpack_end(crnd_unpack_context pContext)
    {
       if (!pContext)
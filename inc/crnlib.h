@@ -22,6 +22,7 @@
 typedef unsigned char   crn_uint8;
 typedef unsigned short  crn_uint16;
 typedef unsigned int    crn_uint32;
+typedef unsigned long long crn_uint64;
 typedef signed char     crn_int8;
 typedef signed short    crn_int16;
 typedef signed int      crn_int32;
@@ -79,13 +80,16 @@ enum crn_limits
    // Max. mipmap level resolution on any axis.
    cCRNMaxLevelResolution     = 4096,
 
+   // Max. mipmap level resolution on any axis of .DDS/.KTX output, which isn't limited by the .CRN file format.
+   cCRNMaxDDSLevelResolution  = 16384,
+
    cCRNMinPaletteSize         = 8,
    cCRNMaxPaletteSize         = 8192,
 
    cCRNMaxFaces               = 6,
    cCRNMaxLevels              = 16,
 
-   cCRNMaxHelperThreads       = 16,
+   cCRNMaxHelperThreads       = 255,
 
    cCRNMinQualityLevel        = 0,
    cCRNMaxQualityLevel        = 255
@@ -141,6 +145,18 @@ enum crn_comp_flags
    // Default: Not set.
    cCRNCompFlagGrayscaleSampling = 256,
 
+   // If enabled, each .CRN mipmap level is split into bands of chunk rows which are coded independently, so crnd_unpack_level_parallel() can
+   // transcode a level on multiple threads. Costs a small amount of compression. Files written with this flag require crn_decomp.h v1.05 or later.
+   // Only useful when writing to .CRN files.
+   // Default: Not set.
+   cCRNCompFlagBandedLevels = 512,
+
+   // If enabled, the .CRN target bitrate search compresses several quality levels of the current bracket at once (up to m_num_helper_threads+1,
+   // at least 2) and interpolates from all of them, so it converges in fewer rounds. Uses more memory, and may select a different quality level
+   // than the sequential search. Only useful when writing to .CRN files with m_target_bitrate set.
+   // Default: Not set.
+   cCRNCompFlagParallelQualitySearch = 1024,
+
    // If enabled, debug information will be output during compression.
    // Default: Not set.
    cCRNCompFlagDebugging = 0x80000000,
@@ -179,6 +195,100 @@ enum crn_dxt_compressor_type
 // subphase_index, total_subphases - progress within current phase
 typedef crn_bool (*crn_progress_callback_func)(crn_uint32 phase_index, crn_uint32 total_phases, crn_uint32 subphase_index, crn_uint32 total_subphases, void* pUser_data_ptr);
 
+// Compression phases timed by crn_comp_stats.
+enum crn_comp_phase
+{
+   cCRNCompPhaseInit,                     // Source image setup and chunk creation
+   cCRNCompPhaseChunkCompression,         // DXT compression of every chunk tile layout
+   cCRNCompPhaseColorEndpointClusters,
+   cCRNCompPhaseColorEndpointCodebook,
+   cCRNCompPhaseAlphaEndpointClusters,
+   cCRNCompPhaseAlphaEndpointCodebook,
+   cCRNCompPhaseColorSelectorCodebook,
+   cCRNCompPhaseAlphaSelectorCodebook,
+   cCRNCompPhaseRefineColorSelectors,
+   cCRNCompPhaseRefineColorEndpoints,
+   cCRNCompPhaseRefineAlphaEndpoints,
+   cCRNCompPhaseRefineAlphaSelectors,
+   cCRNCompPhaseChunkEncodings,
+   cCRNCompPhaseColorEndpointReorder,     // Codebook reordering and chunk packing simulation
+   cCRNCompPhaseColorSelectorReorder,
+   cCRNCompPhaseAlphaEndpointReorder,
+   cCRNCompPhaseAlphaSelectorReorder,
+   cCRNCompPhasePackChunks,
+   cCRNCompPhasePackModels,               // Data models, palettes and the final file
+   cCRNCompPhaseDXTBlocks,                // Plain or clustered .DDS block compression
+
+   cCRNTotalCompPhases,
+
+   cCRNCompPhaseForceDWORD = 0xFFFFFFFF
+};
+
+const crn_uint32 cCRNMaxCompTraceEvents = 1024;
+
+// Counters collected for a single compression phase (or the whole compression).
+// CPU time and allocation counts are process wide, so they'll include any other work done concurrently by the caller.
+struct crn_comp_phase_stats
+{
+   crn_uint32  m_num_calls;               // Times the phase was entered (bitrate searches run each phase once per trial)
+   double      m_wall_time;               // Seconds
+   double      m_cpu_time;                // Seconds of CPU time summed over all threads
+   crn_uint64  m_alloc_bytes;             // Bytes requested from crnlib's allocator
+   crn_uint32  m_num_allocs;
+   crn_uint32  m_num_tasks;               // Tasks queued to the helper thread pool
+};
+
+// A single timed phase, in the order the phases ran. Times are in seconds, relative to the start of compression.
+struct crn_comp_trace_event
+{
+   crn_comp_phase m_phase;
+   double         m_start_time;
+   double         m_duration;
+};
+
+// Optional compression statistics, filled in by crn_compress() if crn_comp_params::m_pStats is not NULL.
+struct crn_comp_stats
+{
+   inline crn_comp_stats() { clear(); }
+
+   inline void clear()
+   {
+      m_num_threads = 0;
+      clear_phase(m_total);
+      for (crn_uint32 i = 0; i < cCRNTotalCompPhases; i++)
+         clear_phase(m_phases[i]);
+      m_num_trace_events = 0;
+      m_trace_origin = 0.0;
+   }
+
+   static inline void clear_phase(crn_comp_phase_stats& s)
+   {
+      s.m_num_calls = 0;
+      s.m_wall_time = 0.0;
+      s.m_cpu_time = 0.0;
+      s.m_alloc_bytes = 0;
+      s.m_num_allocs = 0;
+      s.m_num_tasks = 0;
+   }
+
+   // Fraction of the available thread time (wall time * m_num_threads) actually spent on the CPU, 1.0 = all threads busy.
+   inline double get_thread_utilization(const crn_comp_phase_stats& s) const
+   {
+      return ((s.m_wall_time > 0.0) && (m_num_threads)) ? (s.m_cpu_time / (s.m_wall_time * m_num_threads)) : 0.0;
+   }
+
+   crn_uint32              m_num_threads;                // Helper threads + the calling thread
+   crn_comp_phase_stats    m_total;                      // The entire compression
+   crn_comp_phase_stats    m_phases[cCRNTotalCompPhases];
+
+   // Events past cCRNMaxCompTraceEvents are dropped (the per phase totals are still updated).
+   crn_uint32              m_num_trace_events;
+   crn_comp_trace_event    m_trace_events[cCRNMaxCompTraceEvents];
+
+   // Internal: timer value at the start of compression.
+   double                  m_trace_origin;
+};
+
 // CRN/DDS compression parameters struct.
 struct crn_comp_params
 {
@@ -219,6 +329,7 @@ struct crn_comp_params
       m_userdata1 = 0;
       m_pProgress_func = NULL;
       m_pProgress_func_data = NULL;
+      m_pStats = NULL;
    }
 
    inline bool operator== (const crn_comp_params& rhs) const
@@ -249,6 +360,7 @@ struct crn_comp_params
       CRNLIB_COMP(m_userdata1);
       CRNLIB_COMP(m_pProgress_func);
       CRNLIB_COMP(m_pProgress_func_data);
+      CRNLIB_COMP(m_pStats);
 
       for (crn_uint32 f = 0; f < cCRNMaxFaces; f++)
          for (crn_uint32 l = 0; l < cCRNMaxLevels; l++)
@@ -265,8 +377,8 @@ struct crn_comp_params
          (((int)m_quality_level < (int)cCRNMinQualityLevel) || ((int)m_quality_level > (int)cCRNMaxQualityLevel)) ||
          (m_dxt1a_alpha_threshold > 255) ||
          ((m_faces != 1) && (m_faces != 6)) ||
-         ((m_width < 1) || (m_width > cCRNMaxLevelResolution)) ||
-         ((m_height < 1) || (m_height > cCRNMaxLevelResolution)) ||
+         ((m_width < 1) || (m_width > get_max_level_resolution())) ||
+         ((m_height < 1) || (m_height > get_max_level_resolution())) ||
          ((m_levels < 1) || (m_levels > cCRNMaxLevels)) ||
          ((m_format < cCRNFmtDXT1) || (m_format >= cCRNFmtTotal)) ||
          ((m_crn_color_endpoint_palette_size) && ((m_crn_color_endpoint_palette_size < cCRNMinPaletteSize) || (m_crn_color_endpoint_palette_size > cCRNMaxPaletteSize))) ||
@@ -287,13 +399,16 @@ struct crn_comp_params
    inline bool get_flag(crn_comp_flags flag) const { return (m_flags & flag) != 0; }
    inline void set_flag(crn_comp_flags flag, bool val) { m_flags &= ~flag; if (val) m_flags |= flag; }
 
+   // Max. level resolution of the output file type.
+   inline crn_uint32 get_max_level_resolution() const { return (m_file_type == cCRNFileTypeDDS) ? cCRNMaxDDSLevelResolution : cCRNMaxLevelResolution; }
+
    crn_uint32                 m_size_of_obj;
 
    crn_file_type              m_file_type;               // Output file type: cCRNFileTypeCRN or cCRNFileTypeDDS.
 
    crn_uint32                 m_faces;                   // 1 (2D map) or 6 (cubemap)
-   crn_uint32                 m_width;                   // [1,cCRNMaxLevelResolution], non-power of 2 OK, non-square OK
-   crn_uint32                 m_height;                  // [1,cCRNMaxLevelResolution], non-power of 2 OK, non-square OK
+   crn_uint32                 m_width;                   // [1,cCRNMaxLevelResolution] (.CRN) or [1,cCRNMaxDDSLevelResolution] (.DDS), non-power of 2 OK, non-square OK
+   crn_uint32                 m_height;                  // [1,cCRNMaxLevelResolution] (.CRN) or [1,cCRNMaxDDSLevelResolution] (.DDS), non-power of 2 OK, non-square OK
    crn_uint32                 m_levels;                  // [1,cCRNMaxLevelResolution], non-power of 2 OK, non-square OK
 
    crn_format                 m_format;                  // Output pixel format.
@@ -330,7 +445,8 @@ struct crn_comp_params
    crn_uint32                 m_crn_alpha_endpoint_palette_size;  // [cCRNMinPaletteSize,cCRNMaxPaletteSize]
    crn_uint32                 m_crn_alpha_selector_palette_size;  // [cCRNMinPaletteSize,cCRNMaxPaletteSize]
 
-   // Number of helper threads to create during compression. 0=no threading.
+   // Number of helper threads to split the work between during compression. 0=no threading.
+   // The threads themselves come from the process wide thread pool, see crn_set_thread_pool_config().
    crn_uint32                 m_num_helper_threads;
 
    // CRN userdata0 and userdata1 members, which are written directly to the header of the output file.
@@ -340,6 +456,9 @@ struct crn_comp_params
    // User provided progress callback.
    crn_progress_callback_func m_pProgress_func;
    void*                      m_pProgress_func_data;
+
+   // Optional per phase timing/counters, cleared and filled in during compression.
+   crn_comp_stats*            m_pStats;
 };
 
 // Mipmap generator's mode.
@@ -422,6 +541,8 @@ struct crn_mipmap_params
       m_clamp_scale = false;
       m_clamp_width = 0;
       m_clamp_height = 0;
+
+      m_cascade = false;
    }
 
    inline bool check() const { return true; }
@@ -449,6 +570,7 @@ struct crn_mipmap_params
       CRNLIB_COMP(m_clamp_scale);
       CRNLIB_COMP(m_clamp_width);
       CRNLIB_COMP(m_clamp_height);
+      CRNLIB_COMP(m_cascade);
       return true;
 #undef CRNLIB_COMP
    }
@@ -480,6 +602,10 @@ struct crn_mipmap_params
    crn_bool       m_clamp_scale;
    crn_uint32     m_clamp_width;
    crn_uint32     m_clamp_height;
+
+   // Faster, but each level is resampled from the previous one instead of the source, so the output differs slightly.
+   // Falls back to resampling from the source if the result isn't within crnlib::image_utils::cMipCascadeMinPSNR/cMipCascadeMaxError.
+   crn_bool       m_cascade;
 };
 
 // -------- High-level helper function definitions for CDN/DDS compression.
@@ -494,9 +620,20 @@ typedef void*  (*crn_realloc_func)(void* p, size_t size, size_t* pActual_size, b
 typedef size_t (*crn_msize_func)(void* p, void* pUser_data);
 void crn_set_memory_callbacks(crn_realloc_func pRealloc, crn_msize_func pMSize, void* pUser_data);
 
+// The many small temporary blocks allocated while compressing are normally carved out of 256KB chunks allocated through the above callbacks,
+// so custom callbacks mostly see chunk sized requests. Pass false to send every allocation straight to the callbacks.
+void crn_set_arena_allocation(bool enabled);
+
 // Frees memory blocks allocated by crn_compress(), crn_decompress_crn_to_dds(), or crn_decompress_dds_to_images().
 void crn_free_block(void *pBlock);
 
+// Configures the process wide thread pool shared by compression, mipmap generation, resampling and transcoding.
+// The pool's threads are created the first time they're needed, and live until the process exits or the pool is reconfigured.
+//  num_threads is the number of pool threads, 0=one less than the number of CPU's (the default). Max is cCRNMaxHelperThreads.
+//  cpu_affinity_mask, if non-zero, restricts the pool's threads to the CPU's whose bits are set (CPU's 0-63). Currently only supported on Windows and Linux.
+// Returns false if the pool is being used by another thread, in which case the configuration is unchanged.
+crn_bool crn_set_thread_pool_config(crn_uint32 num_threads, crn_uint64 cpu_affinity_mask = 0);
+
 // Compresses a 32-bit/pixel texture to either: a regular DX9 DDS file, a "clustered" (or reduced entropy) DX9 DDS file, or a CRN file in memory.
 // Input parameters:
 //  comp_params is the compression parameters struct, defined above.
@@ -522,6 +659,29 @@ void *crn_compress(const crn_comp_params &comp_params, crn_uint32 &compressed_si
 // Be sure to set the "m_gamma_filtering" member of crn_mipmap_params to false if the input texture is not sRGB.
 void *crn_compress(const crn_comp_params &comp_params, const crn_mipmap_params &mip_params, crn_uint32 &compressed_size, crn_uint32 *pActual_quality_level = NULL, float *pActual_bitrate = NULL);
 
+// -------- Reusable compressor contexts
+
+// A compressor context keeps its CRN and DDS compressors, and their work buffers, alive between crn_compress() calls. When compressing many
+// textures (especially small ones) this avoids reallocating the quantizer state, chunk arrays, index streams, etc. for every texture.
+// A context must only be used by one thread at a time, but several contexts may be used at once.
+typedef void *crn_compressor_context_t;
+
+// Creates a compressor context.
+//  max_num_helper_threads caps the m_num_helper_threads member of the crn_comp_params passed with this context. The helper thread count
+//  affects the compressed output, so a capped call's output matches crn_compress() with m_num_helper_threads set to the cap, not to the
+//  count that was asked for.
+//  max_retained_bytes, if non-zero, limits the work buffers a compressor may keep after a texture. A compressor which grew larger (say, after
+//  an unusually big texture) is freed, and recreated on the next call which needs it.
+crn_compressor_context_t crn_create_compressor_context(crn_uint32 max_num_helper_threads = cCRNMaxHelperThreads, crn_uint64 max_retained_bytes = 0);
+
+// Same as the crn_compress() functions above, but using the compressors of pContext. The output is identical to crn_compress() with the same
+// params, once m_num_helper_threads has been capped to the context's max_num_helper_threads.
+void *crn_compress(crn_compressor_context_t pContext, const crn_comp_params &comp_params, crn_uint32 &compressed_size, crn_uint32 *pActual_quality_level = NULL, float *pActual_bitrate = NULL);
+void *crn_compress(crn_compressor_context_t pContext, const crn_comp_params &comp_params, const crn_mipmap_params &mip_params, crn_uint32 &compressed_size, crn_uint32 *pActual_quality_level = NULL, float *pActual_bitrate = NULL);
+
+// Frees a compressor context and all of its retained memory.
+void crn_free_compressor_context(crn_compressor_context_t pContext);
+
 // Transcodes an entire CRN file to DDS using the crn_decomp.h header file library to do most of the heavy lifting.
 // The output DDS file's format is guaranteed to be one of the DXTn formats in the crn_format enum.
 // This is a fast operation, because the CRN format is explicitly designed to be efficiently transcodable to DXTn.
@@ -570,6 +730,9 @@ const char* crn_get_format_string(crn_format fmt);
 // Converts a crn_dxt_quality to a string.
 const char* crn_get_dxt_quality_string(crn_dxt_quality q);
 
+// Converts a crn_comp_phase to a string.
+const char* crn_get_comp_phase_string(crn_comp_phase phase);
+
 // -------- Low-level DXTn 4x4 block compressor API
 
 // crnlib's DXTn endpoint optimizer actually supports any number of source pixels (i.e. from 1 to thousands, not just 16),